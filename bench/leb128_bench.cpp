@@ -1,49 +1,470 @@
-#include <benchmark/benchmark.hpp>
+#include <benchmark/benchmark.h>
 #include <cstdint>
+#include <cstdlib>
 #include <array>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include "leb128_single.h"
 
-std::uint32_t leb128_decode_uint32(const unsigned char* data)
+/*
+ * LEB128 decoding benchmarks.
+ *
+ * Each benchmark decodes a whole buffer of encoded integers per iteration and
+ * reports bytes/second and items/second so that decoders can be compared
+ * directly.  Inputs:
+ *   - fixed-width:   every integer has the same encoded size (1 to 5 bytes)
+ *   - mixed:         encoded sizes drawn from a skewed distribution that
+ *                    roughly follows what real modules contain
+ *   - code-section:  a synthetic instruction stream (opcode bytes interleaved
+ *                    with local indices, memory immediates and constants)
+ *   - module:        the LEB128 fields of a real .wasm file, if the
+ *                    'WASM_CPP_BENCH_MODULE' environment variable names one
+ */
+
+namespace leb128 = wasm::parse::leb128;
+
+namespace {
+
+using buffer_type = std::vector<leb128::byte_t>;
+
+// the 'unrolled' decoder from the original prototype, kept as a baseline.
+// assumes at least 5 readable bytes.
+const leb128::byte_t* leb128_decode_uint32_unrolled(const leb128::byte_t* data, std::uint32_t& value)
 {
 	constexpr std::array<std::uint32_t, 5> masks = {
 		0b0000'0000'0000'0000'0000'0000'0111'1111u,
 		0b0000'0000'0000'0000'0011'1111'1111'1111u,
 		0b0000'0000'0001'1111'1111'1111'1111'1111u,
-		0b0000'1111'1111'1111'1111'1111'1111'1111u
+		0b0000'1111'1111'1111'1111'1111'1111'1111u,
+		0b1111'1111'1111'1111'1111'1111'1111'1111u
 	};
 	std::uint32_t val{0};
-	auto byte = *data++;
-	val |= std::uint32_t(byte) << 0;
-	if(static_cast<bool>(byte & 0b1000'0000u))
-		return val & masks[0];
+	std::uint32_t byte = *data++;
+	val |= (byte & 0x7fu) << 0;
+	if(not static_cast<bool>(byte & 0b1000'0000u))
+		return (value = val & masks[0]), data;
 	byte = *data++;
-	val |= std::uint32_t(byte) << 7;
-	if(static_cast<bool>(byte & 0b1000'0000u))
-		return val & masks[1];
+	val |= (byte & 0x7fu) << 7;
+	if(not static_cast<bool>(byte & 0b1000'0000u))
+		return (value = val & masks[1]), data;
 	byte = *data++;
-	val |= std::uint32_t(byte) << 14;
-	if(static_cast<bool>(byte & 0b1000'0000u))
-		return val & masks[2];
+	val |= (byte & 0x7fu) << 14;
+	if(not static_cast<bool>(byte & 0b1000'0000u))
+		return (value = val & masks[2]), data;
 	byte = *data++;
-	val |= std::uint32_t(byte) << 21;
-	if(static_cast<bool>(byte & 0b1000'0000u))
-		return val & masks[3];
+	val |= (byte & 0x7fu) << 21;
+	if(not static_cast<bool>(byte & 0b1000'0000u))
+		return (value = val & masks[3]), data;
 	byte = *data++;
-	val |= std::uint32_t(byte) << 28;
-	return val;
+	val |= byte << 28;
+	if(static_cast<bool>(byte & 0b1000'0000u))
+		return nullptr;
+	return (value = val & masks[4]), data;
+}
+
+void encode_unsigned(buffer_type& buf, std::uint64_t value)
+{
+	do {
+		leb128::byte_t byte = value & 0x7fu;
+		value >>= 7;
+		if(value != 0u)
+			byte |= 0x80u;
+		buf.push_back(byte);
+	} while(value != 0u);
+}
+
+void encode_signed(buffer_type& buf, std::int64_t value)
+{
+	for(bool more = true; more; )
+	{
+		leb128::byte_t byte = value & 0x7f;
+		value >>= 7;
+		bool sign = static_cast<bool>(byte & 0x40u);
+		more = not (((value == 0) and not sign) or ((value == -1) and sign));
+		if(more)
+			byte |= 0x80u;
+		buf.push_back(byte);
+	}
+}
+
+// pad so that the fast paths are not penalized at the very end of the buffer.
+// (the decoders never read past 'last', so this only matters for the tail.)
+void pad(buffer_type& buf)
+{ buf.insert(buf.end(), 16u, 0u); }
+
+constexpr std::size_t value_count = 1u << 16;
+
+/// Integers whose encodings are exactly 'len' bytes long.
+buffer_type make_fixed_width(std::size_t len, std::size_t& count)
+{
+	std::mt19937 rng(len);
+	std::uint32_t lo = len == 1u ? 0u : (std::uint32_t(1) << (7u * (len - 1u)));
+	std::uint32_t hi = len == 5u ? ~std::uint32_t(0) : (std::uint32_t(1) << (7u * len)) - 1u;
+	std::uniform_int_distribution<std::uint32_t> dist(lo, hi);
+	buffer_type buf;
+	for(std::size_t i = 0; i < value_count; ++i)
+		encode_unsigned(buf, dist(rng));
+	count = value_count;
+	pad(buf);
+	return buf;
+}
+
+/// Integers whose encoded sizes follow a distribution skewed towards short
+/// encodings (most indices and immediates are small).
+buffer_type make_mixed(std::size_t& count)
+{
+	std::mt19937 rng(42);
+	std::discrete_distribution<std::size_t> sizes({70, 18, 7, 3, 2});
+	buffer_type buf;
+	for(std::size_t i = 0; i < value_count; ++i)
+	{
+		std::size_t len = sizes(rng) + 1u;
+		std::uint32_t lo = len == 1u ? 0u : (std::uint32_t(1) << (7u * (len - 1u)));
+		std::uint32_t hi = len == 5u ? ~std::uint32_t(0) : (std::uint32_t(1) << (7u * len)) - 1u;
+		encode_unsigned(buf, std::uniform_int_distribution<std::uint32_t>(lo, hi)(rng));
+	}
+	count = value_count;
+	pad(buf);
+	return buf;
+}
+
+/// One decoded field of an instruction stream: whether it is signed, and how
+/// many opcode bytes precede it.
+struct Field {
+	std::uint32_t skip;
+	bool is_signed;
+	bool is_64;
+};
+
+struct InstructionStream {
+	buffer_type bytes;
+	std::vector<Field> fields;
+};
+
+/// A synthetic function body: get_local/set_local, loads/stores with
+/// (flags, offset) immediates, i32/i64 constants and calls.
+InstructionStream make_code_section()
+{
+	std::mt19937 rng(7);
+	std::discrete_distribution<int> kind({30, 10, 15, 10, 5, 5});
+	std::geometric_distribution<std::uint32_t> small(0.2);
+	InstructionStream code;
+	auto& buf = code.bytes;
+	for(std::size_t i = 0; i < value_count; ++i)
+	{
+		switch(kind(rng))
+		{
+		case 0: // get_local/set_local idx
+			buf.push_back(0x20);
+			encode_unsigned(buf, small(rng));
+			code.fields.push_back({1, false, false});
+			break;
+		case 1: // i32.load align offset
+			buf.push_back(0x28);
+			encode_unsigned(buf, 2u);
+			encode_unsigned(buf, small(rng) * 4u);
+			code.fields.push_back({1, false, false});
+			code.fields.push_back({0, false, false});
+			break;
+		case 2: // i32.const
+			buf.push_back(0x41);
+			encode_signed(buf, std::int32_t(rng()) >> (rng() % 32u));
+			code.fields.push_back({1, true, false});
+			break;
+		case 3: // call idx
+			buf.push_back(0x10);
+			encode_unsigned(buf, rng() % 2000u);
+			code.fields.push_back({1, false, false});
+			break;
+		case 4: // i64.const
+			buf.push_back(0x42);
+			encode_signed(buf, std::int64_t(std::uint64_t(rng()) << 32 | rng()) >> (rng() % 64u));
+			code.fields.push_back({1, true, true});
+			break;
+		default: // br_if depth
+			buf.push_back(0x0d);
+			encode_unsigned(buf, small(rng) % 8u);
+			code.fields.push_back({1, false, false});
+			break;
+		}
+	}
+	pad(code.bytes);
+	return code;
+}
+
+/// Collect the LEB128 section and function body framing of a real module: the
+/// section ids/sizes, the function body sizes, and the local entry counts.
+/// Returns an empty buffer if the variable is unset or the file is unusable.
+buffer_type load_module_fields(std::size_t& count)
+{
+	count = 0;
+	const char* path = std::getenv("WASM_CPP_BENCH_MODULE");
+	if(not path)
+		return {};
+	std::ifstream file(path, std::ios::binary);
+	buffer_type module(std::istreambuf_iterator<char>(file), {});
+	if(module.size() < 8u)
+		return {};
+	buffer_type fields;
+	const auto* pos = module.data() + 8;
+	const auto* last = module.data() + module.size();
+	auto copy_u32 = [&]() {
+		std::uint32_t v = 0;
+		const auto* next = leb128::decode_unsigned_scalar<std::uint32_t>(pos, last, v);
+		if(not next)
+			return false;
+		fields.insert(fields.end(), pos, next);
+		++count;
+		pos = next;
+		return true;
+	};
+	while(pos < last)
+	{
+		std::uint8_t id = *pos++;
+		std::uint32_t size;
+		const auto* body = leb128::decode_unsigned_scalar<std::uint32_t>(pos, last, size);
+		if((not body) or (size > std::size_t(last - body)))
+			break;
+		copy_u32();
+		pos = body;
+		const auto* next_section = body + size;
+		if(id == 10u)
+		{
+			std::uint32_t func_count;
+			const auto* p = leb128::decode_unsigned_scalar<std::uint32_t>(pos, next_section, func_count);
+			if(not p)
+				break;
+			copy_u32();
+			for(std::uint32_t f = 0; f < func_count and pos < next_section; ++f)
+			{
+				std::uint32_t body_size;
+				const auto* func = leb128::decode_unsigned_scalar<std::uint32_t>(pos, next_section, body_size);
+				if(not func)
+					break;
+				copy_u32();
+				const auto* next_func = func + body_size;
+				std::uint32_t local_count;
+				const auto* locals = leb128::decode_unsigned_scalar<std::uint32_t>(pos, next_func, local_count);
+				if(not locals)
+					break;
+				copy_u32();
+				for(std::uint32_t l = 0; l < local_count and pos < next_func; ++l)
+				{
+					if(not copy_u32())
+						break;
+					++pos; // value type
+				}
+				pos = next_func;
+			}
+		}
+		pos = next_section;
+	}
+	pad(fields);
+	return fields;
+}
+
+template <class Decoder>
+void run_u32(benchmark::State& state, const buffer_type& buf, std::size_t count, Decoder decode)
+{
+	for(auto _: state)
+	{
+		const auto* pos = buf.data();
+		const auto* last = buf.data() + buf.size();
+		std::uint32_t sum = 0;
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			std::uint32_t v = 0;
+			pos = decode(pos, last, v);
+			sum += v;
+		}
+		benchmark::DoNotOptimize(sum);
+		benchmark::DoNotOptimize(pos);
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	state.SetBytesProcessed(state.iterations() * (buf.size() - 16u));
+}
+
+const auto scalar_u32 = [](const leb128::byte_t* f, const leb128::byte_t* l, std::uint32_t& v) {
+	return leb128::decode_unsigned_scalar<std::uint32_t>(f, l, v);
+};
+
+const auto fast_u32 = [](const leb128::byte_t* f, const leb128::byte_t* l, std::uint32_t& v) {
+	return leb128::decode_unsigned<std::uint32_t>(f, l, v);
+};
+
+const auto unrolled_u32 = [](const leb128::byte_t* f, const leb128::byte_t*, std::uint32_t& v) {
+	return leb128_decode_uint32_unrolled(f, v);
+};
+
+void run_batch(benchmark::State& state, const buffer_type& buf, std::size_t count)
+{
+	std::vector<std::uint32_t> out(count);
+	for(auto _: state)
+	{
+		const auto* pos = leb128::decode_varuint32_batch(
+			buf.data(), buf.data() + buf.size(), out.data(), count
+		);
+		benchmark::DoNotOptimize(pos);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+	state.SetBytesProcessed(state.iterations() * (buf.size() - 16u));
+}
+
+/// @name Fixed-Width Inputs
+/// @{
+
+void BM_leb128_u32_scalar_fixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_fixed_width(state.range(0), count);
+	run_u32(state, buf, count, scalar_u32);
+}
+BENCHMARK(BM_leb128_u32_scalar_fixed)->DenseRange(1, 5);
+
+void BM_leb128_u32_unrolled_fixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_fixed_width(state.range(0), count);
+	run_u32(state, buf, count, unrolled_u32);
+}
+BENCHMARK(BM_leb128_u32_unrolled_fixed)->DenseRange(1, 5);
+
+void BM_leb128_u32_fast_fixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_fixed_width(state.range(0), count);
+	run_u32(state, buf, count, fast_u32);
+}
+BENCHMARK(BM_leb128_u32_fast_fixed)->DenseRange(1, 5);
+
+void BM_leb128_u32_batch_fixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_fixed_width(state.range(0), count);
+	run_batch(state, buf, count);
+}
+BENCHMARK(BM_leb128_u32_batch_fixed)->DenseRange(1, 5);
+
+/// @} Fixed-Width Inputs
+
+/// @name Mixed-Width Inputs
+/// @{
+
+void BM_leb128_u32_scalar_mixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_mixed(count);
+	run_u32(state, buf, count, scalar_u32);
+}
+BENCHMARK(BM_leb128_u32_scalar_mixed);
+
+void BM_leb128_u32_unrolled_mixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_mixed(count);
+	run_u32(state, buf, count, unrolled_u32);
+}
+BENCHMARK(BM_leb128_u32_unrolled_mixed);
+
+void BM_leb128_u32_fast_mixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_mixed(count);
+	run_u32(state, buf, count, fast_u32);
+}
+BENCHMARK(BM_leb128_u32_fast_mixed);
+
+void BM_leb128_u32_batch_mixed(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = make_mixed(count);
+	run_batch(state, buf, count);
 }
+BENCHMARK(BM_leb128_u32_batch_mixed);
 
+/// @} Mixed-Width Inputs
 
+/// @name Code-Section-Like Inputs
+/// @{
 
-static void BM_leb128_uint32_unrolled_1byte(benchmark::State& state)
+template <bool Fast>
+void BM_leb128_code_section(benchmark::State& state)
 {
+	auto code = make_code_section();
 	for(auto _: state)
 	{
-		
+		const auto* pos = code.bytes.data();
+		const auto* last = code.bytes.data() + code.bytes.size();
+		std::uint64_t sum = 0;
+		for(const auto& field: code.fields)
+		{
+			pos += field.skip;
+			if(field.is_64)
+			{
+				std::int64_t v = 0;
+				if constexpr(Fast)
+					pos = leb128::decode_signed<std::int64_t>(pos, last, v);
+				else
+					pos = leb128::decode_signed_scalar<std::int64_t>(pos, last, v);
+				sum += v;
+			}
+			else if(field.is_signed)
+			{
+				std::int32_t v = 0;
+				if constexpr(Fast)
+					pos = leb128::decode_signed<std::int32_t>(pos, last, v);
+				else
+					pos = leb128::decode_signed_scalar<std::int32_t>(pos, last, v);
+				sum += v;
+			}
+			else
+			{
+				std::uint32_t v = 0;
+				if constexpr(Fast)
+					pos = leb128::decode_unsigned<std::uint32_t>(pos, last, v);
+				else
+					pos = leb128::decode_unsigned_scalar<std::uint32_t>(pos, last, v);
+				sum += v;
+			}
+		}
+		benchmark::DoNotOptimize(sum);
 	}
+	state.SetItemsProcessed(state.iterations() * code.fields.size());
+	state.SetBytesProcessed(state.iterations() * (code.bytes.size() - 16u));
 }
-BENCHMARK(BM_leb128_uint32_unrolled_1byte);
+BENCHMARK_TEMPLATE(BM_leb128_code_section, false)->Name("BM_leb128_code_section_scalar");
+BENCHMARK_TEMPLATE(BM_leb128_code_section, true)->Name("BM_leb128_code_section_fast");
+
+/// @} Code-Section-Like Inputs
 
+/// @name Real Module Inputs
+/// @{
 
+void BM_leb128_module_scalar(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = load_module_fields(count);
+	if(count == 0u)
+		return state.SkipWithError("set WASM_CPP_BENCH_MODULE to a .wasm file");
+	run_u32(state, buf, count, scalar_u32);
+}
+BENCHMARK(BM_leb128_module_scalar);
+
+void BM_leb128_module_fast(benchmark::State& state)
+{
+	std::size_t count;
+	auto buf = load_module_fields(count);
+	if(count == 0u)
+		return state.SkipWithError("set WASM_CPP_BENCH_MODULE to a .wasm file");
+	run_u32(state, buf, count, fast_u32);
+}
+BENCHMARK(BM_leb128_module_fast);
 
+/// @} Real Module Inputs
 
+} /* namespace */
 
+BENCHMARK_MAIN();
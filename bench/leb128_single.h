@@ -0,0 +1,99 @@
+#ifndef BENCH_LEB128_SINGLE_H
+#define BENCH_LEB128_SINGLE_H
+
+#include "../frontend2/binparse/leb128_decode.h"
+
+/*
+ * Word-at-a-time decoders for single LEB128 values, which the benchmarks
+ * compare against the scalar decoders in 'leb128_decode.h'.  For one integer
+ * at a time they are no faster than the scalar loop, and slower for 1- and
+ * 3-5-byte encodings, so the parsers don't use them: they decode single
+ * values with the scalar loop and use the word and SIMD paths only for
+ * batches (see 'decode_varuint32_batch()').
+ */
+
+namespace wasm::parse::leb128 {
+
+namespace detail {
+
+template <class Unsigned, std::size_t BitCount>
+inline Unsigned finish_unsigned(std::uint64_t bits)
+{ return static_cast<Unsigned>(bits); }
+
+template <class Signed, std::size_t BitCount>
+inline Signed finish_signed(std::uint64_t bits, std::size_t len)
+{
+	using Unsigned = std::make_unsigned_t<Signed>;
+	std::size_t nbits = 7u * len;
+	if((nbits < BitCount) and static_cast<bool>((bits >> (nbits - 1u)) & 1u))
+		bits |= (~std::uint64_t(0)) << nbits;
+	return static_cast<Signed>(static_cast<Unsigned>(bits));
+}
+
+} /* namespace detail */
+
+/// @name Single-Value Decoders
+/// Use the word-at-a-time fast path when at least 8 bytes are readable and
+/// the encoding fits in a single word, and the scalar decoder otherwise.
+/// @{
+
+template <class Unsigned, std::size_t BitCount = sizeof(Unsigned) * CHAR_BIT>
+inline const byte_t* decode_unsigned(const byte_t* first, const byte_t* last, Unsigned& value)
+{
+	static_assert(std::is_unsigned_v<Unsigned>);
+	constexpr std::size_t max_len = max_encoded_size(BitCount);
+	if constexpr(WASM_LEB128_LITTLE_ENDIAN and (BitCount >= 32u))
+	{
+		if((last - first) >= 8)
+		{
+			auto word = detail::load_word(first);
+			// one- and two-byte encodings dominate real code.  testing for
+			// them with (well-predicted) branches keeps the next position
+			// independent of the loaded word.
+			if(not static_cast<bool>(word & 0x80u))
+			{
+				value = static_cast<Unsigned>(word & 0x7fu);
+				return first + 1;
+			}
+			if(not static_cast<bool>(word & 0x8000u))
+			{
+				value = static_cast<Unsigned>((word & 0x7fu) | ((word & 0x7f00u) >> 1));
+				return first + 2;
+			}
+			std::size_t len = detail::encoded_size(word);
+			if((len != 0u) and (len <= max_len))
+			{
+				value = detail::finish_unsigned<Unsigned, BitCount>(detail::compact(word, len));
+				return first + len;
+			}
+		}
+	}
+	return decode_unsigned_scalar<Unsigned, BitCount>(first, last, value);
+}
+
+template <class Signed, std::size_t BitCount = sizeof(Signed) * CHAR_BIT>
+inline const byte_t* decode_signed(const byte_t* first, const byte_t* last, Signed& value)
+{
+	static_assert(std::is_integral_v<Signed> and std::is_signed_v<Signed>);
+	constexpr std::size_t max_len = max_encoded_size(BitCount);
+	if constexpr(WASM_LEB128_LITTLE_ENDIAN and (BitCount >= 32u))
+	{
+		if((last - first) >= 8)
+		{
+			auto word = detail::load_word(first);
+			std::size_t len = detail::encoded_size(word);
+			if((len != 0u) and (len <= max_len))
+			{
+				value = detail::finish_signed<Signed, BitCount>(detail::compact(word, len), len);
+				return first + len;
+			}
+		}
+	}
+	return decode_signed_scalar<Signed, BitCount>(first, last, value);
+}
+
+/// @} Single-Value Decoders
+
+} /* namespace wasm::parse::leb128 */
+
+#endif /* BENCH_LEB128_SINGLE_H */
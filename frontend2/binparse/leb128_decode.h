@@ -0,0 +1,302 @@
+#ifndef BINPARSE_LEB128_DECODE_H
+#define BINPARSE_LEB128_DECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define WASM_LEB128_X86 1
+# include <immintrin.h>
+#else
+# define WASM_LEB128_X86 0
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# define WASM_LEB128_LITTLE_ENDIAN 1
+#else
+# define WASM_LEB128_LITTLE_ENDIAN 0
+#endif
+
+#if defined(__BMI2__)
+# define WASM_LEB128_BMI2 1
+#else
+# define WASM_LEB128_BMI2 0
+#endif
+
+/*
+ * Raw LEB128 decoders shared by the X3 rules in 'leb128_parsers.h' and the
+ * benchmarks in 'bench/'.  All decoders take a [first, last) byte range and
+ * return the position just past the decoded integer, or nullptr on failure.
+ *
+ * The scalar decoders define the semantics; every other decoder in this file
+ * must agree with them byte-for-byte (including which encodings are rejected).
+ *
+ * The parsers decode single values with the scalar decoders, which the
+ * benchmarks show are as fast as anything else for one integer at a time (the
+ * word-at-a-time single-value decoders they are measured against live in
+ * 'bench/leb128_single.h').  The batch decoder works on 8-byte little-endian
+ * words: the terminating byte of an encoding is the lowest byte whose high bit
+ * is clear, and the 7-bit groups are compacted with a handful of shifts (or a
+ * single 'pext' with BMI2).  It also uses SSE2/AVX2 'movemask' to find every
+ * terminating byte in a 16/32-byte window at once and then decodes all of the
+ * integers that end inside the window without re-scanning.  The AVX2 kernel
+ * (which also uses BMI2) is selected at runtime; SSE2 is the x86-64 baseline.
+ */
+
+namespace wasm::parse::leb128 {
+
+using byte_t = unsigned char;
+
+/// Maximum number of bytes in the encoding of a 'BitCount'-bit integer.
+inline constexpr std::size_t max_encoded_size(std::size_t bit_count)
+{ return (bit_count + 6u) / 7u; }
+
+/// @name Scalar Decoders
+/// @{
+
+template <class Unsigned, std::size_t BitCount = sizeof(Unsigned) * CHAR_BIT>
+const byte_t* decode_unsigned_scalar(const byte_t* first, const byte_t* last, Unsigned& value)
+{
+	static_assert(std::is_unsigned_v<Unsigned>);
+	Unsigned result{0};
+	for(std::size_t sh = 0; ; sh += 7)
+	{
+		if((first == last) or (sh >= BitCount))
+			return nullptr;
+		byte_t byte = *first++;
+		result |= static_cast<Unsigned>(byte & 0b0111'1111u) << sh;
+		if(not static_cast<bool>(byte & 0b1000'0000u))
+			break;
+	}
+	value = result;
+	return first;
+}
+
+template <class Signed, std::size_t BitCount = sizeof(Signed) * CHAR_BIT>
+const byte_t* decode_signed_scalar(const byte_t* first, const byte_t* last, Signed& value)
+{
+	static_assert(std::is_integral_v<Signed> and std::is_signed_v<Signed>);
+	using Unsigned = std::make_unsigned_t<Signed>;
+	Unsigned result{0};
+	Unsigned byte{0};
+	std::size_t shift = 0;
+	do {
+		if((first == last) or (shift >= BitCount))
+			return nullptr;
+		byte = static_cast<Unsigned>(*first++);
+		result |= (byte & Unsigned(0b0111'1111u)) << shift;
+		shift += 7;
+	} while(static_cast<bool>(byte & Unsigned(0b1000'0000u)));
+	if((shift < BitCount) and static_cast<bool>(byte & Unsigned(0b0100'0000u)))
+		result |= (~Unsigned(0)) << shift;
+	value = static_cast<Signed>(result);
+	return first;
+}
+
+/// @} Scalar Decoders
+
+namespace detail {
+
+inline std::uint64_t load_word(const byte_t* p)
+{
+	std::uint64_t word;
+	std::memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+/// Number of bytes in the encoding that starts at the lowest byte of 'word',
+/// or 0 if no terminating byte exists in the word.
+inline std::size_t encoded_size(std::uint64_t word)
+{
+	std::uint64_t terminators = ~word & 0x8080'8080'8080'8080u;
+	if(terminators == 0u)
+		return 0u;
+	return (static_cast<std::size_t>(__builtin_ctzll(terminators)) >> 3u) + 1u;
+}
+
+/// Gather the low 7 bits of each of the 'len' (<= 8) lowest bytes of 'word'.
+inline std::uint64_t compact(std::uint64_t word, std::size_t len)
+{
+	if(len < 8u)
+		word &= (std::uint64_t(1) << (8u * len)) - 1u;
+#if WASM_LEB128_BMI2
+	return _pext_u64(word, 0x7f7f'7f7f'7f7f'7f7fu);
+#else
+	return (word & 0x0000'0000'0000'007fu)
+		| ((word & 0x0000'0000'0000'7f00u) >> 1)
+		| ((word & 0x0000'0000'007f'0000u) >> 2)
+		| ((word & 0x0000'0000'7f00'0000u) >> 3)
+		| ((word & 0x0000'007f'0000'0000u) >> 4)
+		| ((word & 0x0000'7f00'0000'0000u) >> 5)
+		| ((word & 0x007f'0000'0000'0000u) >> 6)
+		| ((word & 0x7f00'0000'0000'0000u) >> 7);
+#endif
+}
+
+
+/*
+ * Decode every varuint32 that terminates inside a window whose terminator
+ * bitmask is 'terminators' (bit i set iff window[i] has its high bit clear).
+ * Every byte of 'window' up to 'window + span + 8' must be readable.
+ * Returns the number of bytes consumed, which is zero if the first integer
+ * in the window is malformed (or does not end in the window).
+ */
+#if WASM_LEB128_X86
+
+[[gnu::target("bmi2")]]
+inline std::uint64_t compact_bmi2(std::uint64_t word, std::size_t len)
+{ return _pext_u64(_bzhi_u64(word, 8u * len), 0x7f7f'7f7f'7f7f'7f7fu); }
+
+#else
+
+std::uint64_t compact_bmi2(std::uint64_t word, std::size_t len);
+
+#endif
+
+template <bool UseBMI2, class Mask>
+[[gnu::always_inline]]
+inline std::size_t decode_window_u32(
+	const byte_t* window,
+	Mask terminators,
+	std::uint32_t*& out,
+	std::size_t& remaining
+)
+{
+	std::size_t start = 0;
+	while(static_cast<bool>(terminators) and (remaining > 0u))
+	{
+		auto end = static_cast<std::size_t>(
+			sizeof(Mask) > 4u ? __builtin_ctzll(terminators) : __builtin_ctz(terminators)
+		);
+		std::size_t len = (end - start) + 1u;
+		if(len > max_encoded_size(32u))
+			break;
+		if constexpr(UseBMI2)
+			*out++ = static_cast<std::uint32_t>(compact_bmi2(load_word(window + start), len));
+		else
+			*out++ = static_cast<std::uint32_t>(compact(load_word(window + start), len));
+		--remaining;
+		start = end + 1u;
+		terminators &= terminators - 1u;
+	}
+	return start;
+}
+
+#if WASM_LEB128_X86 && WASM_LEB128_LITTLE_ENDIAN
+
+inline const byte_t* decode_u32_batch_sse2(const byte_t* first, const byte_t* last, std::uint32_t*& out_, std::size_t& remaining_)
+{
+	// keep the cursors in registers rather than behind the references.
+	auto* out = out_;
+	std::size_t remaining = remaining_;
+	// 16 bytes of window plus 8 bytes of slack for the word loads.
+	while((remaining > 0u) and ((last - first) >= 24))
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+		auto continuation = static_cast<std::uint32_t>(_mm_movemask_epi8(chunk));
+		if((continuation == 0u) and (remaining >= 16u))
+		{
+			// sixteen single-byte integers; just widen them.
+			__m128i zero = _mm_setzero_si128();
+			__m128i lo = _mm_unpacklo_epi8(chunk, zero);
+			__m128i hi = _mm_unpackhi_epi8(chunk, zero);
+			auto* dest = reinterpret_cast<__m128i*>(out);
+			_mm_storeu_si128(dest + 0, _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(hi, zero));
+			out += 16;
+			remaining -= 16u;
+			first += 16;
+			continue;
+		}
+		std::uint32_t terminators = ~continuation & 0xffffu;
+		std::size_t consumed = decode_window_u32<WASM_LEB128_BMI2>(first, terminators, out, remaining);
+		if(consumed == 0u)
+			break;
+		first += consumed;
+	}
+	out_ = out;
+	remaining_ = remaining;
+	return first;
+}
+
+[[gnu::target("avx2,bmi2")]]
+inline const byte_t* decode_u32_batch_avx2(const byte_t* first, const byte_t* last, std::uint32_t*& out_, std::size_t& remaining_)
+{
+	// keep the cursors in registers rather than behind the references.
+	auto* out = out_;
+	std::size_t remaining = remaining_;
+	// 32 bytes of window plus 8 bytes of slack for the word loads.
+	while((remaining > 0u) and ((last - first) >= 40))
+	{
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+		auto continuation = static_cast<std::uint32_t>(_mm256_movemask_epi8(chunk));
+		if((continuation == 0u) and (remaining >= 32u))
+		{
+			// thirty-two single-byte integers; just widen them.
+			auto* dest = reinterpret_cast<__m256i*>(out);
+			for(int i = 0; i < 4; ++i)
+			{
+				__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(first + 8 * i));
+				_mm256_storeu_si256(dest + i, _mm256_cvtepu8_epi32(bytes));
+			}
+			out += 32;
+			remaining -= 32u;
+			first += 32;
+			continue;
+		}
+		std::uint32_t terminators = ~continuation;
+		std::size_t consumed = decode_window_u32<true>(first, terminators, out, remaining);
+		if(consumed == 0u)
+			break;
+		first += consumed;
+	}
+	out_ = out;
+	remaining_ = remaining;
+	return first;
+}
+
+using batch_kernel_type = const byte_t* (*)(const byte_t*, const byte_t*, std::uint32_t*&, std::size_t&);
+
+inline batch_kernel_type select_batch_kernel()
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") and __builtin_cpu_supports("bmi2"))
+		return decode_u32_batch_avx2;
+	return decode_u32_batch_sse2;
+}
+
+inline const batch_kernel_type batch_kernel = select_batch_kernel();
+
+#endif /* WASM_LEB128_X86 && WASM_LEB128_LITTLE_ENDIAN */
+
+} /* namespace detail */
+
+/*
+ * Decode 'count' consecutive varuint32s into 'out'.  Returns the position just
+ * past the last integer, or nullptr if any of them is malformed or the input
+ * runs out first (in which case the contents of 'out' are unspecified).
+ */
+inline const byte_t* decode_varuint32_batch(const byte_t* first, const byte_t* last, std::uint32_t* out, std::size_t count)
+{
+#if WASM_LEB128_X86 && WASM_LEB128_LITTLE_ENDIAN
+	first = detail::batch_kernel(first, last, out, count);
+#endif
+	// tail (and any malformed integer, so that failure is reported exactly as
+	// the scalar decoder would report it).
+	for(; count > 0u; --count)
+	{
+		first = decode_unsigned_scalar<std::uint32_t>(first, last, *out++);
+		if(not first)
+			return nullptr;
+	}
+	return first;
+}
+
+} /* namespace wasm::parse::leb128 */
+
+#endif /* BINPARSE_LEB128_DECODE_H */
@@ -3,14 +3,71 @@
 
 #include <utility>
 #include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
 #include "../../include/wasm_base.h"
 #include "../../include/WasmInstruction.h"
+#include "leb128_decode.h"
 #include <boost/spirit/home/x3.hpp>
 #include <boost/spirit/home/x3/binary.hpp>
 namespace wasm::parse {
 
 namespace x3 = boost::spirit::x3;
 
+namespace detail {
+
+template <class T>
+struct is_byte_type:
+	public std::bool_constant<
+		std::is_integral_v<T> and (sizeof(T) == 1u)
+	>
+{};
+
+/// Whether 'It' is one of the iterators of 'Container'.
+template <class It, class Container>
+struct is_iterator_of:
+	public std::bool_constant<
+		std::is_same_v<It, typename Container::iterator>
+		or std::is_same_v<It, typename Container::const_iterator>
+	>
+{};
+
+/// True for iterators over contiguous storage of byte-sized integers: byte
+/// pointers, and the iterators of the strings and byte vectors that modules
+/// are read into, which are turned into pointers with '&*it'.  These get the
+/// word-at-a-time decoders from 'leb128_decode.h'; everything else (e.g.
+/// multi_pass iterators) falls back to the byte-by-byte loop.
+template <class It>
+struct is_contiguous_byte_iterator:
+	public std::bool_constant<
+		(std::is_pointer_v<It> and is_byte_type<std::remove_cv_t<std::remove_pointer_t<It>>>::value)
+		or is_iterator_of<It, std::string>::value
+		or is_iterator_of<It, std::vector<char>>::value
+		or is_iterator_of<It, std::vector<unsigned char>>::value
+	>
+{};
+
+template <class It>
+inline constexpr const bool is_contiguous_byte_iterator_v = is_contiguous_byte_iterator<It>::value;
+
+template <class T>
+struct is_uint32_vector:
+	public std::false_type
+{};
+
+template <class Alloc>
+struct is_uint32_vector<std::vector<std::uint32_t, Alloc>>:
+	public std::true_type
+{};
+
+template <class It>
+const leb128::byte_t* byte_pointer(const It& it)
+{ return reinterpret_cast<const leb128::byte_t*>(std::addressof(*it)); }
+
+} /* namespace detail */
+
 template <class Unsigned, std::size_t BitCount = sizeof(Unsigned) * CHAR_BIT>
 struct UnsignedLeb128Parser:
 	public x3::parser<UnsignedLeb128Parser<Unsigned>>
@@ -58,12 +115,12 @@ struct SignedLeb128Parser:
 	{
 		using Unsigned = std::make_unsigned_t<Signed>;
 		auto first = first_;
-		Signed result{0};
+		Unsigned result{0};
 		constexpr std::size_t bit_count = BitCount;
 		Unsigned byte;
 		std::size_t shift = 0;
 		do {
-			if(shift >= bit_count)
+			if((first == last) or (shift >= bit_count))
 				return false;
 			byte = static_cast<Unsigned>(*first++);
 			result |= (byte & Unsigned(0b0111'1111u)) << shift;
@@ -116,7 +173,36 @@ struct Varuint32PrefixedSequence:
 		std::uint32_t len{0};
 		if(not varuint32.parse(pos, l, ctx, other, len))
 			return false;
-		if(len)
+		if constexpr(
+			std::is_same_v<std::decay_t<ItemParser>, std::decay_t<decltype(varuint32)>>
+			and detail::is_uint32_vector<Attr>::value
+			and detail::is_contiguous_byte_iterator_v<It>
+		)
+		{
+			// runs of varuint32s (e.g. function section type indices and
+			// element segment function indices) get the batch decoder.
+			if(len)
+			{
+				if(pos == l)
+					return false;
+				const auto* begin = detail::byte_pointer(pos);
+				const auto* end = begin + (l - pos);
+				// each item is at least one byte; reject bogus lengths before
+				// allocating.
+				if(static_cast<std::size_t>(end - begin) < len)
+					return false;
+				auto old_size = attr.size();
+				attr.resize(old_size + len);
+				const auto* stop = leb128::decode_varuint32_batch(begin, end, attr.data() + old_size, len);
+				if(not stop)
+				{
+					attr.resize(old_size);
+					return false;
+				}
+				pos += (stop - begin);
+			}
+		}
+		else if(len)
 		{
 			if(not (x3::repeat(len)[this->subject]).parse(pos, l, ctx, other, attr))
 				return false;
@@ -135,6 +221,42 @@ auto varuint32_prefixed_sequence(Parser&& parser)
 	);
 }
 
+/// A varuint32-prefixed run of bytes, exposed as a view into the input rather
+/// than copied out of it.
+struct Varuint32PrefixedBytes:
+	public x3::parser<Varuint32PrefixedBytes>
+{
+	using attribute_type = std::string_view;
+	static constexpr const bool has_attribute = true;
+
+	template <typename It, typename Ctx, typename Other, typename Attr>
+        bool parse(It& f, It l, Ctx&& ctx, const Other & other, Attr& attr) const 
+	{
+		static_assert(
+			detail::is_contiguous_byte_iterator_v<It>,
+			"Byte views require contiguous input."
+		);
+		auto pos = f;
+		std::uint32_t len{0};
+		if(not varuint32.parse(pos, l, ctx, other, len))
+			return false;
+		if(static_cast<std::size_t>(std::distance(pos, l)) < len)
+			return false;
+		if constexpr(not std::is_same_v<std::decay_t<Attr>, x3::unused_type>)
+		{
+			if(len)
+				attr = std::string_view(reinterpret_cast<const char*>(detail::byte_pointer(pos)), len);
+			else
+				attr = std::string_view();
+		}
+		std::advance(pos, len);
+		f = pos;
+		return true;
+	}
+};
+
+inline const auto varuint32_prefixed_bytes = Varuint32PrefixedBytes{};
+
 } /* namespace wasm::parse */
 
 #endif /* BINPARSE_LEB128_PARSERS_H */
@@ -28,15 +28,21 @@ inline const auto language_type_def
 BOOST_SPIRIT_DEFINE(language_type);
 
 inline const auto utf8_string_def
-	= varuint32_prefixed_sequence(x3::char_);
+	= varuint32_prefixed_bytes;
 BOOST_SPIRIT_DEFINE(utf8_string);
 
+// the binary format encodes mutability ('1' for 'var'); 'GlobalType' and
+// 'GlobalDef' record constness instead.
+inline const auto is_const_flag
+	= x3::rule<struct is_const_flag_tag, bool>{"is_const_flag"}
+	= match_value(x3::byte_, 0x00, true) | match_value(x3::byte_, 0x01, false);
+
 inline const auto global_type_def
-	= value_type >> varuint1;
+	= value_type >> is_const_flag;
 BOOST_SPIRIT_DEFINE(global_type);
 
 inline const auto elem_type_def
-	= match_value<unsigned char>(x3::byte_, LanguageType::anyfunc);
+	= match_value(x3::byte_, 0x70, LanguageType::anyfunc);
 BOOST_SPIRIT_DEFINE(elem_type);
 
 inline const auto resizable_limits_def
@@ -48,7 +54,7 @@ BOOST_SPIRIT_DEFINE(resizable_limits);
 inline const auto func_type_def
 	= x3::omit[x3::byte_(0x60)]
 	> varuint32_prefixed_sequence(value_type)
-	> varuint1_option(value_type);
+	> varuint32_prefixed_sequence(value_type);
 BOOST_SPIRIT_DEFINE(func_type);
 
 inline const auto float32_def
@@ -82,26 +88,26 @@ inline const auto initializer_expression_def
 		| (x3::byte_(relax_enum(wasm::opc::OpCode::F32_CONST))  >> float32)
 		| (x3::byte_(relax_enum(wasm::opc::OpCode::F64_CONST))  >> float64)
 		| (x3::byte_(relax_enum(wasm::opc::OpCode::GET_GLOBAL)) >> varuint32)
-	);
+	) >> x3::omit[x3::byte_(relax_enum(wasm::opc::OpCode::END))];
 BOOST_SPIRIT_DEFINE(initializer_expression);
 
 inline const auto i32_initializer_expression_def
 	= (
 		  (x3::byte_(relax_enum(wasm::opc::OpCode::I32_CONST))  >> varint32)
 		| (x3::byte_(relax_enum(wasm::opc::OpCode::GET_GLOBAL)) >> varuint32)
-	);
+	) >> x3::omit[x3::byte_(relax_enum(wasm::opc::OpCode::END))];
 BOOST_SPIRIT_DEFINE(i32_initializer_expression);
 
 
 inline const auto global_entry_def
-	= (value_type >> varuint1 >> initializer_expression)[(
+	= (value_type >> is_const_flag >> initializer_expression)[(
 		[](auto& ctx) {
 			// auto [kind, is_const, expr] = x3::_attr(ctx);
 			auto& attribute = x3::_attr(ctx);
 			auto kind = boost::fusion::at_c<0>(attribute);
 			auto is_const = boost::fusion::at_c<1>(attribute);
 			auto expr = boost::fusion::at_c<2>(attribute);
-			assert(static_cast<int>(kind) <= -4 and static_cast<int>(kind) >= -1);
+			assert(static_cast<int>(kind) >= -4 and static_cast<int>(kind) <= -1);
 			auto& entry = x3::_val(ctx);
 			entry.value.is_const = is_const;
 			// indicates that the initializer expression depends on the value
@@ -150,7 +156,7 @@ inline const auto elem_segment_def
 BOOST_SPIRIT_DEFINE(elem_segment);
 
 inline const auto data_segment_def
-	= varuint32 >> i32_initializer_expression >> varuint32_prefixed_sequence(x3::byte_);
+	= varuint32 >> i32_initializer_expression >> varuint32_prefixed_bytes;
 BOOST_SPIRIT_DEFINE(data_segment);
 
 inline const auto local_entry_def
@@ -44,7 +44,7 @@ BOOST_SPIRIT_DEFINE(resizable_limits);
 static const auto func_type_def
 	= x3::omit[x3::byte_(0x60)]
 	> varuint32_prefixed_sequence(value_type)
-	> varuint1_option(value_type);
+	> varuint32_prefixed_sequence(value_type);
 BOOST_SPIRIT_DEFINE(func_type);
 
 static const auto float32_def
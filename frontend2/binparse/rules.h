@@ -1,6 +1,7 @@
 #ifndef BINPARSE_RULES_H
 #define BINPARSE_RULES_H
 
+#include <string_view>
 #include <boost/spirit/home/x3.hpp>
 #include "../../include/wasm_base.h"
 #include "helpers.h"
@@ -17,7 +18,7 @@ inline const auto language_type
 	= x3::rule<struct language_type_tag, LanguageType>("language_type");
 
 inline const auto utf8_string
-	= x3::rule<struct utf8_string_tag, std::string>("utf8_string");
+	= x3::rule<struct utf8_string_tag, std::string_view>("utf8_string");
 
 inline const auto global_type = 
 	x3::rule<struct elem_type_tag, GlobalType>("global_type");
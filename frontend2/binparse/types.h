@@ -1,20 +1,121 @@
 #ifndef BINPARSE_TYPES_H
 #define BINPARSE_TYPES_H
 
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <variant>
 #include <ostream>
 #include <tuple>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
 #include <type_traits>
 #include <boost/fusion/include/adapt_struct.hpp>
 #include "../../include/wasm_base.h"
 #include "../../include/WasmInstruction.h"
+#include "../../include/vm/alloc/memory_resource.h"
 
 namespace wasm::parse {
 
+/// @name Module arenas
+/// The storage of a 'ModuleDef' (section vectors, parameter lists, element
+/// indices, locals) is carved out of one monotonic arena that is released in
+/// one shot with the 'ModuleDef'.  Names and data segment contents are not
+/// copied at all; they are views into 'ModuleDef::source'.
+///
+/// X3 default-constructs attributes, so containers cannot be handed an
+/// allocator explicitly.  Instead, 'ArenaAllocator's default constructor picks
+/// up the arena installed on the current thread by a 'ModuleArenaScope' and
+/// falls back to the default resource outside of one.
+/// @{
+namespace detail {
+
+inline thread_local pmr::memory_resource* current_module_arena = nullptr;
+
+} /* namespace detail */
+
+template <class T>
+struct ArenaAllocator:
+	public pmr::polymorphic_allocator<T>
+{
+	using base_type = pmr::polymorphic_allocator<T>;
+
+	ArenaAllocator() noexcept:
+		base_type(
+			detail::current_module_arena ? 
+			detail::current_module_arena : pmr::get_default_resource()
+		)
+	{
+		
+	}
+
+	ArenaAllocator(pmr::memory_resource* resource) noexcept:
+		base_type(resource)
+	{
+		
+	}
+
+	template <class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept:
+		base_type(other.resource())
+	{
+		
+	}
+
+	ArenaAllocator select_on_container_copy_construction() const
+	{ return ArenaAllocator(); }
+};
+
+template <class T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
+template <class CharT>
+using arena_basic_string = std::basic_string<CharT, std::char_traits<CharT>, ArenaAllocator<CharT>>;
+
+/// Installs 'arena' as the calling thread's module arena for the lifetime of
+/// the scope.
+struct ModuleArenaScope
+{
+	ModuleArenaScope(pmr::memory_resource* arena) noexcept:
+		prev_(detail::current_module_arena)
+	{
+		detail::current_module_arena = arena;
+	}
+
+	ModuleArenaScope(const ModuleArenaScope&) = delete;
+	ModuleArenaScope& operator=(const ModuleArenaScope&) = delete;
+
+	~ModuleArenaScope()
+	{
+		detail::current_module_arena = prev_;
+	}
+private:
+	pmr::memory_resource* const prev_;
+};
+/// @}
+
+/// Per-opcode costs for fuel metering.  Code lowered with a cost table in
+/// the parser context (see 'codeparse::fuel_costs_tag') starts each basic
+/// block with a 'FUEL' instruction that charges the summed costs of the
+/// block's instructions.  'ELSE' and 'END' only delimit blocks; they're free.
+struct FuelCosts
+{
+	/// Every instruction costs 'cost'.
+	explicit FuelCosts(std::uint32_t cost = 1u)
+	{ costs.fill(cost); }
+
+	std::uint32_t& operator[](opc::OpCode op)
+	{ return costs[static_cast<std::size_t>(op)]; }
+
+	std::uint32_t operator[](opc::OpCode op) const
+	{ return costs[static_cast<std::size_t>(op)]; }
+
+	std::array<std::uint32_t, 256u> costs;
+};
+
 struct GlobalDef;
 struct ResizableLimits;
 struct GlobalType;
@@ -45,8 +146,8 @@ std::ostream& operator<<(std::ostream& os, const LocalEntry&);
 std::ostream& operator<<(std::ostream& os, const FunctionBody&);
 std::ostream& operator<<(std::ostream& os, const ModuleDef&);
 
-template <class T>
-std::ostream& operator<<(std::ostream& os, const std::vector<T>& vec)
+template <class T, class Alloc>
+std::ostream& operator<<(std::ostream& os, const std::vector<T, Alloc>& vec)
 {
 	os << '[';
 	if(vec.size() > 0)
@@ -121,7 +222,7 @@ struct wasm::parse::GlobalType:
 {
 	using std::pair<LanguageType, bool>::pair;
 	static constexpr const ExternalKind external_kind_v 
-		= LanguageType::Global;
+		= ExternalKind::Global;
 
 	const LanguageType& type() const
 	{ return first; }
@@ -136,18 +237,23 @@ struct wasm::parse::GlobalType:
 	{ return second; }
 };
 
-GlobalType global_type(const GlobalDef& def)
+namespace wasm {
+
+/// The type of the global 'def' defines.  (Not in 'wasm::parse', where
+/// 'global_type' names the parser of an encoded global type.)
+parse::GlobalType global_type(const parse::GlobalDef& def)
 {
 	assert(not def.value.valueless_by_exception());
-	idx = def.value.index();
-	assert(idx < 4u);
+	assert(def.value.index() < 4u);
 	auto tp = std::holds_alternative<std::int32_t>(def.value) ? LanguageType::i32
 		: std::holds_alternative<std::int64_t>(def.value) ? LanguageType::i64
 		: std::holds_alternative<float>(def.value) ? LanguageType::f32
 		: LanguageType::f64;
-	return GlobalType(tp, def.is_const);
+	return parse::GlobalType(tp, def.is_const);
 }
 
+} /* namespace wasm */
+
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::GlobalType,
 	(wasm::LanguageType, first),
@@ -164,7 +270,7 @@ struct wasm::parse::Table:
 	public ResizableLimits
 {
 	static constexpr const ExternalKind external_kind_v 
-		= LanguageType::Table;
+		= ExternalKind::Table;
 	using ResizableLimits::ResizableLimits;
 };
 BOOST_FUSION_ADAPT_STRUCT(
@@ -181,7 +287,7 @@ struct wasm::parse::Memory:
 	public ResizableLimits
 {
 	static constexpr const ExternalKind external_kind_v 
-		= LanguageType::Memory;
+		= ExternalKind::Memory;
 	using ResizableLimits::ResizableLimits;
 };
 BOOST_FUSION_ADAPT_STRUCT(
@@ -195,34 +301,40 @@ std::ostream& wasm::parse::operator<<(std::ostream& os, const Memory& mem)
 }
 
 struct wasm::parse::FunctionSignature {
-	std::basic_string<LanguageType> param_types;
-	std::optional<LanguageType> return_type;
+	arena_basic_string<LanguageType> param_types;
+	arena_basic_string<LanguageType> return_types;
 };
 
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::FunctionSignature,
-	(std::basic_string<wasm::LanguageType>, param_types),
-	(std::optional<wasm::LanguageType>,     return_type)
+	(wasm::parse::arena_basic_string<wasm::LanguageType>, param_types),
+	(wasm::parse::arena_basic_string<wasm::LanguageType>, return_types)
 )
 std::ostream& wasm::parse::operator<<(std::ostream& os, const FunctionSignature& sig)
 {
-	os << "FunctionSignature(params = (";
-	if(sig.param_types.size() > 0)
-	{
-		std::basic_string_view<LanguageType> view(sig.param_types);
-		os << view.front();
-		view.remove_prefix(1);
-		for(const auto& tp: view)
-			os << ", " << tp;
-	}
-	os << "), return_type = " << sig.return_type << ')';
+	auto write_types = [&](std::basic_string_view<LanguageType> view) {
+		os << '(';
+		if(view.size() > 0)
+		{
+			os << view.front();
+			view.remove_prefix(1);
+			for(const auto& tp: view)
+				os << ", " << tp;
+		}
+		os << ')';
+	};
+	os << "FunctionSignature(params = ";
+	write_types(sig.param_types);
+	os << ", return_types = ";
+	write_types(sig.return_types);
+	os << ')';
 	return os;
 }
 
 struct wasm::parse::ImportEntry {
 	using variant_t = std::variant<std::uint32_t, Table, Memory, GlobalType>;
-	std::string module_name;
-	std::string field_name;
+	std::string_view module_name;
+	std::string_view field_name;
 	variant_t entry_type;
 
 	ExternalKind kind() const
@@ -245,8 +357,8 @@ struct wasm::parse::ImportEntry {
 
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::ImportEntry,
-	(std::string, module_name),
-	(std::string, field_name),
+	(std::string_view, module_name),
+	(std::string_view, field_name),
 	(wasm::parse::ImportEntry::variant_t, entry_type)
 )
 std::ostream& wasm::parse::operator<<(std::ostream& os, const ImportEntry& ent)
@@ -272,14 +384,14 @@ std::ostream& wasm::parse::operator<<(std::ostream& os, const GlobalEntry& ent)
 }
 
 struct wasm::parse::ExportEntry {
-	std::string name;
+	std::string_view name;
 	wasm::ExternalKind kind;
 	std::uint32_t index;
 };
 
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::ExportEntry,
-	(std::string, name),
+	(std::string_view, name),
 	(wasm::ExternalKind, kind),
 	(std::uint32_t, index)
 )
@@ -296,13 +408,13 @@ struct wasm::parse::ElemSegment {
 	using variant_t = std::variant<std::int32_t, std::uint32_t>;
 	std::uint32_t index;
 	variant_t offset;
-	std::vector<std::uint32_t> indices;
+	arena_vector<std::uint32_t> indices;
 };
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::ElemSegment,
 	(std::uint32_t, index),
 	(wasm::parse::ElemSegment::variant_t, offset),
-	(std::vector<std::uint32_t>, indices)
+	(wasm::parse::arena_vector<std::uint32_t>, indices)
 )
 std::ostream& wasm::parse::operator<<(std::ostream& os, const ElemSegment& seg)
 {
@@ -322,13 +434,14 @@ struct wasm::parse::DataSegment {
 	using variant_t = std::variant<std::int32_t, std::uint32_t>;
 	std::uint32_t index;
 	variant_t offset;
-	std::vector<std::uint8_t> data;
+	/// View into 'ModuleDef::source'.
+	std::string_view data;
 };
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::DataSegment,
 	(std::uint32_t, index),
 	(wasm::parse::DataSegment::variant_t, offset),
-	(std::vector<std::uint8_t>, data)
+	(std::string_view, data)
 )
 std::ostream& wasm::parse::operator<<(std::ostream& os, const DataSegment& seg)
 {
@@ -338,7 +451,7 @@ std::ostream& wasm::parse::operator<<(std::ostream& os, const DataSegment& seg)
 		os << seg.offset;
 	else
 		os << "Globals[" << std::get<1>(seg.offset) << ']';
-	os << ", data = " << seg.data;
+	os << ", data = <" << seg.data.size() << " bytes>";
 	os << ')';
 	return os;
 }
@@ -361,8 +474,17 @@ std::ostream& wasm::parse::operator<<(std::ostream& os, const LocalEntry& ent)
 }
 
 struct wasm::parse::FunctionBody {
-	std::basic_string<wasm::LanguageType> locals;
+	arena_basic_string<wasm::LanguageType> locals;
 	std::string code;
+	/// For bodies that were not lowered at load time (see 'lazy_module'), the
+	/// size-prefixed encoding of the body within 'ModuleDef::source'.
+	std::string_view encoded;
+	/// Number of 'CALL_INDIRECT' and 'RETURN_CALL_INDIRECT' sites in 'code'.
+	/// Lowering numbers them, and each gets an inline cache slot in the 'WasmFunction'.
+	std::uint32_t call_sites = 0;
+
+	bool is_lowered() const
+	{ return encoded.empty(); }
 };
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::FunctionBody,
@@ -372,7 +494,7 @@ BOOST_FUSION_ADAPT_STRUCT(
 
 std::ostream& wasm::parse::operator<<(std::ostream& os, const FunctionBody& body)
 {
-	os << "FunctionBody(locals = " << body.locals;
+	os << "FunctionBody(locals = " << std::vector<LanguageType>(body.locals.begin(), body.locals.end());
 	std::vector<unsigned> code(body.code.size());
 	std::transform(body.code.begin(), body.code.end(), code.begin(),
 		[](auto c){ return static_cast<unsigned char>(c); }
@@ -384,32 +506,42 @@ std::ostream& wasm::parse::operator<<(std::ostream& os, const FunctionBody& body
 
 struct wasm::parse::ModuleDef {
 	std::string module_name;
-	std::optional<std::vector<FunctionSignature>> type_section;
-	std::optional<std::vector<ImportEntry>>       import_section;
-	std::optional<std::vector<std::uint32_t>>     function_section;
-	std::optional<std::vector<Table>>             table_section;
-	std::optional<std::vector<Memory>>            memory_section;
-	std::optional<std::vector<GlobalEntry>>       global_section;
-	std::optional<std::vector<ExportEntry>>       export_section;
-	std::optional<std::uint32_t>                  start_section;
-	std::optional<std::vector<ElemSegment>>       element_section;
-	std::optional<std::vector<FunctionBody>>      code_section;
-	std::optional<std::vector<DataSegment>>       data_section;
+	/// The module binary.  Names, data segments and unlowered function bodies
+	/// are views into it, so the loader must set this to the parsed buffer.
+	std::shared_ptr<const std::string> source;
+	/// The cost table the function bodies are metered with, if any.  Set by
+	/// 'validated_module' and 'lazy_module' when they find one in their
+	/// context; lazily lowered bodies are metered with it too.
+	std::shared_ptr<const FuelCosts> fuel_costs;
+	/// Owns the storage of the sections below (see 'ModuleArenaScope').
+	/// Declared before them so that it is released after them.
+	std::shared_ptr<pmr::monotonic_buffer_resource> arena;
+	std::optional<arena_vector<FunctionSignature>> type_section;
+	std::optional<arena_vector<ImportEntry>>       import_section;
+	std::optional<arena_vector<std::uint32_t>>     function_section;
+	std::optional<arena_vector<Table>>             table_section;
+	std::optional<arena_vector<Memory>>            memory_section;
+	std::optional<arena_vector<GlobalEntry>>       global_section;
+	std::optional<arena_vector<ExportEntry>>       export_section;
+	std::optional<std::uint32_t>                   start_section;
+	std::optional<arena_vector<ElemSegment>>       element_section;
+	std::optional<arena_vector<FunctionBody>>      code_section;
+	std::optional<arena_vector<DataSegment>>       data_section;
 };
 
 BOOST_FUSION_ADAPT_STRUCT(
 	wasm::parse::ModuleDef,
-	(std::optional<std::vector<wasm::parse::FunctionSignature>>, type_section)
-	(std::optional<std::vector<wasm::parse::ImportEntry>>      , import_section),
-	(std::optional<std::vector<std::uint32_t>>                 , function_section),
-	(std::optional<std::vector<wasm::parse::Table>>            , table_section),
-	(std::optional<std::vector<wasm::parse::Memory>>           , memory_section),
-	(std::optional<std::vector<wasm::parse::GlobalEntry>>      , global_section),
-	(std::optional<std::vector<wasm::parse::ExportEntry>>      , export_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::FunctionSignature>>, type_section)
+	(std::optional<wasm::parse::arena_vector<wasm::parse::ImportEntry>>      , import_section),
+	(std::optional<wasm::parse::arena_vector<std::uint32_t>>                 , function_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::Table>>            , table_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::Memory>>           , memory_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::GlobalEntry>>      , global_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::ExportEntry>>      , export_section),
 	(std::optional<std::uint32_t>                              , start_section),
-	(std::optional<std::vector<wasm::parse::ElemSegment>>      , element_section),
-	(std::optional<std::vector<wasm::parse::FunctionBody>>     , code_section),
-	(std::optional<std::vector<wasm::parse::DataSegment>>      , data_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::ElemSegment>>      , element_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::FunctionBody>>     , code_section),
+	(std::optional<wasm::parse::arena_vector<wasm::parse::DataSegment>>      , data_section),
 )
 std::ostream& wasm::parse::operator<<(std::ostream& os, const ModuleDef& body)
 {
@@ -0,0 +1,911 @@
+#ifndef BINPARSE_VALIDATOR_H
+#define BINPARSE_VALIDATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <unordered_set>
+#include "../../include/wasm_base.h"
+#include "../../include/WasmInstruction.h"
+#include "types.h"
+
+/*
+ * Single-pass validation of WebAssembly modules.
+ *
+ * 'ModuleValidator' checks everything that precedes the code section (and the
+ * data section once it has been parsed) and builds the index spaces that
+ * function bodies are checked against.
+ *
+ * 'FunctionValidator' implements the operand-stack/control-stack algorithm
+ * from the validation appendix of the spec.  It is driven by the lowering
+ * grammar in 'x3binparse.h': every instruction is checked right after it has
+ * been lowered, so a module that parses under a 'FunctionValidator' has been
+ * fully type-checked and the interpreter need not re-check operand types,
+ * stack depths, local/global indices or branch depths at runtime.
+ */
+
+namespace wasm::parse {
+
+using opc::OpCode;
+
+struct InvalidModuleError:
+	public ValidationError<std::logic_error>
+{
+	using ValidationError<std::logic_error>::ValidationError;
+};
+
+struct InvalidCodeError:
+	public InvalidModuleError
+{
+	using InvalidModuleError::InvalidModuleError;
+};
+
+namespace detail {
+
+template <class ... Args>
+std::string validation_message(const Args& ... args)
+{
+	std::ostringstream s;
+	(s << ... << args);
+	return s.str();
+}
+
+template <class T>
+T read_lowered(std::string_view instr, std::size_t offset)
+{
+	assert(instr.size() >= offset + sizeof(T));
+	T value;
+	std::memcpy(&value, instr.data() + offset, sizeof(value));
+	return value;
+}
+
+/// Operand and result types of the numeric instructions.
+struct NumericSignature {
+	LanguageType params[2];
+	std::uint8_t param_count;
+	LanguageType result;
+};
+
+inline std::optional<NumericSignature> numeric_signature(OpCode op)
+{
+	constexpr auto i32 = LanguageType::i32;
+	constexpr auto i64 = LanguageType::i64;
+	constexpr auto f32 = LanguageType::f32;
+	constexpr auto f64 = LanguageType::f64;
+	auto unop = [](LanguageType in, LanguageType out) {
+		return NumericSignature{{in, in}, 1u, out};
+	};
+	auto binop = [](LanguageType in, LanguageType out) {
+		return NumericSignature{{in, in}, 2u, out};
+	};
+	auto v = static_cast<unsigned>(op);
+	if(v == 0x45u)                  return unop(i32, i32);  // i32.eqz
+	if(v >= 0x46u and v <= 0x4fu)   return binop(i32, i32); // i32 comparisons
+	if(v == 0x50u)                  return unop(i64, i32);  // i64.eqz
+	if(v >= 0x51u and v <= 0x5au)   return binop(i64, i32); // i64 comparisons
+	if(v >= 0x5bu and v <= 0x60u)   return binop(f32, i32); // f32 comparisons
+	if(v >= 0x61u and v <= 0x66u)   return binop(f64, i32); // f64 comparisons
+	if(v >= 0x67u and v <= 0x69u)   return unop(i32, i32);  // i32 clz/ctz/popcnt
+	if(v >= 0x6au and v <= 0x78u)   return binop(i32, i32); // i32 arithmetic
+	if(v >= 0x79u and v <= 0x7bu)   return unop(i64, i64);  // i64 clz/ctz/popcnt
+	if(v >= 0x7cu and v <= 0x8au)   return binop(i64, i64); // i64 arithmetic
+	if(v >= 0x8bu and v <= 0x91u)   return unop(f32, f32);  // f32 unary
+	if(v >= 0x92u and v <= 0x98u)   return binop(f32, f32); // f32 binary
+	if(v >= 0x99u and v <= 0x9fu)   return unop(f64, f64);  // f64 unary
+	if(v >= 0xa0u and v <= 0xa6u)   return binop(f64, f64); // f64 binary
+	switch(op)
+	{
+	case OpCode::I32_WRAP:            return unop(i64, i32);
+	case OpCode::I32_TRUNC_F32_S:     [[fallthrough]];
+	case OpCode::I32_TRUNC_F32_U:     return unop(f32, i32);
+	case OpCode::I32_TRUNC_F64_S:     [[fallthrough]];
+	case OpCode::I32_TRUNC_F64_U:     return unop(f64, i32);
+	case OpCode::I64_EXTEND_S:        [[fallthrough]];
+	case OpCode::I64_EXTEND_U:        return unop(i32, i64);
+	case OpCode::I64_TRUNC_F32_S:     [[fallthrough]];
+	case OpCode::I64_TRUNC_F32_U:     return unop(f32, i64);
+	case OpCode::I64_TRUNC_F64_S:     [[fallthrough]];
+	case OpCode::I64_TRUNC_F64_U:     return unop(f64, i64);
+	case OpCode::F32_CONVERT_I32_S:   [[fallthrough]];
+	case OpCode::F32_CONVERT_I32_U:   return unop(i32, f32);
+	case OpCode::F32_CONVERT_I64_S:   [[fallthrough]];
+	case OpCode::F32_CONVERT_I64_U:   return unop(i64, f32);
+	case OpCode::F32_DEMOTE:          return unop(f64, f32);
+	case OpCode::F64_CONVERT_I32_S:   [[fallthrough]];
+	case OpCode::F64_CONVERT_I32_U:   return unop(i32, f64);
+	case OpCode::F64_CONVERT_I64_S:   [[fallthrough]];
+	case OpCode::F64_CONVERT_I64_U:   return unop(i64, f64);
+	case OpCode::F64_PROMOTE:         return unop(f32, f64);
+	case OpCode::I32_REINTERPRET_F32: return unop(f32, i32);
+	case OpCode::I64_REINTERPRET_F64: return unop(f64, i64);
+	case OpCode::F32_REINTERPRET_I32: return unop(i32, f32);
+	case OpCode::F64_REINTERPRET_I64: return unop(i64, f64);
+	default:
+		return std::nullopt;
+	}
+}
+
+/// Value type and natural alignment (log2) of the memory access instructions.
+struct MemoryAccessSignature {
+	LanguageType type;
+	std::uint32_t max_align;
+	bool is_store;
+};
+
+inline std::optional<MemoryAccessSignature> memory_access_signature(OpCode op)
+{
+	constexpr auto i32 = LanguageType::i32;
+	constexpr auto i64 = LanguageType::i64;
+	constexpr auto f32 = LanguageType::f32;
+	constexpr auto f64 = LanguageType::f64;
+	switch(op)
+	{
+	case OpCode::I32_LOAD:     return MemoryAccessSignature{i32, 2u, false};
+	case OpCode::I64_LOAD:     return MemoryAccessSignature{i64, 3u, false};
+	case OpCode::F32_LOAD:     return MemoryAccessSignature{f32, 2u, false};
+	case OpCode::F64_LOAD:     return MemoryAccessSignature{f64, 3u, false};
+	case OpCode::I32_LOAD8_S:  [[fallthrough]];
+	case OpCode::I32_LOAD8_U:  return MemoryAccessSignature{i32, 0u, false};
+	case OpCode::I32_LOAD16_S: [[fallthrough]];
+	case OpCode::I32_LOAD16_U: return MemoryAccessSignature{i32, 1u, false};
+	case OpCode::I64_LOAD8_S:  [[fallthrough]];
+	case OpCode::I64_LOAD8_U:  return MemoryAccessSignature{i64, 0u, false};
+	case OpCode::I64_LOAD16_S: [[fallthrough]];
+	case OpCode::I64_LOAD16_U: return MemoryAccessSignature{i64, 1u, false};
+	case OpCode::I64_LOAD32_S: [[fallthrough]];
+	case OpCode::I64_LOAD32_U: return MemoryAccessSignature{i64, 2u, false};
+	case OpCode::I32_STORE:    return MemoryAccessSignature{i32, 2u, true};
+	case OpCode::I64_STORE:    return MemoryAccessSignature{i64, 3u, true};
+	case OpCode::F32_STORE:    return MemoryAccessSignature{f32, 2u, true};
+	case OpCode::F64_STORE:    return MemoryAccessSignature{f64, 3u, true};
+	case OpCode::I32_STORE8:   return MemoryAccessSignature{i32, 0u, true};
+	case OpCode::I32_STORE16:  return MemoryAccessSignature{i32, 1u, true};
+	case OpCode::I64_STORE8:   return MemoryAccessSignature{i64, 0u, true};
+	case OpCode::I64_STORE16:  return MemoryAccessSignature{i64, 1u, true};
+	case OpCode::I64_STORE32:  return MemoryAccessSignature{i64, 2u, true};
+	default:
+		return std::nullopt;
+	}
+}
+
+} /* namespace detail */
+
+/// Type of a global in the module's global index space.
+struct GlobalInfo {
+	LanguageType type;
+	bool is_const;
+};
+
+/// The index spaces that function bodies are validated against.
+struct ValidationContext {
+	std::vector<FunctionSignature> types;
+	/// Type index of every function, imported functions first.
+	std::vector<std::uint32_t> functions;
+	std::size_t imported_function_count = 0;
+	/// Every global, imported globals first.
+	std::vector<GlobalInfo> globals;
+	std::size_t imported_global_count = 0;
+	std::size_t table_count = 0;
+	std::size_t memory_count = 0;
+};
+
+struct ModuleValidator
+{
+	/// Validate every section up to (but excluding) the code section.
+	ModuleValidator(const ModuleDef& def)
+	{
+		if(def.type_section)
+			context_.types.assign(def.type_section->begin(), def.type_section->end());
+		if(def.import_section)
+		{
+			for(const auto& entry: *def.import_section)
+				read_import(entry);
+		}
+		context_.imported_function_count = context_.functions.size();
+		context_.imported_global_count = context_.globals.size();
+		if(def.function_section)
+		{
+			for(std::uint32_t type_index: *def.function_section)
+				add_function(type_index);
+		}
+		if(def.table_section)
+		{
+			for(const auto& table: *def.table_section)
+				add_table(table);
+		}
+		if(def.memory_section)
+		{
+			for(const auto& memory: *def.memory_section)
+				add_memory(memory);
+		}
+		if(def.global_section)
+		{
+			for(const auto& entry: *def.global_section)
+				add_global(entry);
+		}
+		if(def.export_section)
+			validate_exports(*def.export_section);
+		if(def.start_section)
+			validate_start(*def.start_section);
+		if(def.element_section)
+		{
+			for(const auto& seg: *def.element_section)
+				validate_elem_segment(seg);
+		}
+	}
+
+	/// Validate what follows the code section, once it has been parsed.
+	void validate_tail(const ModuleDef& def) const
+	{
+		std::size_t body_count = def.code_section ? def.code_section->size() : 0u;
+		std::size_t defined_count = context_.functions.size() - context_.imported_function_count;
+		if(body_count != defined_count)
+		{
+			throw InvalidModuleError(detail::validation_message(
+				"Function and code section have inconsistent lengths (",
+				defined_count, " functions declared, ", body_count, " bodies)."
+			));
+		}
+		if(def.data_section)
+		{
+			for(const auto& seg: *def.data_section)
+				validate_data_segment(seg);
+		}
+	}
+
+	const ValidationContext& context() const
+	{ return context_; }
+
+private:
+
+	void read_import(const ImportEntry& entry)
+	{
+		switch(entry.kind())
+		{
+		case ExternalKind::Function:
+			add_function(std::get<std::uint32_t>(entry.entry_type));
+			break;
+		case ExternalKind::Table:
+			add_table(std::get<Table>(entry.entry_type));
+			break;
+		case ExternalKind::Memory:
+			add_memory(std::get<Memory>(entry.entry_type));
+			break;
+		case ExternalKind::Global: {
+			const auto& tp = std::get<GlobalType>(entry.entry_type);
+			if(not tp.is_const())
+			{
+				throw InvalidModuleError(detail::validation_message(
+					"Mutable global imported from \"", entry.module_name,
+					"\".\"", entry.field_name, "\"."
+				));
+			}
+			context_.globals.push_back(GlobalInfo{tp.type(), tp.is_const()});
+			break;
+		}
+		default:
+			assert(false);
+		}
+	}
+
+	void add_function(std::uint32_t type_index)
+	{
+		if(type_index >= context_.types.size())
+		{
+			throw InvalidModuleError(detail::validation_message(
+				"Function type index ", type_index, " out of range (",
+				context_.types.size(), " types)."
+			));
+		}
+		context_.functions.push_back(type_index);
+	}
+
+	static void validate_limits(const ResizableLimits& lims, const char* what, std::uint64_t bound)
+	{
+		if(lims.initial > bound or (lims.maximum and *lims.maximum > bound))
+			throw InvalidModuleError(detail::validation_message(what, " limits out of range."));
+		if(lims.maximum and (*lims.maximum < lims.initial))
+			throw InvalidModuleError(detail::validation_message(what, " maximum is less than its initial size."));
+	}
+
+	void add_table(const Table& table)
+	{
+		validate_limits(table, "Table", ~std::uint32_t(0));
+		if(++context_.table_count > 1u)
+			throw InvalidModuleError("Multiple tables.");
+	}
+
+	void add_memory(const Memory& memory)
+	{
+		// 65536 pages of 64KiB each is the entire 32-bit address space
+		validate_limits(memory, "Memory", 65536u);
+		if(++context_.memory_count > 1u)
+			throw InvalidModuleError("Multiple memories.");
+	}
+
+	void validate_constant_global(std::uint32_t index, LanguageType expect, const char* what) const
+	{
+		// MVP: initializer expressions may only read imported, immutable globals
+		if(index >= context_.imported_global_count)
+		{
+			throw InvalidModuleError(detail::validation_message(
+				what, " initializer reads global ", index,
+				", which is not an imported global."
+			));
+		}
+		const auto& glob = context_.globals[index];
+		if(not glob.is_const)
+		{
+			throw InvalidModuleError(detail::validation_message(
+				what, " initializer reads mutable global ", index, '.'
+			));
+		}
+		if(glob.type != expect)
+		{
+			throw InvalidModuleError(detail::validation_message(
+				what, " initializer has type ", glob.type, " (expected ", expect, ")."
+			));
+		}
+	}
+
+	void add_global(const GlobalEntry& entry)
+	{
+		// alternatives of 'GlobalDef::value_t', in order
+		constexpr LanguageType value_types[] = {
+			LanguageType::i32, LanguageType::i64, LanguageType::f32, LanguageType::f64
+		};
+		assert(entry.value.value.index() < 4u);
+		auto tp = value_types[entry.value.value.index()];
+		if(entry.depends)
+			validate_constant_global(*entry.depends, tp, "Global");
+		context_.globals.push_back(GlobalInfo{tp, entry.value.is_const});
+	}
+
+	void validate_exports(const arena_vector<ExportEntry>& exports) const
+	{
+		std::unordered_set<std::string_view> names;
+		for(const auto& ent: exports)
+		{
+			if(not names.insert(ent.name).second)
+			{
+				throw InvalidModuleError(detail::validation_message(
+					"Duplicate export name \"", ent.name, "\"."
+				));
+			}
+			std::size_t limit = 0;
+			switch(ent.kind)
+			{
+			case ExternalKind::Function: limit = context_.functions.size(); break;
+			case ExternalKind::Table:    limit = context_.table_count;      break;
+			case ExternalKind::Memory:   limit = context_.memory_count;     break;
+			case ExternalKind::Global:   limit = context_.globals.size();   break;
+			default:
+				assert(false);
+			}
+			if(ent.index >= limit)
+			{
+				throw InvalidModuleError(detail::validation_message(
+					"Export \"", ent.name, "\" refers to out-of-range ",
+					ent.kind, " index ", ent.index, '.'
+				));
+			}
+			if(ent.kind == ExternalKind::Global and not context_.globals[ent.index].is_const)
+			{
+				throw InvalidModuleError(detail::validation_message(
+					"Export \"", ent.name, "\" exports a mutable global."
+				));
+			}
+		}
+	}
+
+	void validate_start(std::uint32_t index) const
+	{
+		if(index >= context_.functions.size())
+			throw InvalidModuleError(detail::validation_message("Start function ", index, " out of range."));
+		const auto& sig = context_.types[context_.functions[index]];
+		if(not sig.param_types.empty() or not sig.return_types.empty())
+			throw InvalidModuleError("Start function must take no parameters and return no values.");
+	}
+
+	template <class Segment>
+	void validate_segment_offset(const Segment& seg, std::size_t space_size, const char* what) const
+	{
+		if(seg.index >= space_size)
+		{
+			throw InvalidModuleError(detail::validation_message(
+				what, " segment refers to out-of-range index ", seg.index, '.'
+			));
+		}
+		if(const auto* glob = std::get_if<std::uint32_t>(&seg.offset); glob)
+			validate_constant_global(*glob, LanguageType::i32, what);
+	}
+
+	void validate_elem_segment(const ElemSegment& seg) const
+	{
+		validate_segment_offset(seg, context_.table_count, "Element");
+		for(std::uint32_t func: seg.indices)
+		{
+			if(func >= context_.functions.size())
+			{
+				throw InvalidModuleError(detail::validation_message(
+					"Element segment refers to out-of-range function ", func, '.'
+				));
+			}
+		}
+	}
+
+	void validate_data_segment(const DataSegment& seg) const
+	{ validate_segment_offset(seg, context_.memory_count, "Data"); }
+
+	ValidationContext context_;
+};
+
+struct FunctionValidator
+{
+	/// 'std::nullopt' is the 'Unknown' type: the type of any operand popped
+	/// from the (polymorphic) stack of an unreachable frame.
+	using operand_type = std::optional<LanguageType>;
+	using types_view = std::basic_string_view<LanguageType>;
+
+	/// 'params' and 'results' view either a function type in the context, or
+	/// the static storage returned by 'single_result()'.
+	struct ControlFrame {
+		OpCode opcode;
+		types_view params;
+		types_view results;
+		std::size_t height;
+		bool unreachable;
+	};
+
+	FunctionValidator(const ValidationContext& context):
+		FunctionValidator(context, context.imported_function_count)
+	{
+
+	}
+
+	/// Validate bodies starting with that of function 'first_function' in
+	/// the function index space, for bodies that are validated one at a
+	/// time (see 'lazy_module').
+	FunctionValidator(const ValidationContext& context, std::size_t first_function):
+		context_(context),
+		next_function_(first_function)
+	{
+		assert(first_function >= context.imported_function_count);
+	}
+
+	/// @name Function Bodies
+	/// @{
+
+	/// Most locals a function body may declare, not counting its parameters.
+	static constexpr const std::uint32_t max_locals = 50000u;
+
+	/// Check the number of locals a body declares.  The counts are read from
+	/// the input, so this is done before the locals are allocated, whether or
+	/// not the body is validated.
+	static void check_local_count(std::uint64_t count)
+	{
+		if(count > max_locals)
+		{
+			throw InvalidCodeError(detail::validation_message(
+				"Function body declares ", count, " locals; at most ", max_locals, " are allowed."
+			));
+		}
+	}
+
+	/// Start validating the next function body in the code section.
+	void begin_function(std::basic_string_view<LanguageType> locals)
+	{
+		if(next_function_ >= context_.functions.size())
+			throw InvalidModuleError("Code section contains more function bodies than the function section.");
+		const auto& sig = context_.types[context_.functions[next_function_++]];
+		locals_.assign(sig.param_types);
+		locals_.append(locals.data(), locals.size());
+		operands_.clear();
+		controls_.clear();
+		max_height_ = 0;
+		push_ctrl(OpCode::BLOCK, types_view(), sig.return_types);
+	}
+
+	/// Validate the function's final END.
+	void end_function()
+	{
+		on_end();
+		if(not controls_.empty())
+			throw InvalidCodeError("Function body ends inside of a block.");
+	}
+
+	/// @} Function Bodies
+
+	/// @name Structured Control Flow
+	/// @{
+
+	/// 'block_tp' is the lowered block type: a single result type
+	/// ('LanguageType::block' for none), or 'LanguageType::func' followed by
+	/// a native-format type index for blocks with parameters or several results.
+	void begin_block(OpCode op, std::string_view block_tp)
+	{
+		assert(op == OpCode::BLOCK or op == OpCode::LOOP or op == OpCode::IF);
+		assert(not block_tp.empty());
+		types_view params;
+		types_view results;
+		auto tp = static_cast<LanguageType>(block_tp.front());
+		if(tp == LanguageType::func)
+		{
+			auto index = detail::read_lowered<std::uint32_t>(block_tp, 1u);
+			if(index >= context_.types.size())
+				throw InvalidCodeError(detail::validation_message("Block type index ", index, " out of range."));
+			const auto& sig = context_.types[index];
+			params = sig.param_types;
+			results = sig.return_types;
+		}
+		else if(tp != LanguageType::block)
+		{
+			results = single_result(tp);
+		}
+		if(op == OpCode::IF)
+			pop_operand(LanguageType::i32);
+		pop_operands(params);
+		push_ctrl(op, params, results);
+		push_operands(params);
+	}
+
+	void on_else()
+	{
+		if(controls_.empty() or controls_.back().opcode != OpCode::IF)
+			throw InvalidCodeError("ELSE does not match an IF.");
+		auto frame = pop_ctrl();
+		push_ctrl(OpCode::ELSE, frame.params, frame.results);
+		push_operands(frame.params);
+	}
+
+	void on_end()
+	{
+		auto frame = pop_ctrl();
+		// without an ELSE, the IF's parameters fall through as its results
+		if(frame.opcode == OpCode::IF and frame.params != frame.results)
+			throw InvalidCodeError("IF whose results differ from its parameters has no ELSE.");
+		push_operands(frame.results);
+	}
+
+	/// @} Structured Control Flow
+
+	/// Validate a single lowered instruction other than BLOCK, LOOP, IF, ELSE
+	/// or END.  'instr' is the opcode followed by its native-format immediates.
+	void validate(std::string_view instr)
+	{
+		using detail::read_lowered;
+		assert(not instr.empty());
+		auto op = static_cast<OpCode>(static_cast<unsigned char>(instr.front()));
+		if(auto sig = detail::numeric_signature(op); sig)
+		{
+			for(std::size_t i = sig->param_count; i > 0u; --i)
+				pop_operand(sig->params[i - 1u]);
+			push_operand(sig->result);
+			return;
+		}
+		if(auto sig = detail::memory_access_signature(op); sig)
+		{
+			require_memory();
+			auto align = read_lowered<std::uint32_t>(instr, 1u);
+			if(align > sig->max_align)
+			{
+				throw InvalidCodeError(detail::validation_message(
+					"Alignment 2**", align, " of '", op, "' exceeds natural alignment 2**", sig->max_align, '.'
+				));
+			}
+			if(sig->is_store)
+			{
+				pop_operand(sig->type);
+				pop_operand(LanguageType::i32);
+			}
+			else
+			{
+				pop_operand(LanguageType::i32);
+				push_operand(sig->type);
+			}
+			return;
+		}
+		switch(op)
+		{
+		case OpCode::UNREACHABLE:
+			set_unreachable();
+			break;
+		case OpCode::NOP:
+			break;
+		case OpCode::BR: {
+			const auto& frame = label_at(read_lowered<std::uint32_t>(instr, 1u));
+			pop_label_operands(frame);
+			set_unreachable();
+			break;
+		}
+		case OpCode::BR_IF: {
+			pop_operand(LanguageType::i32);
+			const auto& frame = label_at(read_lowered<std::uint32_t>(instr, 1u));
+			pop_label_operands(frame);
+			push_operands(label_types(frame));
+			break;
+		}
+		case OpCode::BR_TABLE: {
+			pop_operand(LanguageType::i32);
+			auto count = read_lowered<std::uint32_t>(instr, 1u);
+			auto depth_at = [&](std::size_t i) {
+				return read_lowered<std::uint32_t>(instr, 1u + sizeof(std::uint32_t) * (i + 1u));
+			};
+			const auto& default_frame = label_at(depth_at(count));
+			auto default_types = label_types(default_frame);
+			for(std::uint32_t i = 0; i < count; ++i)
+			{
+				if(label_types(label_at(depth_at(i))) != default_types)
+					throw InvalidCodeError("BR_TABLE targets have inconsistent label types.");
+			}
+			pop_label_operands(default_frame);
+			set_unreachable();
+			break;
+		}
+		case OpCode::RETURN:
+			assert(not controls_.empty());
+			pop_label_operands(controls_.front());
+			set_unreachable();
+			break;
+		case OpCode::CALL: [[fallthrough]];
+		case OpCode::RETURN_CALL: {
+			auto index = read_lowered<std::uint32_t>(instr, 1u);
+			if(index >= context_.functions.size())
+				throw InvalidCodeError(detail::validation_message(op, " to out-of-range function ", index, '.'));
+			const auto& sig = context_.types[context_.functions[index]];
+			if(op == OpCode::CALL)
+				apply_signature(sig);
+			else
+				apply_tail_call(sig);
+			break;
+		}
+		case OpCode::CALL_INDIRECT: [[fallthrough]];
+		case OpCode::RETURN_CALL_INDIRECT: {
+			auto index = read_lowered<std::uint32_t>(instr, 1u);
+			if(context_.table_count == 0u)
+				throw InvalidCodeError(detail::validation_message(op, " in a module without a table."));
+			if(index >= context_.types.size())
+				throw InvalidCodeError(detail::validation_message(op, " with out-of-range type index ", index, '.'));
+			pop_operand(LanguageType::i32);
+			const auto& sig = context_.types[index];
+			if(op == OpCode::CALL_INDIRECT)
+				apply_signature(sig);
+			else
+				apply_tail_call(sig);
+			break;
+		}
+		case OpCode::DROP:
+			pop_operand();
+			break;
+		case OpCode::SELECT: {
+			pop_operand(LanguageType::i32);
+			auto tp = pop_operand();
+			push_operand(pop_operand(tp));
+			break;
+		}
+		case OpCode::GET_LOCAL:
+			push_operand(local_at(read_lowered<std::uint32_t>(instr, 1u)));
+			break;
+		case OpCode::SET_LOCAL:
+			pop_operand(local_at(read_lowered<std::uint32_t>(instr, 1u)));
+			break;
+		case OpCode::TEE_LOCAL: {
+			auto tp = local_at(read_lowered<std::uint32_t>(instr, 1u));
+			pop_operand(tp);
+			push_operand(tp);
+			break;
+		}
+		case OpCode::GET_GLOBAL:
+			push_operand(global_at(read_lowered<std::uint32_t>(instr, 1u)).type);
+			break;
+		case OpCode::SET_GLOBAL: {
+			auto index = read_lowered<std::uint32_t>(instr, 1u);
+			const auto& glob = global_at(index);
+			if(glob.is_const)
+				throw InvalidCodeError(detail::validation_message("SET_GLOBAL of immutable global ", index, '.'));
+			pop_operand(glob.type);
+			break;
+		}
+		case OpCode::CURRENT_MEMORY:
+			require_memory();
+			push_operand(LanguageType::i32);
+			break;
+		case OpCode::GROW_MEMORY:
+			require_memory();
+			pop_operand(LanguageType::i32);
+			push_operand(LanguageType::i32);
+			break;
+		case OpCode::I32_CONST:
+			push_operand(LanguageType::i32);
+			break;
+		case OpCode::I64_CONST:
+			push_operand(LanguageType::i64);
+			break;
+		case OpCode::F32_CONST:
+			push_operand(LanguageType::f32);
+			break;
+		case OpCode::F64_CONST:
+			push_operand(LanguageType::f64);
+			break;
+		default:
+			throw InvalidCodeError(detail::validation_message(
+				"Unexpected opcode 0x", std::hex, static_cast<unsigned>(op), '.'
+			));
+		}
+	}
+
+	/// Maximum operand stack height reached by the current function.
+	std::size_t max_stack_height() const
+	{ return max_height_; }
+
+private:
+
+	void push_operand(operand_type tp)
+	{
+		operands_.push_back(tp);
+		if(operands_.size() > max_height_)
+			max_height_ = operands_.size();
+	}
+
+	operand_type pop_operand()
+	{
+		assert(not controls_.empty());
+		const auto& frame = controls_.back();
+		if(operands_.size() == frame.height)
+		{
+			if(frame.unreachable)
+				return std::nullopt;
+			throw InvalidCodeError("Operand stack underflow.");
+		}
+		auto tp = operands_.back();
+		operands_.pop_back();
+		return tp;
+	}
+
+	operand_type pop_operand(operand_type expect)
+	{
+		auto actual = pop_operand();
+		if(not actual)
+			return expect;
+		if(not expect)
+			return actual;
+		if(*actual != *expect)
+		{
+			throw InvalidCodeError(detail::validation_message(
+				"Type mismatch: expected ", *expect, " but found ", *actual, '.'
+			));
+		}
+		return actual;
+	}
+
+	void push_operands(types_view types)
+	{
+		for(LanguageType tp: types)
+			push_operand(tp);
+	}
+
+	void pop_operands(types_view types)
+	{
+		for(auto pos = types.rbegin(); pos != types.rend(); ++pos)
+			pop_operand(*pos);
+	}
+
+	/// A one-element view of 'tp' with static storage duration.
+	static types_view single_result(LanguageType tp)
+	{
+		static constexpr const LanguageType value_types[] = {
+			LanguageType::i32, LanguageType::i64, LanguageType::f32, LanguageType::f64
+		};
+		for(const auto& value_tp: value_types)
+		{
+			if(value_tp == tp)
+				return types_view(&value_tp, 1u);
+		}
+		throw InvalidCodeError(detail::validation_message("Invalid block result type ", tp, '.'));
+	}
+
+	void push_ctrl(OpCode op, types_view params, types_view results)
+	{ controls_.push_back(ControlFrame{op, params, results, operands_.size(), false}); }
+
+	ControlFrame pop_ctrl()
+	{
+		if(controls_.empty())
+			throw InvalidCodeError("END does not match a block.");
+		auto frame = controls_.back();
+		pop_operands(frame.results);
+		if(operands_.size() != frame.height)
+			throw InvalidCodeError("Operand stack is not empty at the end of a block.");
+		controls_.pop_back();
+		return frame;
+	}
+
+	static types_view label_types(const ControlFrame& frame)
+	{
+		// branching to a loop jumps back to its start, which takes the loop's parameters
+		if(frame.opcode == OpCode::LOOP)
+			return frame.params;
+		return frame.results;
+	}
+
+	void pop_label_operands(const ControlFrame& frame)
+	{ pop_operands(label_types(frame)); }
+
+	const ControlFrame& label_at(std::uint32_t depth) const
+	{
+		if(depth >= controls_.size())
+		{
+			throw InvalidCodeError(detail::validation_message(
+				"Branch depth ", depth, " exceeds block nesting depth ", controls_.size(), '.'
+			));
+		}
+		return controls_[controls_.size() - 1u - depth];
+	}
+
+	void set_unreachable()
+	{
+		assert(not controls_.empty());
+		operands_.resize(controls_.back().height);
+		controls_.back().unreachable = true;
+	}
+
+	void apply_signature(const FunctionSignature& sig)
+	{
+		pop_operands(sig.param_types);
+		push_operands(sig.return_types);
+	}
+
+	/// A tail call returns the callee's results from the current function.
+	void apply_tail_call(const FunctionSignature& sig)
+	{
+		assert(not controls_.empty());
+		if(types_view(sig.return_types) != controls_.front().results)
+			throw InvalidCodeError("Tail call to a function whose results differ from the caller's.");
+		pop_operands(sig.param_types);
+		set_unreachable();
+	}
+
+	LanguageType local_at(std::uint32_t index) const
+	{
+		if(index >= locals_.size())
+		{
+			throw InvalidCodeError(detail::validation_message(
+				"Local index ", index, " out of range (", locals_.size(), " locals)."
+			));
+		}
+		return locals_[index];
+	}
+
+	const GlobalInfo& global_at(std::uint32_t index) const
+	{
+		if(index >= context_.globals.size())
+		{
+			throw InvalidCodeError(detail::validation_message(
+				"Global index ", index, " out of range (", context_.globals.size(), " globals)."
+			));
+		}
+		return context_.globals[index];
+	}
+
+	void require_memory() const
+	{
+		if(context_.memory_count == 0u)
+			throw InvalidCodeError("Memory instruction in a module without a memory.");
+	}
+
+	const ValidationContext& context_;
+	std::size_t next_function_;
+	std::basic_string<LanguageType> locals_;
+	std::vector<operand_type> operands_;
+	std::vector<ControlFrame> controls_;
+	std::size_t max_height_ = 0;
+};
+
+} /* namespace wasm::parse */
+
+#endif /* BINPARSE_VALIDATOR_H */
@@ -0,0 +1,232 @@
+#include <cassert>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include "x3binparse.h"
+
+namespace x3 = boost::spirit::x3;
+
+/*
+ * Feeds hand-assembled modules to 'validated_module': one valid module, and
+ * one module per validation rule that breaks only that rule.  Each invalid
+ * module must be rejected with an expectation failure.
+ */
+
+using iterator_type = std::string::const_iterator;
+
+constexpr const char i32 = 0x7f;
+constexpr const char i64 = 0x7e;
+
+std::string leb128_encode_u(std::uintmax_t value)
+{
+	std::string encoding;
+	do {
+		unsigned char byte = static_cast<unsigned char>(value & 0b0111'1111u);
+		value >>= 7;
+		if(value > 0u)
+			byte |= 0b1000'0000u;
+		encoding.push_back(byte);
+	} while(value > 0u);
+	return encoding;
+}
+
+/// A vector of already encoded 'items'.
+std::string vec(std::initializer_list<std::string> items)
+{
+	std::string encoding = leb128_encode_u(items.size());
+	for(const auto& item: items)
+		encoding += item;
+	return encoding;
+}
+
+std::string name(const std::string& str)
+{ return leb128_encode_u(str.size()) + str; }
+
+std::string bytes(std::initializer_list<int> values)
+{
+	std::string encoding;
+	for(int value: values)
+		encoding.push_back(static_cast<char>(value));
+	return encoding;
+}
+
+std::string section(int id, const std::string& contents)
+{ return bytes({id}) + leb128_encode_u(contents.size()) + contents; }
+
+std::string module(std::initializer_list<std::string> sections)
+{
+	std::string encoding = bytes({0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00});
+	for(const auto& sec: sections)
+		encoding += sec;
+	return encoding;
+}
+
+std::string func_type(const std::string& params, const std::string& results)
+{ return bytes({0x60}) + leb128_encode_u(params.size()) + params + leb128_encode_u(results.size()) + results; }
+
+/// A function body with the encoded local entries 'locals'.
+std::string body(const std::string& code, std::initializer_list<std::string> locals = {})
+{
+	std::string contents = vec(locals) + code;
+	return leb128_encode_u(contents.size()) + contents;
+}
+
+/// A local entry of 'count' locals of type 'type'.
+std::string local_entry(std::uint32_t count, char type)
+{ return leb128_encode_u(count) + std::string(1, type); }
+
+/// Types 0: [] -> [], 1: [] -> [i32] and 2: [i32] -> [].
+const std::string types = section(1, vec({
+	func_type("", ""), func_type("", std::string(1, i32)), func_type(std::string(1, i32), "")
+}));
+
+/// One function of type 'type' with body 'code', which may use a memory and
+/// an immutable global 0 of type i32.
+std::string module_with_code(std::uint32_t type, const std::string& code)
+{
+	return module({
+		types,
+		section(3, vec({leb128_encode_u(type)})),
+		section(5, vec({bytes({0x00, 0x01})})),
+		section(6, vec({bytes({i32, 0x00, 0x41, 0x00, 0x0b})})),
+		section(10, vec({body(code)}))
+	});
+}
+
+bool validates(const std::string& contents)
+{
+	wasm::parse::ModuleDef def;
+	iterator_type first = contents.begin();
+	bool matched = x3::parse(first, contents.end(), wasm::parse::validated_module, def);
+	return matched and first == contents.end();
+}
+
+void expect_valid(const char* what, const std::string& contents)
+{
+	try
+	{
+		assert(validates(contents));
+	}
+	catch(const x3::expectation_failure<iterator_type>& e)
+	{
+		std::cerr << what << ": unexpectedly rejected: " << e.which() << std::endl;
+		assert(false);
+	}
+	std::cout << what << ": accepted" << std::endl;
+}
+
+void expect_invalid(const char* what, const std::string& contents)
+{
+	bool rejected = false;
+	try
+	{
+		validates(contents);
+	}
+	catch(const x3::expectation_failure<iterator_type>& e)
+	{
+		std::cout << what << ": rejected at offset " << (e.where() - contents.begin())
+			<< ": " << e.which() << std::endl;
+		rejected = true;
+	}
+	if(not rejected)
+		std::cerr << what << ": unexpectedly accepted" << std::endl;
+	assert(rejected);
+}
+
+int main()
+{
+	// i32.const 1, i32.const 2, i32.add, end
+	const std::string add_code = bytes({0x41, 0x01, 0x41, 0x02, 0x6a, 0x0b});
+	expect_valid("valid module", module_with_code(1, add_code));
+	expect_valid("empty module", module({}));
+
+	// module structure
+	expect_invalid("function type index out of range", module({
+		types, section(3, vec({leb128_encode_u(3)})), section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("fewer bodies than functions", module({
+		types, section(3, vec({leb128_encode_u(0), leb128_encode_u(0)})), section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("more bodies than functions", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(10, vec({body(bytes({0x0b})), body(bytes({0x0b}))}))
+	}));
+	expect_invalid("multiple memories", module({
+		section(5, vec({bytes({0x00, 0x01}), bytes({0x00, 0x01})}))
+	}));
+	expect_invalid("memory limits out of range", module({
+		section(5, vec({bytes({0x00}) + leb128_encode_u(65537)}))
+	}));
+	expect_invalid("memory maximum below initial size", module({
+		section(5, vec({bytes({0x01, 0x02, 0x01})}))
+	}));
+	expect_invalid("multiple tables", module({
+		section(4, vec({bytes({0x70, 0x00, 0x01}), bytes({0x70, 0x00, 0x01})}))
+	}));
+	expect_invalid("mutable global import", module({
+		section(2, vec({name("env") + name("g") + bytes({0x03, i32, 0x01})}))
+	}));
+	expect_invalid("duplicate export name", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(7, vec({name("f") + bytes({0x00, 0x00}), name("f") + bytes({0x00, 0x00})})),
+		section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("export index out of range", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(7, vec({name("f") + bytes({0x00, 0x01})})),
+		section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("start function with parameters", module({
+		types, section(3, vec({leb128_encode_u(2)})),
+		section(8, leb128_encode_u(0)),
+		section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("element segment without a table", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(9, vec({bytes({0x00, 0x41, 0x00, 0x0b}) + vec({leb128_encode_u(0)})})),
+		section(10, vec({body(bytes({0x0b}))}))
+	}));
+	expect_invalid("data segment without a memory", module({
+		section(11, vec({bytes({0x00, 0x41, 0x00, 0x0b}) + name("x")}))
+	}));
+
+	// function bodies
+	expect_invalid("operand type mismatch", module_with_code(1,
+		bytes({0x41, 0x01, 0x42, 0x02, 0x6a, 0x0b})
+	));
+	expect_invalid("operand stack underflow", module_with_code(1, bytes({0x6a, 0x0b})));
+	expect_invalid("missing result", module_with_code(1, bytes({0x0b})));
+	expect_invalid("wrong result type", module_with_code(1, bytes({0x42, 0x00, 0x0b})));
+	expect_invalid("operands left at end", module_with_code(0, bytes({0x41, 0x00, 0x0b})));
+	expect_invalid("local index out of range", module_with_code(2, bytes({0x20, 0x01, 0x1a, 0x0b})));
+	expect_invalid("branch depth out of range", module_with_code(0, bytes({0x0c, 0x01, 0x0b})));
+	expect_invalid("call to out-of-range function", module_with_code(0, bytes({0x10, 0x01, 0x0b})));
+	expect_invalid("call_indirect without a table", module_with_code(0,
+		bytes({0x41, 0x00, 0x11, 0x00, 0x00, 0x0b})
+	));
+	expect_invalid("set of immutable global", module_with_code(0, bytes({0x41, 0x00, 0x24, 0x00, 0x0b})));
+	expect_invalid("memory access without a memory", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(10, vec({body(bytes({0x41, 0x00, 0x28, 0x02, 0x00, 0x1a, 0x0b}))}))
+	}));
+	expect_invalid("alignment larger than natural", module_with_code(0,
+		bytes({0x41, 0x00, 0x28, 0x03, 0x00, 0x1a, 0x0b})
+	));
+	expect_valid("most locals allowed", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(10, vec({body(bytes({0x0b}), {local_entry(49999, i32), local_entry(1, i64)})}))
+	}));
+	expect_invalid("too many locals", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(10, vec({body(bytes({0x0b}), {local_entry(50000, i32), local_entry(1, i64)})}))
+	}));
+	expect_invalid("local count overflowing 32 bits", module({
+		types, section(3, vec({leb128_encode_u(0)})),
+		section(10, vec({body(bytes({0x0b}), {local_entry(0xffffffffu, i32), local_entry(2, i32)})}))
+	}));
+	expect_invalid("if without else with results", module_with_code(1,
+		bytes({0x41, 0x00, 0x04, i32, 0x41, 0x01, 0x0b, 0x0b})
+	));
+	std::cout << "validator: all tests passed" << std::endl;
+	return 0;
+}
@@ -5,12 +5,16 @@
 #include <cstdio>
 #include <type_traits>
 #include <cstddef>
+#include <limits>
 #include <iterator>
 #include <tuple>
 #include <string>
+#include <memory>
+#include <algorithm>
 #include <utility>
 #include <optional>
 #include <variant>
+#include <vector>
 #include <stdexcept>
 #include <cassert>
 #include <boost/spirit/home/x3.hpp>
@@ -19,6 +23,7 @@
 #include "binparse/types.h"
 #include "binparse/rules.h"
 #include "binparse/rule_defs.h"
+#include "binparse/validator.h"
 
 
 namespace wasm::parse {
@@ -114,6 +119,220 @@ namespace codeparse {
 
 using opc::OpCode;
 
+/// Context tag for the 'FunctionValidator' that checks code as it is lowered.
+/// Parsing code without one in the context lowers it without validation.
+struct validator_tag;
+
+/// Context tag for the 'std::uint32_t' counter that numbers the 'CALL_INDIRECT'
+/// sites of the function body being lowered.
+struct call_site_tag;
+
+/// Context tag for the 'FuelCosts' to meter lowered code with.  Parsing code
+/// without one in the context lowers it unmetered.
+struct fuel_costs_tag;
+
+/// Context tag for the 'FuelLowering' of the function body being lowered.
+struct fuel_lowering_tag;
+
+/// Inserts the 'FUEL' instructions of one function body as it is lowered.
+/// Every code sequence (a function body, a block or loop body, an arm of an
+/// IF) gets a scope on 'open_', holding the basic block that the next
+/// instruction of the sequence joins.  The first instruction of a basic
+/// block prepends a 'FUEL' to it, and every instruction adds its cost to
+/// that 'FUEL''s immediate.  A basic block ends after a branch, return or
+/// trap, and after a structured instruction, whose END is a merge point.
+struct FuelLowering {
+
+	explicit FuelLowering(const FuelCosts* costs):
+		costs_(costs)
+	{
+		
+	}
+
+	bool metered() const
+	{ return static_cast<bool>(costs_); }
+
+	void begin_sequence()
+	{ open_.push_back(OpenBlock{no_block, 0u}); }
+
+	void end_sequence()
+	{
+		assert(not open_.empty());
+		open_.pop_back();
+	}
+
+	/// Charge 'op' to the open basic block of the innermost sequence, whose
+	/// lowered code so far is 'code'.  Must be called before the
+	/// instruction is appended to 'code'.
+	void charge(OpCode op, std::string& code)
+	{
+		assert(metered());
+		assert(not open_.empty());
+		auto& block = open_.back();
+		if(block.immed_pos == no_block)
+		{
+			code.push_back(static_cast<char>(OpCode::FUEL));
+			block.immed_pos = code.size();
+			block.cost = 0u;
+			code.append(sizeof(wasm_uint32_t), '\0');
+		}
+		block.cost += (*costs_)[op];
+		// a block costing more than fits is charged the most that does.
+		auto cost = static_cast<wasm_uint32_t>(
+			std::min<std::uint64_t>(block.cost, std::numeric_limits<wasm_uint32_t>::max())
+		);
+		std::memcpy(code.data() + block.immed_pos, &cost, sizeof(cost));
+		if(ends_block(op))
+			block.immed_pos = no_block;
+	}
+
+private:
+	static constexpr const std::size_t no_block = std::numeric_limits<std::size_t>::max();
+
+	static bool ends_block(OpCode op)
+	{
+		switch(op)
+		{
+		case OpCode::BLOCK:                [[fallthrough]];
+		case OpCode::LOOP:                 [[fallthrough]];
+		case OpCode::IF:                   [[fallthrough]];
+		case OpCode::BR:                   [[fallthrough]];
+		case OpCode::BR_IF:                [[fallthrough]];
+		case OpCode::BR_TABLE:             [[fallthrough]];
+		case OpCode::RETURN:               [[fallthrough]];
+		case OpCode::RETURN_CALL:          [[fallthrough]];
+		case OpCode::RETURN_CALL_INDIRECT: [[fallthrough]];
+		case OpCode::UNREACHABLE:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	struct OpenBlock {
+		/// Position of the block's 'FUEL' immediate, or 'no_block'.
+		std::size_t immed_pos;
+		std::uint64_t cost;
+	};
+
+	const FuelCosts* const costs_;
+	std::vector<OpenBlock> open_;
+};
+
+namespace detail {
+
+template <class Context>
+FunctionValidator* get_validator(const Context& ctx)
+{
+	auto&& v = x3::get<validator_tag>(ctx);
+	if constexpr(std::is_same_v<std::decay_t<decltype(v)>, x3::unused_type>)
+		return nullptr;
+	else
+		return &static_cast<FunctionValidator&>(v);
+}
+
+template <class Context>
+const FuelCosts* get_fuel_costs(const Context& ctx)
+{
+	auto&& c = x3::get<fuel_costs_tag>(ctx);
+	if constexpr(std::is_same_v<std::decay_t<decltype(c)>, x3::unused_type>)
+		return nullptr;
+	else
+		return &static_cast<const FuelCosts&>(c);
+}
+
+/// The context's 'FuelLowering', if the code being lowered is metered.
+template <class Context>
+FuelLowering* get_fuel_lowering(const Context& ctx)
+{
+	auto&& f = x3::get<fuel_lowering_tag>(ctx);
+	if constexpr(std::is_same_v<std::decay_t<decltype(f)>, x3::unused_type>)
+		return nullptr;
+	else
+	{
+		FuelLowering& fuel = f;
+		return fuel.metered() ? &fuel : nullptr;
+	}
+}
+
+/// Invoke 'func' with the context's validator (if any), reporting validation
+/// failures as expectation failures at the offending instruction.
+template <class Context, class Func>
+void run_validator(const Context& ctx, Func&& func)
+{
+	if(auto* validator = get_validator(ctx); validator)
+	{
+		try
+		{
+			std::forward<Func>(func)(*validator);
+		}
+		catch(const InvalidCodeError& err)
+		{
+			auto pos = x3::_where(ctx).begin();
+			throw expectation_failure<std::decay_t<decltype(pos)>>(pos, err.what());
+		}
+	}
+}
+
+} /* namespace detail */
+
+/// Validate a lowered (non-structured) instruction.
+inline const auto validate_instr = [](auto& ctx) {
+	const auto& instr = x3::_attr(ctx);
+	detail::run_validator(ctx, [&](FunctionValidator& v) {
+		if constexpr(std::is_same_v<std::decay_t<decltype(instr)>, char>)
+			v.validate(std::string_view(&instr, 1u));
+		else
+			v.validate(std::string_view(instr));
+	});
+};
+
+/// Validate a BLOCK, LOOP or IF header.  Must run right after the header has
+/// been appended to the (otherwise empty) synthesized attribute.
+inline const auto validate_block_begin = [](auto& ctx) {
+	const auto& str = x3::_val(ctx);
+	assert(str.size() >= 2u);
+	detail::run_validator(ctx, [&](FunctionValidator& v) {
+		v.begin_block(
+			static_cast<OpCode>(static_cast<unsigned char>(str[0])),
+			std::string_view(str).substr(1u)
+		);
+	});
+};
+
+/// Charge a lowered instruction to its basic block (see 'FuelLowering').
+/// Must run right before the instruction is appended to the synthesized attribute.
+inline const auto meter_instr = [](auto& ctx) {
+	if(auto* fuel = detail::get_fuel_lowering(ctx); fuel)
+	{
+		const auto& instr = x3::_attr(ctx);
+		char op;
+		if constexpr(std::is_same_v<std::decay_t<decltype(instr)>, char>)
+			op = instr;
+		else
+			op = instr.front();
+		fuel->charge(static_cast<OpCode>(static_cast<unsigned char>(op)), x3::_val(ctx));
+	}
+};
+
+inline const auto begin_fuel_sequence = [](auto& ctx) {
+	if(auto* fuel = detail::get_fuel_lowering(ctx); fuel)
+		fuel->begin_sequence();
+};
+
+inline const auto end_fuel_sequence = [](auto& ctx) {
+	if(auto* fuel = detail::get_fuel_lowering(ctx); fuel)
+		fuel->end_sequence();
+};
+
+inline const auto validate_else = [](auto& ctx) {
+	detail::run_validator(ctx, [](FunctionValidator& v) { v.on_else(); });
+};
+
+inline const auto validate_end = [](auto& ctx) {
+	detail::run_validator(ctx, [](FunctionValidator& v) { v.on_end(); });
+};
+
 inline const auto append_opcode = [](auto& ctx) {
 	unsigned char op = static_cast<unsigned char>(x3::_attr(ctx));
 	assert(opc::opcode_exists(op));
@@ -135,6 +354,16 @@ inline const auto append_code = [](auto& ctx) {
 	outer_code += std::move(inner_code);
 };
 
+/// Append the next call site number (the site's inline cache slot).
+inline const auto append_call_site = [](auto& ctx) {
+	std::uint32_t& count = x3::get<call_site_tag>(ctx);
+	auto& str = x3::_val(ctx);
+	auto oldsz = str.size();
+	str.resize(oldsz + sizeof(count));
+	std::memcpy(str.data() + oldsz, &count, sizeof(count));
+	++count;
+};
+
 template <OpCode Op>
 inline const auto parse_opcode
 	= match_value(x3::byte_, static_cast<unsigned char>(Op), static_cast<char>(Op));
@@ -153,6 +382,9 @@ inline const auto memory_immed
 	= x3::rule<struct memory_immed_tag, std::string>{}
 	= varuint32_to_native[append_code] >> varuint32_to_native[append_code];
 
+/// A block type is lowered to its single result type ('LanguageType::block'
+/// for none), or, for multi-value blocks, to 'LanguageType::func' followed by
+/// the type index.  See 'block_type_size()'.
 inline const auto block_immed
 	= x3::rule<struct block_immed_tag, std::string>{}
 	= block_type[(
@@ -160,7 +392,30 @@ inline const auto block_immed
 			char c = static_cast<char>(x3::_attr(ctx));
 			x3::_val(ctx).push_back(c);
 		}
+	)]
+	| varint64[(
+		// type indices are encoded as non-negative 33-bit signed integers
+		[](auto& ctx) {
+			std::int64_t index = x3::_attr(ctx);
+			x3::_pass(ctx) = (index >= 0 and index <= std::numeric_limits<std::uint32_t>::max());
+			if(not x3::_pass(ctx))
+				return;
+			auto native = static_cast<std::uint32_t>(index);
+			auto& str = x3::_val(ctx);
+			str.push_back(static_cast<char>(LanguageType::func));
+			auto oldsz = str.size();
+			str.resize(oldsz + sizeof(native));
+			std::memcpy(str.data() + oldsz, &native, sizeof(native));
+		}
 	)];
+
+/// Size of the lowered block type at the start of 'immed'.
+inline std::size_t block_type_size(const char* immed)
+{
+	if(static_cast<LanguageType>(*immed) == LanguageType::func)
+		return 1u + sizeof(std::uint32_t);
+	return 1u;
+}
 	
 inline const auto reserved = x3::omit[varuint1];
 
@@ -174,7 +429,7 @@ inline const auto branch_table_immed
 			auto& str = x3::_val(ctx);
 			auto& vec = x3::_attr(ctx);
 			auto old_sz = str.size();
-			str.resize(vec.size() + 1);
+			str.resize(old_sz + sizeof(std::uint32_t) * (vec.size() + 1u));
 			std::uint32_t table_sz = vec.size() - 1u;
 			assert(table_sz == (vec.size() - 1u)); // no truncation
 			auto pos = str.data() + old_sz;
@@ -196,11 +451,18 @@ inline const auto br_table_opcode
 
 inline const auto call_opcode
 	= x3::rule<struct call_opcode_tag, std::string>("call_opcode")
-	= (parse_opcode<OpCode::CALL>[append_opcode] > index_immed[append_code]);
+	= (parse_opcode<OpCode::CALL>[append_opcode] | parse_opcode<OpCode::RETURN_CALL>[append_opcode])
+	> index_immed[append_code];
 
+// tail calls get inline cache slots too; they are numbered with the other call sites.
 inline const auto call_indirect_opcode 
 	= x3::rule<struct call_indirect_opcode_tag, std::string>("call_indirect_opcode")
-	= (parse_opcode<OpCode::CALL>[append_opcode] > index_immed[append_code]) > reserved;
+	= (
+		(parse_opcode<OpCode::CALL_INDIRECT>[append_opcode] | parse_opcode<OpCode::RETURN_CALL_INDIRECT>[append_opcode])
+		> index_immed[append_code]
+		> reserved
+	)
+	> x3::eps[append_call_site];
 
 inline const auto variable_access_opcode
 	= x3::rule<struct variable_access_opcode_tag, std::string>("variable_access_opcode")
@@ -219,7 +481,7 @@ inline const auto memory_access_opcode
 	= x3::byte_[(
 		[](auto& ctx) {
 			auto opcd = static_cast<unsigned>(x3::_attr(ctx));
-			x3::_pass(ctx) = (opcd >= 0x28u and opcd < 0x3Eu);
+			x3::_pass(ctx) = (opcd >= 0x28u and opcd <= 0x3Eu);
 		}
 	)][append_opcode]
 	> memory_immed[append_code];
@@ -251,18 +513,16 @@ inline const auto normal_opcode
 			return;
 		}
 		OpCode op = static_cast<OpCode>(x3::_attr(ctx));
+		// 'FUEL' is internal to lowered code.
 		x3::_pass(ctx) = (
 			(op != OpCode::ELSE)
 			and (op != OpCode::END)
+			and (op != OpCode::FUEL)
 		);
 		x3::_val(ctx) = static_cast<char>(op);
 	}
 )];
 
-inline const auto loop_opcode
-	= x3::rule<struct loop_opcode_tag, std::string>("loop_opcode")
-	= parse_opcode<OpCode::LOOP>[append_opcode] > block_immed[append_code];
-
 inline const auto code
 	= x3::rule<struct code_tag, std::string>("code");
 
@@ -273,12 +533,16 @@ inline constexpr const std::size_t label_size = sizeof(wasm_uint32_t);
 inline const auto unbound_label
 	= x3::attr(std::string(label_size, 0));
 
+/// Position of the first label of the lowered BLOCK or IF 'str'.
+inline char* label_position(std::string& str)
+{ return str.data() + 1u + block_type_size(str.data() + 1u); }
+
 inline const auto bind_block_label = [](auto& ctx) {
 	auto& str = x3::_val(ctx);
 	assert(str.front() == static_cast<char>(OpCode::BLOCK));
 	assert(str.back() == static_cast<char>(OpCode::END));
 	assert(str.size() >= 2u + label_size);
-	auto label_pos = str.data() + 2;
+	auto label_pos = label_position(str);
 	assert(std::all_of(label_pos, label_pos + label_size, [](char c){ return c == 0; }));
 	std::uint32_t jumpdist = str.size() - 1u;
 	assert(jumpdist == (str.size() - 1u)); // no truncation
@@ -289,7 +553,7 @@ inline const auto bind_if_else_label = [](auto& ctx) {
 	auto& str = x3::_val(ctx);
 	assert(str.front() == static_cast<char>(OpCode::IF));
 	assert(str.size() >= 3u + 2u * label_size);
-	auto label_pos = str.data() + 2;
+	auto label_pos = label_position(str);
 	assert(std::all_of(label_pos, label_pos + 2u * label_size, [](char c){ return c == 0; }));
 	assert(str.back() == static_cast<char>(OpCode::ELSE));
 	// bind the second label to the opcode after the ELSE
@@ -303,7 +567,7 @@ inline const auto bind_if_end_label = [](auto& ctx) {
 	auto& str = x3::_val(ctx);
 	assert(str.front() == static_cast<char>(OpCode::IF));
 	assert(str.size() >= 3u + 2u * label_size);
-	auto label_pos = str.data() + 2;
+	auto label_pos = label_position(str);
 	assert(std::all_of(label_pos, label_pos + label_size, [](char c){ return c == 0; }));
 	assert(str.back() == static_cast<char>(OpCode::END));
 	// bind the first label to the END opcode
@@ -312,37 +576,53 @@ inline const auto bind_if_end_label = [](auto& ctx) {
 	std::memcpy(label_pos, &jumpdist, sizeof(jumpdist));
 };
 
+// once the opcode of a structured instruction has matched, the rest of it must
+// parse; backtracking would leave the validator's control stack inconsistent.
 inline const auto block_opcode
 	= x3::rule<struct block_opcode_tag, std::string>{"block_opcode"}
-	= (parse_opcode<OpCode::BLOCK>[append_opcode] > block_immed[append_code])
-	>> unbound_label[append_code]
-	>> code[append_code]
-	>> parse_opcode<OpCode::END>[append_opcode][bind_block_label];
+	= parse_opcode<OpCode::BLOCK>[append_opcode]
+	> block_immed[append_code]
+	> x3::eps[validate_block_begin]
+	> unbound_label[append_code]
+	> code[append_code]
+	> parse_opcode<OpCode::END>[append_opcode][bind_block_label][validate_end];
+
+inline const auto loop_opcode
+	= x3::rule<struct loop_opcode_tag, std::string>("loop_opcode")
+	= parse_opcode<OpCode::LOOP>[append_opcode]
+	> block_immed[append_code]
+	> x3::eps[validate_block_begin]
+	> code[append_code]
+	> parse_opcode<OpCode::END>[append_opcode][validate_end];
 
 inline const auto if_opcode
 	= x3::rule<struct if_opcode_tag, std::string>{"if_opcode"}
-	= (parse_opcode<OpCode::IF>[append_opcode] > block_immed[append_code])
-	>> unbound_label[append_code]
-	>> unbound_label[append_code]
-	>> code[append_code]
-	>> (-(parse_opcode<OpCode::ELSE>[append_opcode][bind_if_else_label] >> code[append_code]))
-	>> parse_opcode<OpCode::END>[append_opcode][bind_if_end_label];
+	= parse_opcode<OpCode::IF>[append_opcode]
+	> block_immed[append_code]
+	> x3::eps[validate_block_begin]
+	> unbound_label[append_code]
+	> unbound_label[append_code]
+	> code[append_code]
+	> (-(parse_opcode<OpCode::ELSE>[append_opcode][bind_if_else_label][validate_else] > code[append_code]))
+	> parse_opcode<OpCode::END>[append_opcode][bind_if_end_label][validate_end];
 
 inline const auto code_def =
-	*(
-		  block_opcode[append_code]
-		| if_opcode[append_code]
-		| loop_opcode[append_code]
-		| br_opcode[append_code]
-		| br_table_opcode[append_code]
-		| call_opcode[append_code]
-		| call_indirect_opcode[append_code]
-		| variable_access_opcode[append_code]
-		| memory_access_opcode[append_code]
-		| memory_grow_or_query_opcode[append_code]
-		| const_opcode[append_code]
-		| normal_opcode[append_opcode]
-	);
+	x3::eps[begin_fuel_sequence]
+	>> *(
+		  block_opcode[meter_instr][append_code]
+		| if_opcode[meter_instr][append_code]
+		| loop_opcode[meter_instr][append_code]
+		| br_opcode[validate_instr][meter_instr][append_code]
+		| br_table_opcode[validate_instr][meter_instr][append_code]
+		| call_opcode[validate_instr][meter_instr][append_code]
+		| call_indirect_opcode[validate_instr][meter_instr][append_code]
+		| variable_access_opcode[validate_instr][meter_instr][append_code]
+		| memory_access_opcode[validate_instr][meter_instr][append_code]
+		| memory_grow_or_query_opcode[validate_instr][meter_instr][append_code]
+		| const_opcode[validate_instr][meter_instr][append_code]
+		| normal_opcode[validate_instr][meter_instr][append_opcode]
+	)
+	>> x3::eps[end_fuel_sequence];
 
 BOOST_SPIRIT_DEFINE(code);
 
@@ -368,7 +648,7 @@ struct FunctionBodyParser:
         template <typename It, typename Ctx, typename Other, typename Attr>
         bool parse(It& first_, It last, Ctx&& ctx, Other&& other, Attr& attr) const
 	{
-		auto first = first;
+		auto first = first_;
 		std::string body;
 		if(
 			(not varuint32_prefixed_sequence(x3::char_).parse(first, last, ctx, other, body)) 
@@ -399,14 +679,56 @@ struct FunctionBodyParser:
 				"Function body too short."
 			);
 		}
+		std::uint64_t local_count = 0;
+		for(const auto& entry: local_entries)
+			local_count += entry.count;
+		try
+		{
+			FunctionValidator::check_local_count(local_count);
+		}
+		catch(const InvalidCodeError& err)
+		{
+			throw expectation_failure<It>(first_, err.what());
+		}
+		arena_basic_string<LanguageType> locals;
+		locals.reserve(local_count);
+		for(const auto& entry: local_entries)
+			locals.append(entry.count, entry.type);
+		auto* validator = codeparse::detail::get_validator(ctx);
+		if(validator)
+		{
+			try
+			{
+				validator->begin_function(locals);
+			}
+			catch(const InvalidModuleError& err)
+			{
+				throw expectation_failure<It>(first_, err.what());
+			}
+		}
 		// get rid of the local entries data
 		std::string body_code;
 		body_code.reserve(body.size());
-		if(not codeparse::function_body_code.parse(
-			pos, body.end(), ctx, other, body_code
-		))
+		std::uint32_t call_sites = 0;
+		codeparse::FuelLowering fuel(codeparse::detail::get_fuel_costs(ctx));
+		auto call_site_ctx = x3::make_context<codeparse::call_site_tag>(call_sites, ctx);
+		auto code_ctx = x3::make_context<codeparse::fuel_lowering_tag>(fuel, call_site_ctx);
+		bool code_matched = false;
+		try
+		{
+			code_matched = codeparse::function_body_code.parse(
+				pos, body.end(), code_ctx, other, body_code
+			);
+		}
+		catch(const x3::expectation_failure<std::string::iterator>& err)
 		{
-			return false
+			// 'err' points into the copy of the body; report the position in the input.
+			auto body_first = first - body.size();
+			throw expectation_failure<It>(body_first + (err.where() - body.begin()), err.which());
+		}
+		if(not code_matched)
+		{
+			return false;
 		}
 		else if(pos != body.end())
 		{
@@ -415,12 +737,23 @@ struct FunctionBodyParser:
 				"Function code finished before end of FunctionBody."
 			);
 		}
+		if(validator)
+		{
+			try
+			{
+				validator->end_function();
+			}
+			catch(const InvalidCodeError& err)
+			{
+				throw expectation_failure<It>(first_ + (body.size() - 1), err.what());
+			}
+		}
 		if constexpr(not std::is_same_v<std::decay_t<Attr>, x3::unused_type>)
 		{
 			assert(attr.locals.empty());
-			for(const auto& entry: local_entries)
-				attr.locals.append(entry.count, entry.type);
+			attr.locals = std::move(locals);
 			attr.code = std::move(body_code);
+			attr.call_sites = call_sites;
 		}
 		first_ = first;
 		return true;
@@ -430,32 +763,68 @@ struct FunctionBodyParser:
 
 inline const auto function_body = FunctionBodyParser{};
 
+/// Records the extent of a function body without decoding it.  The body is
+/// lowered and validated by 'function_body' when it is first needed.
+struct LazyFunctionBodyParser:
+	public x3::parser<LazyFunctionBodyParser>
+{
+	using attribute_type = FunctionBody;
+	static constexpr const bool has_attribute = true;
+
+        template <typename It, typename Ctx, typename Other, typename Attr>
+        bool parse(It& first_, It last, Ctx&& ctx, Other&& other, Attr& attr) const
+	{
+		static_assert(
+			detail::is_contiguous_byte_iterator_v<It>, 
+			"Lazy function bodies must refer to contiguous module data."
+		);
+		auto first = first_;
+		std::uint32_t body_size{0};
+		if(not varuint32.parse(first, last, ctx, other, body_size))
+			return false;
+		else if(body_size == 0u or std::distance(first, last) < body_size)
+			return false;
+		std::advance(first, body_size);
+		if constexpr(not std::is_same_v<std::decay_t<Attr>, x3::unused_type>)
+		{
+			attr.encoded = std::string_view(
+				reinterpret_cast<const char*>(std::addressof(*first_)),
+				std::distance(first_, first)
+			);
+		}
+		first_ = first;
+		return true;
+	}
+};
+
+inline const auto lazy_function_body = LazyFunctionBodyParser{};
+
 inline const auto type_section 
-	= x3::rule<struct type_section_tag, std::vector<FunctionSignature>>{"type_section"}
+	= x3::rule<struct type_section_tag, arena_vector<FunctionSignature>>{"type_section"}
 	= varuint32_prefixed_sequence(func_type);
 
 inline const auto import_section 
-	= x3::rule<struct import_section_tag, std::vector<ImportEntry>>{"import_entry"}
+	= x3::rule<struct import_section_tag, arena_vector<ImportEntry>>{"import_entry"}
 	= varuint32_prefixed_sequence(import_entry);
 
 inline const auto function_section 
-	= x3::rule<struct function_section_tag, std::vector<std::uint32_t>>{"function_section"}
+	= x3::rule<struct function_section_tag, arena_vector<std::uint32_t>>{"function_section"}
 	= varuint32_prefixed_sequence(varuint32);
 
 inline const auto table_section
-	= x3::rule<struct table_section_tag, std::vector<Table>>{"table_section"}
+	= x3::rule<struct table_section_tag, arena_vector<Table>>{"table_section"}
 	= varuint32_prefixed_sequence(table_type);
 
 inline const auto memory_section
-	= x3::rule<struct memory_section_tag, std::vector<Memory>>{"memory_section"}
+	= x3::rule<struct memory_section_tag, arena_vector<Memory>>{"memory_section"}
 	= varuint32_prefixed_sequence(memory_type);
 
 inline const auto global_section
-	= x3::rule<struct global_section_tag, std::vector<GlobalEntry>>{"global_section"}
+	= x3::rule<struct global_section_tag, arena_vector<GlobalEntry>>{"global_section"}
 	= varuint32_prefixed_sequence(global_entry);
 
 inline const auto export_section
-	= x3::rule<struct export_section_tag, std::vector<ExportEntry>>{"export_section"}
+	= x3::rule<struct export_section_tag, arena_vector<ExportEntry>>{"export_section"}
 	= varuint32_prefixed_sequence(export_entry);
 
 inline const auto start_section
@@ -463,15 +832,19 @@ inline const auto start_section
 	= varuint32;
 
 inline const auto element_section
-	= x3::rule<struct element_section_tag, std::vector<ElemSegment>>{"element_section"}
+	= x3::rule<struct element_section_tag, arena_vector<ElemSegment>>{"element_section"}
 	= varuint32_prefixed_sequence(elem_segment);
 
 inline const auto code_section
-	= x3::rule<struct code_section_tag, std::vector<FunctionBody>>{"code_section"}
+	= x3::rule<struct code_section_tag, arena_vector<FunctionBody>>{"code_section"}
 	= varuint32_prefixed_sequence(function_body);
 
+inline const auto lazy_code_section
+	= x3::rule<struct lazy_code_section_tag, arena_vector<FunctionBody>>{"lazy_code_section"}
+	= varuint32_prefixed_sequence(lazy_function_body);
+
 inline const auto data_section 
-	= x3::rule<struct data_section_tag, std::vector<DataSegment>>{"data_section"}
+	= x3::rule<struct data_section_tag, arena_vector<DataSegment>>{"data_section"}
 	= varuint32_prefixed_sequence(data_segment);
 
 inline const auto custom_section
@@ -536,6 +909,107 @@ inline const auto module_strict =
 		}
 	)];
 
+/// Parses and validates a module in a single pass over the input.
+///
+/// The sections preceding the code section are parsed and validated first;
+/// the code section is then lowered under a 'FunctionValidator' so that each
+/// function body is type-checked while its internal code is emitted.
+///
+/// With 'LazyCode', function bodies are only delimited; each is lowered and
+/// validated the first time it is called (see 'WasmFunction').
+template <bool LazyCode = false>
+struct ValidatedModuleParser:
+	public x3::parser<ValidatedModuleParser<LazyCode>>
+{
+	using attribute_type = ModuleDef;
+	static constexpr const bool has_attribute = true;
+
+	template <typename It, typename Ctx, typename Other, typename Attr>
+	bool parse(It& first_, It last, Ctx&& ctx, Other&& other, Attr& attr) const
+	{
+		auto first = first_;
+		ModuleDef def;
+		// everything parsed below is allocated from the module's arena; size
+		// the first block after the input so that most modules need only one.
+		def.arena = std::make_shared<pmr::monotonic_buffer_resource>(
+			std::max<std::size_t>(std::distance(first, last), 1024u)
+		);
+		ModuleArenaScope arena_scope(def.arena.get());
+		if(const FuelCosts* costs = codeparse::detail::get_fuel_costs(ctx); costs)
+			def.fuel_costs = std::make_shared<const FuelCosts>(*costs);
+		auto section = [&](auto sec_parser, auto& dest) {
+			return section_id_good.parse(first, last, ctx, other, x3::unused)
+				and (-sec_parser).parse(first, last, ctx, other, dest)
+				and custom_sections.parse(first, last, ctx, other, x3::unused);
+		};
+		bool good = module_header.parse(first, last, ctx, other, x3::unused)
+			and custom_sections.parse(first, last, ctx, other, x3::unused)
+			and section(module_section<SectionType::Type>(type_section), def.type_section)
+			and section(module_section<SectionType::Import>(import_section), def.import_section)
+			and section(module_section<SectionType::Function>(function_section), def.function_section)
+			and section(module_section<SectionType::Table>(table_section), def.table_section)
+			and section(module_section<SectionType::Memory>(memory_section), def.memory_section)
+			and section(module_section<SectionType::Global>(global_section), def.global_section)
+			and section(module_section<SectionType::Export>(export_section), def.export_section)
+			and section(module_section<SectionType::Start>(start_section), def.start_section)
+			and section(module_section<SectionType::Element>(element_section), def.element_section);
+		if(not good)
+			return false;
+		auto validate = [&](auto&& func, It where) {
+			try
+			{
+				func();
+			}
+			catch(const InvalidModuleError& err)
+			{
+				throw expectation_failure<It>(where, err.what());
+			}
+		};
+		std::optional<ModuleValidator> module_validator;
+		validate([&](){ module_validator.emplace(def); }, first);
+		if constexpr(LazyCode)
+		{
+			if(not section(module_section<SectionType::Code>(lazy_code_section), def.code_section))
+				return false;
+		}
+		else
+		{
+			FunctionValidator function_validator(module_validator->context());
+			auto validated_code_section = x3::with<codeparse::validator_tag>(std::ref(function_validator))[
+				module_section<SectionType::Code>(code_section)
+			];
+			if(not section(validated_code_section, def.code_section))
+				return false;
+		}
+		if(not section(module_section<SectionType::Data>(data_section), def.data_section))
+			return false;
+		validate([&](){ module_validator->validate_tail(def); }, first);
+		if constexpr(not std::is_same_v<std::decay_t<Attr>, x3::unused_type>)
+			attr = std::move(def);
+		first_ = first;
+		return true;
+	}
+};
+
+inline const auto validated_module = ValidatedModuleParser<false>{};
+inline const auto lazy_module = ValidatedModuleParser<true>{};
+
+inline const auto validated_module_strict =
+	validated_module >> x3::eps[(
+		[](auto& ctx) {
+			auto f = x3::_where(ctx).begin();
+			auto l = x3::_where(ctx).end();
+			if(f != l)
+			{
+				x3::_pass(ctx) = false;
+				throw expectation_failure<std::decay_t<decltype(f)>>(
+					f,
+					"Module terminates before end of data."
+				);
+			}
+		}
+	)];
+
 
 template <class T, class It>
 std::pair<T, It> read_immediate(It first, It last)
@@ -564,6 +1038,8 @@ It write_opcode(std::ostream& os, It first, It last, std::size_t& indent, std::s
 	using wasm::opc::OpCode;
 	if(first == last)
 		return first;
+	// labels are offsets from the instruction's opcode (see 'label_position()').
+	const It instr = first;
 	OpCode op;
 	{
 		auto tmp = *first++;
@@ -595,16 +1071,51 @@ It write_opcode(std::ostream& os, It first, It last, std::size_t& indent, std::s
 		assert(first != last);
 		LanguageType tp;
 		signed char tmp = *first++;
-		assert(block_type_exists(tmp));
 		tp = static_cast<LanguageType>(tmp);
-		os << ' ' << tp;
+		if(tp == LanguageType::func)
+		{
+			// multi-value block: (type <index>)
+			std::uint32_t type_index;
+			std::tie(type_index, first) = read_immediate<std::uint32_t>(first, last);
+			os << " (type " << type_index << ')';
+		}
+		else
+		{
+			assert(block_type_exists(tmp));
+			os << ' ' << tp;
+		}
+		std::size_t label_count = (op == OpCode::IF) ? 2u : (op == OpCode::BLOCK) ? 1u : 0u;
+		for(std::size_t i = 0; i < label_count; ++i)
+		{
+			std::uint32_t label;
+			std::tie(label, first) = read_immediate<std::uint32_t>(first, last);
+			if(_show_labels)
+			{
+				os << " (; label = " << label << " (at instruction '";
+				if(label < static_cast<std::size_t>(std::distance(instr, last)))
+					os << static_cast<OpCode>(*std::next(instr, label));
+				else
+					os << "OUT_OF_RANGE";
+				os << "') ;)";
+			}
+		}
 		++indent;
 		break;
 	}
+	case OpCode::CALL_INDIRECT:        [[fallthrough]];
+	case OpCode::RETURN_CALL_INDIRECT: {
+		std::uint32_t type_index;
+		std::tie(type_index, first) = read_immediate<std::uint32_t>(first, last);
+		// skip the inline cache slot
+		std::tie(std::ignore, first) = read_immediate<std::uint32_t>(first, last);
+		os << ' ' << type_index;
+		break;
+	}
 	case OpCode::BR:            [[fallthrough]];
 	case OpCode::BR_IF:         [[fallthrough]];
 	case OpCode::CALL:          [[fallthrough]];
-	case OpCode::CALL_INDIRECT: [[fallthrough]];
+	case OpCode::RETURN_CALL:   [[fallthrough]];
+	case OpCode::FUEL:          [[fallthrough]];
 	case OpCode::GET_LOCAL:     [[fallthrough]];
 	case OpCode::SET_LOCAL:     [[fallthrough]];
 	case OpCode::TEE_LOCAL:     [[fallthrough]];
@@ -687,34 +1198,15 @@ It write_opcode(std::ostream& os, It first, It last, std::size_t& indent, std::s
 		(void)0;
 	} /* switch */
 	
-	// skip over jump distance immediate
-	if(op == OpCode::BLOCK or op == OpCode::ELSE or op == OpCode::IF)
-	{
-		std::uint32_t label;
-		std::tie(label, first) = read_immediate<std::uint32_t>(first, last);
-		if(_show_labels)
-		{
-			os << " (; label = " << label << ", (at instruction '";
-			if(op == OpCode::BLOCK or op == OpCode::IF)
-				label -= (2u + sizeof(std::uint32_t));
-			else
-				label -= (1 + sizeof(std::uint32_t));
-			if(label < std::distance(first, last))
-				os << static_cast<OpCode>(*std::next(first, label));
-			else
-				os << "OUT_OF_RANGE";
-			os <<  "');)";
-		}
-	}
 	return first;
 }
 
 template <class It>
 It write_code(std::ostream& os, It first, It last, std::size_t indent = 0, bool _show_labels = false)
 {
-	for(std::size_t indent = full_function_body; first != last; )
+	for(std::size_t depth = indent; first != last; )
 	{
-		first = write_opcode(os, first, last, indent, 2u, _show_labels);
+		first = write_opcode(os, first, last, depth, 2u, _show_labels);
 		os << '\n';
 	}
 	return first;
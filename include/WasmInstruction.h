@@ -7,8 +7,12 @@
 #include <array>
 #include <bitset>
 #include <optional>
+#include <stdexcept>
 #include <variant>
 #include <algorithm>
+#include <functional>
+#include <string_view>
+#include <tuple>
 #include <iosfwd>
 #include <ostream>
 #include <iomanip>
@@ -18,6 +22,9 @@
 
 
 namespace wasm {
+
+struct WasmFunction;
+
 namespace opc {
 
 enum class OpCode: wasm_ubyte_t
@@ -49,6 +56,12 @@ enum class OpCode: wasm_ubyte_t
 	SELECT 			= 0x1bu,
 	CALL 			= 0x10u,
 	CALL_INDIRECT 		= 0x11u,
+	RETURN_CALL 		= 0x12u,
+	RETURN_CALL_INDIRECT 	= 0x13u,
+
+	// INTERNAL INSTRUCTIONS
+	// Emitted by lowering only; never decoded from a module binary.
+	FUEL			= 0xffu,
 	
 	// INTEGER ARITHMETIC INSTRUCTIONS
 	// int32
@@ -232,9 +245,24 @@ enum class OpCode: wasm_ubyte_t
 };
 
 
+struct BadOpcodeError:
+	public std::logic_error
+{
+	BadOpcodeError(OpCode op, const char* msg):
+		std::logic_error(msg),
+		opcode(op)
+	{
+
+	}
+	
+	const OpCode opcode;
+};
+
+/// Invoke 'visitor' with a 'TemplateVis<op>' object, so that the visitor
+/// sees the opcode as a compile-time constant.
 template <template <OpCode> class TemplateVis, class Vis>
-decltype(auto) visit_opcode_template(Vis&& visitor) {
-	switch(opcode())
+decltype(auto) visit_opcode_template(OpCode op, Vis&& visitor) {
+	switch(op)
 	{
 	/// CONTROL FLOW OPS
 	case OpCode::UNREACHABLE:       return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::UNREACHABLE>{});
@@ -250,6 +278,9 @@ decltype(auto) visit_opcode_template(Vis&& visitor) {
 	case OpCode::RETURN:            return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::RETURN>{});
 	case OpCode::CALL:              return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::CALL>{});
 	case OpCode::CALL_INDIRECT:     return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::CALL_INDIRECT>{});
+	case OpCode::RETURN_CALL:       return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::RETURN_CALL>{});
+	case OpCode::RETURN_CALL_INDIRECT: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::RETURN_CALL_INDIRECT>{});
+	case OpCode::FUEL:              return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::FUEL>{});
 	/// PARAMETRIC OPS
 	case OpCode::DROP:              return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::DROP>{});
 	case OpCode::SELECT:            return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::SELECT>{});
@@ -405,47 +436,54 @@ decltype(auto) visit_opcode_template(Vis&& visitor) {
 	case OpCode::F64_MAX:           return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_MAX>{});
 	case OpCode::F64_COPYSIGN:      return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_COPYSIGN>{});
 	/// CONVERSION OPERATIONS
-	case OpCode::I32_WRAP_I64:      return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_WRAP_I64>{});
+	case OpCode::I32_WRAP:      return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_WRAP>{});
 	// float-to-int32 tuncating conversion
-	case OpCode::I32_TRUNC_S_F32:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_S_F32>{});
-	case OpCode::I32_TRUNC_U_F32:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_U_F32>{});
-	case OpCode::I32_TRUNC_S_F64:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_S_F64>{});
-	case OpCode::I32_TRUNC_U_F64:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_U_F64>{});
+	case OpCode::I32_TRUNC_F32_S:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_F32_S>{});
+	case OpCode::I32_TRUNC_F32_U:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_F32_U>{});
+	case OpCode::I32_TRUNC_F64_S:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_F64_S>{});
+	case OpCode::I32_TRUNC_F64_U:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_TRUNC_F64_U>{});
+	case OpCode::I32_REINTERPRET_F32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I32_REINTERPRET_F32>{});
 	// int32-to-int64 extending conversion
-	case OpCode::I64_EXTEND_S_I32:  return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_EXTEND_S_I32>{});
-	case OpCode::I64_EXTEND_U_I32:  return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_EXTEND_U_I32>{});
+	case OpCode::I64_EXTEND_S:  return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_EXTEND_S>{});
+	case OpCode::I64_EXTEND_U:  return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_EXTEND_U>{});
 	// float-to-int64 truncating conversion
-	case OpCode::I64_TRUNC_S_F32:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_S_F32>{});
-	case OpCode::I64_TRUNC_U_F32:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_U_F32>{});
-	case OpCode::I64_TRUNC_S_F64:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_S_F64>{});
-	case OpCode::I64_TRUNC_U_F64:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_U_F64>{});
+	case OpCode::I64_TRUNC_F32_S:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_F32_S>{});
+	case OpCode::I64_TRUNC_F32_U:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_F32_U>{});
+	case OpCode::I64_TRUNC_F64_S:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_F64_S>{});
+	case OpCode::I64_TRUNC_F64_U:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_TRUNC_F64_U>{});
+	case OpCode::I64_REINTERPRET_F64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::I64_REINTERPRET_F64>{});
 	// int-to-float32 conversion
-	case OpCode::F32_CONVERT_S_I32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_S_I32>{});
-	case OpCode::F32_CONVERT_U_I32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_U_I32>{});
-	case OpCode::F32_CONVERT_S_I64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_S_I64>{});
-	case OpCode::F32_CONVERT_U_I64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_U_I64>{});
+	case OpCode::F32_CONVERT_I32_S: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_I32_S>{});
+	case OpCode::F32_CONVERT_I32_U: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_I32_U>{});
+	case OpCode::F32_CONVERT_I64_S: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_I64_S>{});
+	case OpCode::F32_CONVERT_I64_U: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_CONVERT_I64_U>{});
+	case OpCode::F32_REINTERPRET_I32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_REINTERPRET_I32>{});
 	// float64-to-float32 demoting conversion
-	case OpCode::F32_DEMOTE_F64:    return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_DEMOTE_F64>{});
+	case OpCode::F32_DEMOTE:    return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F32_DEMOTE>{});
 	// int-to-float64 conversion
-	case OpCode::F64_CONVERT_S_I32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_S_I32>{});
-	case OpCode::F64_CONVERT_U_I32: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_U_I32>{});
-	case OpCode::F64_CONVERT_S_I64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_S_I64>{});
-	case OpCode::F64_CONVERT_U_I64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_U_I64>{});
+	case OpCode::F64_CONVERT_I32_S: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_I32_S>{});
+	case OpCode::F64_CONVERT_I32_U: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_I32_U>{});
+	case OpCode::F64_CONVERT_I64_S: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_I64_S>{});
+	case OpCode::F64_CONVERT_I64_U: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_CONVERT_I64_U>{});
+	case OpCode::F64_REINTERPRET_I64: return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_REINTERPRET_I64>{});
 	// float32-to-float64 promoting conversion
-	case OpCode::F64_PROMOTE_F32:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_PROMOTE_F32>{});
-	default:                        assert(false);
+	case OpCode::F64_PROMOTE:   return std::invoke(std::forward<Vis>(visitor), TemplateVis<OpCode::F64_PROMOTE>{});
+	default:
+		assert(false);
+		throw BadOpcodeError(op, "Given op is not a valid WASM opcode.");
 	}
 }
 
-template <LanguageType LT>
-using language_type_constant_t = std::integral_constant<LanguageType, LT>;
+template <OpCode Op>
+using opcode_constant = std::integral_constant<OpCode, Op>;
 
+/// Invoke 'visitor' with 'op' as an 'opcode_constant'.
 template <class Vis>
-decltype(auto) visit_opcode(Vis&& visitor) {
-	return visit_opcode_template<language_type_constant_t>(visitor);
+decltype(auto) visit_opcode(OpCode op, Vis&& visitor) {
+	return visit_opcode_template<opcode_constant>(op, std::forward<Vis>(visitor));
 }
 
-inline constexpr const std::array<OpCode, 168u> all_opcodes {
+inline constexpr const std::array<OpCode, 175u> all_opcodes {
 	OpCode::UNREACHABLE, 
 	OpCode::NOP, 
 	OpCode::BLOCK, 
@@ -459,6 +497,9 @@ inline constexpr const std::array<OpCode, 168u> all_opcodes {
 	OpCode::RETURN, 
 	OpCode::CALL, 
 	OpCode::CALL_INDIRECT, 
+	OpCode::RETURN_CALL, 
+	OpCode::RETURN_CALL_INDIRECT, 
+	OpCode::FUEL, 
 	OpCode::DROP, 
 	OpCode::SELECT, 
 	OpCode::GET_LOCAL, 
@@ -593,27 +634,31 @@ inline constexpr const std::array<OpCode, 168u> all_opcodes {
 	OpCode::F64_MIN, 
 	OpCode::F64_MAX, 
 	OpCode::F64_COPYSIGN, 
-	OpCode::I32_WRAP_I64, 
-	OpCode::I32_TRUNC_S_F32, 
-	OpCode::I32_TRUNC_U_F32, 
-	OpCode::I32_TRUNC_S_F64, 
-	OpCode::I32_TRUNC_U_F64, 
-	OpCode::I64_EXTEND_S_I32, 
-	OpCode::I64_EXTEND_U_I32, 
-	OpCode::I64_TRUNC_S_F32, 
-	OpCode::I64_TRUNC_U_F32, 
-	OpCode::I64_TRUNC_S_F64, 
-	OpCode::I64_TRUNC_U_F64, 
-	OpCode::F32_CONVERT_S_I32, 
-	OpCode::F32_CONVERT_U_I32, 
-	OpCode::F32_CONVERT_S_I64, 
-	OpCode::F32_CONVERT_U_I64, 
-	OpCode::F32_DEMOTE_F64, 
-	OpCode::F64_CONVERT_S_I32, 
-	OpCode::F64_CONVERT_U_I32, 
-	OpCode::F64_CONVERT_S_I64, 
-	OpCode::F64_CONVERT_U_I64, 
-	OpCode::F64_PROMOTE_F32
+	OpCode::I32_WRAP, 
+	OpCode::I32_TRUNC_F32_S, 
+	OpCode::I32_TRUNC_F32_U, 
+	OpCode::I32_TRUNC_F64_S, 
+	OpCode::I32_TRUNC_F64_U, 
+	OpCode::I64_EXTEND_S, 
+	OpCode::I64_EXTEND_U, 
+	OpCode::I64_TRUNC_F32_S, 
+	OpCode::I64_TRUNC_F32_U, 
+	OpCode::I64_TRUNC_F64_S, 
+	OpCode::I64_TRUNC_F64_U, 
+	OpCode::F32_CONVERT_I32_S, 
+	OpCode::F32_CONVERT_I32_U, 
+	OpCode::F32_CONVERT_I64_S, 
+	OpCode::F32_CONVERT_I64_U, 
+	OpCode::F32_DEMOTE, 
+	OpCode::F64_CONVERT_I32_S, 
+	OpCode::F64_CONVERT_I32_U, 
+	OpCode::F64_CONVERT_I64_S, 
+	OpCode::F64_CONVERT_I64_U, 
+	OpCode::F64_PROMOTE, 
+	OpCode::I32_REINTERPRET_F32, 
+	OpCode::I64_REINTERPRET_F64, 
+	OpCode::F32_REINTERPRET_I32, 
+	OpCode::F64_REINTERPRET_I64
 };
 
 
@@ -665,6 +710,9 @@ const std::array<const char*, 256>& opcode_names()
 		tmp[static_cast<int_type>(OpCode::SELECT)]              = "select";
 		tmp[static_cast<int_type>(OpCode::CALL)]                = "call";
 		tmp[static_cast<int_type>(OpCode::CALL_INDIRECT)]       = "call_indirect";
+		tmp[static_cast<int_type>(OpCode::RETURN_CALL)]         = "return_call";
+		tmp[static_cast<int_type>(OpCode::RETURN_CALL_INDIRECT)] = "return_call_indirect";
+		tmp[static_cast<int_type>(OpCode::FUEL)]                = "fuel";
 
 		tmp[static_cast<int_type>(OpCode::I32_ADD)]             = "i32.add";
 		tmp[static_cast<int_type>(OpCode::I32_SUB)]             = "i32.sub";
@@ -854,6 +902,18 @@ std::ostream& operator<<(std::ostream& os, OpCode oc)
 inline bool opcode_exists(std::underlying_type_t<OpCode> oc)
 { return detail::opcode_mask().test(oc); }
 
+/// Type of a BLOCK, LOOP or IF.  A block without parameters and with at most
+/// one result stores that result type ('LanguageType::block' for none).  Any
+/// other (multi-value) block refers to a function type in the module's type
+/// section; 'type' is then 'LanguageType::func'.
+struct BlockType {
+	LanguageType type;
+	wasm_uint32_t type_index;
+
+	bool is_indexed() const
+	{ return type == LanguageType::func; }
+};
+
 namespace detail {
 
 template <class It>
@@ -875,7 +935,7 @@ std::tuple<wasm_uint32_t, wasm_uint32_t, It> read_memory_immediate(It first, It
 		chr = *first++;
 	}
 	std::memcpy(&flags, buff1, sizeof(flags));
-	std::memcpy(&offset, buff1, sizeof(offset));
+	std::memcpy(&offset, buff2, sizeof(offset));
 	return std::make_tuple(flags, offset, first);
 }
 
@@ -895,21 +955,34 @@ std::pair<T, It> read_serialized_immediate(It first, It last)
 	return std::make_pair(value, first);
 }
 
+/// Read a lowered block type: the type byte, plus the type index if it is 'LanguageType::func'.
+template <class It>
+[[gnu::pure]]
+std::pair<BlockType, It> read_block_type(It first, It last)
+{
+	assert(first != last);
+	BlockType tp{static_cast<LanguageType>(*first++), 0u};
+	if(tp.is_indexed())
+		std::tie(tp.type_index, first) = read_serialized_immediate<wasm_uint32_t>(first, last);
+	return std::make_pair(tp, first);
+}
+
 } /* namespace detail */
 
-struct BadOpcodeError:
-	public std::logic_error
+/// 'CALL_INDIRECT' immediate: the type index, and the call site's inline
+/// cache slot (call sites are numbered per function during lowering).
+struct CallIndirectImmediate:
+	public std::pair<const wasm_uint32_t, const wasm_uint32_t>
 {
-	BadOpcodeError(OpCode op, const char* msg):
-		std::logic_error(msg),
-		opcode(op)
-	{
-
-	}
-	
-	const OpCode opcode;
+	using std::pair<const wasm_uint32_t, const wasm_uint32_t>::pair;
 };
 
+wasm_uint32_t type_index(const CallIndirectImmediate& immed)
+{ return immed.first; }
+
+wasm_uint32_t cache_slot(const CallIndirectImmediate& immed)
+{ return immed.second; }
+
 template <class It, class Visitor>
 decltype(auto) visit_opcode(Visitor visitor, It first, It last)
 {
@@ -957,27 +1030,43 @@ decltype(auto) visit_opcode(Visitor visitor, It first, It last)
 	}
 	else if(
 		(op >= OpCode::GET_LOCAL and op <= OpCode::SET_GLOBAL)
-		or (op == OpCode::CALL or op == OpCode::CALL_INDIRECT)
+		or (op == OpCode::CALL or op == OpCode::RETURN_CALL)
 		or (op == OpCode::BR or op == OpCode::BR_IF)
-		or (op == OpCode::ELSE)
+		or (op == OpCode::FUEL)
 	)
 	{
 		wasm_uint32_t value;
 		std::tie(value, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
 		return visitor(first, last, pos, op, value);
 	}
-	else if(op == OpCode::BLOCK or op == OpCode::IF)
+	else if(op == OpCode::CALL_INDIRECT or op == OpCode::RETURN_CALL_INDIRECT)
 	{
-		assert(first != last);
-		LanguageType tp = static_cast<LanguageType>(*first++);
+		wasm_uint32_t type_idx, slot;
+		std::tie(type_idx, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		std::tie(slot, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return visitor(first, last, pos, op, CallIndirectImmediate(type_idx, slot));
+	}
+	else if(op == OpCode::BLOCK)
+	{
+		BlockType tp;
+		std::tie(tp, pos) = detail::read_block_type(pos, last);
 		wasm_uint32_t label;
 		std::tie(label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
 		return visitor(first, last, pos, op, tp, label);
 	}
+	else if(op == OpCode::IF)
+	{
+		BlockType tp;
+		std::tie(tp, pos) = detail::read_block_type(pos, last);
+		wasm_uint32_t end_label, else_label;
+		std::tie(end_label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		std::tie(else_label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return visitor(first, last, pos, op, tp, end_label, else_label);
+	}
 	else if(op == OpCode::LOOP)
 	{
-		assert(first != last);
-		LanguageType tp = static_cast<LanguageType>(*first++);
+		BlockType tp;
+		std::tie(tp, pos) = detail::read_block_type(pos, last);
 		return visitor(first, last, pos, op, tp);
 	}
 	else if(op == OpCode::BR_TABLE)
@@ -1016,7 +1105,7 @@ decltype(auto) visit_opcode(Visitor visitor, It first, It last)
 		break;
 	}
 	default:
-		return visitor(op, first, pos, last);
+		return visitor(first, last, pos, op);
 	}
 	assert(false and "Internal Error: All cases should have been handled by this point.");
 }
@@ -1034,28 +1123,23 @@ wasm_uint32_t offset(const MemoryImmediate& immed)
 { return immed.second; }
 
 struct BlockImmediate:
-	public std::pair<const LanguageType, const wasm_uint32_t>
+	public std::pair<const BlockType, const wasm_uint32_t>
 {
-	using std::pair<const LanguageType, const wasm_uint32_t>::pair;
+	using std::pair<const BlockType, const wasm_uint32_t>::pair;
 };
 
-gsl::span<const LanguageType> signature(const BlockImmediate& immed)
-{
-	if(immed.first == LanguageType::BLOCK)
-		return gsl::span<const LanguageType>();
-	return gsl::span<const LanguageType>(&(immed.first), 1u);
-}
-
-std::size_t arity(const BlockImmediate& immed)
-{ return signature(immed).size(); }
+/// The block's type.  Its parameter and result types are looked up through
+/// the module; see 'WasmModule::block_signature()'.
+const BlockType& block_type(const BlockImmediate& immed)
+{ return immed.first; }
 
 wasm_uint32_t offset(const BlockImmediate& immed)
 { return immed.second; }
 
 struct IfImmediate:
-	public std::tuple<const LanguageType, const wasm_uint32_t, const wasm_uint32_t>
+	public std::tuple<const BlockType, const wasm_uint32_t, const wasm_uint32_t>
 {
-	using std::tuple<const LanguageType, const wasm_uint32_t, const wasm_uint32_t>::pair;
+	using std::tuple<const BlockType, const wasm_uint32_t, const wasm_uint32_t>::tuple;
 };
 
 wasm_uint32_t else_offset(const IfImmediate& immed)
@@ -1064,23 +1148,16 @@ wasm_uint32_t else_offset(const IfImmediate& immed)
 wasm_uint32_t end_offset(const IfImmediate& immed)
 { return std::get<1u>(immed); }
 
-gsl::span<const LanguageType> signature(const IfImmediate& immed)
-{ 
-	if(std::get<0u>(immed) == LanguageType::BLOCK)
-		return gsl::span<const LanguageType>();
-	return gsl::span<const LanguageType>(&(std::get<0u>(immed)), 1u);
-}
-
-std::size_t arity(const IfImmediate& immed)
-{ return signature(immed).size(); }
+const BlockType& block_type(const IfImmediate& immed)
+{ return std::get<0u>(immed); }
 
 struct BranchTableImmediate
 {
-	template <class ... T>
-	BranchTableImmediate(T&& ... args):
-		table_(std::forward<T>(args)...)
+	/// 'count' depths: the branch depths, then the default depth.
+	BranchTableImmediate(const char (*table)[sizeof(wasm_uint32_t)], std::ptrdiff_t count):
+		table_(table, count)
 	{
-		
+		assert(count > 0);
 	}
 
 	wasm_uint32_t at(wasm_uint32_t idx) const
@@ -1095,1331 +1172,116 @@ private:
 	const gsl::span<const char[sizeof(wasm_uint32_t)]> table_;
 };
 
-struct WasmInstruction
-{
-	using null_immediate_type         = std::monostate;
-	using i32_immediate_type          = wasm_sint32_t;
-	using i64_immediate_type          = wasm_sint64_t;
-	using f32_immediate_type          = wasm_float32_t;
-	using f64_immediate_type          = wasm_float64_t;
-	using offset_immediate_type       = wasm_uint32_t;
-	using memory_immediate_type       = MemoryImmediate;
-	using block_immediate_type        = BlockImmediate;
-	using loop_immediate_type         = LanguageType;
-	using branch_table_immediate_type = BranchTableImmediate;
-
-	union immediate_type
-	{
-		// no immediate (most instructions)
-		null_immediate_type         null_immed;
-		// i32.const
-		i32_immediate_type          i32_immed;
-		// i64.const
-		i64_immediate_type          i64_immed;
-		// f32.const
-		f32_immediate_type          f32_immed;
-		// f64.const
-		f64_immediate_type          f64_immed;
-		// offset: br, br_if, else (precomputed jump), call, call_indirect
-		//         get_local, set_local, tee_local, get_global, set_global
-		offset_immediate_type       offset_immed;
-		// memory immediate: i32.load (0x28) through i64.store32 (0x3e)
-		memory_immediate_type       memory_immed;
-		// block immediate (signature + precomputed jump): if, block
-		block_immediate_type        block_immed;
-		// loop (signature)
-		loop_immediate_type         loop_immed;
-		// branch table unaligned array of offset_immediate_type (native byte order)
-		// branch depths + one default depth.  
-		branch_table_immediate_type br_table_immed;
-	};
-
-	using tagged_immediate_type = std::variant<
-		null_immediate_type,
-		i32_immediate_type,
-		i64_immediate_type,
-		f32_immediate_type,
-		f64_immediate_type,
-		offset_immediate_type,
-		memory_immediate_type,
-		block_immediate_type,
-		loop_immediate_type,
-		branch_table_immediate_type
-	>;
-
-
-private:
-	template <class T>
-	struct Tag{};
-
-	void _assert_invariants() const
-	{
-		assert(opcode_exists(opcode));
-		assert(source.size() >= 1u);
-		if(not validate(null_immediate_type{}))
-			assert(source.size() > 1u);
-	}
-
-	bool validate(Tag<null_immediate_type>) const
-	{
-		_assert_invariants();
-		return ((opcode > OpCode::I32_EQZ) 
-			or (opcode == OpCode::UNREACHABLE)
-			or (opcode == OpCode::NOP)
-			or (opcode == OpCode::ELSE)
-			or (opcode == OpCode::END)
-			or (opcode == OpCode::RETURN)
-			or (opcode == OpCode::DROP)
-			or (opcode == OpCode::SELECT)
-			or (opcode == OpCode::CURRENT_MEMORY)
-			or (opcode == OpCode::GROW_MEMORY)
-		);
-	}
-	
-	bool validate(Tag<offset_immediate_type>) const
-	{
-		_assert_invariants();
-		return ((op >= OpCode::GET_LOCAL and op <= OpCode::SET_GLOBAL)
-			or (op >= OpCode::CALL and op <= OpCode::CALL_INDIRECT)
-			or (op >= OpCode::BR and op <= OpCode::BR_IF)
-			or (op == OpCode::ELSE)
-		);
-	}
+namespace detail {
 
-	bool validate(Tag<i32_immediate_type>) const
+/// Read the immediate of a lowered 'Op' from '[first, last)', which starts
+/// just past the opcode.  Returns the immediate and the position after it;
+/// 'std::monostate' stands in for the immediate of an op that has none.
+template <OpCode Op>
+[[gnu::pure]]
+auto read_immediate(const char* first, const char* last)
+{
+	if constexpr(Op >= OpCode::I32_LOAD and Op <= OpCode::I64_STORE32)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::I32_CONST);
+		auto [flags, offset, pos] = read_memory_immediate(first, last);
+		return std::make_pair(MemoryImmediate(flags, offset), pos);
 	}
-
-	bool validate(Tag<i64_immediate_type>) const
+	else if constexpr(
+		(Op >= OpCode::GET_LOCAL and Op <= OpCode::SET_GLOBAL)
+		or Op == OpCode::CALL
+		or Op == OpCode::RETURN_CALL
+		or Op == OpCode::BR
+		or Op == OpCode::BR_IF
+		or Op == OpCode::FUEL
+	)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::I64_CONST);
+		return read_serialized_immediate<wasm_uint32_t>(first, last);
 	}
-
-	bool validate(Tag<f32_immediate_type>) const
+	else if constexpr(Op == OpCode::CALL_INDIRECT or Op == OpCode::RETURN_CALL_INDIRECT)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::F32_CONST);
+		auto [type_idx, pos] = read_serialized_immediate<wasm_uint32_t>(first, last);
+		wasm_uint32_t slot;
+		std::tie(slot, pos) = read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return std::make_pair(CallIndirectImmediate(type_idx, slot), pos);
 	}
-
-	bool validate(Tag<f64_immediate_type>) const
+	else if constexpr(Op == OpCode::BLOCK)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::F64_CONST);
+		auto [tp, pos] = read_block_type(first, last);
+		wasm_uint32_t label;
+		std::tie(label, pos) = read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return std::make_pair(BlockImmediate(tp, label), pos);
 	}
-
-	bool validate(Tag<memory_immediate_type>) const
+	else if constexpr(Op == OpCode::IF)
 	{
-		_assert_invariants();
-		return (opcode >= OpCode::I32_LOAD)
-			and (opcode >= OpCode::I64_STORE32);
+		auto [tp, pos] = read_block_type(first, last);
+		wasm_uint32_t end_label;
+		wasm_uint32_t else_label;
+		std::tie(end_label, pos) = read_serialized_immediate<wasm_uint32_t>(pos, last);
+		std::tie(else_label, pos) = read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return std::make_pair(IfImmediate(tp, end_label, else_label), pos);
 	}
-
-	bool validate(Tag<block_immediate_type>) const
+	else if constexpr(Op == OpCode::LOOP)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::BLOCK)
-			or (opcode == OpCode::IF);
+		return read_block_type(first, last);
 	}
-
-	bool validate(Tag<branch_table_immediate_type>) const
+	else if constexpr(Op == OpCode::BR_TABLE)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::BR_TABLE);
+		auto [len, pos] = read_serialized_immediate<wasm_uint32_t>(first, last);
+		std::size_t table_size = 1u + std::size_t(len);
+		assert(std::size_t(last - pos) >= table_size * sizeof(wasm_uint32_t));
+		using table_elem_type = const char[sizeof(wasm_uint32_t)];
+		BranchTableImmediate table(
+			reinterpret_cast<table_elem_type*>(pos),
+			static_cast<std::ptrdiff_t>(table_size)
+		);
+		return std::make_pair(table, pos + table_size * sizeof(wasm_uint32_t));
 	}
-
-	bool validate(Tag<loop_immediate_type>) const
+	else if constexpr(Op == OpCode::I32_CONST)
 	{
-		_assert_invariants();
-		return (opcode == OpCode::LOOP);
+		return read_serialized_immediate<wasm_sint32_t>(first, last);
 	}
-
-	template <class T>
-	void assert_valid(Tag<T>) const
+	else if constexpr(Op == OpCode::I64_CONST)
 	{
-		assert(validate(Tag<T>{}));
+		return read_serialized_immediate<wasm_sint64_t>(first, last);
 	}
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, null_immediate_type null_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{null_immed}
-	{ assert_valid(Tag<null_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, i32_immediate_type i32_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{i32_immed}
-	{ assert_valid(Tag<i32_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, i64_immediate_type i64_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{i64_immed}
-	{ assert_valid(Tag<i64_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, f32_immediate_type f32_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{f32_immed}
-	{ asser_valid(Tag<f32_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, f64_immediate_type f64_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{f64_immed}
-	{ assert_valid(Tag<f64_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, offset_immediate_type offset_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{offset_immed}
-	{ assert_valid(Tag<offset_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, loop_immediate_type loop_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{loop_immed}
-	{ assert_valid(Tag<loop_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, memory_immediate_type memory_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{memory_immed}
-	{ assert_valid(Tag<memory_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, block_immediate_type block_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{block_immed}
-	{ assert_valid(Tag<loop_immediate_type>{}); }
-
-	WasmInstruction(std::string_view src, OpCode op, const char* end_pos, branch_table_immediate_type br_table_immed):
-		source(src), opcode(op), end(end_pos), raw_immediate_{br_table_immed}
-	{ assert_valid(Tag<branch_table_immediate_type>{}); }
-
-public:
-
-	const immediate_type& raw_immediate() const
-	{ return raw_immediate_; }
-
-	const offset_immediate_type& offset_immed() 
-
-	tagged_immediate_type tagged_immediate() const
+	else if constexpr(Op == OpCode::F32_CONST)
 	{
-		// This if() covers 20-something ops.
-		if(opcode >= OpCode::I32_LOAD and opcode <= I64_STORE32)
-		{
-			return tagged_immediate_type(
-				std::in_place_type<memory_immediate_type>,
-				raw().memory_immed
-			);
-		}
-		switch(opcode)
-		{
-		// case for ops with no immediate
-		default:
-			assert(opcode_exists(static_cast<std::size_t>(opcode)));
-			return tagged_immediate_type(
-				std::in_place_type<null_immediate_type>,
-				raw().null_immed
-			);
-		// cases for block immediate
-		case OpCode::BLOCK: [[fallthrough]];
-		case OpCode::IF:
-			return tagged_immediate_type(
-				std::in_place_type<block_immediate_type>,
-				raw().block_immed
-			);
-		// cases for uint32 immediate
-		case OpCode::ELSE:          [[fallthrough]];
-		case OpCode::BR:            [[fallthrough]];
-		case OpCode::BR_IF:         [[fallthrough]];
-		case OpCode::CALL:          [[fallthrough]];
-		case OpCode::CALL_INDIRECT: [[fallthrough]];
-		case OpCode::GET_LOCAL:     [[fallthrough]];
-		case OpCode::SET_LOCAL:     [[fallthrough]];
-		case OpCode::TEE_LOCAL:     [[fallthrough]];
-		case OpCode::GET_GLOBAL:    [[fallthrough]];
-		case OpCode::SET_GLOBAL:
-			return tagged_immediate_type(
-				std::in_place_type<offset_immediate_type>,
-				raw().offset_immed
-			);
-		// case for loop immediate
-		case OpCode::LOOP:
-			return tagged_immediate_type(
-				std::in_place_type<loop_immediate_type>,
-				raw().loop_immed
-			);
-		// case for loop immediate
-		case OpCode::LOOP:
-			return tagged_immediate_type(
-				std::in_place_type<loop_immediate_type>,
-				raw().loop_immed
-			);
-		// case for br_table immediate
-		case OpCode::BR_TABLE:
-			return tagged_immediate_type(
-				std::in_place_type<branch_table_immediate_type>,
-				raw().br_table_immed
-			);
-		// case for i32.const immediate
-		case OpCode::I32_CONST:
-			return tagged_immediate_type(
-				std::in_place_type<i32_immediate_type>,
-				raw().i32_immed
-			);
-		// case for i64.const immediate
-		case OpCode::I64_CONST:
-			return tagged_immediate_type(
-				std::in_place_type<i64_immediate_type>,
-				raw().i64_immed
-			);
-		// case for f32.const immediate
-		case OpCode::F32_CONST:
-			return tagged_immediate_type(
-				std::in_place_type<f32_immediate_type>,
-				raw().f32_immed
-			);
-		// case for f64.const immediate
-		case OpCode::F64_CONST:
-			return tagged_immediate_type(
-				std::in_place_type<f64_immediate_type>,
-				raw().f64_immed
-			);
-		}
-		assert(false);
+		return read_serialized_immediate<wasm_float32_t>(first, last);
 	}
-
-	
-	OpCode opcode() const
-	{ return opcode_; }
-
-	std::string_view source() const
-	{ return source_; }
-
-	std::string_view full_source() const
-	{ return std::string_view(source().data(), end_ - source().data()); }
-
-	const char* end_pos() const
-	{ return end_; }
-
-	const char* pos() const
-	{ return source().data(); }
-
-	CodeView after() const
+	else if constexpr(Op == OpCode::F64_CONST)
 	{
-		assert(pos() < end_pos());
-		assert(static_cast<std::size_t>(end_pos() - pos()) < source().size());
-		auto source_end = source().data() + source().size()
-		return CodeView(source_end, end_pos() - source_end);
+		return read_serialized_immediate<wasm_float64_t>(first, last);
 	}
-
-	template <class CallStackType>
-	CodeView execute(WasmModule& module, CallStackType& call_stack) 
-	{
-		switch(opcode)
-		{
-		case OpCode::UNREACHABLE:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::UNREACHABLE>();
-			break;
-		case OpCode::NOP:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::NOP>();
-			break;
-		case OpCode::BLOCK:
-			assert_valid(Tag<block_immediate_type>{});
-			op_func<OpCode::BLOCK>();
-			break;
-		case OpCode::LOOP:
-			assert_valid(Tag<loop_immediate_type>{});
-			op_func<OpCode::LOOP>();
-			break;
-		case OpCode::IF:
-			assert_valid(Tag<block_immediate_type>{});
-			op_func<OpCode::IF>();
-			break;
-		case OpCode::ELSE:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::ELSE>();
-			break;
-		case OpCode::END:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::END>(
-				current_frame(call_stack), raw_immediate().offset_immed, *this
-			);
-			break;
-		case OpCode::BR:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::BR>(
-				current_frame(call_stack), raw_immediate().offset_immed, *this
-			);
-			break;
-		case OpCode::BR_IF:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::BR_IF>(
-				current_frame(call_stack), raw_immediate().offset_immed, *this
-			);
-			break;
-		case OpCode::BR_TABLE:
-			assert_valid(Tag<branch_table_immediate_type>{});
-			op_func<OpCode::BR_TABLE>(
-				call_stack, raw_immediate().branch_table_immed, *this
-			);
-			break;
-		case OpCode::RETURN:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::RETURN>(call_stack);
-			break;
-		case OpCode::CALL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::CALL>(
-				call_stack, module, raw_immediate().offset_immed, *this
-			);
-			break;
-		case OpCode::CALL_INDIRECT:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::CALL_INDIRECT>(
-				call_stack, module, raw_immediate().offset_immed, *this
-			);
-			break;
-		case OpCode::DROP:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::DROP>(current_frame(call_stack));
-			break;
-		case OpCode::SELECT:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::SELECT>(current_frame(call_stack));
-			break;
-		case OpCode::GET_LOCAL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::GET_LOCAL>(
-				current_frame(call_stack), raw_immediate().offset_immed, 
-			);
-			break;
-		case OpCode::SET_LOCAL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::SET_LOCAL>(
-				current_frame(call_stack), raw_immediate().offset_immed, 
-			);
-			break;
-		case OpCode::TEE_LOCAL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::TEE_LOCAL>(
-				current_frame(call_stack), raw_immediate().offset_immed
-			);
-			break;
-		case OpCode::GET_GLOBAL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::GET_GLOBAL>(
-				current_frame(call_stack), module, raw_immediate().offset_immed, 
-			);
-			break;
-		case OpCode::SET_GLOBAL:
-			assert_valid(Tag<offset_immediate_type>{});
-			op_func<OpCode::SET_GLOBAL>(
-				current_frame(call_stack), module, raw_immediate().offset_immed, 
-			);
-			break;
-
-		/// MEMORY OPS
-		// load
-		case OpCode::I32_LOAD:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_LOAD>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::F32_LOAD:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::F32_LOAD>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::F64_LOAD:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::F64_LOAD>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// i32 extending loads
-		case OpCode::I32_LOAD8_S:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_LOAD8_S>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I32_LOAD8_U:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_LOAD8_U>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I32_LOAD16_S:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_LOAD16_S>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I32_LOAD16_U:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_LOAD16_U>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// i64 extending loads
-		case OpCode::I64_LOAD8_S:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD8_S>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD8_U:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD8_U>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD16_S:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD16_S>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD16_U:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD16_U>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD32_S:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD32_S>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_LOAD32_U:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_LOAD32_U>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// store
-		case OpCode::I32_STORE:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_STORE>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_STORE:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_STORE>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::F32_STORE:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::F32_STORE>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::F64_STORE:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::F64_STORE>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// i32 wrapping stores 
-		case OpCode::I32_STORE8:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_STORE8>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I32_STORE16:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I32_STORE16>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// i64 wrapping stores 
-		case OpCode::I64_STORE8:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_STORE8>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_STORE16:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_STORE16>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		case OpCode::I64_STORE32:
-			assert_valid(Tag<memory_immediate_type>{});
-			const auto& immed = raw_immediate().memory_immed;
-			op_func<OpCode::I64_STORE32>(
-				current_frame(call_stack), module, flags(immed), offset(immed)
-			);
-			break;
-		// misc
-		case OpCode::CURRENT_MEMORY:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::CURRENT_MEMORY>(current_frame(call_stack), module);
-			break;
-		case OpCode::GROW_MEMORY:
-			assert_valid(Tag<null_immediate_type>{});
-			op_func<OpCode::GROW_MEMORY>(current_frame(call_stack), module);
-			break;
-		/// CONST OPERATIONS
-		case OpCode::I32_CONST:
-			assert_valid(Tag<i32_immediate_type>{});
-			op_func<OpCode::I32_CONST>(current_frame(call_stack), raw_immediate().i32_immed);
-			break;
-		case OpCode::I64_CONST:
-			assert_valid(Tag<i64_immediate_type>{});
-			op_func<OpCode::I64_CONST>(current_frame(call_stack), raw_immediate().i64_immed);
-			break;
-		case OpCode::F32_CONST:
-			assert_valid(Tag<f32_immediate_type>{});
-			op_func<OpCode::F32_CONST>(current_frame(call_stack), raw_immediate().f32_immed);
-			break;
-		case OpCode::F64_CONST:
-			assert_valid(Tag<f64_immediate_type>{});
-			op_func<OpCode::F64_CONST>(current_frame(call_stack), raw_immediate().f32_immed);
-			break;
-		/// COMPARISON OPERATIONS
-		// i32 comparisons
-		case OpCode::I32_EQZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_EQZ>(current_frame(call_stack));
-			break;
-		case OpCode::I32_EQ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_EQ>(current_frame(call_stack));
-			break;
-		case OpCode::I32_NE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_NE>(current_frame(call_stack));
-			break;
-		case OpCode::I32_LT_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_LT_S>(current_frame(call_stack));
-			break;
-		case OpCode::I32_LT_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_LT_U>(current_frame(call_stack));
-			break;
-		case OpCode::I32_GT_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_GT_S>(current_frame(call_stack));
-			break;
-		case OpCode::I32_GT_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_GT_U>(current_frame(call_stack));
-			break;
-		case OpCode::I32_LE_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_LE_S>(current_frame(call_stack));
-			break;
-		case OpCode::I32_LE_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_LE_U>(current_frame(call_stack));
-			break;
-		case OpCode::I32_GE_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_GE_S>(current_frame(call_stack));
-			break;
-		case OpCode::I32_GE_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_GE_U>(current_frame(call_stack));
-			break;
-		// i64 comparisons
-		case OpCode::I64_EQZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_EQZ>(current_frame(call_stack));
-			break;
-		case OpCode::I64_EQ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_EQ>(current_frame(call_stack));
-			break;
-		case OpCode::I64_NE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_NE>(current_frame(call_stack));
-			break;
-		case OpCode::I64_LT_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_LT_S>(current_frame(call_stack));
-			break;
-		case OpCode::I64_LT_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_LT_U>(current_frame(call_stack));
-			break;
-		case OpCode::I64_GT_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_GT_S>(current_frame(call_stack));
-			break;
-		case OpCode::I64_GT_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_GT_U>(current_frame(call_stack));
-			break;
-		case OpCode::I64_LE_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_LE_S>(current_frame(call_stack));
-			break;
-		case OpCode::I64_LE_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_LE_U>(current_frame(call_stack));
-			break;
-		case OpCode::I64_GE_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_GE_S>(current_frame(call_stack));
-			break;
-		case OpCode::I64_GE_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_GE_U>(current_frame(call_stack));
-			break;
-		// f32 comparisons
-		case OpCode::F32_EQ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_EQ>(current_frame(call_stack));
-			break;
-		case OpCode::F32_NE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_NE>(current_frame(call_stack));
-			break;
-		case OpCode::F32_LT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_LT>(current_frame(call_stack));
-			break;
-		case OpCode::F32_GT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_GT>(current_frame(call_stack));
-			break;
-		case OpCode::F32_LE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_LE>(current_frame(call_stack));
-			break;
-		case OpCode::F32_GE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_GE>(current_frame(call_stack));
-			break;
-		// f64 comparisons
-		case OpCode::F64_EQ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_EQ>(current_frame(call_stack));
-			break;
-		case OpCode::F64_NE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_NE>(current_frame(call_stack));
-			break;
-		case OpCode::F64_LT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_LT>(current_frame(call_stack));
-			break;
-		case OpCode::F64_GT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_GT>(current_frame(call_stack));
-			break;
-		case OpCode::F64_LE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_LE>(current_frame(call_stack));
-			break;
-		case OpCode::F64_GE:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_GE>(current_frame(call_stack));
-			break;
-		/// NUMERIC OPERATIONS
-		// i32 operations
-		case OpCode::I32_CLZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_CLZ>();
-			break;
-		case OpCode::I32_CTZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_CTZ>();
-			break;
-		case OpCode::I32_POPCNT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_POPCNT>();
-			break;
-		case OpCode::I32_ADD:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_ADD>();
-			break;
-		case OpCode::I32_SUB:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_SUB>();
-			break;
-		case OpCode::I32_MUL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_MUL>();
-			break;
-		case OpCode::I32_DIV_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_DIV_S>();
-			break;
-		case OpCode::I32_DIV_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_DIV_U>();
-			break;
-		case OpCode::I32_REM_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_REM_S>();
-			break;
-		case OpCode::I32_REM_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_REM_U>();
-			break;
-		case OpCode::I32_AND:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_AND>();
-			break;
-		case OpCode::I32_OR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_OR>();
-			break;
-		case OpCode::I32_XOR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_XOR>();
-			break;
-		case OpCode::I32_SHL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_SHL>();
-			break;
-		case OpCode::I32_SHR_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_SHR_S>();
-			break;
-		case OpCode::I32_SHR_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_SHR_U>();
-			break;
-		case OpCode::I32_ROTL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_ROTL>();
-			break;
-		case OpCode::I32_ROTR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_ROTR>();
-			break;
-		// i64 operations
-		case OpCode::I64_CLZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_CLZ>();
-			break;
-		case OpCode::I64_CTZ:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_CTZ>();
-			break;
-		case OpCode::I64_POPCNT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_POPCNT>();
-			break;
-		case OpCode::I64_ADD:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_ADD>();
-			break;
-		case OpCode::I64_SUB:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_SUB>();
-			break;
-		case OpCode::I64_MUL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_MUL>();
-			break;
-		case OpCode::I64_DIV_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_DIV_S>();
-			break;
-		case OpCode::I64_DIV_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_DIV_U>();
-			break;
-		case OpCode::I64_REM_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_REM_S>();
-			break;
-		case OpCode::I64_REM_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_REM_U>();
-			break;
-		case OpCode::I64_AND:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_AND>();
-			break;
-		case OpCode::I64_OR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_OR>();
-			break;
-		case OpCode::I64_XOR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_XOR>();
-			break;
-		case OpCode::I64_SHL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_SHL>();
-			break;
-		case OpCode::I64_SHR_S:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_SHR_S>();
-			break;
-		case OpCode::I64_SHR_U:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_SHR_U>();
-			break;
-		case OpCode::I64_ROTL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_ROTL>();
-			break;
-		case OpCode::I64_ROTR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_ROTR>();
-			break;
-		// f32 operations
-		case OpCode::F32_ABS:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_ABS>();
-			break;
-		case OpCode::F32_NEG:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_NEG>();
-			break;
-		case OpCode::F32_CEIL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_CEIL>();
-			break;
-		case OpCode::F32_FLOOR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_FLOOR>();
-			break;
-		case OpCode::F32_TRUNC:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_TRUNC>();
-			break;
-		case OpCode::F32_NEAREST:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_NEAREST>();
-			break;
-		case OpCode::F32_SQRT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_SQRT>();
-			break;
-		case OpCode::F32_ADD:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_ADD>();
-			break;
-		case OpCode::F32_SUB:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_SUB>();
-			break;
-		case OpCode::F32_MUL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_MUL>();
-			break;
-		case OpCode::F32_DIV:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_DIV>();
-			break;
-		case OpCode::F32_MIN:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_MIN>();
-			break;
-		case OpCode::F32_MAX:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_MAX>();
-			break;
-		case OpCode::F32_COPYSIGN:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_COPYSIGN>();
-			break;
-		// f64 operations
-		case OpCode::F64_ABS:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_ABS>();
-			break;
-		case OpCode::F64_NEG:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_NEG>();
-			break;
-		case OpCode::F64_CEIL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_CEIL>();
-			break;
-		case OpCode::F64_FLOOR:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_FLOOR>();
-			break;
-		case OpCode::F64_TRUNC:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_TRUNC>();
-			break;
-		case OpCode::F64_NEAREST:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_NEAREST>();
-			break;
-		case OpCode::F64_SQRT:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_SQRT>();
-			break;
-		case OpCode::F64_ADD:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_ADD>();
-			break;
-		case OpCode::F64_SUB:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_SUB>();
-			break;
-		case OpCode::F64_MUL:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_MUL>();
-			break;
-		case OpCode::F64_DIV:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_DIV>();
-			break;
-		case OpCode::F64_MIN:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_MIN>();
-			break;
-		case OpCode::F64_MAX:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_MAX>();
-			break;
-		case OpCode::F64_COPYSIGN:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_COPYSIGN>();
-			break;
-		/// CONVERSION OPERATIONS
-		case OpCode::I32_WRAP_I64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_WRAP_I64>();
-			break;
-		// float-to-int32 tuncating conversion
-		case OpCode::I32_TRUNC_S_F32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_TRUNC_S_F32>();
-			break;
-		case OpCode::I32_TRUNC_U_F32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_TRUNC_U_F32>();
-			break;
-		case OpCode::I32_TRUNC_S_F64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_TRUNC_S_F64>();
-			break;
-		case OpCode::I32_TRUNC_U_F64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I32_TRUNC_U_F64>();
-			break;
-		// int32-to-int64 extending conversion
-		case OpCode::I64_EXTEND_S_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_EXTEND_S_I32>();
-			break;
-		case OpCode::I64_EXTEND_U_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_EXTEND_U_I32>();
-			break;
-		// float-to-int64 truncating conversion
-		case OpCode::I64_TRUNC_S_F32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_TRUNC_S_F32>();
-			break;
-		case OpCode::I64_TRUNC_U_F32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_TRUNC_U_F32>();
-			break;
-		case OpCode::I64_TRUNC_S_F64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_TRUNC_S_F64>();
-			break;
-		case OpCode::I64_TRUNC_U_F64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::I64_TRUNC_U_F64>();
-			break;
-		// int-to-float32 conversion
-		case OpCode::F32_CONVERT_S_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_CONVERT_S_I32>();
-			break;
-		case OpCode::F32_CONVERT_U_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_CONVERT_U_I32>();
-			break;
-		case OpCode::F32_CONVERT_S_I64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_CONVERT_S_I64>();
-			break;
-		case OpCode::F32_CONVERT_U_I64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_CONVERT_U_I64>();
-			break;
-		// float64-to-float32 demoting conversion
-		case OpCode::F32_DEMOTE_F64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F32_DEMOTE_F64>();
-			break;
-		// int-to-float64 conversion
-		case OpCode::F64_CONVERT_S_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_CONVERT_S_I32>();
-			break;
-		case OpCode::F64_CONVERT_U_I32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_CONVERT_U_I32>();
-			break;
-		case OpCode::F64_CONVERT_S_I64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_CONVERT_S_I64>();
-			break;
-		case OpCode::F64_CONVERT_U_I64:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_CONVERT_U_I64>();
-			break;
-		// float32-to-float64 promoting conversion
-		case OpCode::F64_PROMOTE_F32:
-			assert_valid(Tag<null_immediate_tag>{});
-			op_func<OpCode::F64_PROMOTE_F32>();
-			break;
-		}
-	}
-	
-private:
-	
-	void _assert_invariants() const
-	{
-		assert(opcode_exists(opcode()));
-		assert(end_pos() > source().data());
-		assert(source().size() > 0u);
-		std::visit(
-			[](const auto& immed) {
-				using immed_type = std::decay_t<decltype(immed)>;
-				assert(validate(Tag<immed_type>{}));
-			},
-			tagged_immediate()
-		);
-		
-	}
-
-	std::pair<CodeView, const char*> jump_over_if() const
-	{
-		assert_valid(Tag<block_immediate_type>{});
-		assert(opcode() == OpCode::IF);
-		wasm_uint32_t ofs = raw_immediate().block_immed;
-		assert(ofs > 0u);
-		assert(end_pos() > source().data());
-		auto dist = static_cast<std::size_t>(end_pos() - source().data());
-		assert(ofs < dist);
-		auto dest_pos = source().data() + ofs;
-		constexpr auto end_op = static_cast<unsigned char>(OpCode::END);
-		constexpr auto else_op = static_cast<unsigned char>(OpCode::ELSE);
-		if(dest_pos[-1] == end_op)
-		{
-			return std::make_pair(CodeView(dest_pos, end_pos()), nullptr);
-		}
-		else 
-		{
-			assert(dest_pos[-(1 + static_cast<std::ptrdiff_t>(sizeof(ofs)))] == else_op);
-			auto else_pos = dest_pos - (1 + static_cast<std::ptrdiff_t>(sizeof(ofs)));
-			std::memcpy(&ofs, else_pos + 1, sizeof(ofs));
-			return std::make_pair(CodeView(dest_pos, end_pos()), else_pos + ofs);
-		}
-	}
-
-	CodeView branch_to(const char* pos) const
-	{
-		assert(pos[-1] == static_cast<char>(OpCode::END));
-		assert(pos > source().data());
-		assert(pos < end_pos());
-		return CodeView(pos, end_pos());
-	}
-
-	CodeView jump_over_else() const
+	else
 	{
-		assert_valid(Tag<offset_immediate_tag>{});
-		assert(opcode() == OpCode::ELSE);
-		wasm_uint32_t ofs = raw_immediate().block_immed;
-		assert(ofs > 0u);
-		assert(end_pos() > source().data());
-		auto dist = static_cast<std::size_t>(end_pos() - source().data());
-		assert(ofs < dist);
-		auto dest_pos = source().data() + ofs;
-		assert(dest_pos[-1] == static_cast<char>(OpCode::END));
-		return CodeView(dest_pos, end_pos());
+		return std::make_pair(std::monostate{}, first);
 	}
+}
 
-	using null_immediate_type         = std::monostate;
-	using i32_immediate_type          = wasm_sint32_t;
-	using i64_immediate_type          = wasm_sint64_t;
-	using f32_immediate_type          = wasm_float32_t;
-	using f64_immediate_type          = wasm_float64_t;
-	using offset_immediate_type       = wasm_uint32_t;
-	using memory_immediate_type       = MemoryImmediate;
-	using block_immediate_type        = BlockImmediate;
-	using loop_immediate_type         = LanguageType;
-	using branch_table_immediate_type = BranchTableImmediate;
-
-	const i32_immediate_type& i32_immed() const;
-	const i64_immediate_type& i64_immed() const;
-	const f32_immediate_type& f32_immed() const;
-	const f64_immediate_type& f64_immed() const;
-	const offset_immediate_type& offset_immed() const;
-	const memory_immediate_type& memory_immed() const;
-	const memory_immediate_type& memory_immed() const;
-
-	const OpCode& opcode() const
-	{
-		assert(source_.data().size() > 0u);
-		assert(opcode_exists(source_.data().front()));
-		return source_.data().front();
-	}
+} /* namespace detail */
 
+/// Type of the (decoded) immediate of a lowered 'Op'.
+template <OpCode Op>
+using immediate_t = typename decltype(
+	detail::read_immediate<Op>(std::declval<const char*>(), std::declval<const char*>())
+)::first_type;
 
-	struct LazyImmediate {
-		std::size_t consumed;
-		immediate_type;
-	};
-	/// Code from which this instruction was decoded.
-	const CodeView source_;
-	/// Raw union of possible immediate operand alternatives, discriminated by 'this->opcode'.
-	std::optional<const LazyImmediate> immediate_;
-};
+struct WasmInstruction;
 
+/// The lowered code of a function from some instruction to the end of the
+/// function.  Execution walks a function's code one 'WasmInstruction' at a
+/// time, and branches by jumping views forward or to a block's label.
 struct CodeView
 {
-	struct Iterator;
-	using value_type = WasmInstruction;
-	using pointer = WasmInstruction*;
-	using const_pointer = const WasmInstruction*;
-	using reference = WasmInstruction&;
-	using const_reference = WasmInstruction&;
-	using size_type = std::string_view::size_type;
-	using difference_type = std::string_view::difference_type;
-	using iterator = Iterator;
-	using const_iterator = iterator;
-
-private:
-
-	template <LanguageType LT, LanguageType ... V>
-	static constexpr const bool match_one_of_v
-		= ((LT == V) or ...);
-
+	/// The whole of 'func's code.  Defined with 'WasmFunction'.
+	CodeView(const WasmFunction& func);
 
+	/// 'func's code from 'pos', which must lie within it.
+	CodeView(const WasmFunction& func, const char* pos);
 
-	struct InstructionVisitor {
-
-		template <class ... T>
-		WasmInstruction operator()(
-			const char* first,
-			const char* last,
-			const char* pos,
-			OpCode op,
-			T&& ... args
-		)
-		{
-			assert(first < pos);
-			assert(pos <= last);
-			return make_instr(
-				std::string_view(first, pos - first),
-				op,
-				last,
-				std::forward<T>(args)...
-			);
-		}
-
-
-	private:
-		
-		
-		// Overload for instructions with immediate operands
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last)
-		{ return WasmInstruction(view, op, last, std::monostate()); }
-
-		template <
-			class T,
-			/* enable overloads for the simple alternatives. */
-			class = std::enable_if_t<
-				std::disjunction_v<
-					std::is_same_v<std::decay_t<T>, wasm_uint32_t>,
-					std::is_same_v<std::decay_t<T>, wasm_sint32_t>,
-					std::is_same_v<std::decay_t<T>, wasm_sint64_t>,
-					std::is_same_v<std::decay_t<T>, wasm_float32_t>,
-					std::is_same_v<std::decay_t<T>, wasm_float64_t>
-				>
-			>
-		>
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, T&& arg)
-		{ return WasmInstruction(view, op, last, std::forward<T>(arg)); }
-
-		/// Loop overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, LanguageType tp)
-		{ return WasmInstruction(view, op, last, tp); }
-
-		/// Branch table overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, const char* base, wasm_uint32_t len)
-		{
-			assert(last > base);
-			std::size_t byte_count = base - last;
-			std::size_t bytes_needed = sizeof(wasm_uint32_t) * (len + 1u);
-			assert(byte_count >= bytes_needed);
-			// the table and 'view' should end at the same byte address
-			assert(view.data() + view.size() == (base + (len + 1u) * sizeof(wasm_uint32_t)));
-			using buffer_type = const char[sizeof(wasm_uint32_t)];
-			auto table = gsl::span<buffer_type>(reinterpret_cast<buffer_type*>(base), len + 1u);
-			return WasmInstruction(view, op, last, table);
-		}
-
-		/// Block overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, LanguageType tp, wasm_uint32_t label)
-		{ return WasmInstruction(view, op, last, BlockImmediate(tp, label)); }
-
-		/// Memory overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, wasm_uint32_t flags, wasm_uint32_t offset)
-		{ return WasmInstruction(view, op, last, MemoryImmediate(flags, offset)); }
-
-		/// Invalid opcode overload
-		[[noreturn]]
-		WasmInstruction make_instr(std::string_view, OpCode, const char*, const BadOpCodeError& err)
-		{ throw err; }
-
-	};
-
-public:
-	
-	struct Iterator {
-		using value_type = CodeView::value_type;
-		using difference_type = CodeView::difference_type;
-		using pointer = CodeView::pointer;
-		using reference = CodeView::value_type;
-		using iterator_category = std::input_iterator_tag;
-		
-		friend bool operator==(const Iterator& left, const Iterator& right)
-		{ return left.code_ == right.code_; }
-		
-		friend bool operator!=(const Iterator& left, const Iterator& right)
-		{ return not (left == right); }
-	private:
-		gsl::not_null<CodeView*> code_;
-	};
-
-	CodeView(const WasmFunction& func):
-		function_(&func),
-		code_(code(func))
+	CodeView(const WasmFunction* func, std::string_view code):
+		function_(func),
+		code_(code)
 	{
 		
 	}
@@ -2427,214 +1289,55 @@ public:
 	const WasmFunction* function() const
 	{ return function_; }
 
+	const char* pos() const
+	{ return code_.data(); }
+
+	std::size_t size() const
+	{ return code_.size(); }
+
+	bool done() const
+	{ return code_.empty(); }
+
 	OpCode current_op() const
 	{
 		assert(ready());
-		return static_cast<WasmInstruction>(code_.front());
+		return static_cast<OpCode>(code_.front());
 	}
 
-	bool done() const
-	{ return not code_.empty(); }
-
-	const char* pos() const
-	{ return code_.data(); }
-
+	/// Move forward to 'other', a later position in the same function.
 	void advance(const CodeView& other)
 	{
 		assert(function() == other.function());
-		assert(ready());
 		assert(code_.data() + code_.size() == other.code_.data() + other.code_.size());
-		assert(code_.data() < other.code_.data());
+		assert(code_.data() <= other.code_.data());
 		code_ = other.code_;
 	}
 
-	std::optional<WasmInstruction> next_instruction() const
-	{
-		if(code_.size() == 0)
-			return std::nullopt;
-		return visit_opcode(
-			opcode(),
-			[&](auto opcode) {
-				return visit_op_impl(
-					[&](auto first, auto pos, auto last, auto op, auto&& immed) {
-						return WasmInstruction(*this, pos, std::forward<decltype(immed)>(immed));
-					},
-					opcode
-				);
-			}
-		);
-	}
-
-	std::optional<CodeView> advance(
-		WasmModule& module,
-		WasmCallStack<T>& call_stack
-	)
-	{
-		if(code_.size() == 0)
-			return std::nullopt;
-		auto vis = [&](auto first, auto pos, auto last, auto op, const auto& immed) {
-			return dispatch(call_stack, module, first, pos, last, op, immed);
-		};
-	}
+	/// Decode the instruction at the front of this view, if any.
+	std::optional<WasmInstruction> next_instruction() const;
 
+	/// The view 'jump_dist' bytes further into the code.
 	CodeView jump(wasm_uint32_t jump_dist) const
 	{
-		using pair_type = std::pair<CodeView, std::optional<CodeView>>;
 		assert(jump_dist > 0u);
-		assert(code_.size() > jump_dist);
+		assert(code_.size() >= jump_dist);
 		CodeView dest = *this;
 		dest.code_.remove_prefix(jump_dist);
 		return dest;
 	}
-	
-private:
-	template <class T, OpCode Op, class ImmediateType>
-	CodeView dispatch(
-		WasmCallStack<T>& call_stack,
-		WasmModule& module,
-		const char* first,
-		const char* pos,
-		const char* last,
-		std::integral_constant<OpCode, Op> op,
-		const ImmediateType& immed
-	)
-	{
-		auto after = *this;
-		after.code_.remove_prefix(pos - first);
-		return op_func<Op>(call_stack, module, *this, after, immed);
-	}
 
-	template <class Vis, class T, OpCode Op>
-	decltype(auto) visit_op_impl(Vis&& visitor, std::integral_constant<OpCode, Op> op) {
-		auto first = code_.data();
-		auto last = first + code_.size();
+	friend bool operator==(const CodeView& left, const CodeView& right)
+	{ return left.code_.data() == right.code_.data() and left.code_.size() == right.code_.size(); }
 
-		assert(first < last);
-		assert(*first == Op);
+	friend bool operator!=(const CodeView& left, const CodeView& right)
+	{ return not (left == right); }
 
-		if constexpr(op >= OpCode::I32_LOAD and op <= OpCode::I64_STORE32)
-		{
-			auto [flags, offset, pos] = detail::read_memory_immediate(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, MemoryImmediateType(flags, offset)
-			);
-		}
-		else if constexpr(
-			(op >= OpCode::GET_LOCAL and op <= OpCode::SET_GLOBAL)
-			or op == OpCode::CALL
-			or op == OpCode::CALL_INDIRECT
-			or op == OpCode::BR
-			or op == OpCode::BR_IF
-			or op == OpCode::ELSE
-		)
-		{
-			auto [value, pos] = detail::read_serialized_immediate<wasm_uint32_t>(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor), first, pos, last, op, value
-			);
-		}
-		else if constexpr(op == OpCode::BLOCK)
-		{
-			auto pos = first + 1u;
-			assert(pos < last);
-			LanguageType tp = static_cast<LanguageType>(*pos++);
-			wasm_uint32_t label;
-			std::tie(label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, BlockImmediate(tp, label)
-			);
-		}
-		else if constexpr(op == OpCode::IF)
-		{
-			auto pos = first + 1u;
-			assert(pos < last);
-			LanguageType tp = static_cast<LanguageType>(*pos++);
-			wasm_uint32_t end_label;
-			wasm_uint32_t else_label;
-			std::tie(end_label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
-			std::tie(else_label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, IfImmediate(tp, end_label, else_label)
-			);
-		}
-		else if constexpr(op == OpCode::LOOP)
-		{
-			auto pos = first + 1u;
-			assert(pos < last);
-			LanguageType tp = static_cast<LanguageType>(*pos++);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, BlockImmediate(tp, label)
-			);
-		}
-		else if constexpr(op == OpCode::BR_TABLE)
-		{
-			wasm_uint32_t len;
-			std::tie(len, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
-			auto table_base = pos;
-			auto table_size = (1u + len);
-			assert(last - pos > table_size);
-			std::advance(pos, table_size * sizeof(wasm_uint32_t));
-			using table_elem_type = const char[sizeof(wasm_uint32_t)];
-			auto table = gsl::span<table_elem_type>(
-				reinterpret_cast<table_elem_type*>(table_base),
-				table_size
-			);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, table
-			);
-		}
-		else if constexpr(Op == OpCode::I32_CONST)
-		{
-			auto [v, pos] = detail::read_serialized_immediate<wasm_sint32_t>(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, table
-			);
-		}
-		else if constexpr(Op == OpCode::I64_CONST)
-		{
-			auto [v, pos] = detail::read_serialized_immediate<wasm_sint64_t>(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, table
-			);
-		}
-		else if constexpr(Op == OpCode::F32_CONST)
-		{
-			auto [v, pos] = detail::read_serialized_immediate<wasm_float32_t>(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, table
-			);
-		}
-		else if constexpr(Op == OpCode::F64_CONST)
-		{
-			auto [v, pos] = detail::read_serialized_immediate<wasm_float64_t>(first + 1u, last);
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, table
-			);
-		}
-		else
-		{
-			assert(opcode_exists(Op));
-			return std::invoke(
-				std::forward<Vis>(visitor),
-				first, pos, last, op, std::monostate{}
-			);
-		}
-	}
- 
+private:
 	bool ready() const
 	{
 		if(done())
 			return false;
-		assert(opcode_exists(code_.front()));
+		assert(opcode_exists(static_cast<wasm_ubyte_t>(code_.front())));
 		return true;
 	}
 
@@ -2642,6 +1345,85 @@ private:
 	std::string_view code_;
 };
 
+/// One decoded instruction of a function's lowered code: its opcode, the
+/// bytes it was decoded from, and its immediate, if it has one.
+struct WasmInstruction
+{
+	using immediate_type = std::variant<
+		std::monostate,
+		wasm_sint32_t,
+		wasm_sint64_t,
+		wasm_float32_t,
+		wasm_float64_t,
+		wasm_uint32_t,
+		MemoryImmediate,
+		CallIndirectImmediate,
+		BlockImmediate,
+		IfImmediate,
+		BlockType,
+		BranchTableImmediate
+	>;
+
+	/// The instruction at the front of 'code', 'size' bytes long (opcode
+	/// and immediates).
+	WasmInstruction(const CodeView& code, std::size_t size, immediate_type immed):
+		code_(code),
+		size_(size),
+		immediate_(std::move(immed))
+	{
+		assert(size_ > 0u);
+		assert(size_ <= code_.size());
+	}
+
+	OpCode opcode() const
+	{ return code_.current_op(); }
+
+	/// The bytes this instruction was decoded from.
+	std::string_view source() const
+	{ return std::string_view(code_.pos(), size_); }
+
+	/// The function's code from this instruction on.
+	const CodeView& code() const
+	{ return code_; }
+
+	/// The function's code from the instruction after this one on.
+	CodeView after() const
+	{
+		CodeView next = code_;
+		next.advance(CodeView(code_.function(), std::string_view(code_.pos() + size_, code_.size() - size_)));
+		return next;
+	}
+
+	const immediate_type& immediate() const
+	{ return immediate_; }
+
+	/// Execute this instruction and return where execution continues.
+	/// Defined with the ops, in 'vm/op/ops.h'.
+	template <class CallStack, class Module>
+	CodeView execute(CallStack& call_stack, Module& module) const;
+
+private:
+	CodeView code_;
+	std::size_t size_;
+	immediate_type immediate_;
+};
+
+inline std::optional<WasmInstruction> CodeView::next_instruction() const
+{
+	if(not ready())
+		return std::nullopt;
+	const char* first = code_.data();
+	const char* last = first + code_.size();
+	return visit_opcode(current_op(), [&](auto op) -> std::optional<WasmInstruction> {
+		auto [immed, pos] = detail::read_immediate<decltype(op)::value>(first + 1, last);
+		assert(pos <= last);
+		return WasmInstruction(
+			*this,
+			static_cast<std::size_t>(pos - first),
+			WasmInstruction::immediate_type(std::in_place_type<decltype(immed)>, immed)
+		);
+	});
+}
 
 } /* namespace opc */
 } /* namespace wasm */
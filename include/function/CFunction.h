@@ -1,9 +1,17 @@
 #ifndef CFUNCTION_H
 #define CFUNCTION_H
 
+#include <cassert>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <gsl/span>
 #include "wasm_base.h"
 #include "wasm_value.h"
+#include "function/WasmFunctionSignature.h"
 
 namespace wasm {
 
@@ -29,8 +37,8 @@ inline constexpr const bool is_valid_wasm_value_type_v
 
 } /* namespace detail */
 
-template <class Results, class ... Args>
-struct CFunctionImpl;
+template <class FunctionType>
+struct CFunctionWrapper;
 
 
 struct CFunctionWrapperBase
@@ -46,10 +54,10 @@ struct CFunctionWrapperBase
 	virtual const WasmFunctionSignature& signature() const = 0;
 
 	auto return_types() const
-	{ return return_types(signature()); }
+	{ return wasm::return_types(signature()); }
 
 	auto param_types() const
-	{ return param_types(signature()); }
+	{ return wasm::param_types(signature()); }
 
 	std::size_t return_count() const
 	{ return return_types().size(); }
@@ -81,9 +89,38 @@ struct CFunctionWrapperBase
 		invoke_impl(results, args);
 	}
 
+	/// @name Trampolines
+	/// Call the wrapped function with its arguments read from, and its results
+	/// written to, consecutive operand stack slots starting at 'slots' (which
+	/// must hold 'max(param_count(), return_count())' values).  Unlike
+	/// 'invoke()', no arity or type checks are performed: the signature is
+	/// checked once, when the import is linked.
+	/// @{
+	template <class Slot>
+	using trampoline_type = void (*)(CFunctionWrapperBase&, Slot*);
+
+	template <class Slot>
+	trampoline_type<Slot> trampoline() const
+	{
+		static_assert(
+			std::is_same_v<Slot, WasmValue> or std::is_same_v<Slot, TaggedWasmValue>
+		);
+		if constexpr(std::is_same_v<Slot, TaggedWasmValue>)
+			return tagged_trampoline_;
+		else
+			return trampoline_;
+	}
+	/// @}
 
 protected:
-	CFunctionWrapperBase() = default;
+	CFunctionWrapperBase(
+		trampoline_type<WasmValue> tramp, 
+		trampoline_type<TaggedWasmValue> tagged_tramp
+	):
+		trampoline_(tramp), tagged_trampoline_(tagged_tramp)
+	{
+		
+	}
 private:
 	virtual void invoke_impl(
 		gsl::span<WasmValue> results, 
@@ -95,9 +132,11 @@ private:
 		gsl::span<const TaggedWasmValue> args
 	) = 0;
 
+	const trampoline_type<WasmValue> trampoline_;
+	const trampoline_type<TaggedWasmValue> tagged_trampoline_;
 };
 
-template <class InvocableType, class ExposedType>
+template <class InvocableType, class ExposedType, bool IsAsync = false>
 struct CFunctionWrapperImpl;
 
 template <class ... Results, class ... Args>
@@ -110,6 +149,7 @@ struct CFunctionWrapper<std::tuple<Results...> (Args ...)>:
 	using result_type = std::tuple<Results...>;
 	using function_type = result_type(Args ...);
 	using self_type = CFunctionWrapper<std::tuple<Results...> (Args ...)>;
+	using base_type = CFunctionWrapperBase;
 
 	template <class InvocableType>
 	static constexpr const bool can_store_value 
@@ -121,7 +161,7 @@ struct CFunctionWrapper<std::tuple<Results...> (Args ...)>:
 	CFunctionWrapper& operator=(const CFunctionWrapper&) = delete;
 	CFunctionWrapper& operator=(CFunctionWrapper&&) = delete;
 
-	virtual ~CFunctionWrapperImpl() override = default;
+	virtual ~CFunctionWrapper() override = default;
 
 	static constexpr std::size_t return_count()
 	{ return sizeof...(Results); }
@@ -135,9 +175,9 @@ struct CFunctionWrapper<std::tuple<Results...> (Args ...)>:
 		{
 			// lazily construct the signature
 			signature_.emplace(
-				{language_type_value_v<Results>...}, 
-				{language_type_value_v<Args>...}
-			)
+				std::initializer_list<LanguageType>{language_type_value_v<Results>...}, 
+				std::initializer_list<LanguageType>{language_type_value_v<Args>...}
+			);
 		}
 		return *signature_;
 	}
@@ -145,7 +185,14 @@ struct CFunctionWrapper<std::tuple<Results...> (Args ...)>:
 protected:
 	virtual result_type call(Args ... args) = 0;
 
-	CFunctionWrapper() = default;
+	CFunctionWrapper(
+		trampoline_type<WasmValue> tramp, 
+		trampoline_type<TaggedWasmValue> tagged_tramp
+	):
+		CFunctionWrapperBase(tramp, tagged_tramp)
+	{
+		
+	}
 
 private:	
 	void invoke_impl(gsl::span<WasmValue> results, gsl::span<const WasmValue> args) final override
@@ -176,7 +223,7 @@ private:
 		);
 	}
 
-	template <class T, std::size_t ... ArgIndex, std::size_t ResultIndex>
+	template <class T, std::size_t ... ArgIndex, std::size_t ... ResultIndex>
 	void do_call(
 		gsl::span<T> results,
 		gsl::span<const T> args,
@@ -196,8 +243,12 @@ private:
 	mutable std::optional<const WasmFunctionSignature> signature_;
 };
 
-template <class InvocableType, class ... Results, class ... Args>
-struct CFunctionWrapperImpl<InvocableType, std::tuple<Results...>(Args...)> final:
+/// 'IsAsync' wrappers are async host imports: 'InvocableType' takes the
+/// arguments and returns nothing, after starting an operation that completes
+/// later.  Calling one suspends the calling guest until the embedder passes
+/// the import's results to 'RunContext::resume()'.
+template <class InvocableType, bool IsAsync, class ... Results, class ... Args>
+struct CFunctionWrapperImpl<InvocableType, std::tuple<Results...>(Args...), IsAsync> final:
 	public CFunctionWrapper<std::tuple<Results...>(Args...)>
 {
 private:
@@ -205,16 +256,17 @@ private:
 	using exposed_type = result_type(Args...);
 	using function_type = exposed_type;
 	using base_type = CFunctionWrapper<exposed_type>;
-	using self_type = CFunctionWrapperImpl<InvocableType, ExposedType>;
+	using self_type = CFunctionWrapperImpl<InvocableType, exposed_type, IsAsync>;
 
-	static constexpr const bool is_valid
-		= std::is_invocable_r_v<result_type, InvocableType, Args ...>;
+	static constexpr const bool is_valid = IsAsync
+		? std::is_invocable_v<InvocableType, Args ...>
+		: std::is_invocable_r_v<result_type, InvocableType, Args ...>;
 public:
 	static_assert(is_valid, "Cannot store given type in CFunctionWrapper.");
 
 	template <class ... Arguments>
 	CFunctionWrapperImpl(Arguments&& ... args):
-		base_type(),
+		base_type(&trampoline<WasmValue>, &trampoline<TaggedWasmValue>),
 		value_(std::forward<Arguments>(args) ...)
 	{
 		
@@ -229,9 +281,48 @@ public:
 	CFunctionWrapperImpl& operator=(CFunctionWrapperImpl&&) = delete;
 
 	result_type call(Args ... args) final override 
-	{ return std::invoke(value_, args); }
+	{
+		// async imports can only be called by a guest, which they suspend.
+		if constexpr(IsAsync)
+			throw std::bad_function_call();
+		else
+			return std::invoke(value_, args...);
+	}
 
 private:
+	template <class Slot>
+	static void trampoline(CFunctionWrapperBase& self, Slot* slots)
+	{
+		call_in_place(
+			static_cast<CFunctionWrapperImpl&>(self).value_,
+			slots,
+			std::index_sequence_for<Args...>{},
+			std::index_sequence_for<Results...>{}
+		);
+	}
+
+	template <class Slot, std::size_t ... ArgIndex, std::size_t ... ResultIndex>
+	static void call_in_place(
+		InvocableType& func,
+		Slot* slots,
+		std::index_sequence<ArgIndex ...>,
+		std::index_sequence<ResultIndex ...>
+	)
+	{
+		if constexpr(IsAsync)
+		{
+			// the results are written when the guest is resumed.
+			std::invoke(func, slots[ArgIndex].get(tp::member<Args>())...);
+		}
+		else
+		{
+			// every argument is read before the first result overwrites its slot.
+			result_type results = std::invoke(func, slots[ArgIndex].get(tp::member<Args>())...);
+			((slots[ResultIndex] = Slot(tp::member<Results>(), std::get<ResultIndex>(results))), ...);
+			(void)results;
+		}
+	}
+
 	InvocableType value_;
 };
 
@@ -264,10 +355,23 @@ struct CFunction
 	{ return impl_->signature(); }
 
 	std::size_t return_count() const
-	{ return impl_->return_count(); }
+	{ return return_count_; }
 
 	std::size_t param_count() const
-	{ return impl_->param_count(); }
+	{ return param_count_; }
+
+	/// Whether calling this import suspends the calling guest (see
+	/// 'make_async_c_function()').
+	bool is_async() const
+	{ return is_async_; }
+
+	/// Call on operand stack slots (see 'CFunctionWrapperBase::trampoline()').
+	template <class Slot>
+	void call_in_place(Slot* slots) const
+	{
+		assert(impl_);
+		impl_->template trampoline<Slot>()(*impl_, slots);
+	}
 
 private:
 	using pointer = std::shared_ptr<CFunctionWrapperBase>;
@@ -275,21 +379,44 @@ private:
 	template <class WasmFunctionType, class InvocableType>
 	friend CFunction make_c_function(InvocableType&& func)
 	{
-		using wrapper_type = CFunctionWrapperImpl<std::decay_t<InvocableType>, FunctionType>;
+		using wrapper_type = CFunctionWrapperImpl<std::decay_t<InvocableType>, WasmFunctionType>;
 		auto ptr = std::make_shared<wrapper_type>(std::forward<InvocableType>(func));
 		return CFunction(std::move(ptr));
 	}
 
-	template <class F, class I>
-	CFunction(std::make_shared<CFunctionWrapperImpl<F, I> p):
-		impl_(static_cast<pointer>(p))
+	/// An async host import of type 'WasmFunctionType'.  'func' takes the
+	/// arguments, starts the operation and returns nothing; the calling
+	/// guest is suspended until the embedder resumes it with the results.
+	template <class WasmFunctionType, class InvocableType>
+	friend CFunction make_async_c_function(InvocableType&& func)
+	{
+		using wrapper_type = CFunctionWrapperImpl<std::decay_t<InvocableType>, WasmFunctionType, true>;
+		auto ptr = std::make_shared<wrapper_type>(std::forward<InvocableType>(func));
+		return CFunction(std::move(ptr));
+	}
+
+	template <class F, class I, bool A>
+	CFunction(std::shared_ptr<CFunctionWrapperImpl<F, I, A>> p):
+		impl_(static_cast<pointer>(std::move(p))),
+		param_count_(CFunctionWrapperImpl<F, I, A>::param_count()),
+		return_count_(CFunctionWrapperImpl<F, I, A>::return_count()),
+		is_async_(A)
 	{
 		
 	}
 
 	pointer impl_;
+	// cached so that calls need not consult the signature.
+	std::size_t param_count_;
+	std::size_t return_count_;
+	bool is_async_;
 };
 
+template <class WasmFunctionType, class InvocableType>
+CFunction make_c_function(InvocableType&& func);
+
+template <class WasmFunctionType, class InvocableType>
+CFunction make_async_c_function(InvocableType&& func);
 
 } /* namespace wasm */
 
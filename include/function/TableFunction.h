@@ -0,0 +1,74 @@
+#ifndef FUNCTION_TABLE_FUNCTION_H
+#define FUNCTION_TABLE_FUNCTION_H
+
+#include "function/WasmFunctionSignature.h"
+#include "function/WasmFunction.h"
+#include "function/CFunction.h"
+#include <cassert>
+
+namespace wasm {
+
+struct WasmModule;
+
+/// An element of a 'WasmTable'.  The callee's canonical signature id is stored
+/// inline so that 'CALL_INDIRECT' can type-check it without touching the callee.
+struct TableFunction
+{
+	TableFunction() = default;
+
+	/// A wasm function.  'slot' is the function's entry in the index space
+	/// of the instance that stored it, which may still be an unresolved
+	/// import; 'id' is the function's declared signature.  Like a direct
+	/// call of an imported function, a call through the table runs the
+	/// callee in the calling instance: calls across instances are not
+	/// supported.
+	TableFunction(const WasmFunction* const& slot, signature_id_t id):
+		sig_id(id),
+		code(std::addressof(slot)),
+		wasm_callee(true)
+	{
+
+	}
+
+	/// A host function.
+	TableFunction(const CFunction& func):
+		sig_id(signature_id(func.signature())),
+		code(std::addressof(func)),
+		wasm_callee(false)
+	{
+
+	}
+
+	bool is_null() const
+	{ return sig_id == null_signature_id; }
+
+	bool is_wasm_function() const
+	{ return wasm_callee; }
+
+	bool is_c_function() const
+	{ return not (is_null() or is_wasm_function()); }
+
+	/// The wasm callee, or null if it is an import that hasn't been resolved yet.
+	const WasmFunction* get_wasm_function() const
+	{
+		assert(is_wasm_function());
+		return *static_cast<const WasmFunction* const*>(code);
+	}
+
+	const CFunction& get_c_function() const
+	{
+		assert(is_c_function());
+		return *static_cast<const CFunction*>(code);
+	}
+
+	/// Canonical id of the callee's signature.  'null_signature_id' if the element is empty.
+	signature_id_t sig_id = null_signature_id;
+	/// The callee: the index space slot of a 'WasmFunction' if 'wasm_callee'
+	/// is set, otherwise a 'CFunction'.
+	const void* code = nullptr;
+	bool wasm_callee = false;
+};
+
+} /* namespace wasm */
+
+#endif /* FUNCTION_TABLE_FUNCTION_H */
@@ -1,10 +1,29 @@
 #ifndef FUNCTION_WASM_FUNCTION_H
 #define FUNCTION_WASM_FUNCTION_H
 #include "WasmInstruction.h"
+#include "x3binparse.h"
+#include "function/WasmFunctionSignature.h"
+#include "utilities/SimpleVector.h"
+#include <gsl/span>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace wasm {
 
+struct WasmFunction;
+
+/// Monomorphic inline cache for one 'CALL_INDIRECT' site.  Remembers the last
+/// callee that passed the site's signature check; a function's signature never
+/// changes, so finding the same callee in the table again needs no check at all.
+struct IndirectCallCache
+{
+	std::atomic<const WasmFunction*> target{nullptr};
+};
+
 struct WasmFunction
 {
 	using wasm_external_kind_type = WasmFunctionSignature;
@@ -12,12 +31,63 @@ struct WasmFunction
 	using string_type = std::basic_string<opcode_type>;
 	using code_view_type = std::basic_string_view<opcode_type>;
 
-	WasmFunction(const WasmFunctionSignature& sig, parse::FunctionBody&& body):
+	/// Shared by all functions of a module that was loaded with 'parse::lazy_module'.
+	struct LazyCode {
+		/// Keeps the encoded function bodies alive until they are lowered.
+		std::shared_ptr<const std::string> source;
+		/// Index spaces the function bodies are validated against.
+		std::shared_ptr<const parse::ValidationContext> context;
+		/// The cost table to meter the bodies with, if any.
+		std::shared_ptr<const parse::FuelCosts> fuel_costs;
+	};
+
+	/// Everything a direct 'CALL' needs to know about its callee, in one
+	/// record.  Modules resolve their call targets to entries at link time.
+	struct Entry {
+		const WasmFunction* function;
+		wasm_uint32_t param_count;
+		wasm_uint32_t return_count;
+		/// Params plus locals.  Set together with 'code'.
+		wasm_uint32_t frame_size;
+		/// The lowered code; null until the body has been lowered.
+		std::atomic<const opcode_type*> code;
+
+		bool is_lowered() const
+		{ return static_cast<bool>(code.load(std::memory_order_acquire)); }
+	};
+
+	/// 'index' is the function's position in the module's function index
+	/// space, imports included.  It is only needed to validate a body that
+	/// is lowered lazily.
+	WasmFunction(
+		const WasmFunctionSignature& sig,
+		parse::FunctionBody&& body,
+		std::shared_ptr<const LazyCode> lazy = nullptr,
+		wasm_uint32_t index = 0
+	):
 		name_(""),
 		sig_(sig),
-		code_(std::move(body.code)),
-		locals_(body.locals.begin(), body.locals.end())
+		sig_id_(signature_id(sig)),
+		code_(reinterpret_cast<const opcode_type*>(body.code.data()), body.code.size()),
+		locals_(body.locals.begin(), body.locals.end()),
+		encoded_(body.encoded),
+		lazy_(body.is_lowered() ? nullptr : std::move(lazy)),
+		index_(index),
+		entry_{
+			this,
+			static_cast<wasm_uint32_t>(param_count(sig)),
+			static_cast<wasm_uint32_t>(return_count(sig)),
+			0u,
+			nullptr
+		}
 	{
+		assert(body.is_lowered() or lazy_);
+		assert(body.is_lowered() or encoded_in_source());
+		if(body.is_lowered())
+		{
+			allocate_call_caches(body.call_sites);
+			publish_entry();
+		}
 		body.locals.clear(); // release this memory sooner rather than later.
 	}
 		
@@ -25,28 +95,121 @@ struct WasmFunction
 	{ return f.name_; }
 
 	friend code_view_type code(const WasmFunction& f)
-	{ return f.code_; }
+	{
+		f.ensure_lowered();
+		return f.code_;
+	}
 
 	friend const WasmFunctionSignature& signature(const WasmFunction& f) 
 	{ return f.signature(); }
 
-	const WasmFunctionSignature& signature(f) 
-	{ return f.signature_; }
+	friend const Entry& entry(const WasmFunction& f)
+	{ return f.entry_; }
+
+	/// Canonical id of this function's signature.
+	friend signature_id_t signature_id(const WasmFunction& f)
+	{ return f.sig_id_; }
+
+	/// The inline cache of this function's 'slot'th indirect call site.
+	friend IndirectCallCache& indirect_call_cache(const WasmFunction& f, wasm_uint32_t slot)
+	{
+		assert(slot < f.call_site_count_);
+		return f.call_caches_[slot];
+	}
 
 	friend gsl::span<const LanguageType> locals(const WasmFunction& f)
-	{ return gsl::span<const LanguageType>(locals_.data(), locals_.size()); }
+	{
+		f.ensure_lowered();
+		return gsl::span<const LanguageType>(f.locals_.data(), f.locals_.size());
+	}
 
 	
 	friend void assign_name(WasmFunction& f, std::string&& name)
 	{
-		assert(name_.empty());
+		assert(f.name_.empty());
 		f.name_ = std::move(name);
 	}
+
+	/// Lower and validate the body on first use.  Safe to call concurrently;
+	/// the body is lowered exactly once.  If lowering fails, the error
+	/// propagates to the caller and the next call tries again.
+	void ensure_lowered() const
+	{
+		if(lazy_)
+			std::call_once(lowered_, [this]() { lower(); });
+	}
 private:
+	const WasmFunctionSignature& signature() const
+	{ return sig_; }
+
+	void lower() const
+	{
+		namespace x3 = boost::spirit::x3;
+		parse::FunctionValidator validator(*lazy_->context, index_);
+		parse::FunctionBody body;
+		auto first = encoded_.data();
+		auto last = first + encoded_.size();
+		auto parse_body = [&](const auto& parser) {
+			return x3::parse(first, last, parser, body);
+		};
+		auto validated_body
+			= x3::with<parse::codeparse::validator_tag>(std::ref(validator))[parse::function_body];
+		bool matched = lazy_->fuel_costs
+			? parse_body(
+				x3::with<parse::codeparse::fuel_costs_tag>(std::cref(*lazy_->fuel_costs))[validated_body]
+			)
+			: parse_body(validated_body);
+		if(not matched or first != last)
+			throw parse::InvalidCodeError("Malformed function body.");
+		code_ = string_type(
+			reinterpret_cast<const opcode_type*>(body.code.data()), 
+			body.code.size()
+		);
+		locals_ = SimpleVector<LanguageType>(body.locals.begin(), body.locals.end());
+		allocate_call_caches(body.call_sites);
+		publish_entry();
+	}
+
+	void publish_entry() const
+	{
+		entry_.frame_size = entry_.param_count + static_cast<wasm_uint32_t>(locals_.size());
+		entry_.code.store(code_.data(), std::memory_order_release);
+	}
+
+	void allocate_call_caches(wasm_uint32_t count) const
+	{
+		call_site_count_ = count;
+		if(count > 0u)
+			call_caches_ = std::make_unique<IndirectCallCache[]>(count);
+	}
+
+	/// Whether 'encoded_' lies within 'lazy_->source', which keeps it alive.
+	bool encoded_in_source() const
+	{
+		const std::string& source = *lazy_->source;
+		std::less_equal<const char*> le;
+		return le(source.data(), encoded_.data())
+			and le(encoded_.data() + encoded_.size(), source.data() + source.size());
+	}
+
 	std::string name_;
 	const WasmFunctionSignature sig_;
-	const std::basic_string<opcode_type> code_;
-	const SimpleVector<LanguageType> locals_;
+	const signature_id_t sig_id_;
+	/// @name Lowered body
+	/// Written at most once, by 'ensure_lowered()', if 'lazy_' is set.
+	/// @{
+	mutable std::basic_string<opcode_type> code_;
+	mutable SimpleVector<LanguageType> locals_;
+	mutable wasm_uint32_t call_site_count_ = 0;
+	mutable std::unique_ptr<IndirectCallCache[]> call_caches_;
+	/// @}
+	/// The encoded body; empty if the body was lowered at load time.
+	const std::string_view encoded_;
+	const std::shared_ptr<const LazyCode> lazy_;
+	/// Position in the module's function index space, imports included.
+	const wasm_uint32_t index_;
+	mutable std::once_flag lowered_;
+	mutable Entry entry_;
 };
 
 auto return_count(const WasmFunction& f)
@@ -66,7 +229,8 @@ std::ostream& operator<<(std::ostream& os, const WasmFunction& f)
 {
 	os << "(func $" << name(f) << ' ' << signature(f) << " (\n";
 	auto codeseq = code(f);
-	parse::write_code(os, begin(code), end(code), 2);
+	const char* first = reinterpret_cast<const char*>(codeseq.data());
+	parse::write_code(os, first, first + codeseq.size(), 2);
 	os << "  )\n";
 	os << ')';
 	return os;
@@ -76,6 +240,23 @@ std::ostream& write_declaration(std::ostream& os, const WasmFunction& f)
 {
 	return os << "(func $" << name(f) << ' ' << signature(f) << ')';
 }
+
+inline opc::CodeView::CodeView(const WasmFunction& func):
+	CodeView(
+		&func,
+		std::string_view(reinterpret_cast<const char*>(code(func).data()), code(func).size())
+	)
+{
+	
+}
+
+inline opc::CodeView::CodeView(const WasmFunction& func, const char* pos):
+	CodeView(func)
+{
+	assert(code_.data() <= pos and pos <= code_.data() + code_.size());
+	code_.remove_prefix(pos - code_.data());
+}
+
 } /* namespace wasm */
 
 #endif /* FUNCTION_WASM_FUNCTION_H */
@@ -1,10 +1,19 @@
 #ifndef WASM_FUNCTION_SIGNATURE_H
 #define WASM_FUNCTION_SIGNATURE_H
 
-#include "WasmInstruction.h"
+#include "wasm_base.h"
+#include "binparse/types.h"
+#include <cassert>
+#include <initializer_list>
+#include <ostream>
 #include <unordered_set>
+#include <unordered_map>
 #include <string>
 #include <string_view>
+#include <limits>
+#include <mutex>
+
+namespace wasm {
 
 struct WasmFunctionSignature
 {
@@ -14,59 +23,58 @@ struct WasmFunctionSignature
 	static constexpr const ExternalKind external_kind_v
 		= ExternalKind::Function;
 
-	WasmFunctionSignature(const parse::FunctionSignature& sig)
+	/// Result types are stored first, then parameter types, in one string.
+	WasmFunctionSignature(const parse::FunctionSignature& sig):
 		param_count(sig.param_types.size()),
-		return_count(sig.return_type ? 1u : 0u),
-		data([](){ // immediately-invoked lambda expression
-			string_type s;
-			if(sig.return_type)
-				s.push_back(*sig.return_type);
-			s.append(sig.param_types);
-			return s;
-		}())
+		return_count(sig.return_types.size()),
+		data(from_lists(sig.return_types, sig.param_types))
 	{
 		
 	}
 
 	
-	constexpr WasmFunctionSignature(
+	WasmFunctionSignature(
 		std::initializer_list<LanguageType> result_types,
 		std::initializer_list<LanguageType> argument_types
 	):
-		param_count(arg_count),
-		return_count(r),
-		data(std::move(string_type(result_types).append(argument_types)))
+		param_count(argument_types.size()),
+		return_count(result_types.size()),
+		data(from_lists(view_type(result_types.begin(), result_types.size()), view_type(argument_types.begin(), argument_types.size())))
 	{
 		
 	}
 
-	friend auto param_types(const WasmFunctionSignature& sig)
-	{ return view_type(sig.c_str() + sig.return_count, sig.pram_count); }
+	friend view_type param_types(const WasmFunctionSignature& sig)
+	{ return view_type(sig.data.c_str() + sig.return_count, sig.param_count); }
 
 	friend view_type return_types(const WasmFunctionSignature& sig)
-	{ return view_type(sig.c_str(), sig.return_count); }
+	{ return view_type(sig.data.c_str(), sig.return_count); }
 
 private:
-	static string_type from_lists(
-		std::initializer_list<LanguageType> result_types,
-		std::initializer_list<LanguageType> argument_types
-	)
+	static string_type from_lists(view_type result_types, view_type argument_types)
 	{
-		return string_type(result_types).append
+		string_type s;
+		s.reserve(result_types.size() + argument_types.size());
+		s.append(result_types);
+		s.append(argument_types);
+		return s;
 	}
 
-	const std::size_t param_count;
-	const std::size_t return_count;
-	const string_type data;
+	std::size_t param_count;
+	std::size_t return_count;
+	string_type data;
 };
 
+WasmFunctionSignature::view_type param_types(const WasmFunctionSignature& sig);
+WasmFunctionSignature::view_type return_types(const WasmFunctionSignature& sig);
+
 auto return_count(const WasmFunctionSignature& sig)
 { return return_types(sig).size(); }
 
 auto param_count(const WasmFunctionSignature& sig)
 { return param_types(sig).size(); }
 
-bool operator==(const WasmFunctionSignature& left, const WasmFunctionSignature)
+bool operator==(const WasmFunctionSignature& left, const WasmFunctionSignature& right)
 {
 	return return_count(left) == return_count(right)
 		and param_count(left) == param_count(right)
@@ -74,9 +82,69 @@ bool operator==(const WasmFunctionSignature& left, const WasmFunctionSignature)
 		and param_types(left) == param_types(right);
 }
 
-bool operator!=(const WasmFunctionSignature& left, const WasmFunctionSignature)
+bool operator!=(const WasmFunctionSignature& left, const WasmFunctionSignature& right)
 { return not (left == right); }
 
+/// Small integer naming a signature.  Signatures that compare equal get the
+/// same id, whichever module they come from, so that 'CALL_INDIRECT' can
+/// type-check its callee with a single integer compare.
+using signature_id_t = wasm_uint32_t;
+
+/// The signature id of a null table element.  Never handed out by a registry.
+inline constexpr const signature_id_t null_signature_id
+	= std::numeric_limits<signature_id_t>::max();
+
+/// Interns signatures to dense ids, starting from zero.  Ids are never reused.
+/// Interning happens while modules are linked, never while code runs; the
+/// mutex only makes concurrent module loads safe.
+struct SignatureRegistry
+{
+	signature_id_t intern(const WasmFunctionSignature& sig)
+	{
+		std::string key = make_key(sig);
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto id = static_cast<signature_id_t>(ids_.size());
+		assert(id != null_signature_id);
+		return ids_.try_emplace(std::move(key), id).first->second;
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return ids_.size();
+	}
+
+	/// The registry shared by every module in the process.
+	static SignatureRegistry& global()
+	{
+		static SignatureRegistry registry;
+		return registry;
+	}
+
+private:
+	static std::string make_key(const WasmFunctionSignature& sig)
+	{
+		auto returns = return_types(sig);
+		auto params = param_types(sig);
+		std::string key;
+		auto return_count = static_cast<wasm_uint32_t>(returns.size());
+		key.reserve(sizeof(return_count) + returns.size() + params.size());
+		// Leading count so that '(param i32) (result i32)' and '(param i32 i32)' differ.
+		key.append(reinterpret_cast<const char*>(&return_count), sizeof(return_count));
+		for(auto tp: returns)
+			key.push_back(static_cast<char>(tp));
+		for(auto tp: params)
+			key.push_back(static_cast<char>(tp));
+		return key;
+	}
+
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, signature_id_t> ids_;
+};
+
+inline signature_id_t signature_id(const WasmFunctionSignature& sig)
+{ return SignatureRegistry::global().intern(sig); }
+
 
 
 
@@ -108,5 +176,6 @@ std::ostream& operator<<(std::ostream& os, const WasmFunctionSignature& sig)
 	return os;
 }
 
+} /* namespace wasm */
 
 #endif /* WASM_FUNCTION_SIGNATURE_H */
@@ -0,0 +1,296 @@
+#ifndef MODULE_COMPILED_MODULE_H
+#define MODULE_COMPILED_MODULE_H
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "utilities/SimpleVector.h"
+#include "utilities/PerfectHashMap.h"
+#include "utilities/TransformIterator.h"
+#include "function/WasmFunction.h"
+
+namespace wasm {
+
+using parse::ModuleDef;
+
+/// The immutable part of a module: its types, its function bodies, its
+/// imports and exports, and the definitions of the tables, memories,
+/// globals and segments that each instance ('WasmModule') makes its own
+/// copy of.  Made once by 'compile()' and shared read-only by all instances
+/// of the module, on any thread.  The only state a 'CompiledModule' changes
+/// after it is made is internal to its functions: lazily lowered bodies
+/// are lowered once, under 'std::call_once', and the indirect call caches
+/// are atomic.
+struct CompiledModule {
+
+	using import_type = std::variant<
+		WasmFunctionSignature, parse::Table, parse::Memory, parse::GlobalType
+	>;
+
+	/// An import, keyed by interned symbols rather than by name.
+	struct ImportSymbol {
+		/// Index of the exporting module's name in 'ImportTable::modules'.
+		wasm_uint32_t module_id;
+		std::string field_name;
+		/// 'export_map_type::hash(field_name)', computed once at load time.
+		std::size_t field_hash;
+		/// Position of the import in the index space of its kind.
+		std::size_t index;
+		import_type type;
+	};
+
+	struct ImportTable {
+		/// Interned names of the modules imported from.  Symbol id = position.
+		std::vector<std::string> modules;
+		/// Imports, grouped by 'module_id'.
+		std::vector<ImportSymbol> symbols;
+		/// Per external kind, maps index space positions to 'symbols'.
+		std::array<std::vector<wasm_uint32_t>, 4u> ids;
+	};
+
+	/// An export: a position in the index space of its kind.  Instances
+	/// resolve it against their own index spaces.
+	struct ExportEntry {
+		ExternalKind kind;
+		wasm_uint32_t index;
+	};
+	/// Export names are resolved through a minimal perfect hash built once at load time.
+	using export_map_type = PerfectHashMap<ExportEntry>;
+
+	/// Compile 'module_def', which was loaded from 'path'.
+	static std::shared_ptr<const CompiledModule> compile(std::string&& path, ModuleDef&& module_def)
+	{
+		return std::shared_ptr<const CompiledModule>(
+			new CompiledModule(std::move(path), std::move(module_def))
+		);
+	}
+
+	CompiledModule(const CompiledModule&) = delete;
+	CompiledModule& operator=(const CompiledModule&) = delete;
+
+	const std::string& path() const
+	{ return path_; }
+
+	const WasmFunctionSignature& type_at(wasm_uint32_t index) const
+	{ return types_.at(index); }
+
+	/// Canonical id of the signature at 'index' in the type section.
+	signature_id_t type_id_at(wasm_uint32_t index) const
+	{
+		assert(index < type_ids_.size());
+		return type_ids_[index];
+	}
+
+	gsl::span<const WasmFunctionSignature> types() const
+	{ return gsl::span<const WasmFunctionSignature>(types_.data(), types_.size()); }
+
+	/// The functions defined (not imported) in the module.
+	const ConstSimpleVector<WasmFunction>& functions() const
+	{ return functions_; }
+
+	const ImportTable& imports() const
+	{ return imports_; }
+
+	/// Number of imports of kind 'kind', which precede the definitions in
+	/// the index space of that kind.
+	std::size_t import_count(ExternalKind kind) const
+	{ return imports_.ids[static_cast<std::size_t>(kind)].size(); }
+
+	/// Look up an export by name.  Does not allocate.
+	const ExportEntry* find_export(std::string_view name) const
+	{ return exports_.find(name); }
+
+	/// Look up an export by name, with 'hash' as 'export_map_type::hash(name)'.
+	const ExportEntry* find_export(std::string_view name, std::size_t hash) const
+	{ return exports_.find(name, hash); }
+
+	/// Index of the start function, if any.
+	std::optional<wasm_uint32_t> start_index() const
+	{ return def_.start_section; }
+
+	/// The cost table the module's code is metered with, or null if it
+	/// isn't (see 'RunContext::set_fuel()').
+	const parse::FuelCosts* fuel_costs() const
+	{ return def_.fuel_costs.get(); }
+
+	/// The rest of the parsed module: the table, memory and global
+	/// definitions and the element and data segments instances are
+	/// initialized from.  Its arena and source outlive every instance.
+	const ModuleDef& definition() const
+	{ return def_; }
+
+private:
+	CompiledModule(std::string&& path, ModuleDef&& module_def):
+		def_(std::move(module_def)),
+		path_(std::move(path)),
+		types_(read_type_section(def_)),
+		type_ids_(intern_types(types_)),
+		imports_(read_import_section(def_, types_)),
+		functions_(read_functions(def_, types_)),
+		exports_(read_export_section(def_))
+	{
+
+	}
+
+	static SimpleVector<WasmFunctionSignature> read_type_section(ModuleDef& module_def)
+	{
+		if(not module_def.type_section)
+			return SimpleVector<WasmFunctionSignature>();
+		auto& type_sec = *module_def.type_section;
+		auto make_sig = [](parse::FunctionSignature& sig_def) {
+			return WasmFunctionSignature(std::move(sig_def));
+		};
+		return SimpleVector<WasmFunctionSignature>(
+			make_transform_iterator(type_sec.begin(), make_sig),
+			make_transform_iterator(type_sec.end(), make_sig)
+		);
+	}
+
+	static SimpleVector<signature_id_t> intern_types(const SimpleVector<WasmFunctionSignature>& types)
+	{
+		SimpleVector<signature_id_t> ids(types.size());
+		std::transform(types.begin(), types.end(), ids.begin(),
+			[](const auto& sig) { return signature_id(sig); }
+		);
+		return ids;
+	}
+
+	static ImportTable read_import_section(
+		const ModuleDef& module_def,
+		const SimpleVector<WasmFunctionSignature>& types
+	)
+	{
+		ImportTable imports;
+		if(module_def.import_section)
+		{
+			std::array<std::size_t, 4u> spaces{0u, 0u, 0u, 0u};
+			auto& modules = imports.modules;
+			for(const auto& entry: *module_def.import_section)
+			{
+				auto module_pos = std::find(modules.begin(), modules.end(), entry.module_name);
+				if(module_pos == modules.end())
+					module_pos = modules.emplace(module_pos, entry.module_name);
+				auto& space = spaces[static_cast<std::size_t>(entry.kind())];
+				auto make_import = [&](const auto& entry_type) {
+					using type = std::decay_t<decltype(entry_type)>;
+					if constexpr(std::is_same_v<type, std::uint32_t>)
+						return import_type(types[entry_type]);
+					else
+						return import_type(entry_type);
+				};
+				imports.symbols.push_back(ImportSymbol{
+					static_cast<wasm_uint32_t>(module_pos - modules.begin()),
+					std::string(entry.field_name),
+					export_map_type::hash(entry.field_name),
+					space,
+					std::visit(make_import, entry.entry_type)
+				});
+				space += 1u;
+			}
+			// linking against a module then only touches a contiguous range.
+			std::stable_sort(imports.symbols.begin(), imports.symbols.end(),
+				[](const auto& l, const auto& r) { return l.module_id < r.module_id; }
+			);
+			for(std::size_t kind = 0; kind < imports.ids.size(); ++kind)
+				imports.ids[kind].resize(spaces[kind]);
+			for(std::size_t i = 0; i < imports.symbols.size(); ++i)
+			{
+				const auto& sym = imports.symbols[i];
+				imports.ids[sym.type.index()][sym.index] = i;
+			}
+		}
+		return imports;
+	}
+
+	static ConstSimpleVector<WasmFunction> read_functions(
+		ModuleDef& module_def,
+		const SimpleVector<WasmFunctionSignature>& signatures
+	)
+	{
+		if(module_def.function_section)
+		{
+			assert(module_def.type_section);
+			assert(module_def.code_section);
+			std::size_t count = module_def.function_section->size();
+			assert(count == module_def.code_section->size());
+			auto& func_sec = *module_def.function_section;
+			auto& code_sec = *module_def.code_section;
+			// bodies parsed with 'parse::lazy_module' are lowered on first call
+			std::shared_ptr<const WasmFunction::LazyCode> lazy;
+			bool any_lazy = std::any_of(code_sec.begin(), code_sec.end(),
+				[](const auto& body) { return not body.is_lowered(); }
+			);
+			if(any_lazy)
+			{
+				assert(module_def.source);
+				lazy = std::make_shared<const WasmFunction::LazyCode>(
+					WasmFunction::LazyCode{
+						module_def.source,
+						std::make_shared<const parse::ValidationContext>(
+							parse::ModuleValidator(module_def).context()
+						),
+						module_def.fuel_costs
+					}
+				);
+			}
+			// lazy bodies are validated against their own function's type
+			auto first_index = static_cast<wasm_uint32_t>(lazy ? lazy->context->imported_function_count : 0u);
+			// functions can't be moved, so they are made in place.
+			auto make_args = [&](std::size_t i) {
+				return std::tuple<
+					const WasmFunctionSignature&,
+					parse::FunctionBody&&,
+					const std::shared_ptr<const WasmFunction::LazyCode>&,
+					wasm_uint32_t
+				>(
+					signatures.at(func_sec[i]),
+					std::move(code_sec[i]),
+					lazy,
+					first_index + static_cast<wasm_uint32_t>(i)
+				);
+			};
+			return ConstSimpleVector<WasmFunction>(std::piecewise_construct, count, make_args);
+		}
+		return ConstSimpleVector<WasmFunction>();
+	}
+
+	static export_map_type read_export_section(const ModuleDef& module_def)
+	{
+		std::vector<std::pair<std::string_view, ExportEntry>> exports;
+		if(module_def.export_section)
+		{
+			for(const parse::ExportEntry& entry: *module_def.export_section)
+				exports.emplace_back(entry.name, ExportEntry{entry.kind, entry.index});
+		}
+		// export names are unique in a validated module.
+		return export_map_type(exports.begin(), exports.end());
+	}
+
+	/// The parsed module.  Its type and code sections are moved into
+	/// 'types_' and 'functions_' on construction.  Declared first, so the
+	/// arena and source it owns outlive the members below, which refer to them.
+	ModuleDef def_;
+	/// The filesystem path to this module.
+	const std::string path_;
+	/// The function signatures used in this module.
+	const SimpleVector<WasmFunctionSignature> types_;
+	/// Canonical ids of 'types_', so 'CALL_INDIRECT' can check signatures across modules.
+	const SimpleVector<signature_id_t> type_ids_;
+	/// Imports of this module, keyed by interned module/field symbols.
+	const ImportTable imports_;
+	/// The functions defined in this module.  Instances point at these; they are never copied.
+	const ConstSimpleVector<WasmFunction> functions_;
+	/// Maps field names to exports.
+	const export_map_type exports_;
+};
+
+} /* namespace wasm */
+
+#endif /* MODULE_COMPILED_MODULE_H */
@@ -1,15 +1,20 @@
 #ifndef MODULE_WASM_GLOBAL_H
 #define MODULE_WASM_GLOBAL_H
+#include <cassert>
 #include <variant>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include "wasm_base.h"
+#include "wasm_value.h"
+#include "binparse/types.h"
 
 namespace wasm {
 
 struct BadGlobalAccess:
-	public ValidationError<std::exception>
+	public ValidationError<std::logic_error>
 {
-	using base_type = ValidationError<std::exception>;
+	using base_type = ValidationError<std::logic_error>;
 	using base_type::base_type;
 
 };
@@ -18,7 +23,7 @@ struct ConstGlobalWriteError:
 	BadGlobalAccess
 {
 	ConstGlobalWriteError():
-		ConstGlobalWriteError("Attempt to write immutable global.")
+		BadGlobalAccess("Attempt to write immutable global.")
 	{
 		
 	}
@@ -36,234 +41,114 @@ private:
 		s << " as a value of type ";
 		s << attempted;
 		s << '.';
+		return s.str();
 	}
 public:
-	GlobalTypeMismatch(LanguageType actual, LanguageType attempted)
-		GlobalTypeMismatch(msg(actual, attempted))
+	GlobalTypeMismatch(LanguageType actual, LanguageType attempted):
+		BadGlobalAccess(msg(actual, attempted))
 	{
 		
 	}
 };
 
+/// A global variable: its declared type and a pointer to the untagged 8-byte
+/// slot that holds its value.  Slots are stored contiguously, per module
+/// instance (see 'WasmModule'), and validated code reads and writes them
+/// directly; the validator enforces type and mutability.  The checked
+/// accessors below are for the embedder.
 struct WasmGlobal
 {
-	using dependency_type = std::pair<wasm_uint32_t, parse::GlobalType>;
-	using variant_type = std::variant<
-		dependency_type, // dependency on another global
-		wasm_sint32_t,
-		wasm_sint64_t,
-		wasm_float32_t,
-		wasm_float64_t,
-		const wasm_sint32_t,
-		const wasm_sint64_t,
-		const wasm_float32_t,
-		const wasm_float64_t
-	>;
 	using wasm_external_kind_type = parse::GlobalType;
-	using base_type::base_type;
 
 	WasmGlobal() = delete;
-	WasmGlobal(const parse::GlobalEntry& ent):
-		value_(std::in_place_type<wasm_sint32_t>(-1)) // temporary - fix in body
+	WasmGlobal(const parse::GlobalEntry& ent, WasmValue& slot):
+		type_(global_type(ent.value)),
+		slot_(std::addressof(slot)),
+		dependency_(ent.depends)
 	{
-		if(ent.depends)
-		{
-			value_.emplace<dependency_type>(*ent.depends, global_type(ent));
-		}
-		else
-		{
-			std::visit(
-				[&](auto val) {
-					if(ent.value.is_const)
-						value_.emplace<const decltype(val)>(val);
-					else
-						value_.emplace<decltype(val)>(val);
-				},
-				ent.value.value
-			);
-		}
+		if(not has_dependency())
+			std::visit([&](auto val) { *slot_ = WasmValue(val); }, ent.value.value);
 	}
 
+	/// True until the global's initializer, which reads another global, has run.
 	bool has_dependency() const
-	{ return std::holds_alternative<dependency_type>(value_); }
+	{ return dependency_.has_value(); }
 
-	dependency_type get_dependency()
+	/// Index of the global that this global is initialized from.
+	wasm_uint32_t get_dependency() const
 	{
 		assert(has_dependency());
-		return std::get<dependency_type>(value_);
+		return *dependency_;
 	}
 
 	parse::GlobalType get_type() const
-	{
-		if(has_dependency())
-			return get_dependency().type();
-		else
-			return parse::GlobalType(get_language_type(), is_const())
-	}
+	{ return type_; }
 
 	LanguageType get_language_type() const
-	{
-		if(has_dependency())
-			return get_dependency().second.type();
-		return static_cast<LanguageType>(
-			-1 * (std::ptrdiff_t(value_.index()) - 1)
-		);
-	}
+	{ return type_.type(); }
 	
 	bool is_const() const
-	{ return value_.index() > 4u; }
+	{ return type_.is_const(); }
 
 	bool is_mut() const
-	{
-		auto idx = value_.index();
-		return idx <= 4u and idx > 0u;
-	}
-
-	
-
-	template <class T>
-	void init_mut(T&& value)
-	{
-		assert(has_dependency() and "Can't set the global's type after it has been initialized.");
-		using type = std::decay_t<T>;
-		value_.emplace<std::decay_t<T>>(std::forward<T>(T));
-	}
-
-	template <class T>
-	void init_const(T&& value)
-	{
-		assert(has_dependency() and "Can't set the global's type after it has been initialized.");
-		using type = std::decay_t<T>;
-		value_.emplace<const std::decay_t<T>>(std::forward<T>(T));
-	}
+	{ return not is_const(); }
 
 	void init_dep(const WasmGlobal& dep)
 	{
-		assert(this->has_dependency());
-		assert(not other.has_dependency());
-		assert(this->get_language_type() == dep.get_language_type());
-		if(get_type().is_const())
-		{
-			switch(this->get_language_type())
-			{
-			case LanguageType::i32:
-				value_.emplace<const wasm_sint32_t>(read<wasm_sint32_t>(dep));
-				break;
-			case LanguageType::i64:
-				value_.emplace<const wasm_sint64_t>(read<wasm_sint64_t>(dep));
-				break;
-			case LanguageType::f32:
-				value_.emplace<const wasm_float32_t>(read<wasm_float32_t>(dep));
-				break;
-			case LanguageType::f64:
-				value_.emplace<const wasm_float64_t>(read<wasm_float64_t>(dep));
-				break;
-			default:
-				assert(false);
-			}
-		}
-		else
-		{
-			switch(this->get_language_type())
-			{
-			case LanguageType::i32:
-				value_.emplace<wasm_sint32_t>(read<wasm_sint32_t>(dep));
-				break;
-			case LanguageType::i64:
-				value_.emplace<wasm_sint64_t>(read<wasm_sint64_t>(dep));
-				break;
-			case LanguageType::f32:
-				value_.emplace<wasm_float32_t>(read<wasm_float32_t>(dep));
-				break;
-			case LanguageType::f64:
-				value_.emplace<wasm_float64_t>(read<wasm_float64_t>(dep));
-				break;
-			default:
-				assert(false);
-			}
-		}
+		assert(has_dependency());
+		assert(not dep.has_dependency());
+		assert(get_language_type() == dep.get_language_type());
+		*slot_ = *dep.slot_;
+		dependency_.reset();
 	}
 
-	template <class T>
-	friend const T& get(const WasmGlobal& self)
-	{ return std::get<T>(self); }
-
-	template <class T>
-	friend T& get(WasmGlobal& self)
-	{ return std::get<T>(self); }
-
-	template <class T>
-	friend const T* get_if(const WasmGlobal& self)
-	{ return std::get_if<T>(self); }
+	/// The value slot.  Unchecked.
+	WasmValue& slot()
+	{ return *slot_; }
 
-	template <class T>
-	friend T* get_if(WasmGlobal& self)
-	{ return std::get_if<T>(self); }
-
-	template <class T>
-	friend T read(const WasmGlobal& self)
-	{
-		if(const auto* p = get_if<const T>(self); static_cast<bool>(p));
-			return *p;
-		else
-			return get<T>(self);
-	}
-
-	template <class T>
-	friend std::optional<T> read_if(const WasmGlobal& self)
-	{
-		if(const auto* p = get_if<const T>(self); static_cast<bool>(p));
-			return *p;
-		if(const auto* p = get_if<T>(self); static_cast<bool>(p));
-			return *p;
-		return std::nullopt;
-	}
+	const WasmValue& slot() const
+	{ return *slot_; }
 
 	explicit operator TaggedWasmValue() const
 	{
-		return std::visit(
-			[](auto v) {
-				if constexpr(std::is_same_v<decltype(v), dependency_type>)
-					throw BadGlobalAccess("Attempt to access global before it has been initialized.");
-				else
-					return static_cast<TaggedWasmValue>(v);
-			},
-			value_
+		if(has_dependency())
+			throw BadGlobalAccess("Attempt to access global before it has been initialized.");
+		return tp::visit_value_type(
+			[&](auto WasmValue::* p) { return TaggedWasmValue(p, (*slot_).*p); },
+			get_language_type()
 		);
 	}
 
 	explicit operator WasmValue() const
 	{
-		return static_cast<WasmValue>(static_cast<TaggedWasmValue>(*this));
+		if(has_dependency())
+			throw BadGlobalAccess("Attempt to access global before it has been initialized.");
+		return *slot_;
 	}
+
 private:
-	variant_type value_;
+	parse::GlobalType type_;
+	WasmValue* slot_;
+	std::optional<wasm_uint32_t> dependency_;
 };
 
 bool matches(const WasmGlobal& self, const parse::GlobalType& tp)
 { return self.get_type() == tp; }
 
-void set(WasmGlobal& self, TaggedWasmValue v)
-{
-	if(self.get_language_type() != v.tag())
-		throw GlobalTypeMismatch(self.get_language_type(), v.tag());
-	return set(self, static_cast<WasmValue>(v));
-}
-
 void set(WasmGlobal& self, WasmValue v)
 {
 	if(self.has_dependency())
 		throw BadGlobalAccess("Attempt to write global before it has been initialized.");
 	if(self.is_const())
 		throw ConstGlobalWriteError();
-	tp::visit_value_type(
-		[&](auto WasmValue::* p) {
-			auto value = v.*p;
-			using type = decltype(value);
-			get<type>(self) = value;
-		},
-		self.get_language_type()
-	);
+	self.slot() = v;
+}
+
+void set(WasmGlobal& self, TaggedWasmValue v)
+{
+	if(self.get_language_type() != v.tag())
+		throw GlobalTypeMismatch(self.get_language_type(), v.tag());
+	return set(self, static_cast<WasmValue>(v));
 }
 
 template <class U>
@@ -276,26 +161,14 @@ void set(WasmValue& self, const WasmGlobal& g)
 void set(TaggedWasmValue& self, const WasmGlobal& g)
 {
 	if(g.get_language_type() != self.tag())
-		throw GlobalTypeMismatch(self.get_language_type(), v.tag());
-	set(self, static_cast<TaggedWasmValue>(self));
+		throw GlobalTypeMismatch(g.get_language_type(), self.tag());
+	self = static_cast<TaggedWasmValue>(g);
 }
 
-
-
 template <class T>
 const std::decay_t<T>& operator->*(const WasmGlobal& self, T WasmValue::* p) {
-	return read<std::decay_t<T>>(self);
-};
-
-template <class T>
-const std::decay_t<T>& operator->*(WasmGlobal& self, const T WasmValue::* p) {
-	return std::as_const(self)->*p;
-};
-
-template <class T>
-T& operator->*(WasmGlobal& self, T WasmValue::* p) {
-	return get<T>(self);
-};
+	return self.slot().get(p);
+}
 
 } /* namespace wasm */
 #endif /* MODULE_WASM_GLOBAL_H */
@@ -5,18 +5,24 @@
 #include <algorithm>
 #include "wasm_base.h"
 #include "wasm_value.h"
+#include <cassert>
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <limits>
+#include <utility>
 #include <gsl/span>
+#include "binparse/types.h"
 #include "utilities/endianness.h"
+#include "utilities/SimpleVector.h"
+#include "vm/alloc/Numa.h"
 
 namespace wasm {
 
 struct WasmLinearMemory
 {
 	static constexpr const std::size_t page_size = 65536;
-	using page_type = alignas(page_size) char[page_size];
+	struct alignas(page_size) page_type { char bytes[page_size]; };
 private:
 	using vector_type = wasm::SimpleVector<page_type>;
 public:
@@ -29,7 +35,7 @@ public:
 	using page_reference = page_type&;
 	using const_page_reference = const page_type&;
 	
-	using page_span = gsl::span<const page_type>;
+	using page_span = gsl::span<page_type>;
 	using const_page_span = gsl::span<const page_type>;
 
 	using value_type = char;
@@ -46,7 +52,7 @@ public:
 	using size_type = vector_type::size_type;
 	using difference_type = vector_type::difference_type;
 
-	WasmLinearMemory(const parse::Memory& def, const parse::DataSegment& seg);
+	WasmLinearMemory(const parse::Memory& def);
 
 	friend const_page_span pages(const WasmLinearMemory& self)
 	{ return const_page_span(self.memory_.data(), self.memory_.size()); }
@@ -57,16 +63,17 @@ public:
 	friend const_raw_span data(const WasmLinearMemory& self)
 	{
 		return raw_span(
-			static_cast<const_pointer>(self.vec_.data()), 
-			page_size * self.vec_.size()
+			reinterpret_cast<const_pointer>(self.memory_.data()), 
+			page_size * self.memory_.size()
 		);
 	}
 
+	/// Read-only, like the const overload: write through 'write_span()'.
 	friend raw_span data(WasmLinearMemory& self)
 	{
 		return raw_span(
-			static_cast<pointer>(self.vec_.data()), 
-			page_size * self.vec_.size()
+			reinterpret_cast<const_pointer>(self.memory_.data()), 
+			page_size * self.memory_.size()
 		);
 	}
 
@@ -76,14 +83,14 @@ public:
 		assert(prev == pages(self).size());
 		if(delta > 0u)
 		{
-			std::size_t new_size = self.vec_.size() + delta;
-			if(new_size > maximum_)
+			std::size_t new_size = self.memory_.size() + delta;
+			if(new_size > self.maximum_)
 				return -1;
 			try
 			{
-				self.resize(self.vec_.size() + delta);
+				self.resize(new_size);
 			}
-			catch(std::bad_alloc& e)
+			catch(const std::bad_alloc&)
 			{
 				return -1;
 			}
@@ -93,29 +100,106 @@ public:
 
 	friend bool matches(const WasmLinearMemory& self, const parse::Memory& tp)
 	{
-		return self.memory_.size() >= tp.size() and (
-			self.maximum_ == tp.maximum.value_or(std::numeric_limits<std::size_t>::max())
+		return self.memory_.size() >= tp.initial and (
+			not tp.maximum.has_value() or self.maximum_ <= *tp.maximum
 		);
 	}
 
+	/// A writable view of the 'size' bytes at 'address', for initializing a
+	/// data segment or for the host to write to.  The bytes are marked
+	/// dirty, so that 'restore()' sees the writes; writes through 'data()'
+	/// aren't seen, so the host must not cast its constness away.  Throws
+	/// 'std::out_of_range' if the bytes aren't all within the memory.
+	gsl::span<char> write_span(std::size_t address, std::size_t size)
+	{
+		std::size_t bytes = page_size * memory_.size();
+		if(address > bytes or size > bytes - address)
+			throw std::out_of_range("Write does not fit in linear memory.");
+		if(size > 0u)
+			mark_dirty(address, size);
+		return gsl::span<char>(reinterpret_cast<char*>(memory_.data()) + address, size);
+	}
+
+	/// @name Reset
+	/// Stores mark the pages they write as dirty, so that 'restore()' only
+	/// copies back the pages that may differ from an image of the memory.
+	/// @{
+
+	/// Record a write of 'size' bytes at 'address', which is in bounds.
+	void mark_dirty(std::size_t address, std::size_t size)
+	{
+		assert(size > 0u);
+		std::size_t last = (address + size - 1u) / page_size;
+		for(std::size_t page = address / page_size; page <= last; ++page)
+			dirty_[page] = 1u;
+	}
+
+	/// Treat the current contents as the image that 'restore()' restores.
+	void clear_dirty()
+	{ std::fill(dirty_.begin(), dirty_.end(), 0u); }
+
+	/// Restore the size and contents the memory had when 'image' was taken
+	/// with 'data()', followed by 'clear_dirty()'.  Only dirty pages are copied.
+	void restore(const_raw_span image)
+	{
+		assert(image.size() % page_size == 0u);
+		std::size_t image_pages = image.size() / page_size;
+		assert(memory_.size() >= image_pages);
+		// pages added by 'grow_memory' since the image was taken go away.
+		memory_.resize(image_pages);
+		dirty_.resize(image_pages);
+		for(std::size_t page = 0; page < image_pages; ++page)
+		{
+			if(not dirty_[page])
+				continue;
+			std::memcpy(memory_[page].bytes, image.data() + page * page_size, page_size);
+			dirty_[page] = 0u;
+		}
+	}
+	/// @}
+
+	/// @name NUMA placement
+	/// @{
+
+	/// Back the memory with pages of NUMA node 'node', moving the pages
+	/// already backed elsewhere.  Pages added by 'grow_memory' are placed
+	/// on the node too.  Best effort: returns false if placement failed.
+	bool bind_to_node(int node)
+	{
+		node_ = node;
+		return numa::bind(memory_.data(), page_size * memory_.size(), node, true);
+	}
+
+	/// The node the memory was bound to, or -1.
+	int node() const
+	{ return node_; }
+
+	/// Of up to 'samples' pages, the number backed by a node other than 'node'.
+	std::size_t pages_off_node(int node, std::size_t samples) const
+	{ return numa::pages_off_node(memory_.data(), page_size * memory_.size(), node, samples); }
+	/// @}
+
 private:
 	void resize(std::size_t n)
 	{
 		assert(n <= maximum_);
-		using std::swap;
-		vector_type tmp(n);
-		swap(memory_, tmp);
-		std::memcpy(v.data(), tmp.data(), tmp.size() * sizeof(tmp.front()));
-		std::memset(v.data() + tmp.size(), 0, v.size() - tmp.size());
+		// new pages are value-initialized, that is, zeroed.
+		memory_.resize(n);
+		// new pages aren't in any image.
+		dirty_.resize(n, 1u);
+		if(node_ >= 0)
+			numa::bind(memory_.data(), page_size * memory_.size(), node_, true);
 	}
 	vector_type memory_;
+	/// One flag per page of 'memory_': whether it was written since 'clear_dirty()'.
+	std::vector<unsigned char> dirty_;
 	const std::size_t maximum_ = std::numeric_limits<std::size_t>::max();
+	/// The NUMA node the memory is bound to, or -1 (see 'bind_to_node()').
+	int node_ = -1;
 };
 
 LanguageType index_type(const WasmLinearMemory& self)
-{
-	return 
-}
+{ return LanguageType::i32; }
 
 WasmLinearMemory::size_type current_memory(const WasmLinearMemory& self)
 { return pages(self).size(); }
@@ -129,10 +213,26 @@ WasmLinearMemory::size_type size(const WasmLinearMemory& self)
 
 WasmLinearMemory::WasmLinearMemory(const parse::Memory& def):
 	memory_(def.initial),
-	maximum_(def.maximum.value_or(std::numeric_limits<std::size_t>::max())
+	dirty_(def.initial, 1u),
+	maximum_(def.maximum ? *def.maximum : std::numeric_limits<std::size_t>::max())
 {
-	auto bytes = data(*this);
-	std::fill(bytes.begin(), bytes.end(), 0);
+	
+}
+
+/// Whether an access of 'size' bytes at 'base' + 'offset' lies within the
+/// memory.  Load and store instructions check this first and trap with
+/// 'TrapCode::memory_access' if it doesn't.
+bool access_in_bounds(
+	const WasmLinearMemory& self,
+	wasm_uint32_t base,
+	wasm_uint32_t offset,
+	std::size_t size
+)
+{
+	std::size_t bytes = data(self).size();
+	// the sum of two 32-bit values can't overflow a 64-bit 'std::size_t'.
+	std::size_t effective_address = std::size_t(base) + offset;
+	return effective_address <= bytes and size <= bytes - effective_address;
 }
 
 gsl::span<const char> compute_effective_address(
@@ -149,7 +249,7 @@ gsl::span<const char> compute_effective_address(
 	effective_address += offset;
 	if(mem.size() <= effective_address)
 		throw std::out_of_range("Computed effective address is too large for linear memory.");
-	if(std::size_t remaining = mem.size() - effective_address; remaining < sizeof(Type))
+	if(std::size_t remaining = mem.size() - effective_address; remaining < size)
 		throw std::out_of_range("Linear memory access partially acesses out-of-bounds memory.");
 	return mem.subspan(effective_address, size);
 }
@@ -162,9 +262,7 @@ gsl::span<char> compute_effective_address(
 )
 {
 	auto addr = compute_effective_address(std::as_const(self), base, offset, size);
-	const char* data = addr.data();
-	auto size = addr.data();
-	return gsl::span<char>(const_cast<char*>(data), size);
+	return gsl::span<char>(const_cast<char*>(addr.data()), addr.size());
 }
 
 
@@ -179,26 +277,27 @@ Type load_little_endian(const WasmLinearMemory& self, wasm_uint32_t base, wasm_u
 	std::memcpy(&result, addr.data(), sizeof(result));
 	if(not system_is_little_endian())
 	{
-		static_assert(std::is_same_v<decltype(byte_swap(value)), decltype(value)>);
+		static_assert(std::is_same_v<decltype(byte_swap(result)), decltype(result)>);
 		result = byte_swap(result);
 	}
 	return result;
 }
 
 template <class Type, class PassedType>
-void store_little_endian(const WasmLinearMemory& self, wasm_uint32_t base, wasm_uint32_t offset, PassedType value)
+void store_little_endian(WasmLinearMemory& self, wasm_uint32_t base, wasm_uint32_t offset, PassedType value)
 {
 	static_assert(std::is_trivially_copyable_v<Type>);
 	static_assert(std::is_arithmetic_v<Type>);
 	static_assert(std::is_same_v<Type, PassedType>);
 	auto pos = compute_effective_address(self, base, offset, sizeof(Type));
-	assert(addr.size() == sizeof(value));
+	assert(pos.size() == sizeof(value));
+	self.mark_dirty(std::size_t(base) + offset, sizeof(Type));
 	if(not system_is_little_endian())
 	{
 		static_assert(std::is_same_v<decltype(byte_swap(value)), decltype(value)>);
 		value = byte_swap(value);
 	}
-	std::memcpy(pos, &value, sizeof(value));
+	std::memcpy(pos.data(), &value, sizeof(value));
 }
 
 } /* namespace wasm */
@@ -1,20 +1,41 @@
 #ifndef MODULE_MODULE_H
 #define MODULE_MODULE_H
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 #include "utilities/SimpleVector.h"
+#include "utilities/PerfectHashMap.h"
+#include "utilities/SegmentTracker.h"
+#include "utilities/ThreadPool.h"
+#include "utilities/stream_copy.h"
 #include "vm/CallStack.h"
+#include "module/CompiledModule.h"
 #include "module/WasmGlobal.h"
+#include "module/WasmLinearMemory.h"
+#include "module/WasmTable.h"
 #include <boost/container_hash/hash.hpp>
 
 namespace wasm {
 
+struct WasmModule;
+
 struct LinkError:
 	public std::logic_error
 {
 	LinkError(const std::string& str, const WasmModule& imp, const WasmModule& exp):
-		std::logic_error(std::move(str)), importer(imp), exporter(exp)
+		std::logic_error(str), importer(imp), exporter(exp)
 	{
 		
 	}
@@ -30,11 +51,8 @@ struct BadImportError:
 {
 
 	BadImportError(const std::string& msg, const WasmModule& imp, const WasmModule& exp, std::string&& f):
-		LinkError(
-			msg, imp, exp 
-			
-		),
-		exporter(exp), importer(imp), field_name(std::move(f))
+		LinkError(msg, imp, exp),
+		field_name(std::move(f))
 	{
 		
 	}
@@ -45,6 +63,7 @@ struct BadImportError:
 };
 
 struct NullImportError:
+	public BadImportError
 {
 	NullImportError(const WasmModule& imp, const WasmModule& exp, std::string&& f):
 		BadImportError(
@@ -85,7 +104,7 @@ struct ImportKindMismatchError:
 		
 	}
 	
-	virtual ~ImportKindMismatch() = default;
+	virtual ~ImportKindMismatchError() = default;
 };
 
 struct ImportTypeMismatchError:
@@ -100,19 +119,19 @@ struct ImportTypeMismatchError:
 		
 	}
 
-	virtual ~ImportTypeMismatch() = default;
+	virtual ~ImportTypeMismatchError() = default;
 };
 
 struct DoubleImportError:
 	public BadImportError
 {
-	ImportTypeMismatchError(const WasmModule& imp, const WasmModule& exp, std::string&& f):
+	DoubleImportError(const WasmModule& imp, const WasmModule& exp, std::string&& f):
 		BadImportError("Attempt to import field twice.", imp, exp, std::move(f))
 	{
 		
 	}
 
-	virtual ~ImportTypeMismatch() = default;
+	virtual ~DoubleImportError() = default;
 };
 
 struct UnresolvedImportError:
@@ -121,105 +140,163 @@ struct UnresolvedImportError:
 	using std::logic_error::logic_error;
 };
 
+/// An instance of a 'CompiledModule'.  Owns only the instance's mutable
+/// state: its tables, memories and globals, and the index spaces linking
+/// resolves its imports in.  Its functions are those of the compiled
+/// module, which all its instances share.
 struct WasmModule {
 
-	WasmModule(std::sting&& name, std::string&& path, ModuleDef&& module_def):	
-		WasmModule(
-			std::move(name),
-			std::move(path),
-			std::move(module_def),
-			std::array<std::size_t, 4u>{0u, 0u, 0u, 0u}
+	/// Instantiate 'compiled' as a module named 'name'.  Allocates the
+	/// instance's tables, memories, globals and index spaces; the code is
+	/// the compiled module's.
+	WasmModule(std::string&& name, std::shared_ptr<const CompiledModule> compiled):
+		name_(std::move(name)),
+		compiled_(std::move(compiled)),
+		resolved_(compiled_->imports().symbols.size(), false),
+		unresolved_(resolved_.size()),
+		defs_(compiled_->definition()),
+		functions_(make_index_space<const WasmFunction>(
+			compiled_->import_count(ExternalKind::Function), compiled_->functions()
+		)),
+		callees_(make_callees(functions_)),
+		memories_(make_index_space<WasmLinearMemory>(
+			compiled_->import_count(ExternalKind::Memory), defs_.memories_
+		)),
+		tables_(make_index_space<WasmTable>(
+			compiled_->import_count(ExternalKind::Table), defs_.tables_
+		)),
+		globals_(make_index_space<WasmGlobal>(
+			compiled_->import_count(ExternalKind::Global), defs_.globals_
+		)),
+		global_slots_(make_global_slots(globals_)),
+		start_(
+			compiled_->start_index() ?
+			std::addressof(functions_[*compiled_->start_index()]) : nullptr
 		)
 	{
+		for(auto& glbl: globals_)
+		{
+			if(not glbl)
+				continue;
+			if(glbl->has_dependency())
+			{
+				auto idx = glbl->get_dependency();
+				assert(idx < globals_.size());
+				auto& dep = globals_[idx];
+				global_deps_[const_cast<const WasmGlobal* const*>(std::addressof(dep))].push_back(
+					std::addressof(glbl)
+				);
+			}
+		}
+		// notifying erases from 'global_deps_', so find the globals that are
+		// ready first.
+		std::vector<const WasmGlobal* const*> ready;
+		for(const auto& [dep, _] : global_deps_)
+		{
+			assert(dep);
+			if(*dep and not (*dep)->has_dependency())
+				ready.push_back(dep);
+		}
+		for(const WasmGlobal* const* dep: ready)
+			_notify_dependents(dep);
+		// segments stay in the compiled module; pending ones are kept by address.
+		const ModuleDef& module_def = compiled_->definition();
+		if(module_def.element_section)
+		{
+			for(const auto& seg: *module_def.element_section)
+				if(not initialize_elem_segment(seg))
+					elem_segs_[get_segment_dependency(seg)].push_back(std::addressof(seg));
+		}
+		if(module_def.data_section)
+		{
+			std::vector<const parse::DataSegment*> ready;
+			for(const auto& seg: *module_def.data_section)
+			{
+				if(try_get_offset(seg.offset))
+					ready.push_back(std::addressof(seg));
+				else
+					data_segs_[get_segment_dependency(seg)].push_back(std::addressof(seg));
+			}
+			initialize_data_segments(ready);
+		}
+	}
+
+	/// Compile 'module_def' for this instance alone.  To run many instances
+	/// of a module, compile it once and instantiate the result (see 'Store').
+	WasmModule(std::string&& name, std::string&& path, ModuleDef&& module_def):
+		WasmModule(std::move(name), CompiledModule::compile(std::move(path), std::move(module_def)))
+	{
 		
 	}
 
 
 	using signature_vector_type = SimpleVector<WasmFunctionSignature>;
-	using function_type = Function;
+	using function_type = const WasmFunction;
 	using table_type = WasmTable;
 	using memory_type = WasmLinearMemory;
 	using global_type = WasmGlobal;
 
+	/// An export, as a slot in the index space of its kind.
 	using export_type = std::variant<
 		function_type**, table_type**, memory_type**, global_type**
 	>;
-	using export_map_type = std::unordered_map<std::string, export_type>;
 
 private:
-	using import_type = std::variant<
-		WasmFunctionSignature, parse::Table, parse::Memory, parse::GlobalType
-	>;
-	using import_map_type = std::unordered_map<
-		std::string,
-		std::unordered_map<
-			std::string,
-			std::pair<
-				std::size_t,
-				import_type
-			>
-		>
-	>;
+	using import_type = CompiledModule::import_type;
+	using ImportSymbol = CompiledModule::ImportSymbol;
+	using import_map_type = CompiledModule::ImportTable;
 
 	template <class T>
-	const std::string& find_export_name(const T** exported_field) const
+	std::string_view find_export_name(const T* const* exported_field) const
 	{
-		for(const auto& [name, exp]: exports_)
+		// only used to build diagnostics
+		std::string_view name;
+		for(const parse::ExportEntry& ent: *compiled_->definition().export_section)
 		{
+			auto exp = make_export(CompiledModule::ExportEntry{ent.kind, ent.index});
 			if(std::holds_alternative<T**>(exp) and (std::get<T**>(exp) == exported_field))
-				return name;
+				name = ent.name;
 		}
-		assert(false and "Internal error: exported field is not an export.");
+		assert(not name.empty() and "Internal error: exported field is not an export.");
+		return name;
 	}
 
 	template <ExternalKind Kind>
 	std::pair<const std::string&, const std::string&> find_import_name(wasm_uint32_t index) const
 	{
 		using pair_type = std::pair<const std::string&, const std::string&>;
-		for(const auto& [module_name, import_map]: imports_)
-		{
-			for(const auto& [field_name, import_def]: import_map)
-			{
-				const auto& [idx, import_tp] = import_def;
-				if(idx != index)
-					continue;
-				bool match = std::visit(
-					[](const auto& t) { return (t.external_kind_v == Kind); },
-					import_tp
-				);
-				if(match)
-					return pair_type(module_name, field_name);
-			}
-		}
-		assert(false and "Internal error: imported field is not an import.");
+		const auto& ids = imports().ids[static_cast<std::size_t>(Kind)];
+		assert(index < ids.size() and "Internal error: imported field is not an import.");
+		const ImportSymbol& sym = imports().symbols[ids[index]];
+		return pair_type(imports().modules[sym.module_id], sym.field_name);
 	}
 
 	template <class T>
 	const auto& safely_access_index_space(const ConstSimpleVector<T*>& space, wasm_uint32_t index) const
 	{
 		static_assert(
-			std::disjunction<
-				std::is_same<T, WasmFunction>,
+			std::disjunction_v<
+				std::is_same<T, const WasmFunction>,
 				std::is_same<T, WasmTable>,
-				std::is_same<T, WasmMemory>,
+				std::is_same<T, WasmLinearMemory>,
 				std::is_same<T, WasmGlobal>
 			>
 		);
 		static const std::string import_type_name
-			= std::is_same_v<T, WasmFunction> ? "function" 
+			= std::is_same_v<T, const WasmFunction> ? "function" 
 			: std::is_same_v<T, WasmTable> ? "table" 
-			: std::is_same_v<T, WasmMemory> ? "memory" 
+			: std::is_same_v<T, WasmLinearMemory> ? "memory" 
 			: "global";
 		constexpr ExternalKind kind
-			= std::is_same_v<T, WasmFunction> ? ExternalKind::Function
+			= std::is_same_v<T, const WasmFunction> ? ExternalKind::Function
 			: std::is_same_v<T, WasmTable> ? ExternalKind::Table
-			: std::is_same_v<T, WasmMemory> ? ExternalKind::Memory
+			: std::is_same_v<T, WasmLinearMemory> ? ExternalKind::Memory
 			: ExternalKind::Global;
-		const auto*& item = space.at(index);
-		if(not f)
+		T* item = space.at(index);
+		if(not item)
 		{
-			const auto& [module_name, field_name] = find_import_name(&f);
-			throw UnresolvedExportError(
+			const auto& [module_name, field_name] = find_import_name<kind>(index);
+			throw UnresolvedImportError(
 				"Attempt to access imported "
 				+ import_type_name + " '"	
 				+ module_name + "." + field_name
@@ -231,52 +308,161 @@ private:
 	}
 
 public:
+	const WasmFunctionSignature& type_at(wasm_uint32_t index) const
+	{ return compiled_->type_at(index); }
+
+	/// Canonical id of the signature at 'index' in this module's type section.
+	signature_id_t type_id_at(wasm_uint32_t index) const
+	{ return compiled_->type_id_at(index); }
+
+	/// Parameter and result types of a BLOCK, LOOP or IF.  Views of a type in
+	/// this module's type section, or of 'tp' itself for single-result blocks.
+	std::pair<WasmFunctionSignature::view_type, WasmFunctionSignature::view_type>
+	block_signature(const opc::BlockType& tp) const
+	{
+		using view_type = WasmFunctionSignature::view_type;
+		if(tp.is_indexed())
+		{
+			// guaranteed by validation
+			assert(tp.type_index < compiled_->types().size());
+			const auto& sig = compiled_->types()[tp.type_index];
+			return {param_types(sig), return_types(sig)};
+		}
+		if(tp.type == LanguageType::block)
+			return {view_type(), view_type()};
+		return {view_type(), view_type(&tp.type, 1u)};
+	}
+
+	/// Functions are shared by all instances of the compiled module, so
+	/// there is no mutable access to them.
 	const WasmFunction& function_at(wasm_uint32_t index) const
 	{ return safely_access_index_space(functions_, index); }
 
-	WasmFunction& function_at(wasm_uint32_t index)
-	{ return const_cast<WasmFunction&>(as_const(*this).function_at(index)); }
-
 	const WasmTable& table_at(wasm_uint32_t index) const
 	{ return safely_access_index_space(tables_, index); }
 
 	WasmTable& table_at(wasm_uint32_t index)
-	{ return const_cast<WasmTable&>(as_const(*this).table_at(index)); }
+	{ return const_cast<WasmTable&>(std::as_const(*this).table_at(index)); }
 
-	const WasmMemory& memory_at(wasm_uint32_t index) const
+	const WasmLinearMemory& memory_at(wasm_uint32_t index) const
 	{ return safely_access_index_space(memories_, index); }
 
-	WasmMemory& memory_at(wasm_uint32_t index)
-	{ return const_cast<WasmMemory&>(as_const(*this).memory_at(index)); }
+	WasmLinearMemory& memory_at(wasm_uint32_t index)
+	{ return const_cast<WasmLinearMemory&>(std::as_const(*this).memory_at(index)); }
 
-	const WasmGlobal& memory_at(wasm_uint32_t index) const
+	const WasmGlobal& global_at(wasm_uint32_t index) const
 	{ return safely_access_index_space(globals_, index); }
 
-	WasmGlobal& memory_at(wasm_uint32_t index)
-	{ return const_cast<WasmGlobal&>(as_const(*this).global_at(index)); }
+	WasmGlobal& global_at(wasm_uint32_t index)
+	{ return const_cast<WasmGlobal&>(std::as_const(*this).global_at(index)); }
+
+	/// Entry record of the function at 'index'.  Unchecked: for validated
+	/// code in a fully linked module (see 'require_fully_linked()').
+	const WasmFunction::Entry& callee_at(wasm_uint32_t index) const
+	{
+		assert(index < callees_.size());
+		assert(callees_[index]);
+		return *callees_[index];
+	}
 
-	const std::string& name()
+	/// The value slot of the global at 'index'.  Unchecked: for validated code
+	/// in a fully linked module, where the index is in bounds and the import resolved.
+	WasmValue& global_slot(wasm_uint32_t index) const
+	{
+		assert(index < global_slots_.size());
+		assert(global_slots_[index]);
+		return *global_slots_[index];
+	}
+
+	const std::string& name() const
 	{ return name_; }
 
-	const std::string& path()
-	{ return path_; }
+	const std::string& path() const
+	{ return compiled_->path(); }
 
-	std::optional<const WasmFunction*> start(const WasmModule& self)
-	{ return start_ ? *start_ : std::nullopt; }
+	/// The compiled module this is an instance of.
+	const std::shared_ptr<const CompiledModule>& compiled() const
+	{ return compiled_; }
 
-	gsl::span<const WasmFunctionSignature> types(const WasmModule& self)
+	std::optional<const WasmFunction*> start() const
 	{
-		return gsl::span<const WasmFunctionSignature>(
-			self.signatures_.data(), self.signatures_.size()
-		);
+		if(not start_)
+			return std::nullopt;
+		return *start_;
+	}
+
+	gsl::span<const WasmFunctionSignature> types() const
+	{ return compiled_->types(); }
+
+	/// Look up an export by name.  Does not allocate.
+	std::optional<export_type> get_export(std::string_view name) const
+	{
+		if(const auto* ent = compiled_->find_export(name); ent)
+			return make_export(*ent);
+		return std::nullopt;
 	}
 
 	friend void link(WasmModule& left, WasmModule& right)
 	{ left.import_fields_from(right); }
 
+	/// Resolve the imports of this module that 'other' exports, like
+	/// 'link()', but carry on past imports that fail to link: each stays
+	/// unresolved and is passed to 'on_error(symbol)', where 'symbol' is
+	/// its position in 'compiled()->imports().symbols', from within the
+	/// handler of the 'BadImportError' it raised.  Returns the number of
+	/// imports from 'other' that are resolved and the number there are.
+	template <class OnError>
+	std::pair<std::size_t, std::size_t> import_fields_from(const WasmModule& other, OnError&& on_error)
+	{
+		const auto& modules = imports().modules;
+		auto module_pos = std::find(modules.begin(), modules.end(), other.name());
+		if(module_pos == modules.end())
+			return std::make_pair(0, 0);
+		auto module_id = static_cast<wasm_uint32_t>(module_pos - modules.begin());
+		const auto& syms = imports().symbols;
+		auto first = std::partition_point(syms.begin(), syms.end(), 
+			[=](const ImportSymbol& sym) { return sym.module_id < module_id; }
+		);
+		auto last = std::partition_point(first, syms.end(), 
+			[=](const ImportSymbol& sym) { return sym.module_id == module_id; }
+		);
+		std::size_t total = last - first;
+		std::size_t resolved = 0;
+		for(auto pos = first; pos != last; ++pos)
+		{
+			std::size_t symbol = pos - syms.begin();
+			if(resolved_[symbol])
+			{
+				++resolved;
+				continue;
+			}
+			// the field name's hash was computed when the module was compiled
+			const auto* export_def = other.compiled_->find_export(pos->field_name, pos->field_hash);
+			if(not export_def)
+				continue;
+			try
+			{
+				import_field(other, *pos, other.make_export(*export_def));
+			}
+			catch(const BadImportError&)
+			{
+				on_error(symbol);
+				continue;
+			}
+			resolved_[symbol] = true;
+			--unresolved_;
+			++resolved;
+		}
+		return std::make_pair(resolved, total);
+	}
+
+	/// Whether the import at 'symbol' in 'compiled()->imports().symbols' is resolved.
+	bool import_resolved(std::size_t symbol) const
+	{ return resolved_.at(symbol); }
+
 	bool is_fully_linked() const
 	{
-		if(imports.empty())
+		if(unresolved_ == 0u)
 		{
 			assert(elem_segs_.empty());
 			assert(data_segs_.empty());
@@ -288,101 +474,167 @@ public:
 		}
 	}
 
-private:
-
-	static SimpleVector<WasmFunctionSignature> read_type_section(ModuleDef&& module_def)
+	/// Throw 'UnresolvedImportError', naming the first unresolved import, if
+	/// the module isn't fully linked.  Call before running any of its code:
+	/// the interpreter follows resolved call targets and global slots unchecked.
+	void require_fully_linked() const
 	{
-		auto make_sig = [](parse::FunctionSignature&& sig_def) {
-			return WasmFunctionSignature(std::move(sig_def));
-		};
-		return SimpleVector<WasmFunctionSignature>(
-			make_transform_iterator(std::move(def).type_section.begin(), make_sig),
-			make_transform_iterator(std::move(def).type_section.end(), make_sig)
+		if(is_fully_linked())
+			return;
+		auto pos = std::find(resolved_.begin(), resolved_.end(), false);
+		assert(pos != resolved_.end());
+		const ImportSymbol& sym = imports().symbols[pos - resolved_.begin()];
+		throw UnresolvedImportError(
+			"Import '" + imports().modules[sym.module_id] + "." + sym.field_name
+			+ "' of module '" + name() + "' is not resolved."
 		);
 	}
 
-	template <class T>
-	ConstSimpleVector<T*> make_index_space(std::size_t import_count, ConstSimpleVector<T>& defs)
-	{
-		ConstSimpleVector<T*> s(import_count + defs.size());
-		auto pos = s.begin();
-		auto pointer_to = [](auto& v){ return std::addressof(v); };
-		pos = std::fill_n(pos, import_count, nullptr);
-		pos = std::transform(defs.begin(), defs.end(), pos, pointer_to);
-		return s;
-	}
+	/// @name Reuse
+	/// A fully linked instance can be returned to the state it had at its
+	/// reset point and run again, rather than instantiated again (see
+	/// 'InstancePool').  Only the tables, memories and globals the instance
+	/// defines are reset; imported ones belong to their exporters.
+	/// @{
+
+	/// The contents of the memories and globals an instance defines.
+	/// Instances of one compiled module that are linked alike start out with
+	/// the same image, so one image serves them all.
+	struct Image {
+		std::vector<std::vector<char>> memories;
+		std::vector<WasmValue> global_values;
+	};
 
-	WasmModule(std::sting&& name, std::string&& path, ModuleDef&& module_def, std::array<std::size_t, 4u>& spaces):
-		name_(std::move(name)),
-		path_(std::move(path)),
-		types_(read_type_section(std::move(module_def))),
-		imports_(read_import_section(std::move(module_def), spaces)),
-		defs_(std::move(module_def)),
-		functions_(make_index_space(spaces[std::size_t(ExternalKind::Function)], defs_.functions_)),
-		tables_(make_index_space(spaces[std::size_t(ExternalKind::Table)], defs_.tables_)),
-		memories_(make_index_space(spaces[std::size_t(ExternalKind::Memory)], defs_.memories_)),
-		globals_(make_index_space(spaces[std::size_t(ExternalKind::Global)], defs_.globals_)),
-		start_(
-			module_def.start_section ?
-			const_cast<const WasmFunction* const* const>(
-				std::addressof(functions_[*module_def.start_section])
-			) : nullptr
-		),
-		exports_(read_export_section(std::move(module_def)))
+	/// Image of the memories and globals this instance defines.
+	Image image() const
 	{
-		for(auto& glbl: globals_)
+		Image img;
+		img.memories.reserve(defs_.memories_.size());
+		for(const auto& mem: defs_.memories_)
 		{
-			if(not glbl)
-				continue;
-			if(glbl->has_dependency())
-			{
-				auto [idx , tp] = glbl.get_dependency();
-				assert(idx < globals_.size());
-				auto& dep = globals_[idx];
-				global_deps_[const_cast<const WasmGlobal* const*>(std::addressof(dep))].push_back(glbl);
-			}
-		}
-		for(const auto& [dep, _] : global_deps_)
-		{
-			assert(dep);
-			if(*dep)
-				notify_dependents(dep);
+			auto bytes = data(mem);
+			img.memories.emplace_back(bytes.begin(), bytes.end());
 		}
-		if(module_def.element_section)
+		img.global_values.assign(defs_.global_values_.begin(), defs_.global_values_.end());
+		return img;
+	}
+
+	/// Make the current state the one 'reset()' returns to.  Table entries
+	/// refer to their instance, so each instance keeps its own copy of them.
+	void set_reset_point()
+	{
+		require_fully_linked();
+		table_image_.clear();
+		for(const auto& table: defs_.tables_)
 		{
-			for(auto& seg: module_def.element_section)
-				if(not initialize_elem_segment(seg))
-					elem_segs_[get_segment_dependency(seg)].push_back(std::move(seg));
+			auto ents = table.entries();
+			table_image_.emplace_back(ents.begin(), ents.end());
 		}
-		if(module_def.data_section)
+		for(auto& mem: defs_.memories_)
+			mem.clear_dirty();
+	}
+
+	/// Return to the reset point.  'img' is the 'image()' taken there, by this
+	/// instance or by another instance of the same module, linked alike.
+	/// Memories only copy back the pages written since.
+	void reset(const Image& img)
+	{
+		assert(table_image_.size() == defs_.tables_.size());
+		assert(img.memories.size() == defs_.memories_.size());
+		assert(img.global_values.size() == defs_.global_values_.size());
+		for(std::size_t i = 0; i < defs_.tables_.size(); ++i)
+			defs_.tables_[i].restore(table_image_[i]);
+		for(std::size_t i = 0; i < defs_.memories_.size(); ++i)
+			defs_.memories_[i].restore(img.memories[i]);
+		static_assert(std::is_trivially_copyable_v<WasmValue>);
+		if(not img.global_values.empty())
 		{
-			for(auto& seg: module_def.data_section)
-				if(not initialize_data_segment(seg))
-					data_segs_[get_segment_dependency(seg)].push_back(std::move(seg));
+			std::memcpy(
+				defs_.global_values_.data(),
+				img.global_values.data(),
+				img.global_values.size() * sizeof(WasmValue)
+			);
 		}
 	}
+	/// @}
+
+	/// @name NUMA placement
+	/// Only the memories the instance defines are placed; imported ones
+	/// belong to their exporters (see 'WasmLinearMemory::bind_to_node()').
+	/// @{
+
+	/// Back the memories this instance defines with pages of NUMA node
+	/// 'node'.  Best effort: returns false if any couldn't be placed.
+	bool bind_memories_to_node(int node)
+	{
+		bool placed = true;
+		for(auto& mem: defs_.memories_)
+			placed = mem.bind_to_node(node) and placed;
+		return placed;
+	}
+
+	/// Of up to 'samples' pages of each memory this instance defines, the
+	/// number backed by a node other than 'node'.  The instance must not be
+	/// running, since its memories may grow.
+	std::size_t memory_pages_off_node(int node, std::size_t samples) const
+	{
+		std::size_t count = 0;
+		for(const auto& mem: defs_.memories_)
+			count += mem.pages_off_node(node, samples);
+		return count;
+	}
+	/// @}
+
+private:
+
+	static ConstSimpleVector<const WasmFunction::Entry*> make_callees(const ConstSimpleVector<const WasmFunction*>& functions)
+	{
+		ConstSimpleVector<const WasmFunction::Entry*> callees(functions.size());
+		std::transform(functions.begin(), functions.end(), callees.begin(), [](const WasmFunction* func) {
+			return func ? std::addressof(entry(*func)) : nullptr;
+		});
+		return callees;
+	}
+
+	static ConstSimpleVector<WasmValue*> make_global_slots(const ConstSimpleVector<WasmGlobal*>& globals)
+	{
+		ConstSimpleVector<WasmValue*> slots(globals.size());
+		std::transform(globals.begin(), globals.end(), slots.begin(), [](WasmGlobal* glbl) {
+			return glbl ? std::addressof(glbl->slot()) : nullptr;
+		});
+		return slots;
+	}
+
+	/// Imported entries are null until linking resolves them.
+	template <class T, class Defs>
+	static ConstSimpleVector<T*> make_index_space(std::size_t import_count, Defs& defs)
+	{
+		ConstSimpleVector<T*> s(import_count + defs.size());
+		auto pos = s.begin();
+		auto pointer_to = [](auto& v){ return std::addressof(v); };
+		pos = std::fill_n(pos, import_count, nullptr);
+		pos = std::transform(defs.begin(), defs.end(), pos, pointer_to);
+		return s;
+	}
 
 	void import_field(
-		const ModuleDef& other,
-		const std::string& field_name,
-		const import_type& import_def,
+		const WasmModule& other,
+		const ImportSymbol& import_def,
 		const export_type& export_def
 	)
 	{
-		assert(not import_def.valueless_by_exception());
+		const auto& field_name = import_def.field_name;
+		const auto& import_tp = import_def.type;
+		const auto import_index = import_def.index;
+		assert(not import_tp.valueless_by_exception());
 		assert(not export_def.valueless_by_exception());
-		if(import_def.index() != export_def.index())
-			throw ImportKindMismatchError(*this, other, field_name);
-		const auto& [import_index, import_tp] = import_def;
+		if(import_tp.index() != export_def.index())
+			throw ImportKindMismatchError(*this, other, std::string(field_name));
 		auto visit_import_export = [&](const auto& imported, auto** exported) {
 			using import_external_kind_type = std::decay_t<decltype(imported)>;
 			using exported_type = std::decay_t<decltype(**exported)>;
 			using export_external_kind_type = typename exported_type::wasm_external_kind_type;
 			assert(exported);
-			auto do_import = [&](auto& index_space) {
-				auto*& pos = index_space.at(import_index);
-				if(not pos)
-			};
 			constexpr bool external_kinds_match = std::is_same_v<
 				import_external_kind_type,
 				export_external_kind_type
@@ -390,55 +642,46 @@ private:
 			if constexpr(external_kinds_match)
 			{
 				if(not *exported)
-					throw NullImportError(*this, other, field_name);
+					throw NullImportError(*this, other, std::string(field_name));
 				if(not matches(**exported, imported))
-					throw ImportTypeMismatchError(*this, other, field_name);
-				using index_space_type = ConstSimpleVector<exported_type>;
+					throw ImportTypeMismatchError(*this, other, std::string(field_name));
+				using index_space_type = ConstSimpleVector<std::remove_reference_t<decltype(*exported)>>;
 				auto& index_space = std::get<index_space_type&>(
 					std::tie(functions_, tables_, memories_, globals_)
 				);
 				auto*& elem = index_space.at(import_index);
 				assert((not elem)); // shouldn't be possible... uh oh
 				elem = *exported;
+				if constexpr(std::is_same_v<exported_type, WasmFunction>)
+					callees_.at(import_index) = std::addressof(entry(*elem));
 				if constexpr(std::is_same_v<exported_type, WasmGlobal>)
 				{
-					using global_key_type = const parse::WasmGlobal* const*;
+					// point straight at the exporter's value slot.
+					global_slots_.at(import_index) = std::addressof(elem->slot());
+					using global_key_type = const WasmGlobal* const*;
 					_notify_dependents(const_cast<global_key_type>(&elem));
 				}
 			}
 			else
 			{
-				throw ImportKindMismatchError(*this, other, field_name);
+				throw ImportKindMismatchError(*this, other, std::string(field_name));
 			}
 		};
 		std::visit(visit_import_export, import_tp, export_def);
 	}
 
-	std::pair<std::size_t, std::size_t> import_fields_from(const ModuleDef& other)
+	std::pair<std::size_t, std::size_t> import_fields_from(const WasmModule& other)
+	{ return import_fields_from(other, [](std::size_t) { throw; }); }
+
+	/// Canonical signature id of the function at 'index', which may be an
+	/// unresolved import (linking checks that the export's signature matches).
+	signature_id_t function_signature_id(wasm_uint32_t index) const
 	{
-		auto module_pos = imports_.find(name(other));
-		if(module_pos == imports_.end())
-			return std::make_pair(0, 0);
-		auto& imps = *module_pos;
-		std::size_t total = imps.size();
-		for(auto pos = imps.begin(); pos != imps.end(); pos = imps.erase(pos))
-		{
-			const auto& [field_name, import_def] = *pos;
-			if(auto pos = other.exports_.find(field_name); pos != other.exports_.end())
-			{
-				const export_type& export_def = pos->second;
-				import_field(other, field_name, import_def, export_def);
-			}
-		}
-		if(imps.empty())
-		{
-			imports_.erase(module_pos);
-			return std::make_pair(total, total);
-		}
-		else
-		{
-			return std::make_pair(total - imps.size(), total);
-		}
+		if(const WasmFunction* fn = functions_.at(index); fn)
+			return signature_id(*fn);
+		const auto& ids = imports().ids[static_cast<std::size_t>(ExternalKind::Function)];
+		const ImportSymbol& sym = imports().symbols[ids.at(index)];
+		return signature_id(std::get<WasmFunctionSignature>(sym.type));
 	}
 
 	template <class Segment>
@@ -446,7 +689,7 @@ private:
 	{
 		assert(std::holds_alternative<wasm_uint32_t>(seg.offset));
 		return const_cast<const WasmGlobal* const*>(
-			std::addressof(globals_.at(seg.offset))
+			std::addressof(globals_.at(std::get<wasm_uint32_t>(seg.offset)))
 		);
 	}
 
@@ -454,247 +697,246 @@ private:
 	{
 		assert(not ofs.valueless_by_exception());
 		if(std::holds_alternative<wasm_sint32_t>(ofs))
-			return std::get<wasm_sint32_t>(ofs_var);
-		auto globals_offset = std::get<wasm_uint32_t>(ofs_var);
+			return std::get<wasm_sint32_t>(ofs);
+		auto globals_offset = std::get<wasm_uint32_t>(ofs);
 		if(auto g = globals_.at(globals_offset); g and not g->has_dependency())
-			return g->get(tp::i32);
+			return g->slot().get(tp::i32);
 		else
 			return std::nullopt;
 	}
 
-	template <class Segment, class IndexSpace>
-	auto get_segment(Segment& seg, IndexSpace& ind_sp)
+	bool initialize_elem_segment(const parse::ElemSegment& seg)
 	{
-		auto& [index, ofs_var, data] = seg;
-		assert(ind_sp.size() > index);
-		auto maybe_offset = try_get_offset(ofs_var);
+		auto maybe_offset = try_get_offset(seg.offset);
 		if(not maybe_offset)
 			return false;
-		assert(*maybe_offset >= 0);
-		std::size_t offset = *maybe_offset;
-		auto& item = ind_sp.at(offset);
-		return item.get_segment(offset, data.size());
-	}
-
-	bool initialize_elem_segment(parse::ElemSegment&& seg)
-	{
-		auto slice = get_segment(seg, tables_);
-		auto& inds = seg.indices;
-		for(std::size_t i = 0; i < slice.size(); ++i)
-		{
-			const WasmFunction* const& fn = functions_.at(inds[i]);
-			slice[i].emplace_wasm_function(std::addressof(fn));
-		}
-		return true;
-	}
-
-	bool initialize_data_segment(parse::DataSegment&& seg)
-	{
-		auto slice = table.get_segment(seg, memories_);
-		std::copy(seg.data.begin(), seg.data.end(), slice.begin());
+		// offsets are unsigned; a negative i32 is out of bounds.
+		auto offset = static_cast<wasm_uint32_t>(*maybe_offset);
+		gsl::span<const wasm_uint32_t> indices(seg.indices.data(), seg.indices.size());
+		table_at(seg.index).init(
+			offset, indices, 0u, indices.size(),
+			[&](wasm_uint32_t index) {
+				return TableFunction(functions_.at(index), function_signature_id(index));
+			}
+		);
 		return true;
 	}
 
-	void initialize_global_dep(parse::WasmGlobal* const* dest, const parse::WasmGlobal& src)
-	{
-		(*dest)->init_dep(src);
-		// add const qualifier at bottom level
-		nodify_dependents(const_cast<const parse::WasmGlobal* const*>(dest));
-	}
-
-	template <class T>
-	void initialize_global_const(parse::WasmGlobal* const* dest, const T& value)
-	{
-		(*dest)->init_const(value);
-		// add const qualifier at bottom level
-		nodify_dependents(const_cast<const parse::WasmGlobal* const*>(dest));
-	}
-
-	template <class T>
-	void initialize_global_mut(parse::WasmGlobal* const* dest, const T& value)
-	{
-		(*dest)->init_mut(value);
-		// add const qualifier at bottom level
-		_notify_dependents(const_cast<const parse::WasmGlobal* const*>(dest));
-	}
-
-	void _notify_dependents(const parse::WasmGlobal* const* dep)
+	/// Data segments totalling fewer bytes are copied on the calling thread.
+	static constexpr const std::size_t parallel_data_threshold = 8u << 20;
+	/// Bytes of data segment copied by each task of a parallel copy.
+	static constexpr const std::size_t data_chunk_size = 1u << 20;
+
+	/// Copy 'segs', whose offsets are all known, into memory.  Every segment
+	/// is bounds-checked before any is copied.  When they don't overlap and
+	/// total at least 'parallel_data_threshold' bytes, they are split into
+	/// chunks copied in parallel on 'ThreadPool::shared()', with non-temporal
+	/// stores; otherwise they are copied in order, so that later segments
+	/// overwrite earlier ones.
+	void initialize_data_segments(gsl::span<const parse::DataSegment* const> segs)
 	{
-		wasm_uint32_t offset = static_cast<wasm_uint32_t>(dep - globals_.data());
-		assert(static_cast<std::ptrdiff_t>(offset) == dep - globals_.data());
-		// initialize table element segments
-		if(auto pos = elem_segs_.find(dep); pos != elem_segs_.end())
+		struct Copy {
+			char* dest;
+			const char* src;
+			std::size_t size;
+		};
+		std::vector<Copy> copies;
+		copies.reserve(segs.size());
+		std::vector<SegmentTracker> covered(memories_.size());
+		bool disjoint = true;
+		std::size_t total = 0;
+		for(const parse::DataSegment* seg: segs)
 		{
-			for(auto& seg: *pos)
-				initialize_elem_segment(std::move(seg));
-			elem_segs_.erase(pos);
+			auto maybe_offset = try_get_offset(seg->offset);
+			assert(maybe_offset);
+			// offsets are unsigned; a negative i32 is out of bounds.
+			std::size_t offset = static_cast<wasm_uint32_t>(*maybe_offset);
+			std::size_t size = seg->data.size();
+			auto dest = memory_at(seg->index).write_span(offset, size);
+			copies.push_back(Copy{dest.data(), seg->data.data(), size});
+			total += size;
+			if(disjoint)
+			{
+				SegmentTracker& tracker = covered.at(seg->index);
+				if(tracker.overlaps(offset, size))
+					disjoint = false;
+				else
+					tracker.insert_range(offset, size);
+			}
 		}
-		if(auto pos = data_segs_.find(dep); pos != data_segs_.end())
+		if(not disjoint or total < parallel_data_threshold)
 		{
-			for(auto& seg: *pos)
-				initialize_data_segment(std::move(seg));
-			data_segs.erase(pos);
+			for(const Copy& copy: copies)
+				std::memcpy(copy.dest, copy.src, copy.size);
+			return;
 		}
-		if(auto pos = global_deps_.find(dep); pos != global_deps_.end())
+		std::vector<Copy> chunks;
+		chunks.reserve(total / data_chunk_size + copies.size());
+		for(const Copy& copy: copies)
 		{
-			for(WasmGlobal* const* glbl: *pos)
-				// recursively initialize globals.
-				initialize_global_dep(glbl, **dep);
-			global_deps_.erase(pos);
+			for(std::size_t pos = 0; pos < copy.size; pos += data_chunk_size)
+			{
+				chunks.push_back(Copy{
+					copy.dest + pos, copy.src + pos, std::min(data_chunk_size, copy.size - pos)
+				});
+			}
 		}
+		ThreadPool::shared().parallel_for(chunks.size(), [&](std::size_t i) {
+			stream_copy(chunks[i].dest, chunks[i].src, chunks[i].size);
+		});
 	}
 
-	template <class Visitor>
-	decltype(auto) visit_index_space(Visitor&& vis, ExternalKind kind)
+	/// Initialize what waits on the global at 'first', which now has its
+	/// value: segments offset by it and globals initialized from it, then,
+	/// in turn, what waits on those globals.
+	void _notify_dependents(const WasmGlobal* const* first)
 	{
-		switch(kind)
+		// a worklist rather than recursion, so that long chains of globals
+		// don't exhaust the native stack.
+		std::vector<const WasmGlobal* const*> ready{first};
+		while(not ready.empty())
 		{
-		case ExternalKind::Function: 
-			std::invoke(std::forward<Visitor>(vis), functions_);
-			break;
-		case ExternalKind::Table:
-			std::invoke(std::forward<Visitor>(vis), tables_);
-			break;
-		case ExternalKind::Memory:
-			std::invoke(std::forward<Visitor>(vis), memories_);
-			break;
-		case ExternalKind::Global:
-			std::invoke(std::forward<Visitor>(vis), globals_);
-			break;
-		default:
-			assert(false);
+			const WasmGlobal* const* dep = ready.back();
+			ready.pop_back();
+			if(auto pos = elem_segs_.find(dep); pos != elem_segs_.end())
+			{
+				for(const parse::ElemSegment* seg: pos->second)
+					initialize_elem_segment(*seg);
+				elem_segs_.erase(pos);
+			}
+			if(auto pos = data_segs_.find(dep); pos != data_segs_.end())
+			{
+				initialize_data_segments(pos->second);
+				data_segs_.erase(pos);
+			}
+			if(auto pos = global_deps_.find(dep); pos != global_deps_.end())
+			{
+				for(WasmGlobal* const* glbl: pos->second)
+				{
+					(*glbl)->init_dep(**dep);
+					// add const qualifier at bottom level
+					ready.push_back(const_cast<const WasmGlobal* const*>(glbl));
+				}
+				global_deps_.erase(pos);
+			}
 		}
 	}
 
-	export_map_type read_export_section(ModuleDef&& module_def)
-	{
-		export_map_type exports;
-		for(parse::ExportEntry& entry: module_def.export_section)
-		{
-			auto add_export = [&](auto& index_space) {
-				auto [_, success] = exports.try_emplace(std::move(entry.name), &(index_space[entry.index]));
-				assert(success);
-			};
-			visit_index_space(add_export, entry.kind);
-		}
-		return exports;
-	}
+	const import_map_type& imports() const
+	{ return compiled_->imports(); }
 
-	import_map_type read_import_section(ModuleDef&& module_def, std::array<std::size_t, 4u>& spaces)
+	/// The slot 'ent' names in this instance's index spaces.  Like the
+	/// index spaces themselves, exports are only shallowly const.
+	export_type make_export(const CompiledModule::ExportEntry& ent) const
 	{
-		import_map_type imports;
-		if(module_def.import_section)
+		auto& self = const_cast<WasmModule&>(*this);
+		switch(ent.kind)
 		{
-			for(auto&& entry: *module_def.import_section)
-			{
-				auto& module_map = imports[std::move(entry.module_name)];
-				auto& field_name = entry.field_name;
-				
-				auto emplace_import = [&](auto& space, auto&& ... args) {
-					auto [pos, success] = module_map.try_emplace(
-						std::move(field_name), space, std::forward<decltype(args)>(args)...
-					);
-					assert(success);
-					space += 1u;
-				};
-				
-				auto& space = spaces[static_cast<std::size_t>(entry.kind())];
-				auto visit_import = [&](auto&& entry_type) {
-					using type = std::decay_t<decltype(entry_type)>;
-					if constexpr(std::is_same_v<type, std::uint32_t>)
-						return emplace_import(space, signatures[entry_type]);
-					else
-						return emplace_import(space, std::move(entry_type));
-					assert(false && "Unreachable.");
-				};
-				std::visit(visit_import, std::move(entry));
-			}
+		case ExternalKind::Function:
+			return export_type(std::addressof(self.functions_.at(ent.index)));
+		case ExternalKind::Table:
+			return export_type(std::addressof(self.tables_.at(ent.index)));
+		case ExternalKind::Memory:
+			return export_type(std::addressof(self.memories_.at(ent.index)));
+		case ExternalKind::Global:
+			return export_type(std::addressof(self.globals_.at(ent.index)));
+		default:
+			assert(false);
+			throw std::logic_error("Internal error: bad export kind.");
 		}
-		return imports;
 	}
 
+	/// The tables, memories and globals this instance defines, made from
+	/// their definitions in the compiled module.
 	struct ModuleDefinitions {
-		
-		ConstSimpleVector<WasmFunction> read_functions(ModuleDef&& module_def, const signature_vector_type& sigs)
+
+		SimpleVector<WasmValue> read_global_values(const ModuleDef& module_def)
 		{
-			if(module_def.function_section)
-			{
-				assert(module_def.type_section);
-				assert(module_def.code_section);
-				std::size_t count = module_def.function_section.size();
-				assert(count == module_def.code_section.size());
-				auto& func_sec = *module_def.function_section;
-				auto& code_sec = *module_def.code_section;
-				auto code_pos = code_sec.begin();
-				auto& tform = [&](std::uint32_t ofs) {
-					return WasmFunction(signatures.at(ofs), std::move(*code_pos++));
-				};
-				return ConstSimpleVector<WasmFunction>(
-					make_transform_iterator(func_sec.begin(), tform),
-					make_transform_iterator(func_sec.end(), tform)
-				);
-			}
-			return ConstSimpleVector<WasmFunction>();
+			std::size_t count = module_def.global_section ? module_def.global_section->size() : 0u;
+			return SimpleVector<WasmValue>(count, WasmValue(wasm_sint64_t(0)));
 		}
 
-		ConstSimpleVector<WasmGlobal> read_globals(ModuleDef&& module_def)
+		ConstSimpleVector<WasmGlobal> read_globals(const ModuleDef& module_def)
 		{
+			if(not module_def.global_section)
+				return ConstSimpleVector<WasmGlobal>();
+			// each global's value lives in the matching slot of 'global_values_'.
+			std::size_t index = 0;
+			auto make_global = [&](const parse::GlobalEntry& ent) {
+				return WasmGlobal(ent, global_values_[index++]);
+			};
 			return ConstSimpleVector<WasmGlobal>(
-				module_def.global_section.begin(),
-				module_def.global_section.end()
+				make_transform_iterator(module_def.global_section->begin(), make_global),
+				make_transform_iterator(module_def.global_section->end(), make_global)
 			);
 		}
 
-		ConstSimpleVector<WasmLinearMemory> read_memories(ModuleDef&& module_def)
+		ConstSimpleVector<WasmLinearMemory> read_memories(const ModuleDef& module_def)
 		{
+			if(not module_def.memory_section)
+				return ConstSimpleVector<WasmLinearMemory>();
 			return ConstSimpleVector<WasmLinearMemory>(
-				module_def.memory_section.begin(),
-				module_def.memory_section.end()
+				module_def.memory_section->begin(),
+				module_def.memory_section->end()
 			);
 		}
 
+		ConstSimpleVector<WasmTable> read_tables(const ModuleDef& module_def)
+		{
+			if(not module_def.table_section)
+				return ConstSimpleVector<WasmTable>();
+			return ConstSimpleVector<WasmTable>(
+				module_def.table_section->begin(),
+				module_def.table_section->end()
+			);
+		}
 
-		ModuleDefinitions(ModuleDef&& module_def):
-			functions_(read_functions(std::move(module_def))),
-			memories_(read_memories(std::move(module_def))),
-			globals_(read_globals(std::move(module_def))),
-			tables_(read_tables(std::move(module_def)))
+		ModuleDefinitions(const ModuleDef& module_def):
+			memories_(read_memories(module_def)),
+			global_values_(read_global_values(module_def)),
+			globals_(read_globals(module_def)),
+			tables_(read_tables(module_def))
 		{
 			
 		}
 
-		ConstSimpleVector<WasmFunction>     funtions_;
 		ConstSimpleVector<WasmLinearMemory> memories_;
+		/// Values of the globals defined in this module, contiguous, one untagged slot each.
+		SimpleVector<WasmValue>             global_values_;
 		ConstSimpleVector<WasmGlobal>       globals_;
 		ConstSimpleVector<WasmTable>        tables_;
 	};
 
 	/// This module's 'name'.  Used in import/export resolution and debugging.
 	const std::string name_;
-	/// The filesystem path to this module.
-	const std::string path_;
-	/// The function signatures used in this module.
-	const SimpleVector<WasmFunctionSignature> types_;
-	/// Contains the functions, tables, memories, and globals that are explicitly defined in this modules (not imported).
+	/// The code, types, imports and exports, shared with the other instances of the module.
+	const std::shared_ptr<const CompiledModule> compiled_;
+	/// Whether each import in 'compiled_->imports().symbols' is resolved in this instance.
+	std::vector<bool> resolved_;
+	/// Number of 'false' entries in 'resolved_'.
+	std::size_t unresolved_;
+	/// Contains the tables, memories, and globals that are explicitly defined in this modules (not imported).
 	ModuleDefinitions defs_;
-	/// Maps module + field names to not-yet-resolved imports for this module.
-	import_map_type imports_;
 	/// Function index space. Has pointers to all functions visible to this module.
-	ConstSimpleVector<WasmFunction*> functions_;
+	ConstSimpleVector<const WasmFunction*> functions_;
+	/// Entry records of the functions in 'functions_', for direct calls.  Imported entries are filled in by linking.
+	ConstSimpleVector<const WasmFunction::Entry*> callees_;
 	/// Memory index space. Has pointers to all memories visible to this module.
 	ConstSimpleVector<WasmLinearMemory*> memories_;
 	/// Table index space. Has pointers to all tables visible to this module.
 	ConstSimpleVector<WasmTable*> tables_;
 	/// Global index space. Has pointers to all globals visible to this module.
 	ConstSimpleVector<WasmGlobal*> globals_;
+	/// Value slot of every global in 'globals_'.  Imported globals point into the exporter's 'global_values_'.
+	ConstSimpleVector<WasmValue*> global_slots_;
 	/// Pointer-to-pointer to the start function for this module.  Possibly null.  Points into 'functions_'.
 	const WasmFunction* const* const start_;
-	/// Maps field names to exports for this module.
-	export_map_type exports_;
-	/// Uninitialized element segments.
-	std::unordered_map<const WasmGlobal* const*, std::vector<parse::ElemSegment>> elem_segs_;
-	/// Uninitializes data segments.
-	std::unordered_map<const WasmGlobal* const*, std::vector<parse::DataSegment>> data_segs_;
+	/// Uninitialized element segments.  Point into the compiled module's definition.
+	std::unordered_map<const WasmGlobal* const*, std::vector<const parse::ElemSegment*>> elem_segs_;
+	/// Uninitializes data segments.  Point into the compiled module's definition.
+	std::unordered_map<const WasmGlobal* const*, std::vector<const parse::DataSegment*>> data_segs_;
+	/// Entries of the tables defined here at the reset point (see 'set_reset_point()').
+	std::vector<std::vector<TableFunction>> table_image_;
 	/// Uninitialized globals with dependencies.
 	std::unordered_map<const WasmGlobal* const*, std::vector<WasmGlobal* const*>> global_deps_;
 };
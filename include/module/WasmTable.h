@@ -2,36 +2,178 @@
 #define MODULE_WASM_TABLE_H
 
 #include "function/TableFunction.h"
+#include "vm/op/errors.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <vector>
 #include <gsl/span>
 
 namespace wasm {
 
+/// A table of 'TableFunction' entries.  Entries are fixed-size, trivially
+/// copyable records stored contiguously, so the bulk operations are block
+/// copies.  Out-of-bounds accesses trap before any entry is written.
 struct WasmTable {
 
 	using wasm_external_kind_type = parse::Table;
-	using any_function_type = std::optional<
-	
-	gsl::span<any_function_type> get_segment(std::size_t offset, std::size_t length)
+	using table_function_type = TableFunction;
+
+	static_assert(std::is_trivially_copyable_v<table_function_type>);
+
+	explicit WasmTable(const parse::Table& def):
+		table_(def.initial),
+		maximum_(def.maximum ? *def.maximum : std::numeric_limits<std::size_t>::max())
 	{
-		assert(offset <= table_.size());
-		assert((table_.size() - offset) >= lenfth);
-		return gsl::span<TableFunction>(table_.data() + offset, length);
+
 	}
-	
+
 	friend bool matches(const WasmTable& self, const parse::Table& tp)
 	{
-		return self.table_.size() >= tp.size() and (
-			self.maximum_ == tp.maximum.value_or(std::numeric_limits<std::size_t>::max())
+		return self.table_.size() >= tp.initial and (
+			not tp.maximum.has_value() or self.maximum_ <= *tp.maximum
 		);
 	}
 
-	const any_function_type& at(wasm_uint32_t idx) const
+	std::size_t size() const
+	{ return table_.size(); }
+
+	std::size_t maximum() const
+	{ return maximum_; }
+
+	const table_function_type& at(wasm_uint32_t idx) const
 	{ return table_.at(idx); }
-	
-	any_function_type& at(wasm_uint32_t idx)
+
+	table_function_type& at(wasm_uint32_t idx)
 	{ return table_.at(idx); }
-	
+
+	/// @name Table instructions
+	/// @{
+
+	/// 'table.get'
+	const table_function_type& get(wasm_uint32_t idx) const
+	{
+		check_range(idx, 1u);
+		return table_[idx];
+	}
+
+	/// 'table.set'
+	void set(wasm_uint32_t idx, const table_function_type& value)
+	{
+		check_range(idx, 1u);
+		table_[idx] = value;
+	}
+
+	/// 'table.grow'.  Returns the previous size, or -1 if the table can't
+	/// grow by 'delta' entries.
+	wasm_sint32_t grow(wasm_uint32_t delta, const table_function_type& init)
+	{
+		std::size_t prev = table_.size();
+		assert(prev <= maximum_);
+		if(delta > maximum_ - prev)
+			return -1;
+		// 'init' may refer to an entry of this table.
+		table_function_type value = init;
+		try
+		{
+			table_.resize(prev + delta);
+		}
+		catch(std::bad_alloc& e)
+		{
+			return -1;
+		}
+		fill_entries(table_.data() + prev, delta, value);
+		return static_cast<wasm_sint32_t>(prev);
+	}
+
+	/// 'table.fill'
+	void fill(wasm_uint32_t dst, wasm_uint32_t count, const table_function_type& value)
+	{
+		check_range(dst, count);
+		fill_entries(table_.data() + dst, count, value);
+	}
+
+	/// 'table.copy'.  'dest' and 'src' may be the same table, and the ranges
+	/// may overlap.
+	friend void copy(
+		WasmTable& dest,
+		wasm_uint32_t dst,
+		const WasmTable& src,
+		wasm_uint32_t src_offset,
+		wasm_uint32_t count
+	)
+	{
+		src.check_range(src_offset, count);
+		dest.check_range(dst, count);
+		if(count > 0u)
+		{
+			std::memmove(
+				dest.table_.data() + dst,
+				src.table_.data() + src_offset,
+				count * sizeof(table_function_type)
+			);
+		}
+	}
+
+	/// 'table.init', and initialization by active element segments.  Sets
+	/// the 'count' entries at 'dst' to 'make_entry(index)' for the function
+	/// indices 'indices[src_offset, src_offset + count)'.  Element segments
+	/// are kept as function indices; entries are only made for the indices
+	/// that are actually copied into a table.
+	template <class MakeEntry>
+	void init(
+		wasm_uint32_t dst,
+		gsl::span<const wasm_uint32_t> indices,
+		wasm_uint32_t src_offset,
+		wasm_uint32_t count,
+		MakeEntry&& make_entry
+	)
+	{
+		std::size_t seg_size = indices.size();
+		if(src_offset > seg_size or count > seg_size - src_offset)
+			throw ops::TableAccessError();
+		check_range(dst, count);
+		auto first = indices.begin() + src_offset;
+		std::transform(first, first + count, table_.begin() + dst, std::forward<MakeEntry>(make_entry));
+	}
+	/// @}
+
+	/// The entries, for saving and later passing to 'restore()'.
+	gsl::span<const table_function_type> entries() const
+	{ return gsl::span<const table_function_type>(table_.data(), table_.size()); }
+
+	/// Replace the entries with 'image', a copy of 'entries()' taken earlier.
+	void restore(gsl::span<const table_function_type> image)
+	{
+		assert(static_cast<std::size_t>(image.size()) <= maximum_);
+		table_.resize(image.size());
+		if(image.size() > 0)
+			std::memcpy(table_.data(), image.data(), image.size() * sizeof(table_function_type));
+	}
+
 private:
+	void check_range(wasm_uint32_t offset, wasm_uint32_t count) const
+	{
+		if(offset > table_.size() or count > table_.size() - offset)
+			throw ops::TableAccessError();
+	}
+
+	/// Write 'value' once, then double the filled prefix with block copies.
+	static void fill_entries(table_function_type* first, std::size_t count, const table_function_type& value)
+	{
+		if(count == 0u)
+			return;
+		first[0] = value;
+		for(std::size_t filled = 1; filled < count;)
+		{
+			std::size_t n = std::min(filled, count - filled);
+			std::memcpy(first + filled, first, n * sizeof(table_function_type));
+			filled += n;
+		}
+	}
+
 	std::vector<table_function_type> table_;
 	const std::size_t maximum_ = std::numeric_limits<std::size_t>::max();
 };
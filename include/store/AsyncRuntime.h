@@ -0,0 +1,281 @@
+#ifndef STORE_ASYNC_RUNTIME_H
+#define STORE_ASYNC_RUNTIME_H
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "x3binparse.h"
+#include "store/Store.h"
+#include "utilities/ThreadPool.h"
+#include "vm/Executor.h"
+
+namespace wasm {
+
+/// Compiles, instantiates and runs modules without blocking the caller,
+/// for embedders whose threads run event loops.  Each entry point returns
+/// at once, and either returns a future or calls a completion when the
+/// work is done.  Compilation and instantiation run on a pool of threads
+/// of the runtime's own; calls run on an 'Executor'.  Completions run on
+/// those threads, so they should be quick and must not block on other
+/// work of the same runtime.
+///
+/// The runtime owns the instances it makes, at fixed addresses, until they
+/// are released with 'release()' or the runtime is destroyed.  Work not yet
+/// started when the runtime is destroyed is dropped: its completion never
+/// runs, and its future is broken.
+template <class ValueType>
+struct AsyncRuntime {
+
+	using executor_type = Executor<ValueType>;
+	using Outcome = typename executor_type::Outcome;
+	using compiled_type = std::shared_ptr<const CompiledModule>;
+
+	using compile_completion_type = std::function<void(compiled_type, std::exception_ptr)>;
+	using instantiate_completion_type = std::function<void(Instance*, std::exception_ptr)>;
+	using invoke_completion_type = typename executor_type::completion_type;
+
+	struct Options {
+		/// Threads for compiling and instantiating.
+		std::size_t compile_threads = std::max(1u, std::thread::hardware_concurrency() / 2u);
+		/// Check function bodies when the module is compiled, rather than
+		/// on their first call (see 'parse::lazy_module').
+		bool eager_validation = false;
+		/// If set, compiled code is metered with these costs (see
+		/// 'RunContext::set_fuel()' and 'executor_type::Options::fuel').
+		std::shared_ptr<const parse::FuelCosts> fuel_costs;
+		typename executor_type::Options executor;
+	};
+
+	AsyncRuntime():
+		AsyncRuntime(Options())
+	{
+
+	}
+
+	explicit AsyncRuntime(const Options& opts):
+		options_(opts),
+		executor_(opts.executor),
+		pool_(std::max<std::size_t>(opts.compile_threads, 1u))
+	{
+
+	}
+
+	AsyncRuntime(const AsyncRuntime&) = delete;
+	AsyncRuntime& operator=(const AsyncRuntime&) = delete;
+
+	/// @name Compilation
+	/// Parse, validate and compile the module binary 'bytes', loaded from
+	/// 'path'.  Malformed and invalid modules fail with
+	/// 'parse::InvalidModuleError'.
+	/// @{
+	void compile_async(std::string bytes, std::string path, compile_completion_type on_done)
+	{
+		pool_.post(
+			[this, bytes = std::move(bytes), path = std::move(path), on_done = std::move(on_done)]() mutable {
+				compiled_type compiled;
+				std::exception_ptr error;
+				try
+				{
+					compiled = compile(std::move(bytes), std::move(path));
+				}
+				catch(...)
+				{
+					error = std::current_exception();
+				}
+				on_done(std::move(compiled), error);
+			}
+		);
+	}
+
+	std::future<compiled_type> compile_async(std::string bytes, std::string path = std::string())
+	{
+		auto promise = std::make_shared<std::promise<compiled_type>>();
+		auto result = promise->get_future();
+		compile_async(std::move(bytes), std::move(path),
+			[promise](compiled_type compiled, std::exception_ptr error) {
+				if(error)
+					promise->set_exception(error);
+				else
+					promise->set_value(std::move(compiled));
+			}
+		);
+		return result;
+	}
+	/// @}
+
+	/// @name Instantiation
+	/// Instantiate 'compiled' as a module named 'name' and link it against
+	/// each of 'imports' in turn (see 'link()').  Bad imports fail with a
+	/// 'LinkError'.  Imports none of 'imports' provide are left unresolved;
+	/// the instance can't be invoked until they are linked.
+	/// @{
+	void instantiate_async(
+		compiled_type compiled,
+		std::string name,
+		std::vector<Instance*> imports,
+		instantiate_completion_type on_done
+	)
+	{
+		pool_.post(
+			[
+				this,
+				compiled = std::move(compiled),
+				name = std::move(name),
+				imports = std::move(imports),
+				on_done = std::move(on_done)
+			]() mutable {
+				Instance* inst = nullptr;
+				std::exception_ptr error;
+				try
+				{
+					inst = std::addressof(instantiate(std::move(compiled), std::move(name), imports));
+				}
+				catch(...)
+				{
+					error = std::current_exception();
+				}
+				on_done(inst, error);
+			}
+		);
+	}
+
+	std::future<Instance*> instantiate_async(
+		compiled_type compiled,
+		std::string name,
+		std::vector<Instance*> imports = std::vector<Instance*>()
+	)
+	{
+		auto promise = std::make_shared<std::promise<Instance*>>();
+		auto result = promise->get_future();
+		instantiate_async(std::move(compiled), std::move(name), std::move(imports),
+			[promise](Instance* inst, std::exception_ptr error) {
+				if(error)
+					promise->set_exception(error);
+				else
+					promise->set_value(inst);
+			}
+		);
+		return result;
+	}
+	/// @}
+
+	/// @name Invocation
+	/// Call the function 'name' exported by 'instance' with 'args' on the
+	/// executor (see 'Executor::submit()').  'instance' must be fully linked.
+	/// A call made while another call in 'instance' hasn't finished fails
+	/// with a 'std::logic_error' in its 'Outcome'.  Traps and errors are
+	/// reported in the 'Outcome', not by the future.
+	/// @{
+	void invoke_async(
+		Instance& instance,
+		std::string name,
+		std::vector<ValueType> args,
+		invoke_completion_type on_done
+	)
+	{ executor_.submit(instance, std::move(name), std::move(args), std::move(on_done)); }
+
+	std::future<Outcome> invoke_async(Instance& instance, std::string name, std::vector<ValueType> args)
+	{
+		auto promise = std::make_shared<std::promise<Outcome>>();
+		auto result = promise->get_future();
+		invoke_async(instance, std::move(name), std::move(args),
+			[promise](Outcome&& outcome) { promise->set_value(std::move(outcome)); }
+		);
+		return result;
+	}
+	/// @}
+
+	/// Destroy 'instance'.  No call in it may be unfinished, and no other
+	/// instance may import from it.  Throws 'std::invalid_argument' if the
+	/// runtime doesn't own 'instance', and 'std::logic_error' if a call in
+	/// it hasn't finished.
+	void release(Instance& instance)
+	{
+		std::unique_ptr<Instance> owned;
+		{
+			std::lock_guard<std::mutex> lock(instances_mutex_);
+			auto pos = std::find_if(instances_.begin(), instances_.end(),
+				[&](const auto& inst) { return inst.get() == std::addressof(instance); }
+			);
+			if(pos == instances_.end())
+				throw std::invalid_argument("Instance was not made by this runtime.");
+			if(executor_.busy(instance))
+				throw std::logic_error("Attempt to release an instance with an unfinished call.");
+			executor_.forget(instance);
+			owned = std::move(*pos);
+			*pos = std::move(instances_.back());
+			instances_.pop_back();
+		}
+	}
+
+	executor_type& executor()
+	{ return executor_; }
+
+private:
+	compiled_type compile(std::string&& bytes, std::string&& path) const
+	{
+		namespace x3 = boost::spirit::x3;
+		auto source = std::make_shared<const std::string>(std::move(bytes));
+		parse::ModuleDef def;
+		auto first = source->begin();
+		auto last = source->end();
+		auto parse_module = [&](const auto& parser) {
+			if(options_.fuel_costs)
+			{
+				return x3::parse(first, last,
+					x3::with<parse::codeparse::fuel_costs_tag>(std::cref(*options_.fuel_costs))[parser],
+					def
+				);
+			}
+			return x3::parse(first, last, parser, def);
+		};
+		try
+		{
+			bool matched = options_.eager_validation
+				? parse_module(parse::validated_module)
+				: parse_module(parse::lazy_module);
+			if(not matched or first != last)
+				throw parse::InvalidModuleError("Malformed module.");
+		}
+		catch(const x3::expectation_failure<std::string::const_iterator>& err)
+		{
+			throw parse::InvalidModuleError(
+				"Malformed module at offset "
+				+ std::to_string(err.where() - source->begin()) + ": " + err.which()
+			);
+		}
+		def.source = std::move(source);
+		return CompiledModule::compile(std::move(path), std::move(def));
+	}
+
+	Instance& instantiate(compiled_type&& compiled, std::string&& name, const std::vector<Instance*>& imports)
+	{
+		auto inst = std::make_unique<Instance>(std::move(name), std::move(compiled));
+		for(Instance* exporter: imports)
+			link(*inst, *exporter);
+		std::lock_guard<std::mutex> lock(instances_mutex_);
+		instances_.push_back(std::move(inst));
+		return *instances_.back();
+	}
+
+	const Options options_;
+	/// Guards 'instances_'.
+	std::mutex instances_mutex_;
+	/// Declared before the executor and the pool, so that no work is
+	/// running in them when they are destroyed.
+	std::vector<std::unique_ptr<Instance>> instances_;
+	executor_type executor_;
+	ThreadPool pool_;
+};
+
+} /* namespace wasm */
+
+#endif /* STORE_ASYNC_RUNTIME_H */
@@ -0,0 +1,236 @@
+#ifndef STORE_INSTANCE_POOL_H
+#define STORE_INSTANCE_POOL_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "store/Store.h"
+
+namespace wasm {
+
+/// A fixed number of instances of one compiled module, instantiated and
+/// linked up front and kept ready to run.  'try_checkout()' hands out a
+/// ready instance in constant time without taking a lock.  When its lease
+/// ends, a background thread resets the instance to its linked state (see
+/// 'WasmModule::reset()') and makes it ready again, so neither checkout nor
+/// release pays for instantiation or reset.
+///
+/// Instances are linked by the 'link' function passed to the constructor,
+/// which must resolve every import of every instance to the same exports:
+/// all instances are reset from one image, taken from the first.
+///
+/// A reset only copies back the memory pages written since the reset
+/// point.  Guest stores record what they write; the host must write to a
+/// leased instance's memories through 'WasmLinearMemory::write_span()',
+/// which does too, or its writes survive the lease.
+struct InstancePool {
+
+	using link_function = std::function<void(Instance&)>;
+
+	/// Exclusive use of one instance of the pool, until the lease is
+	/// destroyed.  Leases must not outlive their pool.
+	struct Lease {
+
+		Lease() = default;
+
+		Lease(Lease&& other) noexcept:
+			pool_(std::exchange(other.pool_, nullptr)), slot_(other.slot_)
+		{
+
+		}
+
+		Lease& operator=(Lease&& other) noexcept
+		{
+			Lease tmp(std::move(other));
+			std::swap(pool_, tmp.pool_);
+			std::swap(slot_, tmp.slot_);
+			return *this;
+		}
+
+		~Lease()
+		{
+			if(pool_)
+				pool_->release(slot_);
+		}
+
+		explicit operator bool() const
+		{ return static_cast<bool>(pool_); }
+
+		Instance& operator*() const
+		{
+			assert(pool_);
+			return *pool_->instances_[slot_];
+		}
+
+		Instance* operator->() const
+		{ return std::addressof(**this); }
+
+	private:
+		friend struct InstancePool;
+
+		Lease(InstancePool& pool, std::uint32_t slot):
+			pool_(std::addressof(pool)), slot_(slot)
+		{
+
+		}
+
+		InstancePool* pool_ = nullptr;
+		std::uint32_t slot_ = 0;
+	};
+
+	InstancePool(
+		std::shared_ptr<const CompiledModule> compiled,
+		std::string name,
+		std::size_t size,
+		link_function link
+	):
+		next_(std::make_unique<std::atomic<std::uint32_t>[]>(size))
+	{
+		if(size == 0u or size >= std::numeric_limits<std::uint32_t>::max())
+			throw std::invalid_argument("Bad instance pool size.");
+		instances_.reserve(size);
+		for(std::size_t i = 0; i < size; ++i)
+		{
+			Instance& inst = store_.instantiate(name, compiled);
+			if(link)
+				link(inst);
+			inst.set_reset_point();
+			instances_.push_back(std::addressof(inst));
+		}
+		image_ = instances_.front()->image();
+		for(std::size_t i = size; i > 0u; --i)
+			push_ready(static_cast<std::uint32_t>(i - 1u));
+		resetter_ = std::thread([this]() { reset_loop(); });
+	}
+
+	InstancePool(const InstancePool&) = delete;
+	InstancePool& operator=(const InstancePool&) = delete;
+
+	/// Instances still leased are not reset.
+	~InstancePool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		released_cv_.notify_one();
+		resetter_.join();
+	}
+
+	std::size_t size() const
+	{ return instances_.size(); }
+
+	/// Lease a ready instance, or return an empty lease if all instances are
+	/// leased or being reset.  Lock-free; safe to call from any thread.
+	Lease try_checkout()
+	{
+		std::uint32_t slot = pop_ready();
+		if(slot == no_slot)
+			return Lease();
+		return Lease(*this, slot);
+	}
+
+private:
+	static constexpr const std::uint32_t no_slot = std::numeric_limits<std::uint32_t>::max();
+
+	/// @name Ready slots
+	/// A lock-free stack of slot indices.  'ready_head_' packs the top slot
+	/// plus one (zero if the stack is empty) into the low 32 bits and a
+	/// count of the updates to the stack into the high 32 bits, so that a
+	/// slot that is popped and pushed again between another thread's read
+	/// of the head and its update doesn't corrupt the stack.
+	/// @{
+	void push_ready(std::uint32_t slot)
+	{
+		std::uint64_t head = ready_head_.load(std::memory_order_relaxed);
+		std::uint64_t new_head;
+		do {
+			next_[slot].store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+			new_head = (((head >> 32) + 1u) << 32) | (slot + 1u);
+		} while(not ready_head_.compare_exchange_weak(
+			head, new_head, std::memory_order_release, std::memory_order_relaxed
+		));
+	}
+
+	std::uint32_t pop_ready()
+	{
+		std::uint64_t head = ready_head_.load(std::memory_order_acquire);
+		for(;;)
+		{
+			auto top = static_cast<std::uint32_t>(head);
+			if(top == 0u)
+				return no_slot;
+			std::uint32_t next = next_[top - 1u].load(std::memory_order_relaxed);
+			std::uint64_t new_head = (((head >> 32) + 1u) << 32) | next;
+			if(ready_head_.compare_exchange_weak(
+				head, new_head, std::memory_order_acquire, std::memory_order_acquire
+			))
+			{
+				return top - 1u;
+			}
+		}
+	}
+	/// @}
+
+	void release(std::uint32_t slot)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			released_.push_back(slot);
+		}
+		released_cv_.notify_one();
+	}
+
+	/// Reset released instances and make them ready, until the pool is destroyed.
+	void reset_loop()
+	{
+		std::vector<std::uint32_t> batch;
+		for(;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				released_cv_.wait(lock, [this]() { return stopping_ or not released_.empty(); });
+				if(stopping_)
+					return;
+				batch.swap(released_);
+			}
+			for(std::uint32_t slot: batch)
+			{
+				instances_[slot]->reset(image_);
+				push_ready(slot);
+			}
+			batch.clear();
+		}
+	}
+
+	/// Owns the instances.
+	Store store_;
+	/// The instances, by slot.
+	std::vector<Instance*> instances_;
+	/// The memories and globals of every instance at its reset point.
+	Instance::Image image_;
+	/// Per slot, the ready slot below it on the stack, plus one.
+	std::unique_ptr<std::atomic<std::uint32_t>[]> next_;
+	std::atomic<std::uint64_t> ready_head_{0u};
+	/// Guards 'released_' and 'stopping_'.
+	std::mutex mutex_;
+	std::condition_variable released_cv_;
+	/// Slots whose leases ended, waiting for a reset.
+	std::vector<std::uint32_t> released_;
+	bool stopping_ = false;
+	std::thread resetter_;
+};
+
+} /* namespace wasm */
+
+#endif /* STORE_INSTANCE_POOL_H */
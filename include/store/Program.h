@@ -0,0 +1,317 @@
+#ifndef STORE_PROGRAM_H
+#define STORE_PROGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "store/Store.h"
+#include "utilities/ThreadPool.h"
+
+namespace wasm {
+
+/// Thrown by 'Program::instantiate()' with every import of the program
+/// that could not be resolved, rather than just the first.
+struct ProgramLinkError:
+	public std::logic_error
+{
+	struct Failure {
+		/// The module whose import failed.
+		std::string importer;
+		/// The import's module and field names.
+		std::string module_name;
+		std::string field_name;
+		std::string reason;
+	};
+
+	explicit ProgramLinkError(std::vector<Failure>&& f):
+		std::logic_error(describe(f)), failures(std::move(f))
+	{
+
+	}
+
+	virtual ~ProgramLinkError() = default;
+
+	const std::vector<Failure> failures;
+
+private:
+	static std::string describe(const std::vector<Failure>& failures)
+	{
+		std::string msg = std::to_string(failures.size()) + " imports failed to link:";
+		for(const Failure& f: failures)
+		{
+			msg += "\n  " + f.importer + ": '" + f.module_name + "." + f.field_name
+				+ "': " + f.reason;
+		}
+		return msg;
+	}
+};
+
+/// A set of modules that import from each other, instantiated and linked
+/// together.  'instantiate()' builds a graph with an edge from each module
+/// to every module it imports from and links it in one sweep, exporters
+/// before their importers, so an export that is itself an import is
+/// resolved by the time it is imported.  Modules that don't depend on each
+/// other are instantiated and linked in parallel, on 'ThreadPool::shared()'.
+///
+/// Imports from modules outside the program are not resolved; link them
+/// with 'link()' before running the program's code.
+struct Program {
+
+	Program() = default;
+	Program(const Program&) = delete;
+	Program& operator=(const Program&) = delete;
+
+	/// Add an instance of 'compiled' named 'name' to the program.  Throws
+	/// 'std::invalid_argument' if the program already has a module named
+	/// 'name', and 'std::logic_error' if it was already instantiated.
+	void add(std::string name, std::shared_ptr<const CompiledModule> compiled)
+	{
+		if(instantiated_)
+			throw std::logic_error("Cannot add a module to a program after instantiating it.");
+		if(not by_name_.emplace(name, nodes_.size()).second)
+			throw std::invalid_argument("Program already has a module named '" + name + "'.");
+		nodes_.push_back(Node{std::move(name), std::move(compiled)});
+	}
+
+	/// Instantiate and link every module added.  Throws 'ProgramLinkError'
+	/// listing every import within the program that failed to resolve; the
+	/// instances are kept, linked as far as they could be.
+	void instantiate()
+	{
+		if(instantiated_)
+			throw std::logic_error("Program was already instantiated.");
+		instantiated_ = true;
+		ThreadPool& pool = ThreadPool::shared();
+		// no module's instantiation reads another's state: imports are
+		// null until linked, and whatever depends on them waits.
+		pool.parallel_for(nodes_.size(), [&](std::size_t i) {
+			Node& node = nodes_[i];
+			node.instance = std::make_unique<Instance>(std::string(node.name), node.compiled);
+			node.reasons.resize(node.compiled->imports().symbols.size());
+		});
+		resolve_exporters();
+		std::vector<std::vector<std::size_t>> levels = sort_levels();
+		for(std::size_t i = 0; i < levels.size(); ++i)
+		{
+			const std::vector<std::size_t>& level = levels[i];
+			if(i + 1u == levels.size() and not acyclic_)
+			{
+				link_cycles(level);
+				continue;
+			}
+			// linking writes only to the importer, except for imported
+			// tables and memories, whose segments it may initialize.
+			std::vector<std::size_t> independent;
+			std::vector<std::size_t> shared;
+			for(std::size_t n: level)
+				(imports_shared_state(nodes_[n]) ? shared : independent).push_back(n);
+			pool.parallel_for(independent.size(), [&](std::size_t j) {
+				link_node(nodes_[independent[j]]);
+			});
+			for(std::size_t n: shared)
+				link_node(nodes_[n]);
+			order_.insert(order_.end(), level.begin(), level.end());
+		}
+		report_failures();
+	}
+
+	std::size_t size() const
+	{ return nodes_.size(); }
+
+	/// The instance named 'name'.  Throws 'std::out_of_range' if there is
+	/// none, or if the program wasn't instantiated.
+	Instance& at(const std::string& name) const
+	{
+		const Node& node = nodes_[by_name_.at(name)];
+		if(not node.instance)
+			throw std::out_of_range("Program was not instantiated.");
+		return *node.instance;
+	}
+
+	/// The instances, exporters before their importers (except within
+	/// cycles of imports), which is the order to run start functions in.
+	std::vector<Instance*> instances() const
+	{
+		std::vector<Instance*> result;
+		result.reserve(order_.size());
+		for(std::size_t n: order_)
+			result.push_back(nodes_[n].instance.get());
+		return result;
+	}
+
+private:
+	static constexpr const std::size_t no_node = std::numeric_limits<std::size_t>::max();
+
+	struct Node {
+		std::string name;
+		std::shared_ptr<const CompiledModule> compiled;
+		std::unique_ptr<Instance> instance;
+		/// Per name in 'compiled->imports().modules', the module of the
+		/// program it names, or 'no_node'.
+		std::vector<std::size_t> exporters;
+		/// Per import symbol, why it failed to link, if it did.  Each
+		/// node's are written only while it is linked, so that nodes can
+		/// be linked in parallel.
+		std::vector<std::string> reasons;
+	};
+
+	void resolve_exporters()
+	{
+		for(Node& node: nodes_)
+		{
+			const auto& modules = node.compiled->imports().modules;
+			node.exporters.resize(modules.size(), no_node);
+			for(std::size_t i = 0; i < modules.size(); ++i)
+				if(auto pos = by_name_.find(modules[i]); pos != by_name_.end())
+					node.exporters[i] = pos->second;
+		}
+	}
+
+	/// Sort the nodes into levels: a node's exporters are all in earlier
+	/// levels.  Nodes that depend on a cycle of imports, and the cycle
+	/// itself, can't be sorted and go in one last level, which clears
+	/// 'acyclic_'.
+	std::vector<std::vector<std::size_t>> sort_levels()
+	{
+		std::vector<std::size_t> pending(nodes_.size(), 0u);
+		std::vector<std::vector<std::size_t>> importers(nodes_.size());
+		for(std::size_t n = 0; n < nodes_.size(); ++n)
+		{
+			std::vector<std::size_t> deps = nodes_[n].exporters;
+			std::sort(deps.begin(), deps.end());
+			deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+			for(std::size_t dep: deps)
+			{
+				if(dep == no_node or dep == n)
+					continue;
+				importers[dep].push_back(n);
+				++pending[n];
+			}
+		}
+		std::vector<std::vector<std::size_t>> levels;
+		std::vector<std::size_t> current;
+		for(std::size_t n = 0; n < nodes_.size(); ++n)
+			if(pending[n] == 0u)
+				current.push_back(n);
+		std::size_t sorted = 0;
+		while(not current.empty())
+		{
+			std::vector<std::size_t> next;
+			for(std::size_t n: current)
+				for(std::size_t imp: importers[n])
+					if(--pending[imp] == 0u)
+						next.push_back(imp);
+			sorted += current.size();
+			levels.push_back(std::move(current));
+			current = std::move(next);
+		}
+		acyclic_ = (sorted == nodes_.size());
+		if(not acyclic_)
+		{
+			levels.emplace_back();
+			for(std::size_t n = 0; n < nodes_.size(); ++n)
+				if(pending[n] > 0u)
+					levels.back().push_back(n);
+		}
+		return levels;
+	}
+
+	static bool imports_shared_state(const Node& node)
+	{
+		const auto& ids = node.compiled->imports().ids;
+		return not ids[static_cast<std::size_t>(ExternalKind::Table)].empty()
+			or not ids[static_cast<std::size_t>(ExternalKind::Memory)].empty();
+	}
+
+	/// Link 'node' against each module of the program it imports from.
+	/// Returns the number of its imports that are resolved.
+	std::size_t link_node(Node& node)
+	{
+		Instance& inst = *node.instance;
+		std::size_t resolved = 0;
+		for(std::size_t exporter: node.exporters)
+		{
+			if(exporter == no_node)
+				continue;
+			resolved += inst.import_fields_from(*nodes_[exporter].instance, [&](std::size_t symbol) {
+				try
+				{
+					throw;
+				}
+				catch(const std::exception& e)
+				{
+					node.reasons[symbol] = e.what();
+				}
+			}).first;
+		}
+		return resolved;
+	}
+
+	/// Link modules that import from each other, directly or not.  An
+	/// import of an export that is itself an import may fail until the
+	/// exporter is linked, so link the nodes over and over until no more
+	/// imports resolve.  Only the reasons of the last pass are kept.
+	void link_cycles(const std::vector<std::size_t>& level)
+	{
+		std::size_t resolved = 0;
+		for(;;)
+		{
+			std::size_t total = 0;
+			for(std::size_t n: level)
+			{
+				Node& node = nodes_[n];
+				std::fill(node.reasons.begin(), node.reasons.end(), std::string());
+				total += link_node(node);
+			}
+			if(total == resolved)
+				break;
+			resolved = total;
+		}
+		order_.insert(order_.end(), level.begin(), level.end());
+	}
+
+	/// Throw 'ProgramLinkError' if any import within the program is unresolved.
+	void report_failures() const
+	{
+		std::vector<ProgramLinkError::Failure> failures;
+		for(const Node& node: nodes_)
+		{
+			const auto& imports = node.compiled->imports();
+			for(std::size_t i = 0; i < imports.symbols.size(); ++i)
+			{
+				if(node.instance->import_resolved(i))
+					continue;
+				const auto& sym = imports.symbols[i];
+				if(node.exporters[sym.module_id] == no_node)
+					continue;
+				std::string reason = node.reasons[i];
+				if(reason.empty())
+					reason = "Module exports no such field.";
+				failures.push_back(ProgramLinkError::Failure{
+					node.name, imports.modules[sym.module_id], sym.field_name, std::move(reason)
+				});
+			}
+		}
+		if(not failures.empty())
+			throw ProgramLinkError(std::move(failures));
+	}
+
+	/// The modules, in the order they were added.
+	std::vector<Node> nodes_;
+	std::unordered_map<std::string, std::size_t> by_name_;
+	/// Positions in 'nodes_', in the order the nodes were linked.
+	std::vector<std::size_t> order_;
+	bool instantiated_ = false;
+	bool acyclic_ = true;
+};
+
+} /* namespace wasm */
+
+#endif /* STORE_PROGRAM_H */
@@ -1,8 +1,53 @@
 #ifndef STORE_STORE_H
 #define STORE_STORE_H
 
+#include <deque>
+#include <memory>
+#include <string>
+#include "module/CompiledModule.h"
+#include "module/WasmModule.h"
 
+namespace wasm {
 
+/// An instance of a compiled module.
+using Instance = WasmModule;
 
+/// Owns module instances.  A module is compiled once, with 'compile()',
+/// and may then be instantiated any number of times, in this store or in
+/// others: every instance shares the compiled module's types and function
+/// code, and only allocates its own tables, memories, globals and index
+/// spaces.  A 'CompiledModule' may be shared between threads; a 'Store'
+/// and its instances may not, so each thread should use a store of its own.
+struct Store {
+
+	Store() = default;
+	Store(const Store&) = delete;
+	Store& operator=(const Store&) = delete;
+
+	static std::shared_ptr<const CompiledModule> compile(std::string path, ModuleDef&& module_def)
+	{ return CompiledModule::compile(std::move(path), std::move(module_def)); }
+
+	/// Instantiate 'compiled' as a module named 'name'.  The instance lives
+	/// as long as the store, at a fixed address, so other instances may
+	/// link against it.
+	Instance& instantiate(std::string name, std::shared_ptr<const CompiledModule> compiled)
+	{
+		instances_.emplace_back(std::move(name), std::move(compiled));
+		return instances_.back();
+	}
+
+	/// Compile 'module_def' and instantiate it once.
+	Instance& instantiate(std::string name, std::string path, ModuleDef&& module_def)
+	{ return instantiate(std::move(name), compile(std::move(path), std::move(module_def))); }
+
+	std::size_t instance_count() const
+	{ return instances_.size(); }
+
+private:
+	/// A deque, so that instances never move.
+	std::deque<Instance> instances_;
+};
+
+} /* namespace wasm */
 
 #endif /* STORE_STORE_H */
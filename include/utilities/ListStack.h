@@ -1,7 +1,9 @@
 #ifndef UTILITIES_LIST_STACK_H
 #define UTILITIES_LIST_STACK_H
 
+#include <cassert>
 #include <forward_list>
+#include <utility>
 
 
 template <class T, class Allocator>
@@ -10,16 +12,16 @@ struct ListStack
 private:
 	using list_type = std::forward_list<T, Allocator>;
 public:
-	using list_type::value_type;
-	using list_type::allocator_type;
-	using list_type::size_type;
-	using list_type::difference_type;
-	using list_type::reference;
-	using list_type::const_reference;
-	using list_type::pointer;
-	using list_type::const_pointer;
-	using list_type::iterator;
-	using list_type::const_iterator;
+	using typename list_type::value_type;
+	using typename list_type::allocator_type;
+	using typename list_type::size_type;
+	using typename list_type::difference_type;
+	using typename list_type::reference;
+	using typename list_type::const_reference;
+	using typename list_type::pointer;
+	using typename list_type::const_pointer;
+	using typename list_type::iterator;
+	using typename list_type::const_iterator;
 
 	ListStack() = delete;
 
@@ -46,7 +48,7 @@ public:
 
 	[[nodiscard]] bool empty() const
 	{
-		assert(list_.empty() == not static_cast<bool>(count));
+		assert(list_.empty() == not static_cast<bool>(count_));
 		return list_.empty();
 	}
 
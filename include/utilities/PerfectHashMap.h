@@ -0,0 +1,203 @@
+#ifndef UTILITIES_PERFECT_HASH_MAP_H
+#define UTILITIES_PERFECT_HASH_MAP_H
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <stdexcept>
+
+/*
+ * Immutable map from strings to values, built once over a fixed key set using
+ * a minimal perfect hash (hash-and-displace).  Keys are hashed into buckets;
+ * each bucket gets a displacement seed, chosen largest-bucket-first, that
+ * sends all of its keys to distinct free slots.  Lookups hash the key once,
+ * read one seed and compare one stored key; they never allocate.
+ *
+ * Callers that look up the same key repeatedly (e.g. imports, across links)
+ * can compute 'hash(key)' once and use the two-argument 'find()'.
+ */
+template <class Value>
+class PerfectHashMap
+{
+	struct Entry {
+		std::uint32_t key_offset;
+		std::uint32_t key_size;
+		Value value;
+	};
+public:
+	using key_type = std::string_view;
+	using mapped_type = Value;
+	using size_type = std::size_t;
+
+	PerfectHashMap() = default;
+
+	/// Build over a sequence of (key, value) pairs.  Keys must be unique.
+	template <class It>
+	PerfectHashMap(It first, It last)
+	{
+		std::vector<std::pair<std::string_view, Value>> items;
+		for(; first != last; ++first)
+			items.emplace_back(std::string_view(first->first), first->second);
+		build(std::move(items));
+	}
+
+	static std::size_t hash(std::string_view key)
+	{ return std::hash<std::string_view>{}(key); }
+
+	const Value* find(std::string_view key) const
+	{ return find(key, hash(key)); }
+
+	const Value* find(std::string_view key, std::size_t key_hash) const
+	{
+		if(entries_.empty())
+			return nullptr;
+		const Entry& ent = entries_[slot(key_hash, seeds_[bucket(key_hash)])];
+		if(key_at(ent) != key)
+			return nullptr;
+		return &ent.value;
+	}
+
+	Value* find(std::string_view key)
+	{ return const_cast<Value*>(std::as_const(*this).find(key)); }
+
+	Value* find(std::string_view key, std::size_t key_hash)
+	{ return const_cast<Value*>(std::as_const(*this).find(key, key_hash)); }
+
+	bool contains(std::string_view key) const
+	{ return static_cast<bool>(find(key)); }
+
+	size_type size() const
+	{ return entries_.size(); }
+
+	bool empty() const
+	{ return entries_.empty(); }
+
+	/// Visit every (key, value) pair, in slot order.
+	template <class Visitor>
+	void for_each(Visitor&& visitor) const
+	{
+		for(const Entry& ent: entries_)
+			visitor(key_at(ent), ent.value);
+	}
+
+private:
+	static std::size_t mix(std::size_t h, std::uint32_t seed)
+	{
+		std::uint64_t x = static_cast<std::uint64_t>(h) ^ (0x9e3779b97f4a7c15ull * (seed + 1u));
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		return static_cast<std::size_t>(x);
+	}
+
+	std::size_t bucket(std::size_t key_hash) const
+	{ return key_hash % seeds_.size(); }
+
+	std::size_t slot(std::size_t key_hash, std::uint32_t seed) const
+	{ return mix(key_hash, seed) % entries_.size(); }
+
+	std::string_view key_at(const Entry& ent) const
+	{ return std::string_view(keys_.data() + ent.key_offset, ent.key_size); }
+
+	void build(std::vector<std::pair<std::string_view, Value>>&& items)
+	{
+		std::size_t count = items.size();
+		if(count == 0u)
+			return;
+		std::vector<std::size_t> hashes(count);
+		std::transform(items.begin(), items.end(), hashes.begin(),
+			[](const auto& item) { return hash(item.first); }
+		);
+		// ~4 keys per bucket finds seeds quickly; fall back to one key per
+		// bucket (which practically always succeeds) if a bucket gets stuck.
+		for(std::size_t bucket_count: {count / 4u + 1u, count})
+		{
+			if(try_build(items, hashes, bucket_count))
+				return;
+		}
+		throw std::runtime_error("Failed to build perfect hash (duplicate keys?).");
+	}
+
+	bool try_build(
+		const std::vector<std::pair<std::string_view, Value>>& items,
+		const std::vector<std::size_t>& hashes,
+		std::size_t bucket_count
+	)
+	{
+		constexpr const std::uint32_t max_seed = 1u << 16;
+		std::size_t count = items.size();
+		seeds_.assign(bucket_count, 0u);
+		std::vector<std::vector<std::uint32_t>> buckets(bucket_count);
+		for(std::uint32_t i = 0; i < count; ++i)
+			buckets[hashes[i] % bucket_count].push_back(i);
+		std::vector<std::uint32_t> order(bucket_count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](auto l, auto r) {
+			return buckets[l].size() > buckets[r].size();
+		});
+		std::vector<std::uint32_t> slot_of(count);
+		std::vector<bool> taken(count, false);
+		std::vector<std::size_t> trial;
+		for(std::uint32_t b: order)
+		{
+			const auto& keys = buckets[b];
+			if(keys.empty())
+				break;
+			std::uint32_t seed = 0;
+			for(; seed < max_seed; ++seed)
+			{
+				trial.clear();
+				bool ok = true;
+				for(std::uint32_t k: keys)
+				{
+					std::size_t s = mix(hashes[k], seed) % count;
+					if(taken[s] or std::find(trial.begin(), trial.end(), s) != trial.end())
+					{
+						ok = false;
+						break;
+					}
+					trial.push_back(s);
+				}
+				if(ok)
+					break;
+			}
+			if(seed == max_seed)
+				return false;
+			seeds_[b] = seed;
+			for(std::size_t i = 0; i < keys.size(); ++i)
+			{
+				taken[trial[i]] = true;
+				slot_of[keys[i]] = trial[i];
+			}
+		}
+		// lay out the keys contiguously, in slot order.
+		std::vector<std::uint32_t> by_slot(count);
+		for(std::uint32_t i = 0; i < count; ++i)
+			by_slot[slot_of[i]] = i;
+		keys_.clear();
+		entries_.clear();
+		entries_.reserve(count);
+		for(std::uint32_t i: by_slot)
+		{
+			const auto& [key, value] = items[i];
+			entries_.push_back(Entry{
+				static_cast<std::uint32_t>(keys_.size()),
+				static_cast<std::uint32_t>(key.size()),
+				value
+			});
+			keys_.append(key);
+		}
+		return true;
+	}
+
+	std::vector<std::uint32_t> seeds_;
+	std::vector<Entry> entries_;
+	std::string keys_;
+};
+
+#endif /* UTILITIES_PERFECT_HASH_MAP_H */
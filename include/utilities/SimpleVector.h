@@ -6,18 +6,34 @@
 #include <type_traits>
 #include <utility>
 #include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <ostream>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
 
 namespace wasm {
 
 template <class T, bool = std::is_class_v<T> and std::is_empty_v<T> and not std::is_final_v<T>>
 struct Wrapper;
 
-template <class T
+template <class T>
 struct Wrapper<T, true>:
 	private T
 {
-	using base_type = T;
-	using base_type::base_type;
+	template <
+		class ... U, 
+		class = std::enable_if_t<
+			std::is_constructible_v<T, U...>
+		>
+	>
+	Wrapper(U&& ... args):
+		T(std::forward<U>(args)...)
+	{
+		
+	}
+
 	Wrapper(const Wrapper&) = default;
 	Wrapper(Wrapper&&) = default;
 	Wrapper& operator=(const Wrapper&) = default;
@@ -37,7 +53,7 @@ struct Wrapper<T, true>:
 };
 
 template <class T>
-struct Wrapper<T, true>
+struct Wrapper<T, false>
 {
 
 	template <
@@ -61,13 +77,13 @@ struct Wrapper<T, true>
 	{ return self.value_; }
 
 	friend const T&& get(const Wrapper<T>&& self)
-	{ return self.value_; }
+	{ return std::move(self.value_); }
 
 	friend T& get(Wrapper<T>& self)
 	{ return self.value_; }
 
 	friend T&& get(Wrapper<T>&& self)
-	{ return self.value_; }
+	{ return std::move(self.value_); }
 
 	template <class U, class = std::enable_if_t<std::is_swappable_with_v<T, U>>>
 	void swap(Wrapper<U>& other)
@@ -80,7 +96,7 @@ private:
 	T value_;
 };
 
-template <class T, class U, class = std::enable_if_t<std::is_swappable_with_v<T, U>>>>
+template <class T, class U, class = std::enable_if_t<std::is_swappable_with_v<T, U>>>
 void swap(Wrapper<T>& left, Wrapper<U>& right)
 {
 	using std::swap;
@@ -103,8 +119,8 @@ public:
 	using const_pointer = typename traits::const_pointer;
 	using reference = value_type&;
 	using const_reference = const value_type&;
-	using void_pointer = typename traits::pointer;
-	using const_void_pointer = typename traits::const_pointer;
+	using void_pointer = typename traits::void_pointer;
+	using const_void_pointer = typename traits::const_void_pointer;
 	using propagate_on_container_copy_assignment
 		= typename traits::propagate_on_container_copy_assignment;
 	using propagate_on_container_move_assignment
@@ -114,12 +130,12 @@ public:
 
 	template <class T>
 	struct rebind {
-		using other = AllocatorDeleter<typename std::traits::rebind_alloc<T>::other>;
+		using other = AllocatorDeleter<typename traits::template rebind_alloc<T>>;
 	};
 
 	using is_always_equal = typename traits::is_always_equal;
 
-	template <class ... T, class = std::is_constructible_v<Allocator, T...>>
+	template <class ... T, class = std::enable_if_t<std::is_constructible_v<Allocator, T...>>>
 	AllocatorDeleter(T&& ... args):
 		base_type(std::forward<T>(args)...), count_(0)
 	{
@@ -140,7 +156,7 @@ public:
 		if constexpr(propagate_on_container_move_assignment::value or is_always_equal::value)
 		{
 			*this = other;
-			other.size_ = 0u;
+			other.count_ = 0u;
 			return false;
 		}
 		else
@@ -153,7 +169,7 @@ public:
 	operator typename rebind<T>::other() const
 	{
 		using rebound_type = typename rebind<T>::other;
-		using inner_rebound_type = typename traits::rebind_alloc<T>::other;
+		using inner_rebound_type = typename traits::template rebind_alloc<T>;
 		return rebound_type(inner_rebound_type(get_alloc(*this)));
 	}
 	
@@ -164,9 +180,6 @@ public:
 	void deallocate(pointer p, size_type n)
 	{ traits::deallocate(get_alloc(*this), p, n); }
 
-	void deallocate(pointer p, size_type n, const_void_pointer hint)
-	{ traits::deallocate(get_alloc(*this), p, n, hint); }
-
 	template <class T, class ... Args>
 	void construct(T* p, Args&& ... args)
 	{ return traits::construct(get_alloc(*this), p, std::forward<Args>(args) ...); }
@@ -178,13 +191,14 @@ public:
 	size_type max_size() const
 	{ return traits::max_size(get_alloc(*this)); }
 	
-	self_type select_on_container_copy_construction(const self_type& other) const
-	{ return traits::select_on_container_copy_construction(get_alloc(*this)); }
+	self_type select_on_container_copy_construction() const
+	{ return self_type(traits::select_on_container_copy_construction(get_alloc(*this))); }
 
 	void operator()(pointer p)
 	{
-		std::for_each(p, p + count(*this), [&](pointer pt) { this->destroy(pt); });
-		deallocate(p, count(*this));
+		for(size_type i = 0; i < count_; ++i)
+			this->destroy(p + i);
+		deallocate(p, count_);
 	}
 
 	friend const size_type& count(const self_type& self)
@@ -226,19 +240,19 @@ public:
 			or std::is_nothrow_swappable_v<base_type>
 		)
 	{
-		if constexpr(propage_on_container_swap::value)
+		if constexpr(propagate_on_container_swap::value)
 			swap_allocators(other);
 		swap_sizes(other);
 	}
 
-	bool operator!=(const self_type& other)
+	bool operator!=(const self_type& other) const
 	{
 		return (not is_always_equal::value) and (base() != other.base());
 	}
 
-	bool operator==(const self_type& other)
+	bool operator==(const self_type& other) const
 	{
-		return (is_always_equal::value) or (base() != other.base());
+		return (is_always_equal::value) or (base() == other.base());
 	}
 
 private:
@@ -246,22 +260,19 @@ private:
 	{ return static_cast<const base_type&>(*this); }
 
 	const base_type&& to_base() const&&
-	{ return static_cast<const base_type&&>(*this); }
+	{ return static_cast<const base_type&&>(std::move(*this)); }
 
 	base_type&& to_base() &&
-	{ return static_cast<base_type&&>(*this); }
+	{ return static_cast<base_type&&>(std::move(*this)); }
 
 	base_type& to_base() &
 	{ return static_cast<base_type&>(*this); }
 
-	template <
-		class T, 
-		class = std::enable_if_t<
-			std::is_same_v<std::decay_t<T>, self_type>
-		>
-	>
-	friend decltype(auto) get_alloc(T&& self)
-	{ return get(std::forward<T>(self).to_base()); }
+	friend const Allocator& get_alloc(const self_type& self)
+	{ return get(self.to_base()); }
+
+	friend Allocator& get_alloc(self_type& self)
+	{ return get(self.to_base()); }
 
 	size_type count_ = 0u;
 };
@@ -270,19 +281,19 @@ template <class T, class Allocator = std::allocator<T>>
 struct SimpleVector
 {
 private:
-	using self_type    = SimpleVector<T, Allocator>&
+	using self_type    = SimpleVector<T, Allocator>;
 	using deleter_type = AllocatorDeleter<Allocator>;
 	using alloc_traits = std::allocator_traits<deleter_type>;
 	using pointer_type = std::unique_ptr<T[], deleter_type>;
 public:
-	using value_type             = typename traits::value_type;
+	using value_type             = typename alloc_traits::value_type;
 	using allocator_type         = Allocator;
-	using size_type              = typename traits::size_type;
-	using difference_type        = typename traits::difference_type;
+	using size_type              = typename alloc_traits::size_type;
+	using difference_type        = typename alloc_traits::difference_type;
 	using reference              = T&;
 	using const_reference        = const T&;
-	using pointer                = typename traits::pointer;
-	using const_pointer          = typename traits::const_pointer;
+	using pointer                = typename alloc_traits::pointer;
+	using const_pointer          = typename alloc_traits::const_pointer;
 	using iterator               = pointer;
 	using const_iterator         = const_pointer;
 	using reverse_iterator       = std::reverse_iterator<pointer>;
@@ -341,10 +352,10 @@ public:
 	/// @name Constructors 
 	/// @{ 
 
-	SimpleVector() noexcept(noexcept(Allocator())) = default;
+	SimpleVector() = default;
 
 	explicit SimpleVector(const Allocator& alloc) noexcept:
-		pointer_(nullptr, alloc)
+		pointer_(nullptr, deleter_type(alloc))
 	{
 		count(get_alloc()) = 0u;
 	}
@@ -412,6 +423,25 @@ public:
 		
 	}
 
+	/// Construct 'count' elements in place, the 'i'th one from the tuple of
+	/// arguments 'make_args(i)' returns.  For elements that can't be moved.
+	template <class MakeArgs>
+	SimpleVector(std::piecewise_construct_t, size_type count, MakeArgs make_args, const Allocator& alloc = Allocator()):
+		SimpleVector(alloc)
+	{
+		if(count == 0u)
+			return;
+		auto guard = make_buffer(count);
+		for(size_type i = 0; i < count; ++i)
+		{
+			std::apply(
+				[&](auto&& ... args) { guard.emplace_back(std::forward<decltype(args)>(args)...); },
+				make_args(i)
+			);
+		}
+		accept_buffer(guard);
+	}
+
 	/// @} Constructors 
 
 	/// @name Assignment Operators 
@@ -419,33 +449,30 @@ public:
 
 	SimpleVector& operator=(const SimpleVector& other)
 	{
-		constexpr bool prop_alloc =
-			alloc_traits::propagate_on_container_copy_assignment::value;
-		auto guard = prop_alloc ? other.make_buffer(other.size()) : make_buffer(other.size());
-		for(const auto& item: other)
-			guard.emplace_back(item);
-		clear();
-		if constexpr(prop_alloc)
+		if(this == &other)
+			return *this;
+		if constexpr(alloc_traits::propagate_on_container_copy_assignment::value)
 		{
+			clear();
 			get_alloc() = other.get_alloc();
-			count(get_allocator()) = 0u;
+			count(get_alloc()) = 0u;
 		}
-		accept_buffer(guard);
+		assign(other.begin(), other.end());
+		return *this;
 	}
 	
 	SimpleVector& operator=(SimpleVector&& other)
 		noexcept(
 			alloc_traits::propagate_on_container_move_assignment::value
-			or is_always_equal::value
+			or alloc_traits::is_always_equal::value
 		)
 	{
 		if(
 			alloc_traits::propagate_on_container_move_assignment::value
-			or is_always_equal::value
+			or alloc_traits::is_always_equal::value
 			or not (get_alloc() != other.get_alloc())
 		)
 		{
-			get_alloc() = std::move(other.get_alloc());
 			pointer_ = std::move(other.pointer_);
 			count(other.get_alloc()) = 0u;
 		}
@@ -456,6 +483,7 @@ public:
 				std::make_move_iterator(other.end())
 			);
 		}
+		return *this;
 	}
 
 	SimpleVector& operator=(std::initializer_list<T> ilist)
@@ -507,10 +535,10 @@ public:
 	reverse_iterator rbegin()
 	{ return std::make_reverse_iterator(end()); }
 	
-	const_reverse_iterator rbegin()
+	const_reverse_iterator rbegin() const
 	{ return crbegin(); }
 	
-	const_reverse_iterator crbegin()
+	const_reverse_iterator crbegin() const
 	{ return std::make_reverse_iterator(cend()); }
 	
 	iterator end()
@@ -519,16 +547,16 @@ public:
 	const_iterator end() const
 	{ return cend(); }
 
-	const_iterator cbegin() const
+	const_iterator cend() const
 	{ return data() + size(); }
 
 	reverse_iterator rend()
 	{ return std::make_reverse_iterator(begin()); }
 	
-	const_reverse_iterator rend()
+	const_reverse_iterator rend() const
 	{ return crend(); }
 	
-	const_reverse_iterator crend()
+	const_reverse_iterator crend() const
 	{ return std::make_reverse_iterator(cbegin()); }
 	
 	/// @} Iterators
@@ -590,7 +618,7 @@ public:
 	{
 		if(n == size())
 			return;
-		if(size() < n)
+		if(n < size())
 			shrink(n);
 		else
 			grow(n);
@@ -600,7 +628,7 @@ public:
 	{
 		if(n == size())
 			return;
-		if(size() < n)
+		if(n < size())
 			shrink(n);
 		else
 			grow(n, value);
@@ -646,7 +674,7 @@ public:
 		{
 			auto tmp = pointer_.release();
 			pointer_.reset(other.pointer_.release());
-			other.pointer_.reset(tmp_);
+			other.pointer_.reset(tmp);
 			pointer_.get_deleter().auto_swap(other.pointer_.get_deleter());
 		}
 	}
@@ -682,9 +710,14 @@ private:
 	void shrink(size_type n)
 	{
 		assert(n < size());
+		if(n == 0u)
+		{
+			clear();
+			return;
+		}
 		auto guard = make_buffer(n);
-		for(value_type& item: self())
-			guard.emplace_back(std::move_if_noexcept(item));
+		for(size_type i = 0; i < n; ++i)
+			guard.emplace_back(std::move_if_noexcept(self()[i]));
 		accept_buffer(guard);
 	}
 
@@ -706,7 +739,7 @@ private:
 			return;
 		}
 		auto guard = make_buffer(len);
-		assert(guard.size == len);
+		assert(guard.size == static_cast<size_type>(len));
 		while(first != last)
 			guard.emplace_back(*first++);
 		accept_buffer(guard);
@@ -716,13 +749,13 @@ private:
 	{ return *this; }
 	
 	const self_type&& self() const&&
-	{ return *this; }
+	{ return std::move(*this); }
 	
 	self_type& self() &
 	{ return *this; }
 	
 	self_type&& self() &&
-	{ return *this; }
+	{ return std::move(*this); }
 	
 	deleter_type& get_alloc()
 	{ return pointer_.get_deleter(); }
@@ -735,7 +768,7 @@ private:
 };
 
 template <class T, class A>
-void swap(const SimpleVector<T, A>& left, const SimpleVector<T, A>& right)
+void swap(SimpleVector<T, A>& left, SimpleVector<T, A>& right)
 { left.swap(right); }
 
 template <class T, class A>
@@ -749,7 +782,7 @@ bool operator!=(const SimpleVector<T, A>& left, const SimpleVector<T, A>& right)
 template <class T, class A>
 bool operator<(const SimpleVector<T, A>& left, const SimpleVector<T, A>& right)
 {
-	return std::lexographical_compare(
+	return std::lexicographical_compare(
 		left.begin(), left.end(), right.begin(), right.end()
 	);
 }
@@ -776,35 +809,37 @@ std::ostream& operator<<(std::ostream& os, const SimpleVector<T>& v)
 	if(not v.empty())
 	{
 		os << v.front();
-		for(auto pos = next(v.begin()); pos != v.end(); ++pos)
+		for(auto pos = std::next(v.begin()); pos != v.end(); ++pos)
 			os << ", " << *pos;
 	}
 	os << ']';
 	return os;
 }
 
-template <class T, class Allocator>
+template <class T, class Allocator = std::allocator<T>>
 struct ConstSimpleVector:
 	public SimpleVector<T, Allocator>
 {
 private:
 	using base_type = SimpleVector<T, Allocator>;
 public:
-	using base_type::value_type;
-	using base_type::allocator_type;
-	using base_type::size_type;
-	using base_type::difference_type;
-	using base_type::reference;
-	using base_type::const_reference;
-	using base_type::pointer;
-	using base_type::const_pointer;
-	using base_type::iterator;
-	using base_type::const_iterator;
-	using base_type::reverse_iterator;
-	using base_type::const_reverse_iterator;
+	using typename base_type::value_type;
+	using typename base_type::allocator_type;
+	using typename base_type::size_type;
+	using typename base_type::difference_type;
+	using typename base_type::reference;
+	using typename base_type::const_reference;
+	using typename base_type::pointer;
+	using typename base_type::const_pointer;
+	using typename base_type::iterator;
+	using typename base_type::const_iterator;
+	using typename base_type::reverse_iterator;
+	using typename base_type::const_reverse_iterator;
 
 public:
-	using base_type::SimpleVector;
+	using base_type::base_type;
+
+	ConstSimpleVector() = default;
 
 	ConstSimpleVector(const ConstSimpleVector&) = default;
 	ConstSimpleVector(ConstSimpleVector&&) = default;
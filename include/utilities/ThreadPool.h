@@ -0,0 +1,192 @@
+#ifndef UTILITIES_THREAD_POOL_H
+#define UTILITIES_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wasm {
+
+/// A fixed set of threads for splitting bulk work, such as copying data
+/// segments into memory, into tasks that run in parallel.  The thread that
+/// calls 'parallel_for()' runs tasks too, so a pool with no threads runs
+/// everything on the caller.
+struct ThreadPool {
+
+	explicit ThreadPool(std::size_t thread_count)
+	{
+		threads_.reserve(thread_count);
+		for(std::size_t i = 0; i < thread_count; ++i)
+			threads_.emplace_back([this]() { run(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// Jobs still queued are abandoned; their 'parallel_for()' calls must
+	/// have returned first, and posted tasks that haven't started never run.
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_all();
+		for(std::thread& thread: threads_)
+			thread.join();
+	}
+
+	/// A pool shared by the whole process, with a thread per hardware
+	/// thread besides the caller's.  Made on first use.
+	static ThreadPool& shared()
+	{
+		static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1u);
+		return pool;
+	}
+
+	std::size_t thread_count() const
+	{ return threads_.size(); }
+
+	/// Call 'func(i)' for each 'i' in [0, 'count'), in parallel and in no
+	/// particular order, and return when all calls have returned.  If any
+	/// throw, the remaining calls still run and the first exception is
+	/// rethrown.  May be called from any thread, including the pool's own.
+	template <class Func>
+	void parallel_for(std::size_t count, Func&& func)
+	{
+		if(count == 0u)
+			return;
+		if(count == 1u or threads_.empty())
+		{
+			for(std::size_t i = 0; i < count; ++i)
+				func(i);
+			return;
+		}
+		auto job = std::make_shared<Job>(
+			count, [&func](std::size_t i) { func(i); }
+		);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back(job);
+		}
+		cv_.notify_all();
+		work_on(*job);
+		retire(job);
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->cv.wait(lock, [&]() { return job->finished; });
+		if(job->error)
+			std::rethrow_exception(job->error);
+	}
+
+	/// Run 'task' on one of the pool's threads and return without waiting
+	/// for it.  Exceptions it throws are dropped.  The pool must have a
+	/// thread.
+	void post(std::function<void()> task)
+	{
+		assert(not threads_.empty());
+		auto job = std::make_shared<Job>(
+			1u, [task = std::move(task)](std::size_t) { task(); }
+		);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back(std::move(job));
+		}
+		cv_.notify_one();
+	}
+
+private:
+	struct Job {
+		Job(std::size_t n, std::function<void(std::size_t)> f):
+			count(n), func(std::move(f))
+		{
+
+		}
+
+		const std::size_t count;
+		const std::function<void(std::size_t)> func;
+		/// The next task to claim.
+		std::atomic<std::size_t> next{0u};
+		/// The number of tasks that have returned.
+		std::atomic<std::size_t> done{0u};
+		/// Guards 'finished' and 'error'.
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool finished = false;
+		std::exception_ptr error;
+	};
+
+	/// Claim and run tasks of 'job' until none are left to claim.
+	static void work_on(Job& job)
+	{
+		for(;;)
+		{
+			std::size_t i = job.next.fetch_add(1u, std::memory_order_relaxed);
+			if(i >= job.count)
+				return;
+			try
+			{
+				job.func(i);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(job.mutex);
+				if(not job.error)
+					job.error = std::current_exception();
+			}
+			if(job.done.fetch_add(1u, std::memory_order_acq_rel) + 1u == job.count)
+			{
+				{
+					std::lock_guard<std::mutex> lock(job.mutex);
+					job.finished = true;
+				}
+				job.cv.notify_all();
+			}
+		}
+	}
+
+	/// Take 'job' off the queue once all its tasks are claimed.
+	void retire(const std::shared_ptr<Job>& job)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto pos = std::find(jobs_.begin(), jobs_.end(), job);
+		if(pos != jobs_.end())
+			jobs_.erase(pos);
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		for(;;)
+		{
+			cv_.wait(lock, [this]() { return stopping_ or not jobs_.empty(); });
+			if(stopping_)
+				return;
+			std::shared_ptr<Job> job = jobs_.front();
+			lock.unlock();
+			work_on(*job);
+			retire(job);
+			lock.lock();
+		}
+	}
+
+	/// Guards 'jobs_' and 'stopping_'.
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	/// Jobs with tasks left to claim, oldest first.
+	std::deque<std::shared_ptr<Job>> jobs_;
+	bool stopping_ = false;
+	std::vector<std::thread> threads_;
+};
+
+} /* namespace wasm */
+
+#endif /* UTILITIES_THREAD_POOL_H */
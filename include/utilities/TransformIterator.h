@@ -2,6 +2,8 @@
 #define TRANSFORM_ITERATOR_H
 
 #include <iterator>
+#include <type_traits>
+#include <utility>
 
 namespace wasm {
 
@@ -28,7 +30,7 @@ struct TransformIterator<It, Transform, std::input_iterator_tag>
 {
 	using transform_type    = Transform;
 	using base_value_type   = detail::iterator_value_type_t<It>;
-	using value_type        = std::decay_t<std::invoke_result_t<transform_type, base_value_type>>;
+	using value_type        = std::decay_t<std::invoke_result_t<const transform_type&, detail::iterator_reference_t<It>>>;
 	using iterator_category = detail::iterator_category_t<It>;
 	using difference_type   = detail::iterator_difference_type_t<It>;
 	using reference         = value_type&;
@@ -5,6 +5,8 @@
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <iterator>
+#include <type_traits>
 
 namespace wasm {
 
@@ -53,7 +55,7 @@ T byte_swap(T value)
 #endif /* __GNUC__ */
 	else
 	{
-		alignas(alignof(value)) char buff[sizeof(value)];
+		alignas(alignof(T)) char bytes[sizeof(value)];
 		std::memcpy(bytes, &value, sizeof(value));
 		std::reverse(bytes, bytes + sizeof(value));
 		std::memcpy(&value, bytes, sizeof(value));
@@ -105,8 +107,8 @@ Integer le_to_system(Integer value)
 	static_assert(std::is_integral_v<Integer>, "Endianness only affects integral types.");
 	if constexpr(sizeof(Integer) > 1)
 	{
-		if(is_big_endian())
-			byte_swap(value);
+		if(not system_is_little_endian())
+			value = byte_swap(value);
 	}
 	return value;
 }
@@ -117,8 +119,8 @@ Integer be_to_system(Integer value)
 	static_assert(std::is_integral_v<Integer>, "Endianness only affects integral types.");
 	if constexpr(sizeof(Integer) > 1)
 	{
-		if(not is_big_endian())
-			byte_swap(value);
+		if(system_is_little_endian())
+			value = byte_swap(value);
 	}
 	return value;
 }
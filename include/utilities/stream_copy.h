@@ -0,0 +1,45 @@
+#ifndef UTILITIES_STREAM_COPY_H
+#define UTILITIES_STREAM_COPY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// Copy 'size' bytes from 'src' to 'dest', which must not overlap, with
+/// non-temporal stores where the target has them, so that a large copy
+/// that won't be read back soon doesn't evict the cache.  The stores are
+/// fenced, so they are ordered before any later store of the calling
+/// thread (such as the one releasing a lock).
+inline void stream_copy(char* dest, const char* src, std::size_t size)
+{
+#if defined(__SSE2__)
+	// align the destination with an ordinary copy
+	std::size_t head = (16u - reinterpret_cast<std::uintptr_t>(dest) % 16u) % 16u;
+	head = std::min(head, size);
+	std::memcpy(dest, src, head);
+	dest += head;
+	src += head;
+	size -= head;
+	for(; size >= 64u; size -= 64u, dest += 64u, src += 64u)
+	{
+		auto in = reinterpret_cast<const __m128i*>(src);
+		auto out = reinterpret_cast<__m128i*>(dest);
+		__m128i a = _mm_loadu_si128(in);
+		__m128i b = _mm_loadu_si128(in + 1);
+		__m128i c = _mm_loadu_si128(in + 2);
+		__m128i d = _mm_loadu_si128(in + 3);
+		_mm_stream_si128(out, a);
+		_mm_stream_si128(out + 1, b);
+		_mm_stream_si128(out + 2, c);
+		_mm_stream_si128(out + 3, d);
+	}
+	_mm_sfence();
+#endif
+	std::memcpy(dest, src, size);
+}
+
+#endif /* UTILITIES_STREAM_COPY_H */
@@ -2,14 +2,33 @@
 #define VM_CALL_STACK_H
 
 #include "function/WasmFunction.h"
+#include "function/TableFunction.h"
 #include "utilities/SimpleVector.h"
 #include "utilities/ListStack.h"
 #include "vm/alloc/StackResource.h"
+#include "vm/op/errors.h"
+#include "module/WasmTable.h"
 #include <gsl/span>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <forward_list>
+#include <limits>
+#include <optional>
+#include <ostream>
 #include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace wasm {
 
+using opc::CodeView;
+using opc::OpCode;
+using opc::WasmInstruction;
+
 namespace ex {
 
 template <class Container, class Index>
@@ -23,23 +42,11 @@ decltype(auto) at(Container&& c, const Index& index)
 
 } /* namespace ex */
 
-namespace detail {
-auto make_stack_size_guard(auto& stack)
-{
-	auto initial_stack_size = stack.size();
-	return make_scope_guard([&stack, initial_stack_size]() {
-		assert(stack.size() >= initial_stack_size);
-		if(stack.size() > initial_stack_size)
-			stack.pop_n(stack.size() - initial_stack_size);
-	});
-}
-} /* namespace detail */ 
-
 struct BadBranchError:
 	std::logic_error
 {
 private:
-	static std::string make_mesage(std::size_t depth, std::size_t limit)
+	static std::string make_message(std::size_t depth, std::size_t limit)
 	{
 		std::ostringstream s;
 		s << "Invald branch depth (" << depth << ") to non-existant block.  ";
@@ -62,7 +69,7 @@ std::ostream& operator<<(std::ostream& os, const SimpleStack<WasmValue>& stack)
 	os << "Stack([";
 	if(stack.size() > 0u)
 	{
-		os << stack.front();
+		os << stack.top();
 		for(auto pos = std::next(stack.begin()); pos != stack.end(); ++pos)
 			os << ", " << *pos;
 	}
@@ -75,7 +82,7 @@ std::ostream& operator<<(std::ostream& os, const SimpleStack<TaggedWasmValue>& s
 	os << "Stack([";
 	if(stack.size() > 0u)
 	{
-		os << stack.front();
+		os << stack.top();
 		for(auto pos = std::next(stack.begin()); pos != stack.end(); ++pos)
 			os << ", " << *pos;
 	}
@@ -83,14 +90,22 @@ std::ostream& operator<<(std::ostream& os, const SimpleStack<TaggedWasmValue>& s
 	return os;
 }
 
+/// A block's parameters and results live in 'reserved' slots at the top of
+/// the enclosing block's stack: the parameters are moved from there onto the
+/// block's own stack when it is entered, and the results are copied back when
+/// it is left.  A branch to the block's label carries 'arity' values, its END
+/// carries 'results'; they differ only for a LOOP, whose label (the LOOP
+/// instruction itself) takes the loop's parameters.
 template <class T>
 struct Block {
 	
 	using stack_type = SimpleStack<T>;
 
-	Block(const char* label_pos, std::size_t return_count, StackResource& resource):
+	Block(const char* label_pos, std::size_t label_arity, std::size_t result_count, std::size_t reserved_count, StackResource& resource):
 		label(label_pos),
-		arity(return_count),
+		arity(label_arity),
+		results(result_count),
+		reserved(reserved_count),
 		stack(resource)
 	{
 		
@@ -108,6 +123,8 @@ struct Block {
 
 	const char* const label;
 	const std::size_t arity;
+	const std::size_t results;
+	const std::size_t reserved;
 	stack_type stack;
 };
 
@@ -116,6 +133,8 @@ std::ostream& operator<<(std::ostream& os, const Block<T>& block)
 {
 	os << "Block(label = " << block.label;
 	os << ", arity = " << block.arity;
+	os << ", results = " << block.results;
+	os << ", reserved = " << block.reserved;
 	os << ", stack = " << block.stack;
 	os << ')';
 	return os;
@@ -132,25 +151,28 @@ struct WasmStackFrame
 	>;
 	using locals_vector_type = gsl::span<value_type>;
 	using stack_type = SimpleStack<value_type>;
-	using block_iterator = block_list_type::iterator;
-	using const_block_iterator = block_list_type::const_iterator;
+	using types_view = WasmFunctionSignature::view_type;
+	using block_iterator = typename block_list_type::iterator;
+	using const_block_iterator = typename block_list_type::const_iterator;
 	
-	WasmStackFrame(const WasmFunction& func, StackResource& r):
+	/// A call of 'func', whose params and locals are 'locals'.  Execution
+	/// continues at 'return_address' once the call returns; it is empty for
+	/// a call from the host.
+	WasmStackFrame(const WasmFunction& func, const CodeView& return_address, gsl::span<T> locals, StackResource& r):
 		code_(func),
-		locals_(locals_count(func) + param_count(signature(func))),
-		blocks_(r)
-	{
-		blocks_.emplace_front(nullptr, 0u, get_resource());
-	}
-
-	WasmStackFrame(CodeView code, gsl::span<T> locals, StackResource& r):
-		return_address_(),
+		return_address_(return_address),
 		locals_(locals),
-		blocks_(r)
+		blocks_(pmr::polymorphic_allocator<block_type>(&r))
 	{
-		blocks_.push_front(nullptr, 0u, get_resource());
+		blocks_.emplace_front(nullptr, 0u, 0u, 0u, get_resource());
 	}
 
+	WasmStackFrame(const WasmStackFrame&) = delete;
+	WasmStackFrame(WasmStackFrame&&) = delete;
+
+	WasmStackFrame& operator=(const WasmStackFrame&) = delete;
+	WasmStackFrame& operator=(WasmStackFrame&&) = delete;
+
 	~WasmStackFrame()
 	{
 		while(not blocks_.empty())
@@ -165,80 +187,91 @@ struct WasmStackFrame
 			if(count == depth)
 				return pos;
 		}
-		assert(false and "Attempt to access out-of-range block.");
+		throw BadBranchError(depth, count);
 	}
+
+	/// Whether a branch 'depth' levels out targets the function's own label,
+	/// i.e. returns from the function.
+	bool is_function_label(wasm_uint32_t depth)
+	{ return block_at(depth)->is_bottom(); }
 	
-	const char* branch_depth(wasm_uint32_t depth)
+	[[nodiscard]]
+	CodeView branch_depth(wasm_uint32_t depth)
 	{ return branch(block_at(depth)); }
 
-	const char* try_branch_top() const
+	[[nodiscard]]
+	CodeView branch(block_iterator pos)
 	{
-		assert(blocks_.begin() != blocks.end())
-		if(blocks_.front().is_bottom())
-			return nullptr;
-		else
-			return branch_top();
+		assert(pos != blocks_.end());
+		assert(not pos->is_bottom());
+		const char* code_pos = pos->label;
+		unwind(pos, pos->arity);
+		return CodeView(*function(), code_pos);
 	}
 
-	[[nodiscard]]
-	const char* branch(const_block_iterator pos)
+	/// Leave the innermost block through its END.
+	void end_block()
 	{
-		assert(pos != blocks_.end());
-		// get the label
-		auto code_pos = pos->label;
-		auto arity = pos->arity;
-		auto& dest_stack = pos->stack;
-		auto& src_stack = current_stack(*this);
-		assert(&src_stack != &dest_stack);
-		assert(arity <= dest_stack.size());
-		assert(arity <= src_stack.size());
-		std::copy(src_stack.begin(), src_stack.begin() + arity, dest_stack.begin());
-		// TODO: assert(src_stack.size() == arity) for 'IF ... END' blocks
-		while(blocks_.begin() != pos)
-			blocks_.pop_front();
-		return code_pos;
+		assert(not blocks_.empty());
+		assert(not blocks_.front().is_bottom());
+		unwind(blocks_.begin(), blocks_.front().results);
 	}
 
-	void push_block(const char* label, gsl::span<const LanguageType> signature)
+	/// Enter a BLOCK or IF whose END is just before 'label'.
+	void push_block(const char* label, std::size_t param_count, types_view results)
 	{
 		assert(
 			(label[-1] == static_cast<char>(OpCode::END))
 			or (label[-(1 + (std::ptrdiff_t)sizeof(wasm_uint32_t))] == static_cast<char>(OpCode::ELSE))
 		);
-		auto guard_ = make_stack_size_guard(stack());
-		for(const auto& type: signature)
-		{
-			// push return values onto the stack
-			tp::visit_value_type(
-				[&](auto WasmValue::* p) { stack_emplace_top(p, 0); }, type
-			);
-		}
-		blocks_.emplace_front(label, signature.size(), get_resource());
+		_push_block(label, results.size(), param_count, results);
+	}
+
+	/// Enter the LOOP at 'label'.
+	void push_loop(const char* label, std::size_t param_count, types_view results)
+	{
+		assert(label[0] == static_cast<char>(OpCode::LOOP));
+		_push_block(label, param_count, param_count, results);
+	}
+
+	/// Copy the top 'count' values of the current stack to the start of the
+	/// frame's region on the caller's stack (where its params and locals
+	/// begin).  The caller sized the region to hold the frame's results.
+	void store_results(std::size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		const auto& src = stack();
+		assert(src.size() >= count);
+		std::memmove(locals_.data(), src.data() + (src.size() - count), count * sizeof(T));
 	}
 
 	[[nodiscard]]
-	const char* branch_top()
+	CodeView branch_top()
 	{
 		assert(not blocks_.empty());
 		assert(not blocks_.front().is_bottom());
 		return branch(blocks_.begin());
 	}
 
+	/// @name Unchecked accessors
+	/// Code reaching the interpreter has been validated; indices are in bounds.
+	/// @{
 	T& local_at(wasm_uint32_t index)
-	{ return ex::at(locals_, index); }
+	{ assert(index < locals_.size()); return locals_[index]; }
 
 	const T& local_at(wasm_uint32_t index) const
-	{ return ex::at(locals_, index); }
+	{ assert(index < locals_.size()); return locals_[index]; }
 
 	T& stack_at(wasm_uint32_t index)
-	{ return ex::at(stack(), index); }
+	{ assert(index < stack().size()); return stack()[index]; }
 
-	const T& stack_at(wasm_uint32_t index)
-	{ return ex::at(stack(), index); }
+	const T& stack_at(wasm_uint32_t index) const
+	{ assert(index < stack().size()); return stack()[index]; }
+	/// @}
 
 	template <class U>
 	const std::decay_t<U>& stack_at(wasm_uint32_t index, U WasmValue::* p) const
-	{ return stack().at().get(p); }
+	{ return stack().at(index).get(p); }
 
 	template <class U>
 	const U& stack_at(wasm_uint32_t index, const U WasmValue::* p) const
@@ -269,7 +302,7 @@ struct WasmStackFrame
 	std::pair<const T&, const T&> stack_top_2() const
 	{ return std::pair<const T&, const T&>(stack_at(1u), stack_at(0u)); }
 
-	std::pair<T&, T&> stack_top_2() const
+	std::pair<T&, T&> stack_top_2()
 	{ return std::pair<T&, T&>(stack_at(1u), stack_at(0u)); }
 
 	template <class L, class R>
@@ -291,6 +324,9 @@ struct WasmStackFrame
 	void stack_pop_1_push_1(U WasmValue::* mem, U value)
 	{ stack().replace_top(mem, value); }
 
+	void stack_pop_1_push_1(const T& value)
+	{ stack().replace_top(value); }
+
 	T stack_pop()
 	{ return stack().pop(); }
 
@@ -312,19 +348,29 @@ struct WasmStackFrame
 	auto stack_size() const
 	{ return stack().size(); }
 
-	const WasmFunction* function()
-	{ return self.code_.function(); }
+	const WasmFunction* function() const
+	{ return code_.function(); }
+
+	/// Where execution continues once this call returns.
+	const CodeView& return_address() const
+	{ return return_address_; }
 
 
 	friend std::ostream& operator<<(std::ostream& os, const WasmStackFrame& frame)
 	{
 		os << "StackFrame(";
 		os << "function = ";
-		write_declataion(os, function(frame));
-		os << ", locals = " << frame.locals_;
-		os << ", stack = [";
+		write_declaration(os, *frame.function());
+		os << ", locals = [";
 		const char* delim = "";
-		for(const auto& block: frame_.blocks_)
+		for(const auto& item: frame.locals_)
+		{
+			os << delim << item;
+			delim = ", ";
+		}
+		os << "], stack = [";
+		delim = "";
+		for(const auto& block: frame.blocks_)
 		{
 			const auto& stack = block.stack;
 			for(const auto& item: stack)
@@ -333,11 +379,6 @@ struct WasmStackFrame
 				delim = ", ";
 			}
 		}
-		for(const auto& item: frame_.stack_)
-		{
-			os << delim << item;
-			delim = ", ";
-		}
 		os << "])";
 		return os;
 	}
@@ -345,46 +386,118 @@ struct WasmStackFrame
 	bool is_function_call() const
 	{ return static_cast<bool>(function()); }
 
+	/// The top 'count' values of the current stack, bottom first.
+	const T* stack_top_n(std::size_t count) const
+	{
+		assert(stack().size() >= count);
+		return stack().data() + (stack().size() - count);
+	}
+
+	/// The start of this frame's region on the enclosing stack.
+	T* region_base() const
+	{ return locals_.data(); }
+
 	std::optional<WasmInstruction> next_instruction() const
 	{ return code_.next_instruction(); }
 
-	void advance(const WasmInstruction& instr)
+	/// Continue at 'next', a position in this frame's function.
+	void jump(const CodeView& next)
 	{
-		assert(next_instruction());
-		if(not is_next_instruction(instr))
-			throw std::logic_error("Instruction does not match program counter on call stack.");
-		code_.advance(instr);
+		assert(next.function() == function());
+		code_ = next;
 	}
 	
 	bool is_next_instruction(const WasmInstruction& instr) const
-	{ return instr.source().data() == code_.data(); }
+	{ return instr.code() == code_; }
 
-private:
-	const auto& stack() const
+	const stack_type& stack() const
 	{
 		assert(not blocks_.empty());
 		return blocks_.front().stack;
 	}
 
-	auto& stack()
+	stack_type& stack()
 	{
 		assert(not blocks_.empty());
 		return blocks_.front().stack;
 	}
 
+private:
+	void _push_block(const char* label, std::size_t label_arity, std::size_t param_count, types_view results)
+	{
+		auto& outer = stack();
+		// guaranteed by validation
+		assert(outer.size() >= param_count);
+		// the block takes over its parameters' slots; add slots for any extra results.
+		for(std::size_t i = param_count; i < results.size(); ++i)
+		{
+			tp::visit_value_type(
+				[&](auto WasmValue::* p) { outer.emplace(p, 0); }, results[i]
+			);
+		}
+		std::size_t reserved = std::max(param_count, results.size());
+		const T* params = outer.data() + (outer.size() - reserved);
+		blocks_.emplace_front(label, label_arity, results.size(), reserved, get_resource());
+		if(param_count > 0u)
+			blocks_.front().stack.push_range(params, param_count);
+	}
+
+	/// Copy the top 'count' values of the current stack into the slots that
+	/// the block at 'pos' reserved on the stack enclosing it, then pop every
+	/// block up to and including 'pos'.
+	void unwind(block_iterator pos, std::size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		auto next = std::next(pos);
+		assert(next != blocks_.end());
+		std::size_t reserved = pos->reserved;
+		const auto& src_stack = stack();
+		auto& dest_stack = next->stack;
+		assert(src_stack.size() >= count);
+		assert(dest_stack.size() >= reserved);
+		assert(reserved >= count);
+		std::memmove(
+			dest_stack.data() + (dest_stack.size() - reserved),
+			src_stack.data() + (src_stack.size() - count),
+			count * sizeof(T)
+		);
+		while(blocks_.begin() != next)
+			blocks_.pop_front();
+		if(reserved > count)
+			dest_stack.pop_n(reserved - count);
+	}
+
 	StackResource& get_resource()
 	{
-		std::memory_resource* rsc = blocks_.get_allocator().resource();
+		pmr::memory_resource* rsc = blocks_.get_allocator().resource();
 		assert(rsc);
 		assert(static_cast<bool>(dynamic_cast<StackResource*>(rsc)));
 		return *static_cast<StackResource*>(rsc);
 	}
 
 	CodeView code_;
+	const CodeView return_address_;
 	const gsl::span<T> locals_;
 	block_list_type blocks_;
 };
 
+/// What a guest does when it takes an interrupt (see 'WasmCallStack::interrupt()').
+enum class Interrupt: unsigned char {
+	none,
+	/// Yield, as if the safepoint budget ran out.
+	yield,
+	/// Trap with 'TrapCode::interrupted'.
+	trap
+};
+
+/// What a metered guest does when it runs out of fuel (see 'WasmCallStack::set_fuel()').
+enum class OutOfFuel: unsigned char {
+	/// Trap with 'TrapCode::out_of_fuel', before running the block it couldn't pay for.
+	trap,
+	/// Yield after paying for the block anyway; the fuel goes negative.
+	yield
+};
+
 template <class T>
 struct WasmCallStack 
 {
@@ -392,9 +505,21 @@ struct WasmCallStack
 		WasmStackFrame<T>, 
 		pmr::polymorphic_allocator<WasmStackFrame<T>>
 	>;
-	using frame_iterator = list_type::const_iterator;
+	using frame_iterator = typename frame_stack_type::const_iterator;
 
-	WasmCallStack(StackResource& 
+	/// Frames, blocks and operands are all allocated from 'resource'.
+	WasmCallStack(StackResource& resource):
+		base_stack_(resource),
+		frames_(pmr::polymorphic_allocator<WasmStackFrame<T>>(&resource))
+	{
+		
+	}
+
+	WasmCallStack(const WasmCallStack&) = delete;
+	WasmCallStack(WasmCallStack&&) = delete;
+
+	WasmCallStack& operator=(const WasmCallStack&) = delete;
+	WasmCallStack& operator=(WasmCallStack&&) = delete;
 
 	const WasmStackFrame<T>& current_frame() const
 	{
@@ -402,60 +527,253 @@ struct WasmCallStack
 		return frames_.top();
 	}
 
-	CodeView call_function(const Function& func, const WasmInstruction& call_instr)
+	CodeView call_wasm_function(const WasmFunction& func, const WasmInstruction& call_instr)
 	{
 		assert(call_instr.opcode() == OpCode::CALL);
-		if(func.is_wasm_function())
-		{
-			return call_wasm_function(func.get_wasm_function(), call_instr);
-		}
-		else
-		{
-			call_c_function(func.get_c_function());
-			return call_instr.after();
-		}
+		return _call_wasm_function(func, call_instr.after().pos());
 	}
 
-	CodeView call_wasm_function(const WasmFunction& func, const WasmInstruction& call_instr)
+	/// Direct 'CALL' through the callee's entry record, which the module
+	/// resolved at link time.
+	CodeView call_function(const WasmFunction::Entry& callee, const WasmInstruction& call_instr)
 	{
 		assert(call_instr.opcode() == OpCode::CALL);
-		auto& stack = frames_.empty() ? frames_.top().stack() : base_stack_;
-		auto func_sig = signature(func);
-		auto arg_types = param_types(func_sig);
-		auto locals_types = locals(func);
-		auto ret_count = return_count(func);
-		if(stack.size() < arg_types.size())
-			assert(false); // TODO: throw an exception
-
-		// push zero-initialized locals onto the stack.
-		auto guard_ = make_stack_size_guard(stack);
-		for(LanguageType type: locals_types)
+		// the first call of a lazily-lowered function takes the slow path, which lowers it.
+		if(not callee.is_lowered())
+			return call_wasm_function(*callee.function, call_instr);
+		auto& stack = top_stack();
+		// guaranteed by validation
+		assert(stack.size() >= callee.param_count);
+		return _enter_function(
+			stack, *callee.function, callee.frame_size, callee.return_count, call_instr.after().pos()
+		);
+	}
+
+	/// @name Calls from the host
+	/// The host pushes a call's arguments onto the base stack, enters the
+	/// callee, executes until no frames are left and takes the results from
+	/// the base stack.
+	/// @{
+	SimpleStack<T>& base_stack()
+	{ return base_stack_; }
+
+	const SimpleStack<T>& base_stack() const
+	{ return base_stack_; }
+
+	bool empty() const
+	{ return frames_.empty(); }
+
+	/// Push the frame of a host call to 'callee', whose body must already be
+	/// lowered.  Returning from the frame leaves the call stack empty.
+	CodeView enter_from_host(const WasmFunction::Entry& callee)
+	{
+		assert(frames_.empty());
+		assert(callee.is_lowered());
+		assert(base_stack_.size() >= callee.param_count);
+		return _enter_function(
+			base_stack_, *callee.function, callee.frame_size, callee.return_count, nullptr
+		);
+	}
+
+	/// Drop every frame and truncate the base stack to 'base_size' values,
+	/// e.g. after a trap.  Clears the pending trap and any suspension.
+	void reset(std::size_t base_size)
+	{
+		trap_ = ops::TrapCode::none;
+		suspended_in_ = nullptr;
+		return_on_completion_ = false;
+		yielded_ = false;
+		while(not frames_.empty())
+			frames_.pop();
+		assert(base_stack_.size() >= base_size);
+		if(base_stack_.size() > base_size)
+			base_stack_.pop_n(base_stack_.size() - base_size);
+	}
+	/// @}
+
+	/// @name Traps
+	/// Instruction handlers don't throw on a trap.  They record the trap with
+	/// 'trap()' and return; the dispatch loop stops at the first pending trap
+	/// and the frames are unwound once, by 'reset()'.
+	/// @{
+	[[nodiscard]]
+	CodeView trap(ops::TrapCode code, const CodeView& next)
+	{
+		assert(code != ops::TrapCode::none);
+		assert(not trapped());
+		trap_ = code;
+		return next;
+	}
+
+	bool trapped() const
+	{ return trap_ != ops::TrapCode::none; }
+
+	ops::TrapCode pending_trap() const
+	{ return trap_; }
+	/// @}
+
+	/// @name Suspension
+	/// Calling an async host import suspends the guest: the dispatch loop
+	/// stops after the call instruction, with the frames, program counters
+	/// and operands parked in place in the stack resource's buffer.  Nothing
+	/// lives on the native stack, so the guest can be resumed later, on any
+	/// thread, once 'complete_host_call()' has supplied the import's results.
+	/// @{
+	bool suspended() const
+	{ return static_cast<bool>(suspended_in_); }
+
+	/// The async host import that suspended the guest.
+	const CFunction& suspending_import() const
+	{
+		assert(suspended());
+		return *suspended_in_;
+	}
+
+	/// Write the results of the async host import that suspended the guest
+	/// into the call's operand slots, and make the guest runnable again.
+	void complete_host_call(gsl::span<const T> results)
+	{
+		assert(suspended());
+		const CFunction& cfunc = *suspended_in_;
+		std::size_t param_count = cfunc.param_count();
+		std::size_t return_count = cfunc.return_count();
+		if(results.size() != return_count)
+			throw std::invalid_argument("Wrong number of results for suspended host call.");
+		auto& stack = top_stack();
+		std::size_t slot_count = std::max(param_count, return_count);
+		assert(stack.size() >= slot_count);
+		std::copy(results.begin(), results.end(), stack.data() + (stack.size() - slot_count));
+		if(param_count > return_count)
+			stack.pop_n(param_count - return_count);
+		suspended_in_ = nullptr;
+		// an async import called by 'RETURN_CALL_INDIRECT' returns for the frame that called it.
+		if(std::exchange(return_on_completion_, false))
 		{
-			tp::visit_value_type(
-				[&](auto WasmValue::* p) { stack.emplace(p, 0); }, type
-			);
+			CodeView ret_addr = return_from_function();
+			if(not frames_.empty())
+				top_frame().jump(ret_addr);
 		}
-		auto return_address = call_instr.after().pos();
-		auto locals_vector_size = locals_types.size() + arg_types.size();
-		auto locals_pos = stack.data() + (stack.size() - locals_vector_size);
-		gsl::span<T> locals_vector(locals_pos, locals_vector_size);
-		frames_.emplace(func, return_address, locals_vector);
-		return CodeView(func);
+	}
+	/// @}
+
+	/// @name Safepoints
+	/// Function entries and branches to a LOOP are safepoints.  Every call
+	/// and every loop iteration passes one, so a guest can be paused at them
+	/// without any check per instruction.  The safepoint that exhausts the
+	/// budget yields: the dispatch loop stops, as for a suspension, and picks
+	/// up where it left off once 'clear_yield()' is called.
+	///
+	/// Safepoints also poll the interrupt flag, which other threads set with
+	/// 'interrupt()', e.g. when the guest's time slice or time limit runs
+	/// out.  The guest then yields or traps at its next safepoint.
+	/// @{
+
+	/// Ask the guest to stop at its next safepoint.  Safe to call from any
+	/// thread, while the guest runs.
+	void interrupt(Interrupt kind)
+	{ interrupt_.store(kind, std::memory_order_relaxed); }
+
+	/// Withdraw an interrupt the guest hasn't taken yet.
+	void clear_interrupt()
+	{ interrupt_.store(Interrupt::none, std::memory_order_relaxed); }
+
+	/// Yield at the 'count'th safepoint from now.  Once the budget is spent,
+	/// every safepoint yields until it is set again.
+	void set_safepoint_budget(std::size_t count)
+	{
+		assert(count > 0u);
+		safepoint_budget_ = count;
 	}
 
-	void return_from_expression()
+	/// Safepoints left before the guest yields; zero once the budget is spent.
+	std::size_t safepoint_budget() const
+	{ return safepoint_budget_; }
+
+	/// Put back a budget read with 'safepoint_budget()', spent or not.
+	void restore_safepoint_budget(std::size_t count)
+	{ safepoint_budget_ = count; }
+
+	bool yielded() const
+	{ return yielded_; }
+
+	void clear_yield()
+	{ yielded_ = false; }
+
+	/// 'BR' and friends: branch to the label of the block 'depth' levels out.
+	/// A branch to a LOOP's label is a back-edge.
+	[[nodiscard]]
+	CodeView branch(wasm_uint32_t depth)
 	{
-		assert(frames_.size() == 1u);
-		_recurse_return_from_frame_unchecked();
+		auto& frame = top_frame();
+		// a branch to the function's own label returns from it.
+		if(frame.is_function_label(depth))
+			return return_from_function();
+		CodeView label = frame.branch_depth(depth);
+		if(label.current_op() == OpCode::LOOP)
+			safepoint();
+		return label;
+	}
+	/// @}
+
+	/// @name Fuel
+	/// Code lowered with a 'parse::FuelCosts' table starts every basic block
+	/// with a 'FUEL' instruction carrying the block's total cost, so a
+	/// metered guest pays for a block once, on entry, and the count is the
+	/// same on every run.  Code lowered without a table carries no 'FUEL'
+	/// instructions and costs nothing to run unmetered.
+	/// @{
+
+	/// Give the guest 'fuel' units.  What happens when a block costs more
+	/// than is left is up to 'action'.
+	void set_fuel(std::uint64_t fuel, OutOfFuel action = OutOfFuel::trap)
+	{
+		fuel_ = static_cast<std::int64_t>(std::min<std::uint64_t>(fuel, max_fuel));
+		out_of_fuel_ = action;
+	}
+
+	/// Add 'fuel' units, e.g. to pay off a yielded guest's debt before resuming it.
+	void add_fuel(std::uint64_t fuel)
+	{
+		fuel = std::min<std::uint64_t>(fuel, max_fuel);
+		fuel_ = (fuel_ > max_fuel - static_cast<std::int64_t>(fuel)) ? max_fuel : fuel_ + fuel;
 	}
 
+	/// Fuel left.  Negative if the guest yielded owing fuel.
+	std::int64_t fuel() const
+	{ return fuel_; }
+
+	/// 'FUEL': pay 'cost' for the block that starts at 'next'.
 	[[nodiscard]]
-	CodeView end_block()
+	CodeView charge_fuel(wasm_uint32_t cost, const CodeView& next)
 	{
-		if(const char* p = top_frame().try_branch_top(); p)
+		if(fuel_ >= static_cast<std::int64_t>(cost))
 		{
-			
+			fuel_ -= cost;
+			return next;
 		}
+		if(out_of_fuel_ == OutOfFuel::trap)
+			return trap(ops::TrapCode::out_of_fuel, next);
+		fuel_ -= cost;
+		yielded_ = true;
+		return next;
+	}
+	/// @}
+
+	/// 'RETURN_CALL'.  The callee replaces the top frame: its arguments are
+	/// moved to the start of the top frame's region on the caller's stack,
+	/// and its frame takes the top frame's place, so chains of tail calls run
+	/// in constant stack space.
+	[[nodiscard]]
+	CodeView tail_call_function(const WasmFunction::Entry& callee, const WasmInstruction& instr)
+	{
+		assert(instr.opcode() == OpCode::RETURN_CALL);
+		return _tail_call(*callee.function, callee.param_count, callee.return_count);
+	}
+
+	void return_from_expression()
+	{
+		assert(frames_.size() == 1u);
+		_recurse_return_from_frame_unchecked();
 	}
 
 	[[nodiscard]]
@@ -463,86 +781,103 @@ struct WasmCallStack
 	{
 		auto& frame = top_frame();
 		assert(frame.is_function_call());
-		auto ret_types = return_types(signature(*frame.funtion()));
-		assert(frame.stack_size() >= ret_types.size());
-		CodeView ret_addr = top_frame().return_address();
-		_recurse_return_from_frame(return_types);
+		std::size_t ret_count = return_count(*frame.function());
+		assert(frame.stack_size() >= ret_count);
+		CodeView ret_addr = frame.return_address();
+		_return_from_frame(ret_count);
 		return ret_addr;
 	}
 
+	/// 'CALL_INDIRECT'.  'expected' is the canonical id of the call site's
+	/// signature and 'slot' is the call site's inline cache in the caller.
 	[[nodiscard]]
-	CodeView call_table_function(const WasmTable& table, const WasmFunctionSignature& sig, const WasmInstruction& instr)
+	CodeView call_table_function(
+		const WasmTable& table,
+		signature_id_t expected,
+		wasm_uint32_t slot,
+		const WasmInstruction& instr
+	)
 	{
 		assert(instr.opcode() == OpCode::CALL_INDIRECT);
-		assert(frames_.empty() or top_frame().can_exectute_instruction(instr));
-		auto& stack = top_stack();
-		wasm_uint32_t offset = reinterpret_cast<const wasm_uint32_t&>(stack.top().get(tp::i32_c));
-		const TableFunction& func = table.at(offset);
-		if(func.is_null())
-			throw NullTableFunctionError();
-
-		if(func.is_wasm_function())
+		assert(frames_.empty() or top_frame().is_next_instruction(instr));
+		const TableFunction* func = _checked_table_function(table, expected, slot);
+		if(not func)
+			return instr.after();
+		if(func->is_wasm_function())
 		{
-			auto& f = func.get_wasm_function();
-			if(signature(f) != sig)
-				throw BadTableFunctionSignature();
-			stack.pop();
-			return call_wasm_function(func.get_wasm_function());
+			const WasmFunction& callee = *func->get_wasm_function();
+			return _call_wasm_function(callee, instr.after().pos());
 		}
-		assert(func.is_c_function());
-		auto& f = func.get_c_function();
-		if(f.signature() != sig)
-			throw BadTableFunctionSignature();
-
-		{ /* scope */
-			auto stack_size = stack.size();
-			auto guard_ = make_scope_guard(
-				[&, stack_size]{
-					// poor man's check to make sure the c function call  
-					// doesn't modify 'this'.
-					assert(stack.size() == stack_size);
-				}
-			call_c_function(f, offset);
-		} /* /scope */
+		call_c_function(func->get_c_function());
 		return instr.after();
 	}
 
-	void call_c_function(const CFunction& cfunc) const
+	/// 'RETURN_CALL_INDIRECT'.  Like 'tail_call_function()' for wasm callees.
+	/// A host callee runs to completion, then the top frame returns its results.
+	[[nodiscard]]
+	CodeView tail_call_table_function(
+		const WasmTable& table,
+		signature_id_t expected,
+		wasm_uint32_t slot,
+		const WasmInstruction& instr
+	)
+	{
+		assert(instr.opcode() == OpCode::RETURN_CALL_INDIRECT);
+		const TableFunction* func = _checked_table_function(table, expected, slot);
+		if(not func)
+			return instr.after();
+		if(func->is_wasm_function())
+		{
+			const WasmFunction& callee = *func->get_wasm_function();
+			return _tail_call(callee, param_count(callee), return_count(callee));
+		}
+		call_c_function(func->get_c_function());
+		if(suspended())
+		{
+			return_on_completion_ = true;
+			return instr.after();
+		}
+		return return_from_function();
+	}
+
+	void call_c_function(const CFunction& cfunc)
 	{
-		const auto& sig = cfunc.signature();
-		auto param_types = param_types(sig);
-		auto return_types = return_types(sig);
+		// the import's signature was checked when it was linked; the
+		// trampoline reads the arguments and writes the results in place.
 		auto& stack = top_stack();
-		assert(stack.size() >= param_types.size());
-		auto args = gsl::span<const T>(stack.data(), stack.size()).last(param_types.size());
+		std::size_t param_count = cfunc.param_count();
+		std::size_t return_count = cfunc.return_count();
+		assert(stack.size() >= param_count);
+		for(std::size_t i = param_count; i < return_count; ++i)
+			stack.emplace(tp::i32); // placeholder, overwritten by the trampoline
+		std::size_t slot_count = std::max(param_count, return_count);
+		cfunc.call_in_place(stack.data() + (stack.size() - slot_count));
+		if(cfunc.is_async())
 		{
-			auto guard_ = make_stack_size_guard(stack());
-			for(LanguageType value_tp: return_types)
-				stack.emplace(value_tp);
-			auto results = gsl::span<T>(stack.data(), stack.size()).last(return_types.size());
-			cfunc(results, args);
+			// the results are written by 'complete_host_call()'.
+			suspended_in_ = &cfunc;
+			return;
 		}
-		assert(stack.size() >= return_types.size() + param_types.size());
-		std::rotate(
-			stack.begin(),
-			stack.begin() + return_types.size(),
-			stack.begin() + return_types.size() + param_types.size()
-		);
-		stack.pop_n(param_types.size());
+		if(param_count > return_count)
+			stack.pop_n(param_count - return_count);
 	}
 
 	std::optional<WasmInstruction> next_instruction() const
 	{ return top_frame().next_instruction(); }
 
-	void execute(const WasmInstruction& instr, const WasmModule& module) const
+	template <class Module>
+	void execute(const WasmInstruction& instr, Module& module)
 	{
-		if(not top_frame().is_next_instruction())
+		if(not top_frame().is_next_instruction(instr))
 			throw std::logic_error("Instruction does not match program counter on call stack.");
 		CodeView next = instr.execute(*this, module);
-		top_frame().code_.advance(next);
+		// returning from a host call pops the last frame, and a trap leaves
+		// the frames to be unwound by 'reset()'.  A suspended guest resumes
+		// after the call instruction, a yielded one at the safepoint's target.
+		if(not (frames_.empty() or trapped()))
+			top_frame().jump(next);
 	}
 
-private:
 	WasmStackFrame<T>& top_frame()
 	{
 		if(frames_.empty())
@@ -550,6 +885,14 @@ private:
 		return frames_.top();
 	}
 
+	const WasmStackFrame<T>& top_frame() const
+	{
+		if(frames_.empty())
+			throw std::out_of_range("Attempt to access out-of-bounds call stack frame.");
+		return frames_.top();
+	}
+
+private:
 	SimpleStack<T>& top_stack()
 	{
 		if(frames_.empty())
@@ -562,11 +905,25 @@ private:
 		if(frames_.empty())
 			throw std::out_of_range("Attempt to access out-of-bounds frame.");
 		auto pos = frames_.begin();
-		const auto& hi = *pos++;
+		auto& hi = *pos++;
 		if(pos == frames_.end())
 			throw std::out_of_range("Attempt to access out-of-bounds frame.");
-		const auto& lo = *pos++;
-		return std::pair<WasmStackFrame&, WasmStackFrame&>(lo, hi);
+		auto& lo = *pos++;
+		return std::pair<WasmStackFrame<T>&, WasmStackFrame<T>&>(lo, hi);
+	}
+
+	/// Enter 'func', whose arguments are on top of the current stack,
+	/// lowering it first if it hasn't been yet.
+	CodeView _call_wasm_function(const WasmFunction& func, const char* return_address)
+	{
+		const WasmFunction::Entry& callee = entry(func);
+		// sets the entry's 'frame_size' and 'code' before returning.
+		if(not callee.is_lowered())
+			func.ensure_lowered();
+		auto& stack = top_stack();
+		// guaranteed by validation
+		assert(stack.size() >= callee.param_count);
+		return _enter_function(stack, func, callee.frame_size, callee.return_count, return_address);
 	}
 
 	void _recurse_return_from_frame_unchecked()
@@ -582,89 +939,206 @@ private:
 			top_stack().emplace(ret_v);
 		}
 	}
-	void _recurse_return_from_frame(const gsl::span<const LanguageType>& return_types, std::size_t index = 0u)
+
+	/// The table element selected by the i32 on top of the stack, checked
+	/// against the call site's signature 'expected'.  Pops the i32.  Records
+	/// a trap and returns null if the element is out of bounds, empty or of
+	/// the wrong signature.
+	const TableFunction* _checked_table_function(const WasmTable& table, signature_id_t expected, wasm_uint32_t slot)
 	{
-		assert(not frames_.empty());
-		if(index < return_types.size())
+		auto& stack = top_stack();
+		wasm_uint32_t offset = reinterpret_cast<const wasm_uint32_t&>(stack.top().get(tp::i32_c));
+		if(offset >= table.size())
+			return _trap_table_call(ops::TrapCode::table_access);
+		const TableFunction& func = table.at(offset);
+		if(func.is_wasm_function())
 		{
-			// one of the return values from the callee's frame
-			tp::visit_value_type(
-				[&](auto WasmValue::* p) {
-					auto ret_v = top_frame().stack_at(index, p);
-					// keep recursing until we exhaust the return
-					// values.  Once we've done that, pop the callee's 
-					// frame, and then pop the locals vector and arguments 
-					// off the caller's stack.
-					_recurse_return_from_frame(return_types, index);
-					// now that we've popped the callee's frame from the call stack, 
-					// and the locals vector off of the caller's frame's stack, push 
-					// the return values onto the callee's frame's stack.
-					//
-					// note that there may be no frame below the one we popped, in which
-					// case, the return values are pushed onto 'this->base_stack_'
-					top_stack().stack_emplace_top(p, ret_v);
-				},
-				return_types[return_types.size() - index]
-			);
+			const WasmFunction* callee = func.get_wasm_function();
+			// an element whose import isn't linked yet has no callee.
+			if(not callee)
+				return _trap_table_call(ops::TrapCode::null_table_function);
+			IndirectCallCache& cache = indirect_call_cache(*top_frame().function(), slot);
+			// A callee that passed this site's check before still passes it;
+			// function signatures never change.
+			if(callee != cache.target.load(std::memory_order_relaxed))
+			{
+				if(func.sig_id != expected)
+					return _trap_table_call(ops::TrapCode::bad_table_function_signature);
+				cache.target.store(callee, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			if(func.is_null())
+				return _trap_table_call(ops::TrapCode::null_table_function);
+			if(func.sig_id != expected)
+				return _trap_table_call(ops::TrapCode::bad_table_function_signature);
+		}
+		stack.pop();
+		return &func;
+	}
+
+	const TableFunction* _trap_table_call(ops::TrapCode code)
+	{
+		assert(not trapped());
+		trap_ = code;
+		return nullptr;
+	}
+
+	/// Push the zero-initialized locals of 'func', whose arguments are on top
+	/// of 'stack', pad its region for its results, and push its frame.
+	CodeView _enter_function(
+		SimpleStack<T>& stack,
+		const WasmFunction& func,
+		std::size_t frame_size,
+		std::size_t ret_count,
+		const char* return_address
+	)
+	{
+		std::size_t locals_count = frame_size - param_count(func);
+		if constexpr(std::is_same_v<T, WasmValue>)
+		{
+			// zero bits are zero for every value type.
+			for(std::size_t i = 0; i < locals_count; ++i)
+				stack.emplace(tp::i64, 0);
+		}
+		else
+		{
+			for(LanguageType type: locals(func))
+			{
+				tp::visit_value_type(
+					[&](auto WasmValue::* p) { stack.emplace(p, 0); }, type
+				);
+			}
+		}
+		std::size_t region_size = frame_size;
+		if(ret_count > frame_size)
+		{
+			reserve_result_slots(stack, signature(func), frame_size);
+			region_size = ret_count;
+		}
+		auto locals_pos = stack.data() + (stack.size() - region_size);
+		gsl::span<T> locals_vector(locals_pos, frame_size);
+		// a host call has no caller to return to.
+		CodeView ret_addr = return_address
+			? CodeView(*top_frame().function(), return_address)
+			: CodeView(nullptr, std::string_view());
+		frames_.emplace(func, ret_addr, locals_vector, stack_resource());
+		safepoint();
+		return CodeView(func);
+	}
+
+	/// Replace the top frame with a call to 'callee', whose arguments are on
+	/// top of the current stack.
+	CodeView _tail_call(const WasmFunction& callee, std::size_t arg_count, std::size_t ret_count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		auto& frame = top_frame();
+		assert(frame.is_function_call());
+		const char* return_address = frame.return_address().pos();
+		const T* args = frame.stack_top_n(arg_count);
+		T* region = frame.region_base();
+		frames_.pop();
+		// 'region' is where the popped frame's params began; everything above
+		// it on the caller's stack was the popped frame's.  The arguments lie
+		// above the caller's stack, in storage the popped frame released.
+		// Releasing storage to a 'StackResource' leaves its contents alone,
+		// and 'push_range()' moves the arguments down before anything else
+		// is allocated there, unless the stack outgrows its chunk and moves
+		// to the next one, where the arguments may be: copy them out first.
+		auto& stack = top_stack();
+		std::size_t base = region - stack.data();
+		assert(stack.size() >= base);
+		if(stack.size() > base)
+			stack.pop_n(stack.size() - base);
+		if(stack.can_push_in_place(arg_count))
+		{
+			stack.push_range(args, arg_count);
 		}
 		else
 		{
-			const auto* func_p = top_frame.function();
-			assert(func_p);
-			const auto& func = *func_p;
-			std::size_t total_locals = param_count(func) + locals_count(func);
-			// pop the top frame
-			frames_.pop_front();
-			assert(not frames_.empty());
-			auto& new_top_frame = frames_.front();
-			assert(new_top_frame.stack_size() >= total_locals);
-			// pop the locals (args + locals) vector of the frame we just popped
-			// off of the stack.  note that the locals vector of the current frame
-			// lives on the stack of the previous frame.
-			new_top_frame.stack_pop_n(total_locals);
-			// push the return values of the frame we just popped... 
-			// ... by simply returning from _recurse_return_from_frame().  each
-			// recursive call which took the if() branch above will push the return
-			// values onto the new frame. 
+			std::vector<T> saved(args, args + arg_count);
+			stack.push_range(saved.data(), arg_count);
+		}
+		return _enter_function(stack, callee, arg_count + locals_count(callee), ret_count, return_address);
+	}
+
+	/// A call's region on the caller's stack holds the callee's params and
+	/// locals, and receives its results when it returns.  Pad the region if
+	/// the callee has more results than params and locals.
+	void reserve_result_slots(SimpleStack<T>& stack, const WasmFunctionSignature& sig, std::size_t frame_size)
+	{
+		auto ret_types = return_types(sig);
+		for(std::size_t i = frame_size; i < ret_types.size(); ++i)
+		{
+			tp::visit_value_type(
+				[&](auto WasmValue::* p) { stack.emplace(p, 0); }, ret_types[i]
+			);
 		}
 	}
 
+	/// Pop the top frame, leaving its 'result_count' results on the caller's
+	/// stack in place of the frame's region: one memmove of the results,
+	/// then one pop of what is left of the region.
+	void _return_from_frame(std::size_t result_count)
+	{
+		auto& frame = top_frame();
+		const WasmFunction* func = frame.function();
+		assert(func);
+		std::size_t frame_size = param_count(*func) + locals_count(*func);
+		std::size_t region_size = std::max(frame_size, result_count);
+		frame.store_results(result_count);
+		frames_.pop();
+		auto& stack = top_stack();
+		assert(stack.size() >= region_size);
+		if(region_size > result_count)
+			stack.pop_n(region_size - result_count);
+	}
+
+	void safepoint()
+	{
+		// an exhausted budget stays exhausted rather than wrapping around.
+		if(safepoint_budget_ == 0u or --safepoint_budget_ == 0u)
+			yielded_ = true;
+		if(interrupt_.load(std::memory_order_relaxed) != Interrupt::none)
+			take_interrupt();
+	}
+
+	void take_interrupt()
+	{
+		Interrupt kind = interrupt_.exchange(Interrupt::none, std::memory_order_relaxed);
+		if(kind == Interrupt::yield)
+			yielded_ = true;
+		else if(kind == Interrupt::trap and not trapped())
+			trap_ = ops::TrapCode::interrupted;
+	}
+
 	const StackResource& stack_resource() const
 	{ return base_stack_.get_resource(); }
 
 	StackResource& stack_resource()
 	{ return base_stack_.get_resource(); }
 
-	frame_stack_type frames_;
 	SimpleStack<T> base_stack_;
+	frame_stack_type frames_;
+	ops::TrapCode trap_ = ops::TrapCode::none;
+	/// The async host import the guest is suspended in, if any.
+	const CFunction* suspended_in_ = nullptr;
+	bool return_on_completion_ = false;
+	/// Safepoints left before the guest yields.  Practically unlimited by default.
+	std::size_t safepoint_budget_ = std::numeric_limits<std::size_t>::max();
+	bool yielded_ = false;
+	static constexpr const std::int64_t max_fuel = std::numeric_limits<std::int64_t>::max();
+	/// Fuel left for metered code.  Practically unlimited by default.
+	std::int64_t fuel_ = max_fuel;
+	OutOfFuel out_of_fuel_ = OutOfFuel::trap;
+	/// Set by other threads; taken at the next safepoint.
+	std::atomic<Interrupt> interrupt_{Interrupt::none};
 };
 
+/// The call stack 'RunContext' drives.
 template <class T>
-const T& local_at(const WasmCallStack<T>& self, std::size_t idx)
-{
-	auto locals = locals(current_frame(self));
-	if(idx >= locals.size())
-		throw ValidationError<std::out_of_range>("Attempt to access out-of-bounds local.");
-	return locals[idx];
-}
-
-template <class T>
-T& local_at(WasmCallStack<T>& self, std::size_t idx)
-{
-	auto locals = locals(current_frame(self));
-	if(idx >= locals.size())
-		throw ValidationError<std::out_of_range>("Attempt to access out-of-bounds local.");
-	return locals[idx];
-}
-
-template <class T>
-const auto& current_stack(const WasmCallStack<T>& self, std::size_t idx)
-{ return current_stack(current_frame(self)); }
-
-template <class T>
-auto& current_stack(WasmCallStack<T>& self, std::size_t idx)
-{ return current_stack(current_frame(self)); }
-
+using CallStack = WasmCallStack<T>;
 
 } /* namespace wasm */
 
@@ -0,0 +1,620 @@
+#ifndef VM_EXECUTOR_H
+#define VM_EXECUTOR_H
+
+#include "vm/Run.h"
+#include "vm/InterruptTimer.h"
+#include "vm/alloc/Numa.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace wasm {
+
+/// Runs calls of exported functions ("guests") on a pool of worker threads.
+/// Each worker keeps a queue of guests and runs the one at its front for a
+/// time slice of 'Options::slice' safepoints (see 'RunContext::proceed()'),
+/// then moves it to the back, so a long-running guest can't starve the
+/// others.  A worker whose queue is empty steals from the back of another
+/// worker's queue.  Slices may also be limited in time, and guests in total
+/// run time: a timer thread interrupts the guest, which yields or traps
+/// with 'TrapCode::interrupted' at its next safepoint.
+///
+/// A guest's frames live in its own stack buffer, which moves with it when
+/// it is stolen.  Buffers come from a cache kept by each worker and are
+/// first touched by the worker that allocates them.  Guests must be
+/// isolated: an instance runs one guest at a time, and a guest submitted
+/// while another is queued or running in the same instance fails with a
+/// 'std::logic_error'.  Guests calling async host imports aren't supported; a guest that
+/// suspends is cancelled, with a 'std::logic_error'.
+///
+/// On NUMA hosts, the executor can keep each instance on a home node (see
+/// 'Options::numa_aware'), so that its guests run next to its memory.
+/// 'numa_stats()' reports how often they didn't.
+template <class ValueType>
+struct Executor {
+
+	struct Options {
+		std::size_t worker_count = std::max(1u, std::thread::hardware_concurrency());
+		/// Size of each guest's stack buffer, in bytes.
+		std::size_t stack_size = std::size_t(1) << 20;
+		/// If greater than 'stack_size', guests that outgrow their stack
+		/// buffer grow it by chunks of 'stack_size' bytes, from the running
+		/// worker's chunk cache, up to this many bytes in all.
+		std::size_t stack_limit = 0;
+		/// Stack buffers each worker keeps for reuse.
+		std::size_t cached_stacks = 8;
+		/// Safepoints a guest runs for before it goes to the back of the queue.
+		std::size_t slice = 100000;
+		/// If nonzero, the longest a guest runs before it goes to the back of the queue.
+		std::chrono::microseconds slice_time{0};
+		/// If nonzero, the longest a guest runs in total before it traps.
+		std::chrono::microseconds time_limit{0};
+		/// If nonzero, the fuel each guest gets.  A guest running metered
+		/// code traps with 'TrapCode::out_of_fuel' once it has used it up.
+		std::uint64_t fuel = 0;
+		/// Pin worker 'i' to the 'i'th of the CPUs the process may run on
+		/// (see 'numa::allowed_cpus()'), modulo their count.  Linux only.
+		bool pin_workers = false;
+		/// Give each instance a home NUMA node, chosen round-robin when it is
+		/// first submitted, and move the memories it defines there.  Its
+		/// guests then queue on the node's workers, which steal from each
+		/// other before they steal from other nodes, and a guest stolen by
+		/// another node goes back home after its slice.  Pins the workers.
+		/// Linux only.
+		bool numa_aware = false;
+	};
+
+	/// How a guest ended.  'error' is set if running it threw, e.g. on
+	/// stack exhaustion; otherwise 'results' holds its results unless it trapped.
+	struct Outcome {
+		ops::TrapCode trap = ops::TrapCode::none;
+		std::vector<ValueType> results;
+		std::exception_ptr error;
+		/// The fuel the guest used, if 'Options::fuel' is set.
+		std::uint64_t fuel_used = 0;
+	};
+	using completion_type = std::function<void(Outcome&&)>;
+
+	/// Hints of the traffic between NUMA nodes, per node.  Without
+	/// 'Options::numa_aware', every guest is at home on node 0.
+	struct NodeStats {
+		std::size_t workers = 0;
+		/// Instances whose home is the node.
+		std::size_t instances = 0;
+		/// Slices the node's workers ran for guests at home on the node.
+		std::uint64_t local_slices = 0;
+		/// Slices the node's workers ran for guests at home elsewhere, whose
+		/// memory accesses crossed nodes.
+		std::uint64_t remote_slices = 0;
+		/// Guests the node's workers stole from other nodes.
+		std::uint64_t remote_steals = 0;
+	};
+
+	Executor():
+		Executor(Options())
+	{
+
+	}
+
+	explicit Executor(const Options& opts):
+		options_(opts),
+		workers_(std::max<std::size_t>(opts.worker_count, 1u))
+	{
+		if(opts.slice_time.count() > 0 or opts.time_limit.count() > 0)
+			timer_ = std::make_unique<InterruptTimer>();
+		std::vector<unsigned> cpus = numa::allowed_cpus();
+		for(std::size_t i = 0; i < workers_.size(); ++i)
+		{
+			workers_[i].cpu = cpus[i % cpus.size()];
+			if(opts.numa_aware)
+				workers_[i].node = numa::node_of_cpu(workers_[i].cpu);
+		}
+		for(std::size_t i = 0; i < workers_.size(); ++i)
+		{
+			auto node = static_cast<std::size_t>(workers_[i].node);
+			if(node >= node_workers_.size())
+				node_workers_.resize(node + 1u);
+			node_workers_[node].push_back(i);
+		}
+		for(std::size_t i = 0; i < workers_.size(); ++i)
+			workers_[i].thread = std::thread([this, i]() { work(i); });
+	}
+
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+	/// Guests that haven't finished are dropped without their completions running.
+	~Executor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			stopping_ = true;
+		}
+		work_cv_.notify_all();
+		for(auto& w: workers_)
+			w.thread.join();
+	}
+
+	/// Call the function 'name' exported by 'instance' with 'args', on some
+	/// worker, and pass the outcome to 'on_done', on that worker.  'instance'
+	/// must be fully linked and outlive the call.  If another guest submitted
+	/// to 'instance' hasn't finished, the call fails without running.
+	void submit(
+		WasmModule& instance,
+		std::string name,
+		std::vector<ValueType> args,
+		completion_type on_done
+	)
+	{
+		auto guest = std::make_unique<Guest>();
+		guest->instance = &instance;
+		guest->name = std::move(name);
+		guest->args = std::move(args);
+		guest->on_done = std::move(on_done);
+		guest->claimed = claim(instance);
+		if(not guest->claimed)
+		{
+			guest->outcome.error = std::make_exception_ptr(
+				std::logic_error("Instance '" + instance.name() + "' is already running a guest.")
+			);
+		}
+		std::size_t target;
+		if(options_.numa_aware)
+		{
+			guest->home = home_of(instance);
+			const auto& local = node_workers_[guest->home];
+			target = local[next_worker_.fetch_add(1u, std::memory_order_relaxed) % local.size()];
+		}
+		else
+		{
+			target = next_worker_.fetch_add(1u, std::memory_order_relaxed) % workers_.size();
+		}
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			++outstanding_;
+		}
+		enqueue(target, std::move(guest));
+	}
+
+	/// Block until every submitted guest has finished.
+	void wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(idle_mutex_);
+		idle_cv_.wait(lock, [this]() { return outstanding_ == 0u; });
+	}
+
+	std::size_t worker_count() const
+	{ return workers_.size(); }
+
+	/// Whether a guest submitted to 'instance' hasn't finished.
+	bool busy(const WasmModule& instance) const
+	{
+		std::lock_guard<std::mutex> lock(busy_mutex_);
+		return busy_.count(std::addressof(instance)) > 0u;
+	}
+
+	/// Forget 'instance', which is about to be destroyed, so that an
+	/// instance made later at the same address isn't taken for it.  No guest
+	/// submitted to it may be unfinished.
+	void forget(const WasmModule& instance)
+	{
+		assert(not busy(instance));
+		std::lock_guard<std::mutex> lock(homes_mutex_);
+		homes_.erase(std::addressof(instance));
+	}
+
+	/// Traffic hints for each node with workers, by node.  The counts are
+	/// read without stopping the workers, so they may be slightly stale.
+	std::vector<NodeStats> numa_stats() const
+	{
+		std::vector<NodeStats> stats(node_workers_.size());
+		for(const Worker& w: workers_)
+		{
+			NodeStats& node = stats[w.node];
+			++node.workers;
+			node.local_slices += w.local_slices.load(std::memory_order_relaxed);
+			node.remote_slices += w.remote_slices.load(std::memory_order_relaxed);
+			node.remote_steals += w.remote_steals.load(std::memory_order_relaxed);
+		}
+		std::lock_guard<std::mutex> lock(homes_mutex_);
+		for(const auto& home: homes_)
+			++stats[home.second].instances;
+		return stats;
+	}
+
+private:
+	struct Guest {
+		WasmModule* instance = nullptr;
+		std::string name;
+		std::vector<ValueType> args;
+		completion_type on_done;
+		/// Whether the guest holds 'instance' (see 'claim()').  A guest that
+		/// doesn't fails without running.
+		bool claimed = false;
+		std::unique_ptr<char[]> stack;
+		/// Made on the guest's first slice.
+		std::unique_ptr<RunContext<ValueType>> context;
+		std::size_t return_count = 0;
+		/// The home node of 'instance'.
+		int home = 0;
+		/// Run time of the slices so far.
+		InterruptTimer::clock::duration elapsed{0};
+		Outcome outcome;
+	};
+
+	/// An interrupt scheduled for the end of a slice.
+	struct Alarm {
+		InterruptTimer::clock::time_point deadline;
+		InterruptTimer::ticket id;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		/// Runs from the front; thieves take from the back.
+		std::deque<std::unique_ptr<Guest>> queue;
+		/// Only touched by the worker's thread.
+		std::vector<std::unique_ptr<char[]>> free_stacks;
+		std::thread thread;
+		/// The CPU the worker is pinned to, if workers are pinned.
+		unsigned cpu = 0;
+		/// The NUMA node the worker runs on.
+		int node = 0;
+		/// See 'NodeStats'.
+		std::atomic<std::uint64_t> local_slices{0u};
+		std::atomic<std::uint64_t> remote_slices{0u};
+		std::atomic<std::uint64_t> remote_steals{0u};
+	};
+
+	void enqueue(std::size_t index, std::unique_ptr<Guest> guest)
+	{
+		{
+			std::lock_guard<std::mutex> lock(workers_[index].mutex);
+			workers_[index].queue.push_back(std::move(guest));
+		}
+		{
+			// a worker checks 'queued_' under 'idle_mutex_' before it sleeps.
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			++queued_;
+		}
+		work_cv_.notify_one();
+	}
+
+	std::unique_ptr<Guest> dequeue(std::size_t index)
+	{
+		std::unique_ptr<Guest> guest = take(index, true);
+		// steal from the worker's own node first, then from the others.
+		for(int pass = 0; pass < 2 and not guest; ++pass)
+		{
+			for(std::size_t i = 1; not guest and i < workers_.size(); ++i)
+			{
+				std::size_t victim = (index + i) % workers_.size();
+				if((workers_[victim].node == workers_[index].node) != (pass == 0))
+					continue;
+				guest = take(victim, false);
+				if(guest and pass > 0)
+					workers_[index].remote_steals.fetch_add(1u, std::memory_order_relaxed);
+			}
+		}
+		if(guest)
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			--queued_;
+		}
+		return guest;
+	}
+
+	std::unique_ptr<Guest> take(std::size_t index, bool front)
+	{
+		Worker& w = workers_[index];
+		std::lock_guard<std::mutex> lock(w.mutex);
+		if(w.queue.empty())
+			return nullptr;
+		std::unique_ptr<Guest> guest;
+		if(front)
+		{
+			guest = std::move(w.queue.front());
+			w.queue.pop_front();
+		}
+		else
+		{
+			guest = std::move(w.queue.back());
+			w.queue.pop_back();
+		}
+		return guest;
+	}
+
+	void work(std::size_t index)
+	{
+		if(options_.pin_workers or options_.numa_aware)
+			pin_to_cpu(workers_[index].cpu);
+		Worker& self = workers_[index];
+		for(;;)
+		{
+			std::unique_ptr<Guest> guest = dequeue(index);
+			if(not guest)
+			{
+				std::unique_lock<std::mutex> lock(idle_mutex_);
+				work_cv_.wait(lock, [this]() { return stopping_ or queued_ > 0u; });
+				if(stopping_)
+					return;
+				continue;
+			}
+			if(not guest->claimed)
+			{
+				finish(index, std::move(guest));
+				continue;
+			}
+			auto& slices = (guest->home == self.node) ? self.local_slices : self.remote_slices;
+			slices.fetch_add(1u, std::memory_order_relaxed);
+			if(run_slice(index, *guest))
+				finish(index, std::move(guest));
+			else
+				enqueue(requeue_target(index, *guest), std::move(guest));
+		}
+	}
+
+	/// @name NUMA placement
+	/// @{
+
+	/// The home node of 'instance'.  Chosen the first time the instance is
+	/// submitted, when the memories it defines are moved there.  Instances
+	/// are remembered by address.
+	int home_of(WasmModule& instance)
+	{
+		std::lock_guard<std::mutex> lock(homes_mutex_);
+		auto [pos, inserted] = homes_.emplace(std::addressof(instance), 0);
+		if(inserted)
+		{
+			std::size_t node;
+			do {
+				node = next_home_++ % node_workers_.size();
+			} while(node_workers_[node].empty());
+			pos->second = static_cast<int>(node);
+			instance.bind_memories_to_node(pos->second);
+		}
+		return pos->second;
+	}
+
+	/// The worker to queue 'guest' on after it ran a slice on worker
+	/// 'index': that worker, unless the guest was stolen away from home.
+	std::size_t requeue_target(std::size_t index, const Guest& guest)
+	{
+		if(workers_[index].node == guest.home)
+			return index;
+		const auto& local = node_workers_[guest.home];
+		return local[next_worker_.fetch_add(1u, std::memory_order_relaxed) % local.size()];
+	}
+	/// @}
+
+	/// @name Instance isolation
+	/// @{
+
+	/// Mark 'instance' as running a guest.  Returns false if it already is.
+	bool claim(const WasmModule& instance)
+	{
+		std::lock_guard<std::mutex> lock(busy_mutex_);
+		return busy_.insert(std::addressof(instance)).second;
+	}
+
+	void unclaim(const WasmModule& instance)
+	{
+		std::lock_guard<std::mutex> lock(busy_mutex_);
+		busy_.erase(std::addressof(instance));
+	}
+	/// @}
+
+	/// Run 'guest' for one slice.  Returns true if it ended.
+	bool run_slice(std::size_t index, Guest& guest)
+	{
+		std::optional<Alarm> alarm;
+		try
+		{
+			ops::TrapCode trap;
+			auto start_time = InterruptTimer::clock::now();
+			if(not guest.context)
+			{
+				guest.stack = acquire_stack(index);
+				gsl::span<char> space(guest.stack.get(), options_.stack_size);
+				if(options_.stack_limit > options_.stack_size)
+				{
+					guest.context = std::make_unique<RunContext<ValueType>>(
+						*guest.instance, space,
+						StackResource::Options{options_.stack_size, options_.stack_limit}
+					);
+				}
+				else
+				{
+					guest.context = std::make_unique<RunContext<ValueType>>(*guest.instance, space);
+				}
+				auto func = guest.context->bind(guest.name);
+				guest.return_count = func.return_count();
+				if(options_.fuel > 0u)
+					guest.context->set_fuel(options_.fuel);
+				guest.context->set_safepoint_budget(options_.slice);
+				alarm = set_alarm(guest, start_time);
+				trap = func.start(guest.args);
+			}
+			else
+			{
+				guest.context->set_safepoint_budget(options_.slice);
+				alarm = set_alarm(guest, start_time);
+				trap = guest.context->proceed();
+			}
+			clear_alarm(guest, std::exchange(alarm, std::nullopt));
+			guest.elapsed += InterruptTimer::clock::now() - start_time;
+			auto& ctx = *guest.context;
+			if(trap != ops::TrapCode::none)
+			{
+				guest.outcome.trap = trap;
+				return true;
+			}
+			if(ctx.yielded())
+				return false;
+			if(ctx.suspended())
+			{
+				ctx.cancel();
+				throw std::logic_error("Guests run by an executor can't call async host imports.");
+			}
+			guest.outcome.results.resize(guest.return_count);
+			ctx.take_results(gsl::span<ValueType>(guest.outcome.results.data(), guest.outcome.results.size()));
+		}
+		catch(...)
+		{
+			// the alarm refers to the guest's context.
+			clear_alarm(guest, alarm);
+			guest.outcome.error = std::current_exception();
+		}
+		return true;
+	}
+
+	void finish(std::size_t index, std::unique_ptr<Guest> guest)
+	{
+		Outcome outcome = std::move(guest->outcome);
+		completion_type on_done = std::move(guest->on_done);
+		if(options_.fuel > 0u and guest->context)
+			outcome.fuel_used = options_.fuel - std::max<std::int64_t>(guest->context->fuel(), 0);
+		guest->context.reset();
+		if(guest->stack)
+			release_stack(index, std::move(guest->stack));
+		// before the completion, which may submit to the instance again.
+		if(guest->claimed)
+			unclaim(*guest->instance);
+		guest.reset();
+		if(on_done)
+			on_done(std::move(outcome));
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			idle = (--outstanding_ == 0u);
+		}
+		if(idle)
+			idle_cv_.notify_all();
+	}
+
+	/// @name Time slices
+	/// @{
+
+	/// Schedule the interrupt that ends the slice 'guest' starts at 'now':
+	/// a yield when the slice time is up, or a trap if the guest's time limit
+	/// is up first.
+	std::optional<Alarm> set_alarm(Guest& guest, InterruptTimer::clock::time_point now)
+	{
+		if(not timer_)
+			return std::nullopt;
+		auto kind = Interrupt::yield;
+		InterruptTimer::clock::duration slice = options_.slice_time;
+		if(options_.time_limit.count() > 0)
+		{
+			auto left = options_.time_limit - guest.elapsed;
+			if(options_.slice_time.count() == 0 or left <= slice)
+			{
+				kind = Interrupt::trap;
+				slice = std::max(left, InterruptTimer::clock::duration::zero());
+			}
+		}
+		auto deadline = now + slice;
+		RunContext<ValueType>* ctx = guest.context.get();
+		auto id = timer_->schedule(deadline, [ctx, kind]() { ctx->interrupt(kind); });
+		return Alarm{deadline, id};
+	}
+
+	/// Cancel the slice's interrupt, or withdraw it if it arrived after the
+	/// guest had stopped on its own.
+	void clear_alarm(Guest& guest, const std::optional<Alarm>& alarm)
+	{
+		if(alarm and not timer_->cancel(alarm->deadline, alarm->id))
+			guest.context->clear_interrupt();
+	}
+	/// @}
+
+	/// @name Stack buffers
+	/// @{
+	std::unique_ptr<char[]> acquire_stack(std::size_t index)
+	{
+		auto& free_stacks = workers_[index].free_stacks;
+		if(free_stacks.empty())
+		{
+			// uninitialized, so that no page is backed before the policy is set.
+			std::unique_ptr<char[]> stack(new char[options_.stack_size]);
+			if(options_.numa_aware)
+				numa::bind(stack.get(), options_.stack_size, workers_[index].node, true);
+			// touch the buffer here, so its pages are backed near this worker.
+			std::fill_n(stack.get(), options_.stack_size, char(0));
+			return stack;
+		}
+		auto stack = std::move(free_stacks.back());
+		free_stacks.pop_back();
+		return stack;
+	}
+
+	void release_stack(std::size_t index, std::unique_ptr<char[]> stack)
+	{
+		auto& free_stacks = workers_[index].free_stacks;
+		if(free_stacks.size() < options_.cached_stacks)
+			free_stacks.push_back(std::move(stack));
+	}
+	/// @}
+
+	static void pin_to_cpu(unsigned cpu)
+	{
+#ifdef __linux__
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		// best effort: an unpinned worker still works.
+		static_cast<void>(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus));
+#else
+		static_cast<void>(cpu);
+#endif
+	}
+
+	const Options options_;
+	/// Only made if slices or guests are limited in time.
+	std::unique_ptr<InterruptTimer> timer_;
+	std::vector<Worker> workers_;
+	/// Positions in 'workers_' of the workers on each NUMA node, by node.
+	std::vector<std::vector<std::size_t>> node_workers_;
+	std::atomic<std::size_t> next_worker_{0u};
+	/// Guards 'homes_' and 'next_home_'.
+	mutable std::mutex homes_mutex_;
+	/// Home nodes of the instances submitted, if 'Options::numa_aware' is set.
+	std::unordered_map<const WasmModule*, int> homes_;
+	std::size_t next_home_ = 0;
+	/// Guards 'busy_'.
+	mutable std::mutex busy_mutex_;
+	/// Instances with an unfinished guest.
+	std::unordered_set<const WasmModule*> busy_;
+	/// Guards 'queued_', 'outstanding_' and 'stopping_'.
+	std::mutex idle_mutex_;
+	std::condition_variable work_cv_;
+	std::condition_variable idle_cv_;
+	/// Guests in the workers' queues.
+	std::size_t queued_ = 0;
+	/// Guests submitted and not yet finished.
+	std::size_t outstanding_ = 0;
+	bool stopping_ = false;
+};
+
+} /* namespace wasm */
+
+#endif /* VM_EXECUTOR_H */
@@ -0,0 +1,102 @@
+#ifndef VM_INTERRUPT_TIMER_H
+#define VM_INTERRUPT_TIMER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace wasm {
+
+/// A thread that runs actions at deadlines, for preempting guests: the
+/// action interrupts a running call (see 'RunContext::interrupt()'), which
+/// then yields or traps at its next safepoint.  Actions run on the timer's
+/// thread, one at a time, and must be quick.
+struct InterruptTimer {
+
+	using clock = std::chrono::steady_clock;
+	using ticket = std::uint64_t;
+
+	InterruptTimer():
+		thread_([this]() { run(); })
+	{
+
+	}
+
+	InterruptTimer(const InterruptTimer&) = delete;
+	InterruptTimer& operator=(const InterruptTimer&) = delete;
+
+	~InterruptTimer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_one();
+		thread_.join();
+	}
+
+	/// Run 'action' at 'deadline', unless the returned ticket is cancelled first.
+	ticket schedule(clock::time_point deadline, std::function<void()> action)
+	{
+		ticket id;
+		bool earliest;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			id = next_ticket_++;
+			earliest = pending_.empty() or deadline < pending_.begin()->first.first;
+			pending_.emplace(std::make_pair(deadline, id), std::move(action));
+		}
+		if(earliest)
+			cv_.notify_one();
+		return id;
+	}
+
+	/// Cancel the action scheduled at 'deadline' with ticket 'id'.  Returns
+	/// false if it already ran.  The action isn't running when this returns.
+	bool cancel(clock::time_point deadline, ticket id)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return pending_.erase(std::make_pair(deadline, id)) > 0u;
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(not stopping_)
+		{
+			if(pending_.empty())
+			{
+				cv_.wait(lock);
+				continue;
+			}
+			auto first = pending_.begin();
+			if(clock::now() < first->first.first)
+			{
+				cv_.wait_until(lock, first->first.first);
+				continue;
+			}
+			// run under the lock, so 'cancel()' never returns while it runs.
+			std::function<void()> action = std::move(first->second);
+			pending_.erase(first);
+			action();
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	/// Ordered by deadline, then by ticket.
+	std::map<std::pair<clock::time_point, ticket>, std::function<void()>> pending_;
+	ticket next_ticket_ = 0;
+	bool stopping_ = false;
+	std::thread thread_;
+};
+
+} /* namespace wasm */
+
+#endif /* VM_INTERRUPT_TIMER_H */
@@ -2,31 +2,345 @@
 #define VM_RUN_H
 
 #include "vm/CallStack.h"
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
 
 namespace wasm {
 
+struct BadExportError:
+	public std::invalid_argument
+{
+	using std::invalid_argument::invalid_argument;
+};
+
+template <class ValueType>
+struct BoundFunction;
 
 template <class ValueType>
 struct RunContext {
 
+	/// Run guests with their frames in 'space', which they may not outgrow.
 	RunContext(WasmModule& module, gsl::span<char> space):
 		stack_resource_(space),
 		call_stack_(stack_resource_),
 		module_(module)
 	{
-		
+		module_.require_fully_linked();
+	}
+
+	/// Run guests with their frames in 'space' and, once they outgrow it, in
+	/// chunks from the running thread's chunk cache, up to 'stack.limit'
+	/// bytes in all (see 'StackResource').
+	RunContext(WasmModule& module, gsl::span<char> space, const StackResource::Options& stack):
+		stack_resource_(space, stack),
+		call_stack_(stack_resource_),
+		module_(module)
+	{
+		module_.require_fully_linked();
+	}
+
+	/// Run guests with their frames in chunks only.
+	RunContext(WasmModule& module, const StackResource::Options& stack):
+		stack_resource_(stack),
+		call_stack_(stack_resource_),
+		module_(module)
+	{
+		module_.require_fully_linked();
 	}
 
 	std::size_t stack_usage() const
-	{ return resource().inspect().size(); }
+	{ return resource().used(); }
 
 	std::size_t stack_capacity() const
 	{ return resource().capacity(); }
 
+	/// Give back the stack chunks and pages a deep call left behind (see
+	/// 'StackResource::trim()').  Only between calls.
+	void trim_stack()
+	{
+		if(running())
+			throw std::logic_error("Attempt to trim the stack of a running call.");
+		resource().trim();
+	}
+
 	const WasmModule& module() const
 	{ return module_; }
 
+	/// Bind the exported function 'name' for repeated calls from the host.
+	BoundFunction<ValueType> bind(std::string_view name)
+	{
+		auto export_def = module_.get_export(name);
+		const WasmFunction* func = nullptr;
+		if(export_def)
+		{
+			std::visit([&](auto** exported) {
+				using exported_type = std::decay_t<decltype(**exported)>;
+				if constexpr(std::is_same_v<exported_type, WasmFunction>)
+					func = *exported;
+			}, *export_def);
+		}
+		if(not func)
+		{
+			throw BadExportError(
+				"Module '" + module_.name()
+				+ "' exports no function named '" + std::string(name) + "'."
+			);
+		}
+		// lower the body now rather than during the first call.
+		static_cast<void>(code(*func));
+		return BoundFunction<ValueType>(*this, entry(*func));
+	}
+
+	/// @name Suspendable calls
+	/// A call started with 'BoundFunction::start()' runs until it finishes,
+	/// traps, or calls an async host import (see 'make_async_c_function()'),
+	/// which suspends it.  A suspended call stays parked in this context's
+	/// stack buffer, without holding a thread; 'resume()' passes it the
+	/// import's results and continues it, on whichever thread calls it.  A
+	/// context runs one call at a time, so each concurrent guest needs its
+	/// own context.
+	/// @{
+
+	/// Whether a started call has not been finished with 'take_results()'
+	/// or ended by a trap or 'cancel()'.
+	bool running() const
+	{ return static_cast<bool>(active_); }
+
+	bool suspended() const
+	{ return running() and call_stack_.suspended(); }
+
+	bool finished() const
+	{ return running() and call_stack_.empty(); }
+
+	/// The async host import the running call is suspended in.
+	const CFunction& suspending_import() const
+	{ return call_stack_.suspending_import(); }
+
+	/// Continue the suspended call, with 'import_results' as the results of
+	/// the import it is suspended in.  Returns the trap code if the call
+	/// traps, which ends it.
+	ops::TrapCode resume(gsl::span<const ValueType> import_results)
+	{
+		if(not suspended())
+			throw std::logic_error("No suspended call to resume.");
+		call_stack_.complete_host_call(import_results);
+		return run();
+	}
+
+	/// Pop the results of the finished call, ending it.
+	void take_results(gsl::span<ValueType> results)
+	{
+		if(not finished())
+			throw std::logic_error("Attempt to take the results of a call that has not finished.");
+		if(results.size() != active_->return_count)
+			throw std::invalid_argument("Wrong number of results for finished call.");
+		finish([&](std::size_t i) -> ValueType& { return results[i]; });
+	}
+
+	/// End the running call, if any, discarding its state.
+	void cancel()
+	{
+		if(running())
+			abandon();
+	}
+
+	/// Make the running call, or the next one started, yield at its
+	/// 'count'th safepoint from now (see 'CallStack::set_safepoint_budget()').
+	/// A yielded call stays parked like a suspended one, and 'proceed()'
+	/// continues it.  Calls made with 'BoundFunction::operator()()' run
+	/// through their yields.
+	void set_safepoint_budget(std::size_t count)
+	{ call_stack_.set_safepoint_budget(count); }
+
+	bool yielded() const
+	{ return running() and call_stack_.yielded(); }
+
+	/// Continue the call that yielded.  Returns the trap code if the call
+	/// traps, which ends it.  A call that spent its safepoint budget yields
+	/// again at its next safepoint unless it is given a new one first.
+	ops::TrapCode proceed()
+	{
+		if(not yielded())
+			throw std::logic_error("No yielded call to continue.");
+		call_stack_.clear_yield();
+		return run();
+	}
+
+	/// Make the running call yield or trap at its next safepoint.  The only
+	/// member that may be called from another thread while the call runs.
+	void interrupt(Interrupt kind)
+	{ call_stack_.interrupt(kind); }
+
+	/// Withdraw an interrupt that hasn't been taken yet, e.g. one that
+	/// arrived after the call it was meant for had already stopped.
+	void clear_interrupt()
+	{ call_stack_.clear_interrupt(); }
+
+	/// Meter calls into code lowered with a fuel cost table: give them
+	/// 'fuel' units between them, and trap or yield when a basic block costs
+	/// more than is left (see 'CallStack::set_fuel()').  A call that yielded
+	/// owing fuel should get more with 'add_fuel()' before 'proceed()'.
+	void set_fuel(std::uint64_t fuel, OutOfFuel action = OutOfFuel::trap)
+	{ call_stack_.set_fuel(fuel, action); }
+
+	void add_fuel(std::uint64_t fuel)
+	{ call_stack_.add_fuel(fuel); }
+
+	/// Fuel left; what was given less what was used is what to bill.
+	std::int64_t fuel() const
+	{ return call_stack_.fuel(); }
+	/// @}
+
 private:
+	friend struct BoundFunction<ValueType>;
+
+	/// Call 'callee' with 'arg_at(i)' as its 'i'th argument and store its
+	/// 'j'th result in 'result_at(j)'.  Returns the trap code if the call
+	/// traps.  Leaves the stack as it found it, even if the call traps or
+	/// overflows the stack.
+	///
+	/// The call runs through its yields: it ignores the safepoint budget,
+	/// which is left as it was for the next call started, and isn't parked
+	/// for 'proceed()' when interrupted with 'Interrupt::yield'.  Running
+	/// out of fuel traps with 'TrapCode::out_of_fuel' even under
+	/// 'OutOfFuel::yield'.
+	template <class ArgAt, class ResultAt>
+	ops::TrapCode call(const WasmFunction::Entry& callee, ArgAt&& arg_at, ResultAt&& result_at)
+	{
+		const std::size_t budget = call_stack_.safepoint_budget();
+		ops::TrapCode trap = ops::TrapCode::none;
+		try
+		{
+			begin(callee, std::forward<ArgAt>(arg_at));
+			trap = run();
+			while(trap == ops::TrapCode::none and call_stack_.yielded())
+			{
+				// only a block it couldn't pay for leaves a guest owing fuel;
+				// running on would bypass the meter.
+				if(call_stack_.fuel() < 0)
+				{
+					abandon();
+					trap = ops::TrapCode::out_of_fuel;
+					break;
+				}
+				// don't stop at every safepoint once a budget is spent.
+				call_stack_.restore_safepoint_budget(std::numeric_limits<std::size_t>::max());
+				call_stack_.clear_yield();
+				trap = run();
+			}
+		}
+		catch(...)
+		{
+			call_stack_.restore_safepoint_budget(budget);
+			throw;
+		}
+		call_stack_.restore_safepoint_budget(budget);
+		if(trap != ops::TrapCode::none)
+			return trap;
+		if(call_stack_.suspended())
+		{
+			abandon();
+			throw std::logic_error(
+				"An async host import suspended a call that can't be resumed; "
+				"use 'BoundFunction::start()'."
+			);
+		}
+		finish(std::forward<ResultAt>(result_at));
+		return ops::TrapCode::none;
+	}
+
+	ops::TrapCode start(const WasmFunction::Entry& callee, gsl::span<const ValueType> args)
+	{
+		begin(callee, [&](std::size_t i) -> const ValueType& { return args[i]; });
+		return run();
+	}
+
+	/// Push the arguments and enter 'callee'.
+	template <class ArgAt>
+	void begin(const WasmFunction::Entry& callee, ArgAt&& arg_at)
+	{
+		if(running())
+			throw std::logic_error("Attempt to start a call while another call is running.");
+		auto& stack = call_stack_.base_stack();
+		active_ = &callee;
+		active_base_ = stack.size();
+		try
+		{
+			for(std::size_t i = 0; i < callee.param_count; ++i)
+				stack.push(arg_at(i));
+			static_cast<void>(call_stack_.enter_from_host(callee));
+		}
+		catch(...)
+		{
+			abandon();
+			throw;
+		}
+	}
+
+	/// Run the running call until it finishes, traps, suspends or yields.
+	/// A trap ends the call.
+	ops::TrapCode run()
+	{
+		ops::TrapCode trap = ops::TrapCode::none;
+		try
+		{
+			trap = run_to_return();
+		}
+		catch(...)
+		{
+			// stack exhaustion is still reported by the stack allocator.
+			abandon();
+			throw;
+		}
+		if(trap != ops::TrapCode::none)
+			abandon();
+		return trap;
+	}
+
+	/// Store the finished call's results with 'result_at(j)' and pop them.
+	template <class ResultAt>
+	void finish(ResultAt&& result_at)
+	{
+		assert(finished());
+		auto& stack = call_stack_.base_stack();
+		std::size_t return_count = active_->return_count;
+		assert(stack.size() == active_base_ + return_count);
+		const ValueType* returned = stack.data() + active_base_;
+		for(std::size_t i = 0; i < return_count; ++i)
+			result_at(i) = returned[i];
+		if(return_count > 0u)
+			stack.pop_n(return_count);
+		active_ = nullptr;
+	}
+
+	/// Unwind the running call and end it.
+	void abandon()
+	{
+		call_stack_.reset(active_base_);
+		active_ = nullptr;
+	}
+
+	/// Execute until the frame entered from the host returns, a trap is
+	/// raised, or the guest is suspended or yields.  Returns the trap, if
+	/// any; the frames are left to the caller to unwind.
+	ops::TrapCode run_to_return()
+	{
+		while(not (
+			call_stack_.empty() or call_stack_.trapped()
+			or call_stack_.suspended() or call_stack_.yielded()
+		))
+		{
+			auto instr = call_stack_.next_instruction();
+			// validated bodies end with 'END', which returns.
+			assert(instr);
+			call_stack_.execute(*instr, module_);
+		}
+		return call_stack_.pending_trap();
+	}
+
 	const StackResource& resource() const
 	{ return stack_resource_; }
 
@@ -36,6 +350,110 @@ private:
 	StackResource stack_resource_;
 	CallStack<ValueType> call_stack_;
 	WasmModule& module_;
+	/// The running call, if any.
+	const WasmFunction::Entry* active_ = nullptr;
+	/// Size of the base stack before the running call's arguments were pushed.
+	std::size_t active_base_ = 0;
+};
+
+/// An exported function bound to a 'RunContext' by 'RunContext::bind()'.
+/// The export lookup, lowering and frame layout are resolved once, when
+/// binding; a call only pushes the arguments, runs the body and pops the
+/// results.  Calls leave the context's stack as they found it, so they all
+/// run in the same stack storage.
+template <class ValueType>
+struct BoundFunction {
+
+	BoundFunction(RunContext<ValueType>& ctx, const WasmFunction::Entry& callee):
+		context_(ctx), callee_(callee)
+	{
+
+	}
+
+	std::size_t param_count() const
+	{ return callee_.param_count; }
+
+	std::size_t return_count() const
+	{ return callee_.return_count; }
+
+	/// Call once, with one value per param in 'args' and one slot per
+	/// result in 'results'.  Throws the trap's exception if the call traps.
+	void operator()(gsl::span<const ValueType> args, gsl::span<ValueType> results) const
+	{
+		if(ops::TrapCode trap = try_invoke(args, results); trap != ops::TrapCode::none)
+			ops::throw_trap(trap);
+	}
+
+	/// Like 'operator()()', but returns the trap code instead of throwing.
+	ops::TrapCode try_invoke(gsl::span<const ValueType> args, gsl::span<ValueType> results) const
+	{
+		check_arity(args.size(), results.size());
+		return context_.call(
+			callee_,
+			[&](std::size_t i) -> const ValueType& { return args[i]; },
+			[&](std::size_t i) -> ValueType& { return results[i]; }
+		);
+	}
+
+	/// Start a call that async host imports may suspend (see
+	/// 'RunContext::resume()').  Returns the trap code if the call traps
+	/// before it finishes or suspends.
+	ops::TrapCode start(gsl::span<const ValueType> args) const
+	{
+		if(args.size() != param_count())
+			throw std::invalid_argument("Wrong number of arguments for bound function.");
+		return context_.start(callee_, args);
+	}
+
+	/// Call once per row of a columnar batch: row 'r' passes 'arg_columns[i][r]'
+	/// as the 'i'th argument and stores the 'j'th result in 'result_columns[j][r]'.
+	/// Every column holds 'rows' values.  If a row traps, the rows before it
+	/// have their results and the trap's exception is thrown.
+	void invoke_batch(
+		gsl::span<const ValueType* const> arg_columns,
+		gsl::span<ValueType* const> result_columns,
+		std::size_t rows
+	) const
+	{
+		ops::TrapCode trap = try_invoke_batch(arg_columns, result_columns, rows).second;
+		if(trap != ops::TrapCode::none)
+			ops::throw_trap(trap);
+	}
+
+	/// Like 'invoke_batch()', but stops at the first row that traps instead
+	/// of throwing.  Returns the number of rows that completed and the trap
+	/// code of the row after them ('TrapCode::none' if every row completed).
+	std::pair<std::size_t, ops::TrapCode> try_invoke_batch(
+		gsl::span<const ValueType* const> arg_columns,
+		gsl::span<ValueType* const> result_columns,
+		std::size_t rows
+	) const
+	{
+		check_arity(arg_columns.size(), result_columns.size());
+		for(std::size_t row = 0; row < rows; ++row)
+		{
+			ops::TrapCode trap = context_.call(
+				callee_,
+				[&](std::size_t i) -> const ValueType& { return arg_columns[i][row]; },
+				[&](std::size_t i) -> ValueType& { return result_columns[i][row]; }
+			);
+			if(trap != ops::TrapCode::none)
+				return std::make_pair(row, trap);
+		}
+		return std::make_pair(rows, ops::TrapCode::none);
+	}
+
+private:
+	void check_arity(std::size_t arg_count, std::size_t result_count) const
+	{
+		if(arg_count != param_count())
+			throw std::invalid_argument("Wrong number of arguments for bound function.");
+		if(result_count != return_count())
+			throw std::invalid_argument("Wrong number of results for bound function.");
+	}
+
+	RunContext<ValueType>& context_;
+	const WasmFunction::Entry& callee_;
 };
 
 } /* namespace wasm */
@@ -0,0 +1,201 @@
+#ifndef VM_ALLOC_NUMA_H
+#define VM_ALLOC_NUMA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Best-effort NUMA placement, through the kernel's interfaces directly, so
+ * that libnuma isn't a dependency.  On hosts with one node, and on systems
+ * other than Linux, there is one node, 0, and placement does nothing.
+ */
+
+namespace wasm::numa {
+
+namespace detail {
+
+#ifdef __linux__
+/// Memory policy constants from <linux/mempolicy.h>.
+constexpr const int mpol_preferred = 1;
+constexpr const unsigned mpol_mf_move = 1u << 1;
+#endif
+
+inline std::size_t os_page_size()
+{
+#ifdef __linux__
+	static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	return size;
+#else
+	return 4096u;
+#endif
+}
+
+/// The whole pages within the 'size' bytes at 'p', as [first, last).
+inline std::pair<std::uintptr_t, std::uintptr_t> inner_pages(const void* p, std::size_t size)
+{
+	std::size_t page = os_page_size();
+	auto first = (reinterpret_cast<std::uintptr_t>(p) + page - 1u) / page * page;
+	auto last = (reinterpret_cast<std::uintptr_t>(p) + size) / page * page;
+	return std::make_pair(first, std::max(first, last));
+}
+
+/// The highest number in a sysfs list such as "0-3,8", or -1.
+inline int last_in_list(const std::string& path)
+{
+	std::ifstream file(path);
+	std::string list;
+	if(not (file >> list))
+		return -1;
+	auto pos = list.find_last_of(",-");
+	return std::stoi(pos == std::string::npos ? list : list.substr(pos + 1u));
+}
+
+} /* namespace detail */
+
+/// The number of NUMA nodes.  Read once.
+inline std::size_t node_count()
+{
+#ifdef __linux__
+	static const std::size_t count = static_cast<std::size_t>(
+		std::max(detail::last_in_list("/sys/devices/system/node/online") + 1, 1)
+	);
+	return count;
+#else
+	return 1u;
+#endif
+}
+
+/// The logical CPUs the calling thread may run on, in increasing order,
+/// which may be fewer than the host has (e.g. under 'taskset' or in a
+/// container).  Never empty.
+inline std::vector<unsigned> allowed_cpus()
+{
+	std::vector<unsigned> cpus;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(::sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for(unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if(CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+	}
+#endif
+	if(cpus.empty())
+	{
+		for(unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+/// The node of logical CPU 'cpu', or 0 if it can't be told.
+inline int node_of_cpu(unsigned cpu)
+{
+#ifdef __linux__
+	std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node";
+	for(std::size_t node = 0; node < node_count(); ++node)
+	{
+		if(::access((base + std::to_string(node)).c_str(), F_OK) == 0)
+			return static_cast<int>(node);
+	}
+#else
+	static_cast<void>(cpu);
+#endif
+	return 0;
+}
+
+/// The node the calling thread is running on.
+inline int current_node()
+{
+#ifdef __linux__
+	unsigned cpu = 0;
+	unsigned node = 0;
+	if(node_count() > 1u and ::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+		return static_cast<int>(node);
+#endif
+	return 0;
+}
+
+/// Prefer 'node' for the whole pages within the 'size' bytes at 'p', and
+/// move those already backed elsewhere if 'move' is set.  Pages are
+/// allocated on 'node' while it has free memory, and elsewhere after.
+/// Returns false if the policy couldn't be set.
+inline bool bind(void* p, std::size_t size, int node, bool move)
+{
+#ifdef __linux__
+	if(node_count() < 2u or node < 0)
+		return false;
+	auto [first, last] = detail::inner_pages(p, size);
+	if(first == last)
+		return false;
+	constexpr std::size_t mask_bits = 8u * sizeof(unsigned long);
+	std::vector<unsigned long> mask((node_count() + mask_bits - 1u) / mask_bits, 0ul);
+	mask[node / mask_bits] |= 1ul << (node % mask_bits);
+	long err = ::syscall(
+		SYS_mbind, reinterpret_cast<void*>(first), last - first,
+		detail::mpol_preferred, mask.data(), mask.size() * mask_bits + 1u,
+		move ? detail::mpol_mf_move : 0u
+	);
+	return err == 0;
+#else
+	static_cast<void>(p);
+	static_cast<void>(size);
+	static_cast<void>(node);
+	static_cast<void>(move);
+	return false;
+#endif
+}
+
+/// Of up to 'samples' pages spread evenly over the 'size' bytes at 'p',
+/// the number backed by a node other than 'node'.  Pages not backed yet
+/// aren't counted.
+inline std::size_t pages_off_node(const void* p, std::size_t size, int node, std::size_t samples)
+{
+#ifdef __linux__
+	if(node_count() < 2u or samples == 0u)
+		return 0u;
+	auto [first, last] = detail::inner_pages(p, size);
+	std::size_t page = detail::os_page_size();
+	std::size_t count = (last - first) / page;
+	if(count == 0u)
+		return 0u;
+	std::size_t step = std::max<std::size_t>(count / samples, 1u);
+	std::vector<void*> pages;
+	for(std::size_t i = 0; i < count and pages.size() < samples; i += step)
+		pages.push_back(reinterpret_cast<void*>(first + i * page));
+	std::vector<int> status(pages.size(), -1);
+	// with no target nodes, 'move_pages' only reports where each page is.
+	long err = ::syscall(
+		SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0
+	);
+	if(err != 0)
+		return 0u;
+	return std::count_if(status.begin(), status.end(),
+		[node](int s) { return s >= 0 and s != node; }
+	);
+#else
+	static_cast<void>(p);
+	static_cast<void>(size);
+	static_cast<void>(node);
+	static_cast<void>(samples);
+	return 0u;
+#endif
+}
+
+} /* namespace wasm::numa */
+
+#endif /* VM_ALLOC_NUMA_H */
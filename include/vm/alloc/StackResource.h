@@ -2,8 +2,24 @@
 #define VM_ALLOC_STACK_RESOURCE_H
 
 #include "vm/alloc/memory_resource.h"
+#include "vm/alloc/Numa.h"
 #include <gsl/span>
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace wasm {
 
@@ -23,7 +39,7 @@ struct StackOverflowError:
 struct BadAlignmentError:
 	public std::bad_alloc
 {
-	StackOverflowError(std::size_t req):
+	BadAlignmentError(std::size_t req):
 		std::bad_alloc(), requested(req)
 	{
 		
@@ -32,83 +48,298 @@ struct BadAlignmentError:
 	const std::size_t requested;
 };
 
+namespace detail {
+
+inline std::size_t os_page_size()
+{
+#ifdef __linux__
+	static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	return size;
+#else
+	return 4096u;
+#endif
+}
+
+inline std::size_t round_up_to_os_pages(std::size_t size)
+{
+	std::size_t page = os_page_size();
+	return ((size + page - 1u) / page) * page;
+}
+
+/// Page-aligned storage for stack chunks, preferring the calling thread's NUMA node.
+inline char* map_stack_chunk(std::size_t size)
+{
+#ifdef __linux__
+	void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+		throw std::bad_alloc();
+	// chunks are cached per thread, so back them near the thread mapping them.
+	numa::bind(p, size, numa::current_node(), false);
+	return static_cast<char*>(p);
+#else
+	return static_cast<char*>(::operator new(size, std::align_val_t(os_page_size())));
+#endif
+}
+
+inline void unmap_stack_chunk(char* p, std::size_t size)
+{
+#ifdef __linux__
+	::munmap(p, size);
+#else
+	::operator delete(p, size, std::align_val_t(os_page_size()));
+#endif
+}
+
+/// Give the whole pages of the 'size' bytes at 'p' back to the OS.  They
+/// stay mapped, and read as zero when next touched.
+inline void discard_stack_pages(char* p, std::size_t size)
+{
+#ifdef __linux__
+	std::size_t page = os_page_size();
+	auto first = (reinterpret_cast<std::uintptr_t>(p) + page - 1u) / page * page;
+	auto last = (reinterpret_cast<std::uintptr_t>(p) + size) / page * page;
+	if(first < last)
+		::madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#else
+	static_cast<void>(p);
+	static_cast<void>(size);
+#endif
+}
+
+/// Stack chunks released on one thread, kept for the next stack resources
+/// on that thread to grow into.  Holds at most 'max_bytes'; chunks beyond
+/// that are unmapped.
+struct StackChunkCache {
+
+	static constexpr const std::size_t max_bytes = std::size_t(64) << 20;
+
+	StackChunkCache() = default;
+	StackChunkCache(const StackChunkCache&) = delete;
+	StackChunkCache& operator=(const StackChunkCache&) = delete;
+
+	~StackChunkCache()
+	{
+		for(auto [p, size]: chunks_)
+			unmap_stack_chunk(p, size);
+	}
+
+	/// A chunk of at least 'size' bytes, a whole number of pages.  Reuses
+	/// the smallest cached chunk that is big enough.
+	std::pair<char*, std::size_t> acquire(std::size_t size)
+	{
+		auto best = chunks_.end();
+		for(auto pos = chunks_.begin(); pos != chunks_.end(); ++pos)
+		{
+			if(pos->second >= size and (best == chunks_.end() or pos->second < best->second))
+				best = pos;
+		}
+		if(best == chunks_.end())
+		{
+			size = round_up_to_os_pages(size);
+			return std::make_pair(map_stack_chunk(size), size);
+		}
+		auto chunk = *best;
+		*best = chunks_.back();
+		chunks_.pop_back();
+		bytes_ -= chunk.second;
+		return chunk;
+	}
+
+	void release(char* p, std::size_t size)
+	{
+		if(bytes_ + size > max_bytes)
+		{
+			unmap_stack_chunk(p, size);
+			return;
+		}
+		chunks_.emplace_back(p, size);
+		bytes_ += size;
+	}
+
+private:
+	std::vector<std::pair<char*, std::size_t>> chunks_;
+	std::size_t bytes_ = 0;
+};
+
+inline thread_local StackChunkCache stack_chunk_cache;
+
+} /* namespace detail */
+
+/// Storage for a guest's frames and operands, allocated and released in
+/// LIFO order.  The stack starts in one buffer and may grow by chunks,
+/// taken from and given back to the current thread's chunk cache, up to a
+/// limit on its total size.  An allocation never straddles two chunks:
+/// 'expand()' moves the most recent allocation to the next chunk if it
+/// doesn't fit in its own, which is safe because nothing refers into the
+/// top of a guest's stack but the operand stack that owns it.
+///
+/// Chunks that fall empty stay with the resource, so a guest whose depth
+/// hovers around a chunk boundary doesn't keep trading chunks with the
+/// cache.  'trim()' gives them back after a spike in recursion depth.
 struct StackResource:
 	public pmr::memory_resource
 {
 
 	static constexpr const std::size_t max_alignment = alignof(std::max_align_t);
 
+	struct Options {
+		/// Size of each chunk the stack grows by.  Rounded up to whole pages.
+		std::size_t chunk_size = std::size_t(256) << 10;
+		/// The most bytes the stack may hold, in all its chunks.  Allocating
+		/// beyond it throws 'StackOverflowError'.
+		std::size_t limit = std::size_t(64) << 20;
+	};
+
 	StackResource(char* base, std::size_t count):
 		StackResource(gsl::span<char>(base, count))
 	{
 		
 	}
 	
+	/// A stack confined to 'buff', which the caller owns.
 	StackResource(gsl::span<char> buff):
-		base_(buff.data()),
-		buffer_(buff)
+		StackResource(buff, Options{0u, buff.size()})
+	{
+		
+	}
+
+	/// A stack that starts in 'buff', which the caller owns, and grows by
+	/// chunks up to 'opts.limit' bytes.
+	StackResource(gsl::span<char> buff, const Options& opts):
+		opts_(opts)
 	{
-		assert(buffer_.data() == base_);
+		char* base = buff.data();
+		std::size_t count = buff.size();
+		ensure_aligned(base, count);
+		chunks_.push_back(Chunk{base, count, false, nullptr, 0u});
+		reserved_ = count;
+		top_ = base;
+	}
+
+	/// A stack made of chunks only.
+	explicit StackResource(const Options& opts):
+		opts_(opts)
+	{
+		std::size_t size = std::max<std::size_t>(opts_.chunk_size, max_alignment);
+		if(size > opts_.limit)
+			throw StackOverflowError(nullptr, size);
+		auto [base, count] = detail::stack_chunk_cache.acquire(size);
+		chunks_.push_back(Chunk{base, count, true, nullptr, 0u});
+		reserved_ = count;
+		top_ = base;
 	}
 	
 	StackResource(const StackResource& other) = delete;
 
+	~StackResource()
+	{
+		for(const Chunk& chunk: chunks_)
+		{
+			if(chunk.owned)
+				detail::stack_chunk_cache.release(chunk.base, chunk.size);
+		}
+	}
+
+	/// Grow the most recent allocation, 'p', from 'old_size' to 'new_size'
+	/// bytes.  Returns its address, which differs from 'p' if it had to move
+	/// to another chunk; its first 'old_size' bytes are moved with it.
 	void* expand(void* p, std::size_t old_size, std::size_t new_size, std::size_t alignment)
 	{
-		assert(pos + bytes <= buffer_.data());
-		assert(pos >= base_);
-		assert((pos < buffer_.data()) or (old_size == 0u));
+		_assert_invariants();
+		char* pos = static_cast<char*>(p);
+		auto old_size_adj = adjusted_size(old_size);
+		auto new_size_adj = adjusted_size(new_size);
 		assert(
-			(pos == (buffer_.data() - bytes_adj))
+			(pos + old_size_adj == top_)
 			and "Can only reallocate the most-recent allocation from a stack resource."
 		);
-		assert(new_size > old_size);
-		assert((old_size == 0u) or is_aligned(pos, old_size, max_alignment));
-		auto new_size_adj = adjusted_size(new_size);
-		auto old_size_adj = adjusted_size(old_size);
 		assert(new_size_adj >= old_size_adj);
-		auto alloc_size = static_cast<std::size_t>(new_size_adj - old_size_adj);
-		assert((alloc_size % max_alignment) == 0u);
-		if(alloc_size == 0u);
+		if(alignment > max_alignment)
+			throw BadAlignmentError(alignment);
+		if(new_size_adj - old_size_adj <= room())
+		{
+			top_ = pos + new_size_adj;
 			return p;
-		if(alloc_size > buffer_.size())
-			throw StackOverflowError(buffer_.data(), alloc_size);
-		buffer_ = buffer.subspan(alloc_size);
-		return p;
+		}
+		// the allocation leaves its chunk, which keeps its contents until
+		// it is next allocated from.
+		top_ = pos;
+		assert(chunks_[current_].live > 0u);
+		--chunks_[current_].live;
+		enter_chunk(new_size_adj);
+		++chunks_[current_].live;
+		char* new_pos = top_;
+		std::memcpy(new_pos, pos, old_size);
+		top_ = new_pos + new_size_adj;
+		_assert_invariants();
+		return new_pos;
 	}
 
-	void* contract(void* p, std::size_t old_size, std::size_t new_size) override
+	/// Whether growing the most recent allocation, 'p', from 'old_size' to
+	/// 'new_size' bytes leaves it where it is.
+	bool can_expand_in_place(const void* p, std::size_t old_size, std::size_t new_size) const
 	{
-		_assert_invariants();
 		const char* pos = static_cast<const char*>(p);
-		assert(pos + bytes <= buffer_.data());
-		assert(pos >= base_);
-		assert((pos < buffer_.data()) or (old_size == 0u));
+		assert(pos + adjusted_size(old_size) == top_);
+		return adjusted_size(new_size) - adjusted_size(old_size) <= room();
+	}
+
+	void* contract(void* p, std::size_t old_size, std::size_t new_size)
+	{
+		_assert_invariants();
+		char* pos = static_cast<char*>(p);
+		auto old_size_adj = adjusted_size(old_size);
+		auto new_size_adj = adjusted_size(new_size);
 		assert(
-			(pos == (buffer_.data() - old_size))
+			(pos + old_size_adj == top_)
 			and "Can only reallocate the most-recent allocation from a stack resource."
 		);
-		assert(new_size < old_size);
-		assert(is_aligned(pos, old_size, max_alignment));
-		auto new_size_adj = adjusted_size(new_size);
-		auto old_size_adj = adjusted_size(old_size);
-		assert(old_size_adj >= new_size_adj);
-		std::size_t dist = old_size_adj - new_size_adj;
-		if(dist == 0u);
-			return p;
-		assert(static_cast<std::ptrdiff_t>(dist) == (buffer_.data() - pos));
-		buffer_ = gsl::span<char>(p, buffer_.size() + dist);
+		assert(new_size_adj <= old_size_adj);
+		top_ = pos + new_size_adj;
 		_assert_invariants();
 		return p;
 	}
 
+	/// The most bytes the stack may hold.
 	std::size_t capacity() const
-	{ return (buffer_.data() + buffer_.size()) - base_; }
+	{ return opts_.limit; }
+
+	/// Bytes allocated, in all chunks.
+	std::size_t used() const
+	{
+		std::size_t total = top_ - chunks_[current_].base;
+		for(std::size_t i = 0; i < current_; ++i)
+			total += chunks_[i + 1u].below_top - chunks_[i].base;
+		return total;
+	}
 
-	gsl::span<const char> inspect() const
-	{ return gsl::span<const char>(base_, buffer_.data() - base_); }
+	/// Bytes held, in all chunks, including empty ones.
+	std::size_t reserved() const
+	{ return reserved_; }
+
+	/// Give back what a spike in stack depth left behind: the empty chunks
+	/// above the current one go back to the thread's chunk cache, and the
+	/// unused pages of the chunks go back to the OS.  Released storage
+	/// loses its contents, so only trim between calls.
+	void trim()
+	{
+		release_spare_chunks(current_ + 1u, true);
+		const Chunk& chunk = chunks_[current_];
+		if(chunk.owned)
+			detail::discard_stack_pages(top_, (chunk.base + chunk.size) - top_);
+	}
 
 private:
+	struct Chunk {
+		char* base;
+		std::size_t size;
+		/// False for the buffer the stack started in, which the caller owns.
+		bool owned;
+		/// How far the chunk below was filled when this one was entered.
+		char* below_top;
+		/// Allocations that live in this chunk.
+		std::size_t live;
+	};
 	
 	static bool is_power_of_two(std::size_t value)
 	{
@@ -119,18 +350,22 @@ private:
 	static bool is_aligned(const char* p, std::size_t count, std::size_t alignment)
 	{
 		assert(is_power_of_two(alignment));
-		return p == std::align(alignment, 1u, p, count);
+		void* vp = const_cast<char*>(p);
+		return vp == std::align(alignment, 1u, vp, count);
 	}
 
-	static char* ensure_aligned(char*& base, std::size_t& count)
+	static void ensure_aligned(char*& base, std::size_t& count)
 	{
 		assert(base);
 		assert(count);
-		if(not std::align(alignof(std::max_align_t), 1u, base, count))
+		void* vp = base;
+		if(not std::align(max_alignment, 1u, vp, count))
 			throw std::invalid_argument("Pointer-size pair could not be aligned in 'StackResource' constructor.");
+		base = static_cast<char*>(vp);
+		count -= count % max_alignment;
 	}
 
-	static std::size_t adjust_size(std::size_t size)
+	static std::size_t adjusted_size(std::size_t size)
 	{
 		auto err = size % max_alignment;
 		if(err != 0u)
@@ -138,48 +373,103 @@ private:
 		return size;
 	}
 
+	std::size_t room() const
+	{
+		const Chunk& chunk = chunks_[current_];
+		return (chunk.base + chunk.size) - top_;
+	}
+
+	/// Continue in the chunk above the current one, making it if need be,
+	/// with room for at least 'size' bytes.
+	void enter_chunk(std::size_t size)
+	{
+		std::size_t next = current_ + 1u;
+		if(next < chunks_.size() and chunks_[next].size < size)
+			release_spare_chunks(next, false);
+		if(next == chunks_.size())
+		{
+			std::size_t chunk_size = detail::round_up_to_os_pages(std::max(size, opts_.chunk_size));
+			if(opts_.chunk_size == 0u or reserved_ + chunk_size > opts_.limit)
+				throw StackOverflowError(top_, size);
+			auto [base, count] = detail::stack_chunk_cache.acquire(chunk_size);
+			chunks_.push_back(Chunk{base, count, true, nullptr, 0u});
+			reserved_ += count;
+		}
+		chunks_[next].below_top = top_;
+		current_ = next;
+		top_ = chunks_[next].base;
+	}
+
+	/// Return to the chunk below the current one, and below that while the
+	/// chunks are empty.  The chunks left stay, empty, for reuse.
+	void leave_chunk()
+	{
+		do {
+			assert(top_ == chunks_[current_].base);
+			top_ = chunks_[current_].below_top;
+			--current_;
+		} while(current_ > 0u and chunks_[current_].live == 0u and top_ == chunks_[current_].base);
+	}
+
+	/// Give the chunks from 'first' on back to the thread's chunk cache.
+	void release_spare_chunks(std::size_t first, bool discard)
+	{
+		assert(first > current_);
+		for(std::size_t i = first; i < chunks_.size(); ++i)
+		{
+			const Chunk& chunk = chunks_[i];
+			assert(chunk.live == 0u);
+			assert(chunk.owned);
+			if(discard)
+				detail::discard_stack_pages(chunk.base, chunk.size);
+			detail::stack_chunk_cache.release(chunk.base, chunk.size);
+			reserved_ -= chunk.size;
+		}
+		chunks_.erase(chunks_.begin() + first, chunks_.end());
+	}
+
 	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
 	{
 		_assert_invariants();
-		const char* pos = static_cast<const char*>(p);
+		char* pos = static_cast<char*>(p);
 		std::size_t alloc_size = adjusted_size(bytes);
-		assert(is_aligned(pos, alloc_size, max_alignment));
-		assert(std::distance(base_, buffer_.data()) >= alloc_size);
 		assert(
-			pos + alloc_size == buffer_.data()
+			pos + alloc_size == top_
 			and "Attempt to deallocate memory from a StackResource in non FIFO order."
 		);
-		assert((pos < buffer_.data()) or (bytes == 0u));
-		assert(pos >= base_);
-		buffer_ = gsl::span<char>(pos, buffer_.size() + alloc_size);
+		top_ = pos;
+		Chunk& chunk = chunks_[current_];
+		assert(chunk.live > 0u);
+		if(--chunk.live == 0u and current_ > 0u)
+			leave_chunk();
 		_assert_invariants();
 	}
 
 	void* do_allocate(std::size_t bytes, std::size_t alignment) override
 	{
 		_assert_invariants();
-		void* pos = buffer_.data();
 		if(alignment > max_alignment)
 			throw BadAlignmentError(alignment);
 		std::size_t alloc_size = adjusted_size(bytes);
-		std::size_t len = buffer_.size();
-		if(buffer.size() < alloc_size)
-			throw StackOverflowError(buffer_.data(), bytes);
-		buffer_ = buffer_.subspan(alloc_size);
+		if(alloc_size > room())
+			enter_chunk(alloc_size);
+		char* pos = top_;
+		top_ += alloc_size;
+		++chunks_[current_].live;
 		_assert_invariants();
 		return pos;
 	}
 
 	void _assert_invariants() const
 	{
-		auto buff_pos = buffer_.data();
-		assert(base_ <= buff_pos);
-		auto allocd = static_cast<std::size_t>(buff_pos - base_);
-		assert(allocd == 0u or is_aligned(base_, allocd, max_alignment));
-		assert(buffer_.size() == 0u or is_aligned(buff_pos, buffer_.size(), max_alignment));
+		assert(current_ < chunks_.size());
+		const Chunk& chunk = chunks_[current_];
+		assert(chunk.base <= top_);
+		assert(top_ <= chunk.base + chunk.size);
+		assert(is_aligned(top_, 1u, max_alignment));
 	}
 	
-	bool do_is_equal(const pmr::memory_resource& other) const override
+	bool do_is_equal(const pmr::memory_resource& other) const noexcept override
 	{
 		if(this == &other)
 			return true;
@@ -187,11 +477,16 @@ private:
 	}
 
 private:
-	char* const base_;
-	gsl::span<char> buffer_;
+	const Options opts_;
+	/// From the bottom of the stack up.  Chunks above 'current_' are empty.
+	std::vector<Chunk> chunks_;
+	std::size_t current_ = 0;
+	/// The next free byte of the current chunk.
+	char* top_ = nullptr;
+	/// Total size of 'chunks_'.
+	std::size_t reserved_ = 0;
 };
 
-
 template <class T>
 struct SimpleStack
 {
@@ -278,6 +573,24 @@ struct SimpleStack
 	void push(T&& value)
 	{ emplace(std::move(value)); }
 
+	/// Whether pushing 'n' values leaves the stack where it is, rather than
+	/// moving it to another chunk of its resource.
+	bool can_push_in_place(size_type n) const
+	{ return resource_.can_expand_in_place(base_, size() * sizeof(T), (size() + n) * sizeof(T)); }
+
+	/// Push copies of the 'n' values at 'first' with a single block copy.
+	/// 'first' must not point into this stack, but may point into storage
+	/// just released above it, such as a popped frame's, if the stack
+	/// grows in place (see 'can_push_in_place()').
+	void push_range(const_pointer first, size_type n)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		if(n == 0u)
+			return;
+		alloc_n(n);
+		std::memmove(base_ + (size() - n), first, n * sizeof(T));
+	}
+
 	template <class ... Args>
 	reference emplace(Args&& ... args)
 	{
@@ -300,7 +613,7 @@ struct SimpleStack
 	{
 		assert(not empty());
 		auto v = top();
-		pop(1u);
+		pop_n(1u);
 		return v;
 	}
 
@@ -381,8 +694,10 @@ private:
 	void alloc_n(std::size_t n)
 	{
 		assert(n > 0u);
-		T* pos = static_cast<T*>(resource_.expand(base_, sizeof(T) * n, alignof(T)));
-		assert(pos == base_);
+		// the stack moves if it outgrows its chunk.
+		T* pos = static_cast<T*>(
+			resource_.expand(base_, count_ * sizeof(T), (count_ + n) * sizeof(T), alignof(T))
+		);
 		base_ = pos;
 		count_ += n;
 	}
@@ -391,7 +706,7 @@ private:
 	{
 		assert(n > 0u);
 		assert(count_ >= n);
-		T* pos = static_cast<T*>(resource_.contract(base_, n * sizeof(T), alignof(T)));
+		T* pos = static_cast<T*>(resource_.contract(base_, count_ * sizeof(T), (count_ - n) * sizeof(T)));
 		base_ = pos;
 		count_ -= n;
 	}
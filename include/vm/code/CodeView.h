@@ -61,6 +61,18 @@ std::pair<T, It> read_serialized_immediate(It first, It last)
 	return std::make_pair(value, first);
 }
 
+/// Read a lowered block type: the type byte, plus the type index if it is 'LanguageType::func'.
+template <class It>
+[[gnu::pure]]
+std::pair<BlockType, It> read_block_type(It first, It last)
+{
+	assert(first != last);
+	BlockType tp{static_cast<LanguageType>(*first++), 0u};
+	if(tp.is_indexed())
+		std::tie(tp.type_index, first) = read_serialized_immediate<wasm_uint32_t>(first, last);
+	return std::make_pair(tp, first);
+}
+
 } /* namespace detail */
 
 struct BadOpcodeError:
@@ -123,27 +135,35 @@ decltype(auto) visit_opcode(Visitor visitor, It first, It last)
 	}
 	else if(
 		(op >= OpCode::GET_LOCAL and op <= OpCode::SET_GLOBAL)
-		or (op == OpCode::CALL or op == OpCode::CALL_INDIRECT)
+		or (op == OpCode::CALL or op == OpCode::RETURN_CALL)
 		or (op == OpCode::BR or op == OpCode::BR_IF)
 		or (op == OpCode::ELSE)
+		or (op == OpCode::FUEL)
 	)
 	{
 		wasm_uint32_t value;
 		std::tie(value, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
 		return visitor(first, last, pos, op, value);
 	}
+	else if(op == OpCode::CALL_INDIRECT or op == OpCode::RETURN_CALL_INDIRECT)
+	{
+		wasm_uint32_t type_idx, slot;
+		std::tie(type_idx, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		std::tie(slot, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
+		return visitor(first, last, pos, op, CallIndirectImmediate(type_idx, slot));
+	}
 	else if(op == OpCode::BLOCK or op == OpCode::IF)
 	{
-		assert(first != last);
-		LanguageType tp = static_cast<LanguageType>(*first++);
+		BlockType tp;
+		std::tie(tp, pos) = detail::read_block_type(pos, last);
 		wasm_uint32_t label;
 		std::tie(label, pos) = detail::read_serialized_immediate<wasm_uint32_t>(pos, last);
 		return visitor(first, last, pos, op, tp, label);
 	}
 	else if(op == OpCode::LOOP)
 	{
-		assert(first != last);
-		LanguageType tp = static_cast<LanguageType>(*first++);
+		BlockType tp;
+		std::tie(tp, pos) = detail::read_block_type(pos, last);
 		return visitor(first, last, pos, op, tp);
 	}
 	else if(op == OpCode::BR_TABLE)
@@ -200,16 +220,13 @@ wasm_uint32_t offset(const MemoryImmediate& immed)
 { return immed.second; }
 
 struct BlockImmediate:
-	public std::pair<const LanguageType, const wasm_uint32_t>
+	public std::pair<const BlockType, const wasm_uint32_t>
 {
-	using std::pair<const LanguageType, const wasm_uint32_t>::pair;
+	using std::pair<const BlockType, const wasm_uint32_t>::pair;
 };
 
-gsl::span<const LanguageType> signature(const BlockImmediate& immed)
-{ return gsl::span<const LanguageType>(&(immed.first), 1u); }
-
-std::size_t arity(const BlockImmediate& immed)
-{ return signature(immed).size(); }
+const BlockType& block_type(const BlockImmediate& immed)
+{ return immed.first; }
 
 wasm_uint32_t offset(const BlockImmediate& immed)
 { return immed.second; }
@@ -293,7 +310,7 @@ private:
 		{ return WasmInstruction(view, op, last, std::forward<T>(arg)); }
 
 		/// Loop overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, LanguageType tp)
+		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, BlockType tp)
 		{ return WasmInstruction(view, op, last, tp); }
 
 		/// Branch table overload
@@ -311,13 +328,17 @@ private:
 		}
 
 		/// Block overload
-		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, LanguageType tp, wasm_uint32_t label)
+		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, BlockType tp, wasm_uint32_t label)
 		{ return WasmInstruction(view, op, last, BlockImmediate(tp, label)); }
 
 		/// Memory overload
 		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, wasm_uint32_t flags, wasm_uint32_t offset)
 		{ return WasmInstruction(view, op, last, MemoryImmediate(flags, offset)); }
 
+		/// Call indirect overload
+		WasmInstruction make_instr(std::string_view view, OpCode op, const char* last, CallIndirectImmediate immed)
+		{ return WasmInstruction(view, op, last, immed); }
+
 		/// Invalid opcode overload
 		[[noreturn]]
 		WasmInstruction make_instr(std::string_view, OpCode, const char*, const BadOpCodeError& err)
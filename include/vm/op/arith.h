@@ -6,6 +6,8 @@
 #include <sstream>
 #include <cmath>
 #include <cfenv>
+#include <climits>
+#include <limits>
 #include "vm/op/errors.h"
 
 namespace wasm::ops::arith {
@@ -145,31 +147,25 @@ inline const auto i64_div_u = [](wasm_sint64_t l, wasm_sint64_t r) -> wasm_sint6
 };
 
 inline const auto i32_rem_s = [](wasm_sint32_t l, wasm_sint32_t r) -> wasm_sint32_t {
-	try
-	{
-		wasm_sint32_t quot = i32_div_s(l, r);
-		return to_signed(
-			to_unsigned(l) - to_unsigned(quot) * to_unsigned(r)
-		);
-	}
-	catch(const OverflowError&)
-	{
+	ensure_nonzero(r);
+	// the remainder of dividing by -1 is 0, even where the quotient overflows.
+	if(r == -1)
 		return 0;
-	}
+	wasm_sint32_t quot = i32_div_s(l, r);
+	return to_signed(
+		to_unsigned(l) - to_unsigned(quot) * to_unsigned(r)
+	);
 };
 
 inline const auto i64_rem_s = [](wasm_sint64_t l, wasm_sint64_t r) -> wasm_sint64_t {
-	try
-	{
-		wasm_sint64_t quot = i64_div_s(l, r);
-		return to_signed(
-			to_unsigned(l) - to_unsigned(quot) * to_unsigned(r)
-		);
-	}
-	catch(const OverflowError&)
-	{
+	ensure_nonzero(r);
+	// the remainder of dividing by -1 is 0, even where the quotient overflows.
+	if(r == -1)
 		return 0;
-	}
+	wasm_sint64_t quot = i64_div_s(l, r);
+	return to_signed(
+		to_unsigned(l) - to_unsigned(quot) * to_unsigned(r)
+	);
 };
 
 inline const auto i32_rem_u = [](wasm_sint32_t l, wasm_sint32_t r) -> wasm_sint32_t {
@@ -181,6 +177,28 @@ inline const auto i64_rem_u = [](wasm_sint64_t l, wasm_sint64_t r) -> wasm_sint6
 	return to_signed(to_unsigned(l) % to_unsigned(r));
 };
 
+/// @name Trap checks
+/// Trap-free handlers check an operation's operands before applying it.  An
+/// operation whose operands pass its check doesn't throw.
+/// @{
+
+template <class Integer>
+TrapCode check_div_s(Integer l, Integer r)
+{
+	if(r == Integer(0))
+		return TrapCode::division_by_zero;
+	if(r == Integer(-1) and l == std::numeric_limits<Integer>::min())
+		return TrapCode::integer_overflow;
+	return TrapCode::none;
+}
+
+/// Unsigned division and both remainders only trap on a zero divisor.
+template <class Integer>
+TrapCode check_divisor(Integer, Integer r)
+{ return (r == Integer(0)) ? TrapCode::division_by_zero : TrapCode::none; }
+
+/// @}
+
 inline const auto i32_and = std::bit_and<wasm_int32_t>{};
 inline const auto i64_and = std::bit_and<wasm_int64_t>{};
 
@@ -552,42 +570,38 @@ inline const auto i64_extend_u_i32 = [](wasm_sint32_t value) {
 	return to_signed(wasm_uint64_t(to_unsigned(value)));
 };
 
-namespace detail {
-
-template <class Integral>
-inline const auto truncate_checked = [](auto value) {
-	static_assert(std::is_floating_point_v<decltype(value)>);
+/// Trap check of float-to-integer truncation: 'value' truncated toward zero
+/// must be representable as an 'Integral'.
+template <class Integral, class Float>
+TrapCode check_truncate(Float value)
+{
+	static_assert(std::is_floating_point_v<Float>);
 	static_assert(std::is_integral_v<Integral>);
-	using float_type = decltype(value);
-	static constexpr const std::size_t bit_count = CHAR_BIT * sizeof(value);
+	constexpr const int bit_count = CHAR_BIT * sizeof(Integral);
 	if(std::isnan(value) or std::isinf(value))
-		throw BadTruncation();
+		return TrapCode::bad_truncation;
+	Float truncated = std::trunc(value);
 	if constexpr(std::is_signed_v<Integral>)
 	{
-		const float_type minm = -std::exp2(float_type(bit_count - 1)) - 1;
-		const float_type maxm = std::exp2(float_type(bit_count - 1));
-		if(value > minm and value < maxm)
-		{
-			std::make_unsigned_t<Integral> abs_val = std::fabs(truncated);
-			assert(static_cast<float_type>(abs_val) == truncated);
-			if(std::signbit(truncated))
-				abs_val = (~abs_val) + 1u;
-			return reinterpret_cast<const Integral&>(abs_val);
-		}
-		throw BadTruncation();
+		const Float limit = std::exp2(Float(bit_count - 1));
+		if(truncated < -limit or truncated >= limit)
+			return TrapCode::bad_truncation;
 	}
 	else
 	{
-		const float_type minm = -1;
-		const float_type maxm = std::exp2(float_type(bit_count));
-		if(truncated > minm and truncated < maxm)
-		{
-			auto result = static_cast<Integral>(truncated);
-			assert(static_cast<float_type>(result) == truncated);
-			return result;
-		}
-		throw BadTruncation();
+		if(truncated <= Float(-1) or truncated >= std::exp2(Float(bit_count)))
+			return TrapCode::bad_truncation;
 	}
+	return TrapCode::none;
+}
+
+namespace detail {
+
+template <class Integral>
+inline const auto truncate_checked = [](auto value) {
+	if(check_truncate<Integral>(value) != TrapCode::none)
+		throw BadTruncation();
+	return static_cast<Integral>(value);
 };
 
 } /* namespace detail */
@@ -2,6 +2,7 @@
 #define VM_OP_ERRORS_H
 
 #include <stdexcept>
+#include <cassert>
 
 namespace wasm::ops {
 
@@ -34,16 +35,133 @@ struct UnreachableError:
 	using TrapError::TrapError;
 };
 
+struct TableAccessError:
+	public TrapError
+{
+	TableAccessError():
+		TrapError("Trap: out-of-bounds table access.")
+	{
+		
+	}
+};
+
 struct BadTruncation:
 	public TrapError
 {
-	DivisionByZeroError():
+	BadTruncation():
 		TrapError("Trap: out-of-range value in float-to-integer truncation")
 	{
 		
 	}
 };
 
+struct MemoryAccessError:
+	public TrapError
+{
+	MemoryAccessError():
+		TrapError("Trap: out-of-bounds linear memory access.")
+	{
+		
+	}
+};
+
+/// A guest stopped by the host (see 'CallStack::interrupt()').
+struct InterruptedError:
+	public TrapError
+{
+	InterruptedError():
+		TrapError("Trap: guest interrupted.")
+	{
+		
+	}
+};
+
+/// A metered guest that ran out of fuel (see 'CallStack::set_fuel()').
+struct OutOfFuelError:
+	public TrapError
+{
+	OutOfFuelError():
+		TrapError("Trap: out of fuel.")
+	{
+		
+	}
+};
+
+/// Traps raised inside the engine.  Instruction handlers record a trap code
+/// on the call stack instead of throwing; the code is turned into one of the
+/// exceptions above only at the embedding API boundary, by 'throw_trap()'.
+enum class TrapCode: unsigned char
+{
+	none = 0,
+	unreachable,
+	division_by_zero,
+	integer_overflow,
+	bad_truncation,
+	memory_access,
+	table_access,
+	null_table_function,
+	bad_table_function_signature,
+	interrupted,
+	out_of_fuel
+};
+
+inline const char* trap_message(TrapCode code)
+{
+	switch(code)
+	{
+	case TrapCode::none:
+		return "No trap.";
+	case TrapCode::unreachable:
+		return "Trap: unreachable instruction executed.";
+	case TrapCode::division_by_zero:
+		return "Trap: attemped division by zero.";
+	case TrapCode::integer_overflow:
+		return "Trap: integer overflow.";
+	case TrapCode::bad_truncation:
+		return "Trap: out-of-range value in float-to-integer truncation";
+	case TrapCode::memory_access:
+		return "Trap: out-of-bounds linear memory access.";
+	case TrapCode::table_access:
+		return "Trap: out-of-bounds table access.";
+	case TrapCode::null_table_function:
+		return "Trap: indirect call to an empty table element.";
+	case TrapCode::bad_table_function_signature:
+		return "Trap: indirect call signature mismatch.";
+	case TrapCode::interrupted:
+		return "Trap: guest interrupted.";
+	case TrapCode::out_of_fuel:
+		return "Trap: out of fuel.";
+	}
+	return "Trap: unknown trap code.";
+}
+
+[[noreturn]]
+inline void throw_trap(TrapCode code)
+{
+	assert(code != TrapCode::none);
+	switch(code)
+	{
+	case TrapCode::unreachable:
+		throw UnreachableError(trap_message(code));
+	case TrapCode::division_by_zero:
+		throw DivisionByZeroError();
+	case TrapCode::integer_overflow:
+		throw OverflowError(trap_message(code));
+	case TrapCode::bad_truncation:
+		throw BadTruncation();
+	case TrapCode::memory_access:
+		throw MemoryAccessError();
+	case TrapCode::table_access:
+		throw TableAccessError();
+	case TrapCode::interrupted:
+		throw InterruptedError();
+	case TrapCode::out_of_fuel:
+		throw OutOfFuelError();
+	default:
+		throw TrapError(trap_message(code));
+	}
+}
+
 } /* namespace wasm::ops */
 
 #endif /* VM_OP_ERRORS_H */
@@ -5,6 +5,7 @@
 #include "wasm_value.h"
 #include "WasmInstruction.h"
 #include "utilities/bit_cast.h"
+#include "vm/op/errors.h"
 #include <functional>
 
 namespace wasm::opc {
@@ -21,16 +22,6 @@ struct UnreachableError:
 	using TrapError::TrapError;
 };
 
-struct BadStackAccessError:
-	public ValidationError
-{
-	BadStackAccessError():
-		ValidationError("Attempt to access out-of-bounds value on the stack.")
-	{
-		
-	}
-};
-
 
 template <class Results, class Params>
 struct OpSignature {
@@ -98,6 +89,49 @@ auto make_unary_op(
 };
 
 
+/// Like 'make_binary_op()', for operations that can trap.  The operands
+/// are passed to 'check' first; if it returns a trap code, the trap is
+/// recorded on the call stack and the operands are left in place.
+template <class Check, class Binop, class Result, class Left, class Right>
+inline const auto make_checked_binary_op(
+	Check check,
+	Binop binop,
+	Result WasmValue::* result_p,
+	Left WasmValue::* left_p,
+	Right WasmValue::* right_p
+)
+{
+	static_assert(std::is_same_v<std::invoke_result_t<Check, Left, Right>, ops::TrapCode>);
+	return [=](auto& call_stack, WasmModule&, auto&, const CodeView& after, auto&) -> CodeView {
+		auto& frame = call_stack.top_frame();
+		auto [left, right] = frame.stack_top_2(left_p, right_p);
+		if(ops::TrapCode code = check(left, right); code != ops::TrapCode::none)
+			return call_stack.trap(code, after);
+		frame.stack_pop_2_push_1(result_p, binop(left, right));
+		return after;
+	};
+};
+
+/// Like 'make_unary_op()', for operations that can trap.
+template <class Check, class Unop, class Result, class Input>
+auto make_checked_unary_op(
+	Check check,
+	Unop unop,
+	Result WasmValue::* result_p,
+	Input WasmValue::* input_p
+)
+{
+	static_assert(std::is_same_v<std::invoke_result_t<Check, Input>, ops::TrapCode>);
+	return [=](auto& call_stack, WasmModule&, auto&, const CodeView& after, auto&) -> CodeView {
+		auto& frame = call_stack.top_frame();
+		auto input = frame.stack_top(input_p);
+		if(ops::TrapCode code = check(input); code != ops::TrapCode::none)
+			return call_stack.trap(code, after);
+		frame.stack_pop_1_push_1(result_p, unop(input));
+		return after;
+	};
+};
+
 template <class Function>
 struct NoDiscard {
 
@@ -151,30 +185,35 @@ inline const auto op_func<OpCode::NOP> = [](){ return;	};
 
 template <>
 inline const auto op_func<OpCode::UNREACHABLE>
-	= []() { throw UnreachableError(); };
+	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, std::monostate) -> CodeView
+{
+	return call_stack.trap(ops::TrapCode::unreachable, after);
+};
 
 template <>
 inline const auto op_func<OpCode::BLOCK>
-	= [](auto& call_stack, WasmModule&, const CodeView& pos, const CodeView& after, const BlockImmediate& immed) -> CodeView
+	= [](auto& call_stack, WasmModule& module, const CodeView& pos, const CodeView& after, const BlockImmediate& immed) -> CodeView
 {
-	auto sig = signature(immed);
+	auto [params, results] = module.block_signature(block_type(immed));
 	auto offset = offset(immed);
 	assert(offset > 0u);
-	call_stack.top_frame().push_block(pos.jump(offset), sig);
+	call_stack.top_frame().push_block(pos.jump(offset), params.size(), results);
 	return after;
 };
 
 template <>
 inline const auto op_func<OpCode::LOOP>
-	= [](auto& call_stack, WasmModule&, const CodeView& pos, const CodeView& after, LanguageType immed) -> CodeView
+	= [](auto& call_stack, WasmModule& module, const CodeView& pos, const CodeView& after, const BlockType& immed) -> CodeView
 {
-	call_stack.top_frame().push_block(after, sig);
+	auto [params, results] = module.block_signature(immed);
+	// branches to the loop re-execute this instruction
+	call_stack.top_frame().push_loop(pos, params.size(), results);
 	return after;
 };
 
 template <>
 inline const auto op_func<OpCode::IF>
-	= [](auto& call_stack, WasmModule&, const CodeView& pos, const CodeView& after, const IfImmediate& immed) -> CodeView
+	= [](auto& call_stack, WasmModule& module, const CodeView& pos, const CodeView& after, const IfImmediate& immed) -> CodeView
 		-> CodeView
 {
 	auto& frame = call_stack.top_frame();
@@ -182,17 +221,18 @@ inline const auto op_func<OpCode::IF>
 	assert(instr.opcode() == static_cast<char>(OpCode::IF));
 	// CodeView starting at the END opcode for this if block
 	auto end_pos = pos.jump(end_offset(immed));
-	auto sig = signature(immed);
+	auto [params, results] = module.block_signature(block_type(immed));
+	frame.stack_pop();
 	if(static_cast<bool>(condition))
 	{
 		// push the IF block
-		frame.push_block(end_pos, sig);
+		frame.push_block(end_pos, params.size(), results);
 		return after;
 	}
 	else
 	{
 		assert(else_offset(immed) != 0u);
-		frame.push_block(end_pos, sig);
+		frame.push_block(end_pos, params.size(), results);
 		// CodeView starting just after the ELSE opcode for this if block
 		return pos.jump(else_offset(immed));
 	}
@@ -210,16 +250,16 @@ inline const auto op_func<OpCode::END>
 	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, std::monostate) -> CodeView
 {
 	if(after.size() == 0u)
-		return call_stack.return_from_frame();
-	else
-		return call_stack.top_frame().branch_top();
+		return call_stack.return_from_function();
+	call_stack.top_frame().end_block();
+	return after;
 };
 
 template <>
 inline const auto op_func<OpCode::BR>
 	= [](auto& call_stack, WasmModule&, const auto&, const CodeView&, wasm_uint32_t depth) -> CodeView
 {
-	return call_stack.top_frame().branch_depth(depth);
+	return call_stack.branch(depth);
 };
 
 template <>
@@ -228,12 +268,9 @@ inline const auto op_func<OpCode::BR_IF>
 {
 	auto& frame = call_stack.top_frame();
 	wasm_uint32_t cond = reinterpret_cast<const wasm_uint32_t&>(frame_stack_top(tp::i32));
-	auto tmp = frame.stack_pop();
+	frame.stack_pop();
 	if(static_cast<bool>(cond))
-	{
-		auto guard_ = make_scope_guard([&](){ frame.stack_emplace_top(tmp); });
-		return frame.branch_depth(depth);
-	}
+		return call_stack.branch(depth);
 	return after;
 };
 
@@ -244,32 +281,57 @@ inline const auto op_func<OpCode::BR_TABLE>
 	auto& frame = call_stack.top_frame();
 	wasm_uint32_t index = reinterpret_cast<const wasm_uint32_t&>(frame.stack_top(tp::i32));
 	wasm_uint32_t depth = table.at(index);
-	auto tmp = frame.stack_pop();
-	auto guard_ = make_scope_guard([&](){ frame.stack_emplace_top(tmp); });
-	return frame.branch_depth(depth);
+	frame.stack_pop();
+	return call_stack.branch(depth);
 };
 
 template <>
 inline const auto op_func<OpCode::RETURN>
 	= [](auto& call_stack, WasmModule&, const auto&, const CodeView&, std::monostate) -> CodeView
 {
-	return call_stack.return_from_frame();
+	return call_stack.return_from_function();
 }
 
+/// Fuel Metering
+template <>
+inline const auto op_func<OpCode::FUEL>
+	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, wasm_uint32_t cost) -> CodeView
+{
+	return call_stack.charge_fuel(cost, after);
+};
+
 /// Function Calls
 template <>
 inline const auto op_func<OpCode::CALL>
-	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, wasm_uint32_t index) -> CodeView
+	= [](auto& call_stack, WasmModule& module, const auto& instr, const CodeView&, wasm_uint32_t index) -> CodeView
 {
-	return call_stack.call_function(module.function_at(index), after);
+	return call_stack.call_function(module.callee_at(index), instr);
 };
 
 template <>
 inline const auto op_func<OpCode::CALL_INDIRECT>
-	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, wasm_uint32_t type_index) -> CodeView
+	= [](auto& call_stack, WasmModule& module, const auto& instr, const CodeView&, CallIndirectImmediate immed) -> CodeView
 {
-	call_stack.call_table_function(module.table_at(0), module.type_at(type_index));
-	return after;
+	return call_stack.call_table_function(
+		module.table_at(0), module.type_id_at(type_index(immed)), cache_slot(immed), instr
+	);
+};
+
+/// Tail Calls
+template <>
+inline const auto op_func<OpCode::RETURN_CALL>
+	= [](auto& call_stack, WasmModule& module, const auto& instr, const CodeView&, wasm_uint32_t index) -> CodeView
+{
+	return call_stack.tail_call_function(module.callee_at(index), instr);
+};
+
+template <>
+inline const auto op_func<OpCode::RETURN_CALL_INDIRECT>
+	= [](auto& call_stack, WasmModule& module, const auto& instr, const CodeView&, CallIndirectImmediate immed) -> CodeView
+{
+	return call_stack.tail_call_table_function(
+		module.table_at(0), module.type_id_at(type_index(immed)), cache_slot(immed), instr
+	);
 };
 
 /// Variable Access
@@ -306,8 +368,11 @@ inline const auto op_func<OpCode::GET_GLOBAL>
 	= [](auto& call_stack, WasmModule& module, const auto&, const CodeView& after, wasm_uint32_t global_index) -> CodeView
 {
 	auto& frame = call_stack.top_frame();
-	const auto& g = module.global_at(global_index);
-	frame.stack_emplace_top(static_cast<TaggedWasmValue>(g));
+	using value_type = typename std::decay_t<decltype(frame)>::value_type;
+	if constexpr(std::is_same_v<value_type, WasmValue>)
+		frame.stack_emplace_top(module.global_slot(global_index));
+	else // tagged stack: keep the type tag
+		frame.stack_emplace_top(static_cast<TaggedWasmValue>(module.global_at(global_index)));
 	return after;
 };
 
@@ -316,8 +381,7 @@ inline const auto op_func<OpCode::SET_GLOBAL>
 	= [](auto& call_stack, WasmModule& module, const auto&, const CodeView& after, wasm_uint32_t global_index) -> CodeView
 {
 	auto& frame = call_stack.top_frame();
-	auto& g = module.global_at(global_index);
-	set(g, frame.stack_top());
+	module.global_slot(global_index) = static_cast<WasmValue>(frame.stack_top());
 	frame.stack_pop();
 	return after;
 };
@@ -328,10 +392,7 @@ inline const auto op_func<OpCode::SELECT>
 	= [](auto& call_stack, WasmModule&, const auto&, const CodeView& after, std::monostate) -> CodeView 
 {
 	auto& frame = call_stack.top_frame();
-	// throw early so that the erroneous state of the stack can be inspected
-	// for debugging purposes.
-	if(frame.stack_size() < 3u)
-		BadStackAccess();
+	assert(frame.stack_size() >= 3u);
 	auto cond = frame.stack_pop(tp::i32);
 	auto alt = frame.stack_pop();
 	if(not cond)
@@ -402,7 +463,7 @@ auto memory_op(Member member, Convert convert = idendity) {
 		[[maybe_unused]] auto pos,
 		const CodeView& after,
 		const MemoryImmediate& immed
-	)
+	) -> CodeView
 	{
 		auto& frame = call_stack.top_frame();
 		wasm_uint32_t offset = offset(immed);
@@ -411,17 +472,22 @@ auto memory_op(Member member, Convert convert = idendity) {
 		if constexpr(LoadStore == LoadStoreOp::LOAD)
 		{
 			wasm_uint32_t base = reinterpret_cast<const wasm_uint32_t&>(frame.stack_top(tp::i32_c));
+			if(not access_in_bounds(mem, base, offset, sizeof(StoredType)))
+				return call_stack.trap(ops::TrapCode::memory_access, after);
 			StoredType value = load_little_endian<StoredType>(mem, base, offset);
 			frame.stack_pop_1_push_1(member, convert(value));
 		}
 		else
 		{
 			static_assert(LoadStore == LoadStoreOp::STORE);
-			const auto& [base, value] = frame.stack_top_2(tp::i32_c, member);
+			const auto& [address, value] = frame.stack_top_2(tp::i32_c, member);
+			wasm_uint32_t base = reinterpret_cast<const wasm_uint32_t&>(address);
+			if(not access_in_bounds(mem, base, offset, sizeof(StoredType)))
+				return call_stack.trap(ops::TrapCode::memory_access, after);
 			StoredType converted_value = convert(value);
-			wasm_uint32_t base = reinterpret_cast<const wasm_uint32_t&>(base);
 			store_little_endian<StoredType>(mem, base, offset, converted_value);
 		}
+		return after;
 	};
 }
 
@@ -595,19 +661,27 @@ inline const auto op_func<OpCode::I32_MUL>
 
 template <>
 inline const auto op_func<OpCode::I32_DIV_S>
-	= detail::make_binary_op(arith::i32_div_s, tp::i32, tp::i32_c, tp::i32_c);
+	= detail::make_checked_binary_op(
+		arith::check_div_s<wasm_sint32_t>, arith::i32_div_s, tp::i32, tp::i32_c, tp::i32_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I32_DIV_U>
-	= detail::make_binary_op(arith::i32_div_u, tp::i32, tp::i32_c, tp::i32_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint32_t>, arith::i32_div_u, tp::i32, tp::i32_c, tp::i32_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I32_REM_S>
-	= detail::make_binary_op(arith::i32_rem_s, tp::i32, tp::i32_c, tp::i32_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint32_t>, arith::i32_rem_s, tp::i32, tp::i32_c, tp::i32_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I32_REM_U>
-	= detail::make_binary_op(arith::i32_rem_u, tp::i32, tp::i32_c, tp::i32_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint32_t>, arith::i32_rem_u, tp::i32, tp::i32_c, tp::i32_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I32_AND>
@@ -698,19 +772,27 @@ inline const auto op_func<OpCode::I64_MUL>
 
 template <>
 inline const auto op_func<OpCode::I64_DIV_S>
-	= detail::make_binary_op(arith::i64_div_s, tp::i64, tp::i64_c, tp::i64_c);
+	= detail::make_checked_binary_op(
+		arith::check_div_s<wasm_sint64_t>, arith::i64_div_s, tp::i64, tp::i64_c, tp::i64_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I64_DIV_U>
-	= detail::make_binary_op(arith::i64_div_u, tp::i64, tp::i64_c, tp::i64_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint64_t>, arith::i64_div_u, tp::i64, tp::i64_c, tp::i64_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I64_REM_S>
-	= detail::make_binary_op(arith::i64_rem_s, tp::i64, tp::i64_c, tp::i64_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint64_t>, arith::i64_rem_s, tp::i64, tp::i64_c, tp::i64_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I64_REM_U>
-	= detail::make_binary_op(arith::i64_rem_u, tp::i64, tp::i64_c, tp::i64_c);
+	= detail::make_checked_binary_op(
+		arith::check_divisor<wasm_sint64_t>, arith::i64_rem_u, tp::i64, tp::i64_c, tp::i64_c
+	);
 
 template <>
 inline const auto op_func<OpCode::I64_AND>
@@ -939,79 +1021,95 @@ inline const auto op_func<OpCode::F64_GE>
 
 // truncate signed
 template <>
-inline const auto op_func<OpCode::I32_TRUNC_S_F32>
-	= detail::make_unary_op(arith::i32_trunc_s_f32, tp::i32, tp::f32_c);
+inline const auto op_func<OpCode::I32_TRUNC_F32_S>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_sint32_t, wasm_float32_t>, arith::i32_trunc_s_f32, tp::i32, tp::f32_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I32_TRUNC_S_F64>
-	= detail::make_unary_op(arith::i32_trunc_s_f64, tp::i32, tp::f64_c);
+inline const auto op_func<OpCode::I32_TRUNC_F64_S>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_sint32_t, wasm_float64_t>, arith::i32_trunc_s_f64, tp::i32, tp::f64_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I64_TRUNC_S_F32>
-	= detail::make_unary_op(arith::i64_trunc_s_f32, tp::i64, tp::f32_c);
+inline const auto op_func<OpCode::I64_TRUNC_F32_S>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_sint64_t, wasm_float32_t>, arith::i64_trunc_s_f32, tp::i64, tp::f32_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I64_TRUNC_S_F64>
-	= detail::make_unary_op(arith::i64_trunc_s_f64, tp::i64, tp::f64_c);
+inline const auto op_func<OpCode::I64_TRUNC_F64_S>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_sint64_t, wasm_float64_t>, arith::i64_trunc_s_f64, tp::i64, tp::f64_c
+	);
 
 // truncate unsigned
 template <>
-inline const auto op_func<OpCode::I32_TRUNC_U_F32>
-	= detail::make_unary_op(arith::i32_trunc_u_f32, tp::i32, tp::f32_c);
+inline const auto op_func<OpCode::I32_TRUNC_F32_U>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_uint32_t, wasm_float32_t>, arith::i32_trunc_u_f32, tp::i32, tp::f32_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I32_TRUNC_U_F64>
-	= detail::make_unary_op(arith::i32_trunc_u_f64, tp::i32, tp::f64_c);
+inline const auto op_func<OpCode::I32_TRUNC_F64_U>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_uint32_t, wasm_float64_t>, arith::i32_trunc_u_f64, tp::i32, tp::f64_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I64_TRUNC_U_F32>
-	= detail::make_unary_op(arith::i64_trunc_u_f32, tp::i64, tp::f32_c);
+inline const auto op_func<OpCode::I64_TRUNC_F32_U>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_uint64_t, wasm_float32_t>, arith::i64_trunc_u_f32, tp::i64, tp::f32_c
+	);
 
 template <>
-inline const auto op_func<OpCode::I64_TRUNC_U_F64>
-	= detail::make_unary_op(arith::i64_trunc_u_f64, tp::i64, tp::f64_c);
+inline const auto op_func<OpCode::I64_TRUNC_F64_U>
+	= detail::make_checked_unary_op(
+		arith::check_truncate<wasm_uint64_t, wasm_float64_t>, arith::i64_trunc_u_f64, tp::i64, tp::f64_c
+	);
 
 // promote/demote
 template <>
-inline const auto op_func<OpCode::F32_DEMOTE_F64>
+inline const auto op_func<OpCode::F32_DEMOTE>
 	= detail::make_unary_op(arith::f32_demote_f64, tp::f32, tp::f32_c);
 
 template <>
-inline const auto op_func<OpCode::F64_PROMOTE_F32>
+inline const auto op_func<OpCode::F64_PROMOTE>
 	= detail::make_unary_op(arith::f64_promote_f32, tp::f64, tp::f32_c);
 
 // signed int-to-float conversions
 template <>
-inline const auto op_func<OpCode::F32_CONVERT_S_I32>
+inline const auto op_func<OpCode::F32_CONVERT_I32_S>
 	= detail::make_unary_op(arith::f32_convert_s_i32, tp::f32, tp::i32_c);
 
 template <>
-inline const auto op_func<OpCode::F32_CONVERT_S_I64>
+inline const auto op_func<OpCode::F32_CONVERT_I64_S>
 	= detail::make_unary_op(arith::f32_convert_s_i64, tp::f32, tp::i64_c);
 
 template <>
-inline const auto op_func<OpCode::F64_CONVERT_S_I32>
+inline const auto op_func<OpCode::F64_CONVERT_I32_S>
 	= detail::make_unary_op(arith::f64_convert_s_i32, tp::f64, tp::i32_c);
 
 template <>
-inline const auto op_func<OpCode::F64_CONVERT_S_I64>
+inline const auto op_func<OpCode::F64_CONVERT_I64_S>
 	= detail::make_unary_op(arith::f64_convert_s_i64, tp::f64, tp::i64_c);
 
 // unsigned int-to-float conversions
 template <>
-inline const auto op_func<OpCode::F32_CONVERT_U_I32>
+inline const auto op_func<OpCode::F32_CONVERT_I32_U>
 	= detail::make_unary_op(arith::f32_convert_u_i32, tp::f32, tp::i32_c);
 
 template <>
-inline const auto op_func<OpCode::F32_CONVERT_U_I64>
+inline const auto op_func<OpCode::F32_CONVERT_I64_U>
 	= detail::make_unary_op(arith::f32_convert_u_i64, tp::f32, tp::i64_c);
 
 template <>
-inline const auto op_func<OpCode::F64_CONVERT_U_I32>
+inline const auto op_func<OpCode::F64_CONVERT_I32_U>
 	= detail::make_unary_op(arith::f64_convert_u_i32, tp::f64, tp::i32_c);
 
 template <>
-inline const auto op_func<OpCode::F64_CONVERT_U_I64>
+inline const auto op_func<OpCode::F64_CONVERT_I64_U>
 	= detail::make_unary_op(arith::f64_convert_u_i64, tp::f64, tp::i64_c);
 
 
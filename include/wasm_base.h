@@ -5,8 +5,11 @@
 #include <cassert>
 #include <cstdint>
 #include <climits>
+#include <cstring>
 #include <limits>
 #include <array>
+#include <ostream>
+#include <type_traits>
 
 namespace wasm {
 
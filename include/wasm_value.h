@@ -3,6 +3,11 @@
 
 #include "wasm_base.h"
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
 
 namespace wasm {
 
@@ -15,13 +20,8 @@ typedef double 	       wasm_float64_t;
 
 struct WasmValue {
 	
-	WasmValue() = delete;
-
-	WasmValue(const TaggedWasmValue&) = default;
-	WasmValue(TaggedWasmValue&&) = default;
-
-	WasmValue& operator=(const TaggedWasmValue&) = default;
-	WasmValue& operator=(TaggedWasmValue&&) = default;
+	/// Zero, as any of the member types.
+	WasmValue() = default;
 
 	explicit WasmValue(wasm_sint32_t i32_init):  i32(i32_init) { }
 	explicit WasmValue(wasm_sint64_t i64_init):  i64(i64_init) { }
@@ -30,18 +30,16 @@ struct WasmValue {
 
 	template <class T, class Initializer>
 	WasmValue(T WasmValue::* active_member, Initializer&& init):
-		WasmValue(static_cast<T>(std::forward<Initializer>(init))
+		WasmValue(static_cast<std::remove_const_t<T>>(std::forward<Initializer>(init)))
 	{
 		
 	}
 
 	template <class T>
 	explicit WasmValue(T WasmValue::* active_member):
-		WasmValue(active_member, T(0))
+		WasmValue(active_member, 0)
 	{
-		alignas(alignof(*this)) const char zer[sizeof(*this)] = {0};
-		std::memcpy(this, zer, sizeof(*this));
-		this->*active_member = 0;
+		
 	}
 
 	explicit WasmValue(LanguageType lt)
@@ -106,17 +104,13 @@ std::ostream& operator<<(std::ostream& os, WasmValue value)
 	std::memcpy(&f64, &value, sizeof(f64));
 	os << "Value(";
 	os << "i32 = " << i32;
-	os << ", i64 = " << i32;
+	os << ", i64 = " << i64;
 	os << ", f32 = " << f32;
 	os << ", f64 = " << f64;
 	os << ')';
 	return os;
 }
 
-# ifdef __cplusplus
-
-} /* extern "C" */
-
 namespace tp {
 
 // pointers-to-members for abstraction over member access
@@ -135,7 +129,7 @@ inline constexpr const auto member()
 {
 	using type = std::remove_const_t<T>;
 	static_assert(
-		std::is_same_v<type, std::decay_t<type>
+		std::is_same_v<type, std::decay_t<type>>,
 		"T must be a (possible const) non-reference, non-pointer type in wasm::tp::member<T>()."
 	);
 	static_assert(
@@ -182,15 +176,16 @@ decltype(auto) visit_value_type(Visitor&& vis, LanguageType value_type_v)
 	switch(value_type_v)
 	{
 	case LanguageType::i32:
-		return std::forward<Visitor>(tp::i32);
+		return std::invoke(std::forward<Visitor>(vis), tp::i32);
 	case LanguageType::i64:
-		return std::forward<Visitor>(tp::i64);
+		return std::invoke(std::forward<Visitor>(vis), tp::i64);
 	case LanguageType::f32:
-		return std::forward<Visitor>(tp::f32);
+		return std::invoke(std::forward<Visitor>(vis), tp::f32);
 	case LanguageType::f64:
-		return std::forward<Visitor>(tp::f64);
+		return std::invoke(std::forward<Visitor>(vis), tp::f64);
 	default:
 		assert(false);
+		throw std::invalid_argument("Not a value type.");
 	}
 }
 
@@ -236,25 +231,25 @@ struct TaggedWasmValue {
 
 	template <class T, class Initializer>
 	TaggedWasmValue(T WasmValue::* active_member, Initializer&& init):
-		tag_(language_type_value_v<T>),
-		value_(static_cast<T>(std::forward<Initializer>(init)))
+		tag_(language_type_value_v<std::remove_const_t<T>>),
+		value_(active_member, std::forward<Initializer>(init))
 	{
 		
 	}
 	
 	template <class T>
 	explicit TaggedWasmValue(T WasmValue::* active_member):
-		TaggedWasmValue(active_member, T(0))
-	{ set_zero(); }
+		TaggedWasmValue(active_member, 0)
+	{
+		
+	}
 
+	/// Zero, of type 'lt'.
 	explicit TaggedWasmValue(LanguageType lt):
-		TaggedWasmValue(tp::i64, 0)
+		tag_(lt),
+		value_(lt)
 	{
-		auto visitor = [&](const auto& self, auto p){
-			self.value_.*p = 0;
-		};
-		tp::visit_value_type(visitor, lt);
-		tag_ = lt;
+		
 	}
 
 	template <class T>
@@ -270,34 +265,22 @@ struct TaggedWasmValue {
 	{ return this->value_.*p; }
 
 	template <class T>
-	const T& operator->*(T WasmValue::* p) const
-	{
-		return this->value_.*p;
-	}
+	const T& get(T WasmValue::* p) const
+	{ return this->value_.*p; }
 
 	template <class T>
-	const T& operator->*(const T WasmValue::* p) const
+	const T& get(const T WasmValue::* p) const
 	{ return this->value_.*p; }
 
 	template <class T>
-	T& operator->*(T WasmValue::* p)
+	T& get(T WasmValue::* p)
 	{ return this->value_.*p; }
 
-	
 	explicit operator WasmValue() const
-	{
-		WasmValue v;
-		auto visitor = [&](const auto& self, auto p){
-			v.*p = self.value_.*p;
-		};
-		tp::visit_value_type(visitor, tag());
-		return v;
-	}
+	{ return value_; }
 
-	void set_zero() {
-		constexpr alignas(alignof(value_)) const char buff[sizeof(value_)] = {0};
-		std::memcpy(&value_, buff, sizeof(value_));
-	}
+	void set_zero()
+	{ value_ = WasmValue(); }
 
 	template <class T>
 	constexpr bool holds() const
@@ -348,14 +331,14 @@ struct TaggedWasmValue {
 	friend const T& get(const TaggedWasmValue& self)
 	{
 		self.ensure_holds<std::decay_t<T>>();
-		return self->*tp::member<type>();
+		return self.value_.*tp::member<std::decay_t<T>>();
 	}
 
 	template <class T>
 	friend decltype(auto) get(TaggedWasmValue& self)
 	{
 		self.ensure_holds<std::decay_t<T>>();
-		return self->*tp::member<type>();
+		return self.value_.*tp::member<std::decay_t<T>>();
 	}
 
 	template <class Vis>
@@ -363,7 +346,7 @@ struct TaggedWasmValue {
 	{
 		return tp::visit_value_type(
 			[&](auto WasmValue::* p) -> decltype(auto) {
-				return std::invoke(std::forward<Vis>(vis), self->*p)
+				return std::invoke(std::forward<Vis>(vis), self->*p);
 			},
 			self.tag()
 		);
@@ -374,7 +357,7 @@ struct TaggedWasmValue {
 	{
 		return tp::visit_value_type(
 			[&](auto WasmValue::* p) -> decltype(auto) {
-				return std::invoke(std::forward<Vis>(vis), self->*p)
+				return std::invoke(std::forward<Vis>(vis), self->*p);
 			},
 			self.tag()
 		);
@@ -386,7 +369,7 @@ private:
 };
 
 std::ostream& operator<<(std::ostream& os, const TaggedWasmValue& val)
-{ return visit([](auto v) { return os << v; }, val); }
+{ return visit([&](auto v) -> std::ostream& { return os << v; }, val); }
 
 
 
@@ -0,0 +1,129 @@
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "x3binparse.h"
+#include "store/InstancePool.h"
+
+/*
+ * Exercises 'InstancePool': what a lease writes to its instance's memory,
+ * through guest stores or 'WasmLinearMemory::write_span()', and the pages
+ * it grows the memory by, are gone when the instance is checked out again.
+ */
+
+namespace x3 = boost::spirit::x3;
+
+using wasm::InstancePool;
+using wasm::WasmLinearMemory;
+
+std::string leb128_encode_u(std::uintmax_t value)
+{
+	std::string encoding;
+	do {
+		unsigned char byte = static_cast<unsigned char>(value & 0b0111'1111u);
+		value >>= 7;
+		if(value > 0u)
+			byte |= 0b1000'0000u;
+		encoding.push_back(byte);
+	} while(value > 0u);
+	return encoding;
+}
+
+std::string vec(const std::vector<std::string>& items)
+{
+	std::string encoding = leb128_encode_u(items.size());
+	for(const auto& item: items)
+		encoding += item;
+	return encoding;
+}
+
+std::string bytes(std::initializer_list<int> values)
+{
+	std::string encoding;
+	for(int value: values)
+		encoding.push_back(static_cast<char>(value));
+	return encoding;
+}
+
+std::string section(int id, const std::string& contents)
+{ return bytes({id}) + leb128_encode_u(contents.size()) + contents; }
+
+/// A module with a memory of one page, at most two, holding "hello" at 16.
+std::shared_ptr<const wasm::CompiledModule> compile()
+{
+	std::string contents = bytes({0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00})
+		+ section(5, vec({bytes({0x01, 0x01, 0x02})}))
+		+ section(11, vec({bytes({0x00, 0x41, 0x10, 0x0b}) + vec({"h", "e", "l", "l", "o"})}));
+	wasm::parse::ModuleDef def;
+	auto first = contents.cbegin();
+	bool matched = x3::parse(first, contents.cend(), wasm::parse::validated_module, def);
+	assert(matched and first == contents.cend());
+	return wasm::CompiledModule::compile("pooled.wasm", std::move(def));
+}
+
+std::string bytes_at(const WasmLinearMemory& mem, std::size_t address, std::size_t size)
+{
+	auto mem_data = data(mem);
+	assert(address + size <= mem_data.size());
+	return std::string(mem_data.data() + address, size);
+}
+
+InstancePool::Lease checkout(InstancePool& pool)
+{
+	// released instances are made ready by the pool's thread.
+	InstancePool::Lease lease;
+	while(not (lease = pool.try_checkout()))
+		std::this_thread::yield();
+	return lease;
+}
+
+int main()
+{
+	InstancePool pool(compile(), "pooled", 1u, nullptr);
+	constexpr std::size_t page_size = WasmLinearMemory::page_size;
+	{
+		InstancePool::Lease lease = checkout(pool);
+		// the only instance is leased.
+		assert(not pool.try_checkout());
+		auto& mem = lease->memory_at(0);
+		assert(bytes_at(mem, 16u, 5u) == "hello");
+		// host writes, on the data segment's page and at the end of the page.
+		auto dest = mem.write_span(16u, 5u);
+		std::memcpy(dest.data(), "HELLO", 5u);
+		mem.write_span(page_size - 1u, 1u)[0] = 'x';
+		// a guest store.
+		wasm::store_little_endian<wasm::wasm_sint32_t>(mem, 32u, 0u, wasm::wasm_sint32_t(-1));
+		assert(grow_memory(mem, 1u) == 1);
+		mem.write_span(page_size, 1u)[0] = 'y';
+		assert(bytes_at(mem, 16u, 5u) == "HELLO");
+		std::cout << "instance pool: first lease wrote its memory" << std::endl;
+	}
+	{
+		InstancePool::Lease lease = checkout(pool);
+		const auto& mem = lease->memory_at(0);
+		assert(page_count(mem) == 1u);
+		assert(bytes_at(mem, 16u, 5u) == "hello");
+		assert(bytes_at(mem, 32u, 4u) == std::string(4u, '\0'));
+		assert(bytes_at(mem, page_size - 1u, 1u) == std::string(1u, '\0'));
+		std::cout << "instance pool: second lease sees a reset memory" << std::endl;
+	}
+	// out-of-bounds host writes are refused.
+	{
+		InstancePool::Lease lease = checkout(pool);
+		bool threw = false;
+		try
+		{
+			lease->memory_at(0).write_span(page_size - 2u, 4u);
+		}
+		catch(const std::out_of_range&)
+		{
+			threw = true;
+		}
+		assert(threw);
+	}
+	std::cout << "instance pool: all tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "utilities/PerfectHashMap.h"
+
+/*
+ * Exercises 'PerfectHashMap': every key is found with its own value, with
+ * and without a precomputed hash, and keys that weren't inserted (including
+ * prefixes and extensions of inserted keys) are not.
+ */
+
+static std::vector<std::pair<std::string, unsigned>> make_items(std::size_t count)
+{
+	std::vector<std::pair<std::string, unsigned>> items;
+	for(std::size_t i = 0; i < count; ++i)
+		items.emplace_back("field_" + std::to_string(i * 7919u), static_cast<unsigned>(i));
+	return items;
+}
+
+static void check_map(std::size_t count)
+{
+	auto items = make_items(count);
+	PerfectHashMap<unsigned> map(items.begin(), items.end());
+	assert(map.size() == count);
+	assert(map.empty() == (count == 0u));
+	std::unordered_set<std::string> keys;
+	for(const auto& item: items)
+		keys.insert(item.first);
+	auto is_key = [&](const std::string& key) { return keys.count(key) > 0u; };
+	for(const auto& [key, value]: items)
+	{
+		const unsigned* found = map.find(key);
+		assert(found and *found == value);
+		found = map.find(key, PerfectHashMap<unsigned>::hash(key));
+		assert(found and *found == value);
+		assert(map.contains(key));
+		// near misses, unless they happen to be keys too
+		for(std::string miss: {key + "x", key.substr(0, key.size() - 1u), "x" + key})
+			assert(is_key(miss) or not map.contains(miss));
+	}
+	assert(not map.contains(""));
+	assert(not map.contains("field_1"));
+	assert(not map.contains("field_7918"));
+	assert(not map.contains("no such field"));
+	std::size_t visited = 0;
+	map.for_each([&](std::string_view key, unsigned value) {
+		assert(items.at(value).first == key);
+		++visited;
+	});
+	assert(visited == count);
+}
+
+int main()
+{
+	for(std::size_t count: {0u, 1u, 2u, 3u, 17u, 100u, 1000u, 20000u})
+	{
+		check_map(count);
+		std::cout << "perfect hash: " << count << " keys ok" << std::endl;
+	}
+	// an empty map has no keys, not even the empty one.
+	PerfectHashMap<int> empty;
+	assert(not empty.find(""));
+	// duplicate keys can't be placed.
+	std::vector<std::pair<std::string, int>> dups{{"a", 1}, {"a", 2}};
+	bool threw = false;
+	try
+	{
+		PerfectHashMap<int> bad(dups.begin(), dups.end());
+	}
+	catch(const std::runtime_error&)
+	{
+		threw = true;
+	}
+	assert(threw);
+	std::cout << "perfect hash: all tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "x3binparse.h"
+#include "store/Program.h"
+
+/*
+ * Exercises 'Program': modules added importers first are linked exporters
+ * first, re-exported imports resolve through chains of modules, cycles of
+ * imports link when they can, and every import that can't is reported.
+ */
+
+namespace x3 = boost::spirit::x3;
+
+using wasm::Program;
+using wasm::ProgramLinkError;
+
+constexpr const int i32 = 0x7f;
+
+std::string leb128_encode_u(std::uintmax_t value)
+{
+	std::string encoding;
+	do {
+		unsigned char byte = static_cast<unsigned char>(value & 0b0111'1111u);
+		value >>= 7;
+		if(value > 0u)
+			byte |= 0b1000'0000u;
+		encoding.push_back(byte);
+	} while(value > 0u);
+	return encoding;
+}
+
+std::string vec(const std::vector<std::string>& items)
+{
+	std::string encoding = leb128_encode_u(items.size());
+	for(const auto& item: items)
+		encoding += item;
+	return encoding;
+}
+
+std::string name(const std::string& str)
+{ return leb128_encode_u(str.size()) + str; }
+
+std::string bytes(std::initializer_list<int> values)
+{
+	std::string encoding;
+	for(int value: values)
+		encoding.push_back(static_cast<char>(value));
+	return encoding;
+}
+
+std::string section(int id, const std::string& contents)
+{ return bytes({id}) + leb128_encode_u(contents.size()) + contents; }
+
+/// The parts of a module this test varies: imported functions of type
+/// [] -> [i32], functions of that type defined in the module, and exports
+/// of functions by index (imports first).
+struct ModuleSpec {
+	std::vector<std::pair<std::string, std::string>> imports;
+	std::size_t defined = 0;
+	std::vector<std::pair<std::string, std::uint32_t>> exports;
+};
+
+std::shared_ptr<const wasm::CompiledModule> compile(const std::string& path, const ModuleSpec& spec)
+{
+	std::vector<std::string> imports;
+	for(const auto& [module_name, field_name]: spec.imports)
+		imports.push_back(name(module_name) + name(field_name) + bytes({0x00, 0x00}));
+	std::vector<std::string> functions(spec.defined, leb128_encode_u(0));
+	std::vector<std::string> exports;
+	for(const auto& [field_name, index]: spec.exports)
+		exports.push_back(name(field_name) + bytes({0x00}) + leb128_encode_u(index));
+	// i32.const 7, end
+	std::string body = vec({}) + bytes({0x41, 0x07, 0x0b});
+	std::vector<std::string> bodies(spec.defined, leb128_encode_u(body.size()) + body);
+	std::string contents = bytes({0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00})
+		+ section(1, vec({bytes({0x60, 0x00, 0x01, i32})}))
+		+ section(2, vec(imports))
+		+ section(3, vec(functions))
+		+ section(7, vec(exports))
+		+ section(10, vec(bodies));
+	wasm::parse::ModuleDef def;
+	auto first = contents.cbegin();
+	bool matched = x3::parse(first, contents.cend(), wasm::parse::validated_module, def);
+	assert(matched and first == contents.cend());
+	return wasm::CompiledModule::compile(std::string(path), std::move(def));
+}
+
+std::vector<std::string> link_order(const Program& prog)
+{
+	std::vector<std::string> names;
+	for(wasm::Instance* inst: prog.instances())
+		names.push_back(inst->name());
+	return names;
+}
+
+/// Whether the import of 'module_name'.'field_name' by 'inst' is resolved.
+bool resolved(const wasm::Instance& inst, const std::string& module_name, const std::string& field_name)
+{
+	const auto& imports = inst.compiled()->imports();
+	for(std::size_t i = 0; i < imports.symbols.size(); ++i)
+	{
+		const auto& sym = imports.symbols[i];
+		if(imports.modules[sym.module_id] == module_name and sym.field_name == field_name)
+			return inst.import_resolved(i);
+	}
+	assert(false);
+	return false;
+}
+
+std::size_t position(const std::vector<std::string>& names, const std::string& nm)
+{
+	auto pos = std::find(names.begin(), names.end(), nm);
+	assert(pos != names.end());
+	return pos - names.begin();
+}
+
+void test_topological_order()
+{
+	Program prog;
+	// added importers first, so that insertion order is the wrong order.
+	prog.add("top", compile("top", {{{"mid", "f2"}, {"base", "f"}, {"outside", "h"}}, 0u, {}}));
+	prog.add("mid", compile("mid", {{{"base", "f"}}, 0u, {{"f2", 0u}}}));
+	prog.add("base", compile("base", {{}, 1u, {{"f", 0u}}}));
+	prog.add("lone", compile("lone", {{}, 1u, {}}));
+	prog.instantiate();
+	assert(prog.size() == 4u);
+	auto order = link_order(prog);
+	assert(order.size() == 4u);
+	assert(position(order, "base") < position(order, "mid"));
+	assert(position(order, "mid") < position(order, "top"));
+	const auto& top = prog.at("top");
+	// 'top.f2' resolves through the import that 'mid' re-exports.
+	assert(resolved(top, "mid", "f2"));
+	assert(resolved(top, "base", "f"));
+	// imports from outside the program are left for 'link()'.
+	assert(not resolved(top, "outside", "h"));
+	assert(not top.is_fully_linked());
+	assert(prog.at("mid").is_fully_linked());
+	std::cout << "program: topological order ok" << std::endl;
+}
+
+void test_cycle()
+{
+	Program prog;
+	// 'a' and 'b' import each other's own functions: the cycle links.
+	prog.add("a", compile("a", {{{"b", "fb"}}, 1u, {{"fa", 1u}}}));
+	prog.add("b", compile("b", {{{"a", "fa"}}, 1u, {{"fb", 1u}}}));
+	// 'user' depends on the cycle, and goes after it.
+	prog.add("user", compile("user", {{{"a", "fa"}, {"base", "f"}}, 0u, {}}));
+	prog.add("base", compile("base", {{}, 1u, {{"f", 0u}}}));
+	prog.instantiate();
+	auto order = link_order(prog);
+	assert(order.size() == 4u);
+	assert(position(order, "base") < position(order, "user"));
+	assert(prog.at("a").is_fully_linked());
+	assert(prog.at("b").is_fully_linked());
+	assert(prog.at("user").is_fully_linked());
+	std::cout << "program: cycle ok" << std::endl;
+}
+
+void test_failures()
+{
+	Program prog;
+	// 'c' and 'd' only re-export each other's imports: neither can resolve.
+	prog.add("c", compile("c", {{{"d", "x"}}, 0u, {{"y", 0u}}}));
+	prog.add("d", compile("d", {{{"c", "y"}}, 0u, {{"x", 0u}}}));
+	prog.add("e", compile("e", {{{"base", "missing"}, {"base", "f"}}, 0u, {}}));
+	prog.add("base", compile("base", {{}, 1u, {{"f", 0u}}}));
+	bool threw = false;
+	try
+	{
+		prog.instantiate();
+	}
+	catch(const ProgramLinkError& err)
+	{
+		threw = true;
+		// every failure is reported, not only the first.
+		assert(err.failures.size() == 3u);
+		auto has = [&](const char* importer, const char* field) {
+			return std::any_of(err.failures.begin(), err.failures.end(), [&](const auto& f) {
+				return f.importer == importer and f.field_name == field and not f.reason.empty();
+			});
+		};
+		assert(has("c", "x"));
+		assert(has("d", "y"));
+		assert(has("e", "missing"));
+		std::cout << err.what() << std::endl;
+	}
+	assert(threw);
+	// the instances are kept, linked as far as they could be.
+	assert(resolved(prog.at("e"), "base", "f"));
+	assert(not resolved(prog.at("e"), "base", "missing"));
+	std::cout << "program: link failures ok" << std::endl;
+}
+
+void test_misuse()
+{
+	Program prog;
+	prog.add("base", compile("base", {{}, 1u, {{"f", 0u}}}));
+	bool threw = false;
+	try
+	{
+		prog.add("base", compile("base", {{}, 1u, {}}));
+	}
+	catch(const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	assert(threw);
+	threw = false;
+	try
+	{
+		prog.at("base");
+	}
+	catch(const std::out_of_range&)
+	{
+		threw = true;
+	}
+	assert(threw);
+	prog.instantiate();
+	threw = false;
+	try
+	{
+		prog.add("other", compile("other", {{}, 1u, {}}));
+	}
+	catch(const std::logic_error&)
+	{
+		threw = true;
+	}
+	assert(threw);
+	std::cout << "program: misuse ok" << std::endl;
+}
+
+int main()
+{
+	test_topological_order();
+	test_cycle();
+	test_failures();
+	test_misuse();
+	std::cout << "program: all tests passed" << std::endl;
+	return 0;
+}